@@ -0,0 +1,24 @@
+# all.tcl --
+#
+# This file contains a top-level script to run all of the Tnm 
+# benchmarks. Execute it by invoking "source all.tcl" when running 
+# scotty in this directory.
+#
+# @(#) $Id$
+
+set benchDirectory [file dir [info script]]
+
+puts stdout "Tcl $tcl_patchLevel benchmarks running in interp:  [info nameofexecutable]"
+puts stdout "Benchmarks began at [clock format [clock seconds]]"
+
+foreach file [lsort [glob -nocomplain -directory $benchDirectory *.bench]] {
+    puts stdout [file tail $file]
+    set code [catch {
+	exec [info nameofexecutable] $file >@ stdout 2>@ stderr
+    } msg]
+    if {$code} {
+	puts stdout $msg
+    }
+}
+
+puts stdout "Benchmarks ended at [clock format [clock seconds]]"
@@ -0,0 +1,455 @@
+/*
+ * berbench.c --
+ *
+ *	Microbenchmark for the BER encoder and decoder. It measures
+ *	the time needed to encode and decode SNMP response messages
+ *	as they are returned for get, getnext and getbulk requests
+ *	with 1, 10 and 50 varbinds. All messages are encoded into and
+ *	decoded from a caller owned BER stream which is reset for
+ *	every message, so no memory is allocated while measuring.
+ *
+ *	The same messages are then run through the message layer
+ *	with TnmSnmpEncodeResponse() and TnmSnmpDecode() for SNMPv2c
+ *	and SNMPv3 sessions. This includes the varbind list conversion
+ *	and one sendto() per encoded message to the local discard port.
+ *	Authenticated SNMPv3 messages are signed when they are sent
+ *	and their digest is verified when they are decoded.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include "tnmSnmp.h"
+
+/*
+ * The kinds of response messages we encode and decode. The varbinds
+ * of a get response carry strings, the varbinds of a getnext response
+ * carry integers and the varbinds of a getbulk response carry 64 bit
+ * counters of consecutive table rows.
+ */
+
+enum kinds { kindGet, kindGetNext, kindGetBulk };
+
+static char *kindNames[] = { "get", "getnext", "getbulk" };
+
+static int sizes[] = { 1, 10, 50 };
+
+static char descr[] = "Linux router 5.10.0 #1 SMP x86_64";
+
+/*
+ * The sessions used to measure the message layer.
+ */
+
+static char *sessionNames[] = { "v2c", "v3", "v3/md5" };
+
+static char *sessionCmds[] = {
+    "snmp generator -address 127.0.0.1 -port 9 -version SNMPv2c",
+    "snmp generator -address 127.0.0.1 -port 9 -version SNMPv3 \
+	-user bench -engineID 00:00:00:00:00:00:00:00:00:00:00:02",
+    "snmp generator -address 127.0.0.1 -port 9 -version SNMPv3 \
+	-user bench -security md5/noPriv -authPassWord maplesyrup \
+	-engineID 00:00:00:00:00:00:00:00:00:00:00:02"
+};
+
+/*
+ * Forward declarations for procedures defined later in this file:
+ */
+
+static TnmBer*
+Encode			_ANSI_ARGS_((TnmBer *ber, int kind, int count));
+
+static TnmBer*
+Decode			_ANSI_ARGS_((TnmBer *ber));
+
+static Tcl_Obj*
+VarBindList		_ANSI_ARGS_((int kind, int count));
+
+static int
+BenchMessages		_ANSI_ARGS_((Tcl_Interp *interp, int iterations));
+
+static double
+Elapsed			_ANSI_ARGS_((Tcl_Time *start));
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Encode --
+ *
+ *	This procedure encodes a response message of the given kind
+ *	with count varbinds.
+ *
+ * Results:
+ *	The BER stream or NULL if the encoding failed.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmBer*
+Encode(ber, kind, count)
+    TnmBer *ber;
+    int kind;
+    int count;
+{
+    static Tnm_Oid oid[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1, 6, 0 };
+    u_char *msgToken, *pduToken, *vblToken, *vbToken;
+    int i, oidlen = sizeof(oid) / sizeof(Tnm_Oid);
+
+    ber = TnmBerEncSequenceStart(ber, ASN1_SEQUENCE, &msgToken);
+    ber = TnmBerEncInt(ber, ASN1_INTEGER, 1);
+    ber = TnmBerEncOctetString(ber, ASN1_OCTET_STRING, "public", 6);
+    ber = TnmBerEncSequenceStart(ber, ASN1_SNMP_RESPONSE, &pduToken);
+    ber = TnmBerEncInt(ber, ASN1_INTEGER, 4711);
+    ber = TnmBerEncInt(ber, ASN1_INTEGER, 0);
+    ber = TnmBerEncInt(ber, ASN1_INTEGER, 0);
+    ber = TnmBerEncSequenceStart(ber, ASN1_SEQUENCE, &vblToken);
+    for (i = 0; i < count; i++) {
+	oid[oidlen-1] = i + 1;
+	ber = TnmBerEncSequenceStart(ber, ASN1_SEQUENCE, &vbToken);
+	ber = TnmBerEncOID(ber, oid, oidlen);
+	switch (kind) {
+	case kindGet:
+	    ber = TnmBerEncOctetString(ber, ASN1_OCTET_STRING,
+				       descr, sizeof(descr) - 1);
+	    break;
+	case kindGetNext:
+	    ber = TnmBerEncInt(ber, ASN1_INTEGER, 100000 * i);
+	    break;
+	case kindGetBulk:
+	    ber = TnmBerEncUnsigned64(ber, 1234567890123.0 + i);
+	    break;
+	}
+	ber = TnmBerEncSequenceEnd(ber, vbToken);
+    }
+    ber = TnmBerEncSequenceEnd(ber, vblToken);
+    ber = TnmBerEncSequenceEnd(ber, pduToken);
+    ber = TnmBerEncSequenceEnd(ber, msgToken);
+    return ber;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Decode --
+ *
+ *	This procedure decodes a response message and all varbinds.
+ *
+ * Results:
+ *	The BER stream or NULL if the decoding failed.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmBer*
+Decode(ber)
+    TnmBer *ber;
+{
+    Tnm_Oid oid[TNM_OID_MAX_SIZE];
+    u_char *msgToken, *pduToken, *vblToken, *vbToken, tag;
+    int msgLength, pduLength, vblLength, vbLength, oidlen, len, value;
+    char *octets;
+    TnmUnsigned64 u;
+
+    ber = TnmBerDecSequenceStart(ber, ASN1_SEQUENCE, &msgToken, &msgLength);
+    ber = TnmBerDecInt(ber, ASN1_INTEGER, &value);
+    ber = TnmBerDecOctetString(ber, ASN1_OCTET_STRING, &octets, &len);
+    ber = TnmBerDecSequenceStart(ber, ASN1_SNMP_RESPONSE,
+				 &pduToken, &pduLength);
+    ber = TnmBerDecInt(ber, ASN1_INTEGER, &value);
+    ber = TnmBerDecInt(ber, ASN1_INTEGER, &value);
+    ber = TnmBerDecInt(ber, ASN1_INTEGER, &value);
+    ber = TnmBerDecSequenceStart(ber, ASN1_SEQUENCE, &vblToken, &vblLength);
+    while (ber && ! TnmBerDecDone(ber)) {
+	ber = TnmBerDecSequenceStart(ber, ASN1_SEQUENCE, &vbToken, &vbLength);
+	ber = TnmBerDecOID(ber, oid, &oidlen);
+	ber = TnmBerDecPeek(ber, &tag);
+	if (! ber) {
+	    break;
+	}
+	switch (tag) {
+	case ASN1_OCTET_STRING:
+	    ber = TnmBerDecOctetString(ber, tag, &octets, &len);
+	    break;
+	case ASN1_INTEGER:
+	    ber = TnmBerDecInt(ber, tag, &value);
+	    break;
+	case ASN1_COUNTER64:
+	    ber = TnmBerDecUnsigned64(ber, &u);
+	    break;
+	default:
+	    ber = TnmBerDecAny(ber, &octets, &len);
+	    break;
+	}
+	ber = TnmBerDecSequenceEnd(ber, vbToken, vbLength);
+    }
+    ber = TnmBerDecSequenceEnd(ber, vblToken, vblLength);
+    ber = TnmBerDecSequenceEnd(ber, pduToken, pduLength);
+    ber = TnmBerDecSequenceEnd(ber, msgToken, msgLength);
+    return ber;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * VarBindList --
+ *
+ *	This procedure creates the varbind list of a response message
+ *	of the given kind with count varbinds. The varbinds carry the
+ *	same values as the messages built by Encode().
+ *
+ * Results:
+ *	The varbind list with a zero reference count.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_Obj*
+VarBindList(kind, count)
+    int kind;
+    int count;
+{
+    Tcl_Obj *listPtr, *vbv[3];
+    char buf[80], hex[sizeof(descr) * 3];
+    int i;
+
+    TnmHexEnc(descr, sizeof(descr) - 1, hex);
+    listPtr = Tcl_NewListObj(0, NULL);
+    for (i = 0; i < count; i++) {
+	sprintf(buf, "1.3.6.1.2.1.31.1.1.1.6.%d", i + 1);
+	vbv[0] = Tcl_NewStringObj(buf, -1);
+	switch (kind) {
+	case kindGet:
+	    vbv[1] = Tcl_NewStringObj("OCTET STRING", -1);
+	    vbv[2] = Tcl_NewStringObj(hex, -1);
+	    break;
+	case kindGetNext:
+	    vbv[1] = Tcl_NewStringObj("Integer32", -1);
+	    vbv[2] = Tcl_NewIntObj(100000 * i);
+	    break;
+	case kindGetBulk:
+	    vbv[1] = Tcl_NewStringObj("Counter64", -1);
+	    sprintf(buf, "%.0f", 1234567890123.0 + i);
+	    vbv[2] = Tcl_NewStringObj(buf, -1);
+	    break;
+	}
+	Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewListObj(3, vbv));
+    }
+    return listPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * BenchMessages --
+ *
+ *	This procedure measures TnmSnmpEncodeResponse() and
+ *	TnmSnmpDecode() for all sessions and response messages.
+ *
+ * Results:
+ *	Returns 0 on success and 1 if a message can not be encoded
+ *	or decoded.
+ *
+ * Side effects:
+ *	The results are written to standard output.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+BenchMessages(interp, iterations)
+    Tcl_Interp *interp;
+    int iterations;
+{
+    u_char packet[TNM_SNMP_MAXSIZE], *bytes;
+    TnmSnmpPdu _pdu, *pdu = &_pdu;
+    Tcl_CmdInfo info;
+    TnmSnmp *session;
+    Tcl_Obj *packetObj;
+    int i, k, s, v, n, len, id, status, index;
+    Tcl_Time start;
+    double encTime, decTime;
+    char name[20];
+
+    packetObj = Tcl_NewObj();
+    Tcl_IncrRefCount(packetObj);
+
+    for (v = 0; v < sizeof(sessionCmds) / sizeof(char *); v++) {
+	if (Tcl_Eval(interp, sessionCmds[v]) != TCL_OK
+	    || ! Tcl_GetCommandInfo(interp,
+				    Tcl_GetStringResult(interp), &info)) {
+	    fprintf(stderr, "berbench: %s\n", Tcl_GetStringResult(interp));
+	    return 1;
+	}
+	session = (TnmSnmp *) info.objClientData;
+
+	for (k = kindGet; k <= kindGetBulk; k++) {
+	    for (s = 0; s < sizeof(sizes) / sizeof(int); s++) {
+		n = sizes[s];
+
+		memset((char *) pdu, 0, sizeof(TnmSnmpPdu));
+		pdu->addr = session->maddr;
+		pdu->type = ASN1_SNMP_RESPONSE;
+		pdu->requestId = 4711;
+		Tcl_DStringInit(&pdu->varbind);
+		pdu->vbList = VarBindList(k, n);
+		Tcl_IncrRefCount(pdu->vbList);
+
+		Tcl_GetTime(&start);
+		for (i = 0; i < iterations; i++) {
+		    if (TnmSnmpEncodeResponse(interp, session,
+					      pdu, packetObj) != TCL_OK) {
+			fprintf(stderr, "berbench: encoding failed: %s\n",
+				Tcl_GetStringResult(interp));
+			return 1;
+		    }
+		}
+		encTime = Elapsed(&start) / iterations;
+		Tcl_DecrRefCount(pdu->vbList);
+
+		bytes = Tcl_GetByteArrayFromObj(packetObj, &len);
+		memcpy((char *) packet, (char *) bytes, (size_t) len);
+		Tcl_GetTime(&start);
+		for (i = 0; i < iterations; i++) {
+		    if (TnmSnmpDecode(interp, packet, len, &session->maddr,
+				      session, &id, &status, &index) == TCL_ERROR
+			|| id != 4711) {
+			fprintf(stderr, "berbench: decoding failed: %s\n",
+				Tcl_GetStringResult(interp));
+			return 1;
+		    }
+		    Tcl_ResetResult(interp);
+		}
+		decTime = Elapsed(&start) / iterations;
+
+		sprintf(name, "%s/%s", sessionNames[v], kindNames[k]);
+		printf("%-14s %8d %8d %12.0f %12.0f\n",
+		       name, n, len, encTime, decTime);
+	    }
+	}
+    }
+
+    Tcl_DecrRefCount(packetObj);
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Elapsed --
+ *
+ *	This procedure computes the time elapsed since start.
+ *
+ * Results:
+ *	The elapsed time in nanoseconds.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static double
+Elapsed(start)
+    Tcl_Time *start;
+{
+    Tcl_Time now;
+
+    Tcl_GetTime(&now);
+    return (now.sec - start->sec) * 1e9 + (now.usec - start->usec) * 1e3;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * main --
+ *
+ *	This procedure runs the benchmark. The optional argument
+ *	defines the number of iterations per BER measurement. The
+ *	message layer is measured with a tenth of the iterations.
+ *
+ * Results:
+ *	Returns 0 on success and 1 if a message can not be encoded
+ *	or decoded.
+ *
+ * Side effects:
+ *	The results are written to standard output.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+main(argc, argv)
+    int argc;
+    char *argv[];
+{
+    u_char packet[TNM_SNMP_MAXSIZE];
+    TnmBer _ber, *ber = &_ber;
+    Tcl_Interp *interp;
+    int i, k, s, n, len, iterations = 100000;
+    Tcl_Time start;
+    double encTime, decTime;
+
+    if (argc > 1) {
+	iterations = atoi(argv[1]);
+    }
+    if (argc > 2 || iterations <= 0) {
+	fprintf(stderr, "usage: berbench ?iterations?\n");
+	return 1;
+    }
+
+    printf("%-14s %8s %8s %12s %12s\n",
+	   "pdu", "varbinds", "bytes", "encode ns/op", "decode ns/op");
+
+    for (k = kindGet; k <= kindGetBulk; k++) {
+	for (s = 0; s < sizeof(sizes) / sizeof(int); s++) {
+	    n = sizes[s];
+
+	    TnmBerInit(ber, packet, sizeof(packet));
+	    Tcl_GetTime(&start);
+	    for (i = 0; i < iterations; i++) {
+		TnmBerReset(ber);
+		if (! Encode(ber, k, n)) {
+		    fprintf(stderr, "berbench: encoding failed: %s\n",
+			    TnmBerGetError(ber));
+		    return 1;
+		}
+	    }
+	    encTime = Elapsed(&start) / iterations;
+	    len = TnmBerSize(ber);
+
+	    TnmBerInit(ber, packet, len);
+	    Tcl_GetTime(&start);
+	    for (i = 0; i < iterations; i++) {
+		TnmBerReset(ber);
+		if (! Decode(ber)) {
+		    fprintf(stderr, "berbench: decoding failed: %s\n",
+			    TnmBerGetError(ber));
+		    return 1;
+		}
+	    }
+	    decTime = Elapsed(&start) / iterations;
+
+	    printf("%-14s %8d %8d %12.0f %12.0f\n",
+		   kindNames[k], n, len, encTime, decTime);
+	}
+    }
+
+    interp = Tcl_CreateInterp();
+    Tcl_CreateObjCommand(interp, "snmp", Tnm_SnmpObjCmd,
+			 (ClientData) NULL, (Tcl_CmdDeleteProc *) NULL);
+    iterations = (iterations < 10) ? 1 : iterations / 10;
+    if (BenchMessages(interp, iterations) != 0) {
+	return 1;
+    }
+    Tcl_DeleteInterp(interp);
+
+    return 0;
+}
@@ -0,0 +1,309 @@
+/*
+ * icmpbench.c --
+ *
+ *	Load test for the nmicmpd daemon. It starts the daemon given
+ *	on the command line and feeds it a large number of synthetic
+ *	ICMP echo jobs on stdin without going through the Tcl icmp
+ *	command. All jobs are sent to a loopback target by default.
+ *	Commands are written while replies are read so that neither
+ *	side blocks on a full pipe. The elapsed time, the job rate and
+ *	the number of timeouts and errors are reported on stdout.
+ *
+ *	The daemon needs root permissions to open its raw socket, so
+ *	this test must either be run as root or against a setuid
+ *	installed nmicmpd.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * The message sizes and field values of the nmicmpd protocol as
+ * documented in nmicmpd(8).
+ */
+
+#define ICMP_PROTO_CMD_LEN	20
+#define ICMP_PROTO_REPLY_LEN	16
+
+#define ICMP_TYPE_ECHO		1
+
+#define ICMP_STATUS_NOERROR	0x00
+#define ICMP_STATUS_TIMEOUT	0x01
+
+#define BLOCK			256		/* messages per read/write */
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StartDaemon --
+ *
+ *	This procedure forks the daemon with pipes connected to its
+ *	stdin and stdout.
+ *
+ * Results:
+ *	The process id of the daemon or -1 on error. The file
+ *	descriptors to write commands and to read replies are
+ *	returned in to and from.
+ *
+ * Side effects:
+ *	A child process is created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static pid_t
+StartDaemon(path, to, from)
+    char *path;
+    int *to;
+    int *from;
+{
+    int in[2], out[2];
+    pid_t pid;
+
+    if (pipe(in) < 0 || pipe(out) < 0) {
+	perror("icmpbench: pipe");
+	return -1;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+	perror("icmpbench: fork");
+	return -1;
+    }
+
+    if (pid == 0) {
+	dup2(in[0], 0);
+	dup2(out[1], 1);
+	close(in[0]); close(in[1]);
+	close(out[0]); close(out[1]);
+	execl(path, path, (char *) 0);
+	perror(path);
+	_exit(1);
+    }
+
+    close(in[0]);
+    close(out[1]);
+    *to = in[1];
+    *from = out[0];
+    return pid;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EncodeJob --
+ *
+ *	This procedure encodes an echo command with a timeout of
+ *	5 seconds, 2 retries and 64 bytes of data.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The command is written to the buffer cmd.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EncodeJob(cmd, tid, addr, window)
+    unsigned char *cmd;
+    unsigned tid;
+    struct in_addr addr;
+    int window;
+{
+    uint32_t ntid = htonl(tid);
+    uint16_t size = htons(64), win = htons(window);
+
+    memset(cmd, 0, ICMP_PROTO_CMD_LEN);
+    cmd[0] = 0;					/* version */
+    cmd[1] = ICMP_TYPE_ECHO;			/* type */
+    memcpy(cmd + 4, &ntid, 4);			/* tid */
+    memcpy(cmd + 8, &addr, 4);			/* address */
+    cmd[12] = 0;				/* ttl */
+    cmd[13] = 5;				/* timeout */
+    cmd[14] = 2;				/* retries */
+    cmd[15] = 0;				/* delay */
+    memcpy(cmd + 16, &size, 2);			/* size */
+    memcpy(cmd + 18, &win, 2);			/* window */
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Elapsed --
+ *
+ *	This procedure computes the time elapsed since start.
+ *
+ * Results:
+ *	The elapsed time in seconds.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static double
+Elapsed(start)
+    struct timeval *start;
+{
+    struct timeval now;
+
+    gettimeofday(&now, (struct timezone *) 0);
+    return (now.tv_sec - start->tv_sec)
+	+ (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * main --
+ *
+ *	This procedure runs the load test. The optional arguments
+ *	define the number of jobs, the window size of every job and
+ *	the target address.
+ *
+ * Results:
+ *	Returns 0 if all jobs were answered without errors and 1
+ *	otherwise.
+ *
+ * Side effects:
+ *	The results are written to standard output.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+main(argc, argv)
+    int argc;
+    char *argv[];
+{
+    unsigned char cmds[ICMP_PROTO_CMD_LEN * BLOCK];
+    unsigned char replies[ICMP_PROTO_REPLY_LEN * BLOCK];
+    int jobs = 100000, window = 0, to, from, rc, i, n;
+    int sent = 0, received = 0, timeouts = 0, errors = 0;
+    int cmd_off = 0, cmd_len = 0, reply_len = 0;
+    struct in_addr addr;
+    struct timeval start;
+    double elapsed;
+    pid_t pid;
+    fd_set rfds, wfds;
+
+    addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (argc > 2) {
+	jobs = atoi(argv[2]);
+    }
+    if (argc > 3) {
+	window = atoi(argv[3]);
+    }
+    if (argc > 4 && ! inet_aton(argv[4], &addr)) {
+	jobs = 0;
+    }
+    if (argc < 2 || argc > 5 || jobs <= 0 || window < 0 || window > 65535) {
+	fprintf(stderr,
+		"usage: icmpbench nmicmpd ?jobs? ?window? ?address?\n");
+	return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    pid = StartDaemon(argv[1], &to, &from);
+    if (pid < 0) {
+	return 1;
+    }
+
+    printf("%8s %8s %-15s %10s %12s %8s %8s\n", "jobs", "window",
+	   "address", "seconds", "jobs/s", "timeouts", "errors");
+
+    gettimeofday(&start, (struct timezone *) 0);
+
+    while (received < jobs) {
+
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	FD_SET(from, &rfds);
+	if (to >= 0) {
+	    FD_SET(to, &wfds);
+	}
+
+	if (select((to > from ? to : from) + 1, &rfds, &wfds,
+		   (fd_set *) 0, (struct timeval *) 0) < 0) {
+	    if (errno == EINTR) continue;
+	    perror("icmpbench: select");
+	    break;
+	}
+
+	/*
+	 * Refill the command buffer and write as much as the pipe takes.
+	 */
+
+	if (to >= 0 && FD_ISSET(to, &wfds)) {
+	    if (cmd_off == cmd_len) {
+		for (n = 0; n < BLOCK && sent < jobs; n++, sent++) {
+		    EncodeJob(cmds + n * ICMP_PROTO_CMD_LEN, sent, addr, window);
+		}
+		cmd_off = 0;
+		cmd_len = n * ICMP_PROTO_CMD_LEN;
+	    }
+	    rc = write(to, cmds + cmd_off, cmd_len - cmd_off);
+	    if (rc < 0) {
+		perror("icmpbench: write");
+		break;
+	    }
+	    cmd_off += rc;
+	    if (sent == jobs && cmd_off == cmd_len) {
+		close(to);
+		to = -1;
+	    }
+	}
+
+	/*
+	 * Read replies and count them by status.
+	 */
+
+	if (FD_ISSET(from, &rfds)) {
+	    rc = read(from, replies + reply_len, sizeof(replies) - reply_len);
+	    if (rc <= 0) {
+		fprintf(stderr, "icmpbench: daemon closed its output\n");
+		break;
+	    }
+	    reply_len += rc;
+	    for (i = 0; i + ICMP_PROTO_REPLY_LEN <= reply_len;
+		 i += ICMP_PROTO_REPLY_LEN) {
+		received++;
+		if (replies[i + 2] == ICMP_STATUS_TIMEOUT) {
+		    timeouts++;
+		} else if (replies[i + 2] != ICMP_STATUS_NOERROR) {
+		    errors++;
+		}
+	    }
+	    reply_len -= i;
+	    memmove(replies, replies + i, reply_len);
+	}
+    }
+
+    elapsed = Elapsed(&start);
+    printf("%8d %8d %-15s %10.3f %12.0f %8d %8d\n", jobs, window,
+	   inet_ntoa(addr), elapsed, received / elapsed, timeouts,
+	   errors + jobs - received);
+
+    close(from);
+    if (to >= 0) {
+	close(to);
+    }
+    waitpid(pid, (int *) 0, 0);
+
+    return received == jobs && errors == 0 ? 0 : 1;
+}
@@ -29,6 +29,7 @@ typedef struct IcmpControl {
     int size;			/* Default size of the ICMP packet. */
     int delay;			/* Default delay between ICMP packets. */
     int window;			/* Default window of active ICMP packets. */
+    int count;			/* Default number of ICMP echo requests. */
 } IcmpControl;
 
 /*
@@ -36,10 +37,12 @@ typedef struct IcmpControl {
  */
 
 enum options {
-    optDelay, optRetries, optSize, optTimeout, optWindow
+    optCommand, optCount, optDelay, optRetries, optSize, optTimeout, optWindow
 };
 
 static TnmTable icmpOptionTable[] = {
+    { optCommand,	"-command" },
+    { optCount,		"-count" },
     { optDelay,		"-delay" },
     { optRetries,	"-retries" },
     { optSize,		"-size" },
@@ -48,6 +51,17 @@ static TnmTable icmpOptionTable[] = {
     { 0, NULL }
 };
 
+/*
+ * The status values reported to the callbacks of asynchronous requests.
+ */
+
+static TnmTable icmpStatusTable[] = {
+    { TNM_ICMP_STATUS_NOERROR,	"noError" },
+    { TNM_ICMP_STATUS_TIMEOUT,	"noResponse" },
+    { TNM_ICMP_STATUS_GENERROR,	"genErr" },
+    { 0, NULL }
+};
+
 /*
  * Mutex used to serialize access to static variables in this module.
  */
@@ -61,6 +75,15 @@ TCL_DECLARE_MUTEX(icmpMutex)
 static void
 AssocDeleteProc	_ANSI_ARGS_((ClientData clientData, Tcl_Interp *interp));
 
+static struct in_addr
+TargetAddress	_ANSI_ARGS_((TnmIcmpRequest *icmpPtr,
+			     TnmIcmpTarget *targetPtr));
+static Tcl_Obj*
+TargetStats	_ANSI_ARGS_((TnmIcmpTarget *targetPtr));
+
+static Tcl_Obj*
+TargetValue	_ANSI_ARGS_((TnmIcmpRequest *icmpPtr,
+			     TnmIcmpTarget *targetPtr));
 static int
 IcmpRequest	_ANSI_ARGS_((Tcl_Interp *interp, Tcl_Obj *hosts, 
 			     TnmIcmpRequest *icmpPtr));
@@ -94,18 +117,279 @@ AssocDeleteProc(clientData, interp)
     }
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * TargetAddress --
+ *
+ *	This procedure returns the address reported for a target. This
+ *	is the address of the responding hop for ttl and trace requests
+ *	and the target address otherwise.
+ *
+ * Results:
+ *	The IPv4 address of the target or the responding hop.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static struct in_addr
+TargetAddress(icmpPtr, targetPtr)
+    TnmIcmpRequest *icmpPtr;
+    TnmIcmpTarget *targetPtr;
+{
+    if (icmpPtr->type == TNM_ICMP_TYPE_TRACE
+	&& ! (icmpPtr->flags & TNM_ICMP_FLAG_LASTHOP
+	      && targetPtr->flags & TNM_ICMP_FLAG_LASTHOP)) {
+	return targetPtr->res;
+    }
+    return targetPtr->dst;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TargetStats --
+ *
+ *	This procedure converts the statistics of a target which has
+ *	been probed with more than one echo request into a list of
+ *	key value pairs. The round trip times and the jitter are
+ *	reported in milliseconds and are empty if no reply has been
+ *	received.
+ *
+ * Results:
+ *	A new Tcl object with a reference count of 0.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_Obj*
+TargetStats(targetPtr)
+    TnmIcmpTarget *targetPtr;
+{
+    Tcl_Obj *listPtr, *objv[4];
+    static char *names[] = { "min", "avg", "max", "jitter" };
+    int i;
+
+    objv[0] = Tcl_NewDoubleObj(targetPtr->rttMin / 1e6);
+    objv[1] = Tcl_NewDoubleObj(targetPtr->rttAvg / 1e6);
+    objv[2] = Tcl_NewDoubleObj(targetPtr->rttMax / 1e6);
+    objv[3] = Tcl_NewDoubleObj(targetPtr->jitter / 1e6);
+
+    listPtr = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewStringObj("sent", -1));
+    Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewIntObj(targetPtr->sent));
+    Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewStringObj("received", -1));
+    Tcl_ListObjAppendElement(NULL, listPtr,
+			     Tcl_NewIntObj(targetPtr->received));
+    for (i = 0; i < 4; i++) {
+	if (! targetPtr->received) {
+	    Tcl_SetStringObj(objv[i], NULL, 0);
+	}
+	Tcl_ListObjAppendElement(NULL, listPtr,
+				 Tcl_NewStringObj(names[i], -1));
+	Tcl_ListObjAppendElement(NULL, listPtr, objv[i]);
+    }
+    return listPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TargetValue --
+ *
+ *	This procedure converts the result of a target into a Tcl
+ *	object. The object is empty if the target did not respond.
+ *	Round trip times are reported in milliseconds with the
+ *	nanosecond resolution of the measurement. Echo requests
+ *	with more than one probe per target report the statistics
+ *	of the target, even if no reply has been received.
+ *
+ * Results:
+ *	A new Tcl object with a reference count of 0.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_Obj*
+TargetValue(icmpPtr, targetPtr)
+    TnmIcmpRequest *icmpPtr;
+    TnmIcmpTarget *targetPtr;
+{
+    if (icmpPtr->type == TNM_ICMP_TYPE_ECHO && icmpPtr->count > 1
+	&& targetPtr->status != TNM_ICMP_STATUS_GENERROR) {
+	return TargetStats(targetPtr);
+    }
+
+    if (targetPtr->status == TNM_ICMP_STATUS_NOERROR) {
+	switch (icmpPtr->type) {
+	case TNM_ICMP_TYPE_ECHO:
+	case TNM_ICMP_TYPE_TRACE:
+	    return Tcl_NewDoubleObj(targetPtr->rttAvg / 1e6);
+	case TNM_ICMP_TYPE_TIMESTAMP:
+	    return Tcl_NewDoubleObj((double)(targetPtr->u.rtt / 1000.0));
+	case TNM_ICMP_TYPE_MASK: {
+	    struct in_addr ipaddr;
+	    ipaddr.s_addr = htonl(targetPtr->u.mask);
+	    return Tcl_NewStringObj(inet_ntoa(ipaddr), -1);
+	    }
+	}
+    }
+    return Tcl_NewStringObj(NULL, 0);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmIcmpEvalCallback --
+ *
+ *	This procedure is called by the platform specific code when a
+ *	target of an asynchronous request has been completed. The
+ *	callback is modified according to the % escapes before it is
+ *	evaluated. The supported escapes are %H = the host as given,
+ *	%A = the address of the target or the responding hop, %V = the
+ *	result value and %E = the status of the target.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Tcl commands are evaluated which can have all kind of effects.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmIcmpEvalCallback(icmpPtr, targetPtr)
+    TnmIcmpRequest *icmpPtr;
+    TnmIcmpTarget *targetPtr;
+{
+    Tcl_Interp *interp = icmpPtr->interp;
+    Tcl_Obj *objPtr;
+    Tcl_DString tclCmd;
+    char *startPtr, *scanPtr, *name;
+    char buf[20];
+    int code;
+
+    if (Tcl_InterpDeleted(interp)) {
+	return;
+    }
+
+    Tcl_DStringInit(&tclCmd);
+    startPtr = Tcl_GetStringFromObj(icmpPtr->cmdObj, NULL);
+    for (scanPtr = startPtr; *scanPtr != '\0'; scanPtr++) {
+	if (*scanPtr != '%') {
+	    continue;
+	}
+	Tcl_DStringAppend(&tclCmd, startPtr, scanPtr - startPtr);
+	scanPtr++;
+	startPtr = scanPtr + 1;
+	switch (*scanPtr) {
+	case 'H':
+	    if (Tcl_ListObjIndex((Tcl_Interp *) NULL, icmpPtr->hosts,
+				 (int) (targetPtr - icmpPtr->targets),
+				 &objPtr) == TCL_OK && objPtr) {
+		Tcl_DStringAppend(&tclCmd, Tcl_GetString(objPtr), -1);
+	    }
+	    break;
+	case 'A':
+	    Tcl_DStringAppend(&tclCmd,
+			      inet_ntoa(TargetAddress(icmpPtr, targetPtr)), -1);
+	    break;
+	case 'V':
+	    objPtr = TargetValue(icmpPtr, targetPtr);
+	    Tcl_IncrRefCount(objPtr);
+	    Tcl_DStringAppend(&tclCmd, Tcl_GetString(objPtr), -1);
+	    Tcl_DecrRefCount(objPtr);
+	    break;
+	case 'E':
+	    name = TnmGetTableValue(icmpStatusTable,
+				    (unsigned) targetPtr->status);
+	    if (name == NULL) {
+		name = "unknown";
+	    }
+	    Tcl_DStringAppend(&tclCmd, name, -1);
+	    break;
+	case '%':
+	    Tcl_DStringAppend(&tclCmd, "%", -1);
+	    break;
+	default:
+	    sprintf(buf, "%%%c", *scanPtr);
+	    Tcl_DStringAppend(&tclCmd, buf, -1);
+	}
+    }
+    Tcl_DStringAppend(&tclCmd, startPtr, scanPtr - startPtr);
+
+    Tcl_Preserve((ClientData) interp);
+    Tcl_AllowExceptions(interp);
+    code = Tcl_GlobalEval(interp, Tcl_DStringValue(&tclCmd));
+    Tcl_DStringFree(&tclCmd);
+    if (code == TCL_ERROR) {
+	Tcl_AddErrorInfo(interp, "\n    (icmp callback)");
+	Tcl_BackgroundError(interp);
+    }
+    Tcl_Release((ClientData) interp);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmIcmpFreeRequest --
+ *
+ *	This procedure frees an ICMP request and all the resources
+ *	held by it.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmIcmpFreeRequest(icmpPtr)
+    TnmIcmpRequest *icmpPtr;
+{
+    if (icmpPtr->targets) {
+	ckfree((char *) icmpPtr->targets);
+    }
+    if (icmpPtr->hosts) {
+	Tcl_DecrRefCount(icmpPtr->hosts);
+    }
+    if (icmpPtr->cmdObj) {
+	Tcl_DecrRefCount(icmpPtr->cmdObj);
+    }
+    if (icmpPtr->interp) {
+	Tcl_Release((ClientData) icmpPtr->interp);
+    }
+    ckfree((char *) icmpPtr);
+}
+
 /*
  *----------------------------------------------------------------------
  *
  * IcmpRequest --
  *
  *	This procedure is called to process a single ICMP request.
+ *	Asynchronous requests are passed to the platform specific
+ *	code which evaluates the callbacks and frees the request.
  *
  * Results:
  *	A standard Tcl result.
  *
  * Side effects:
- *	None.
+ *	The request is freed unless it is an asynchronous request
+ *	which has been accepted by the platform specific code.
  *
  *----------------------------------------------------------------------
  */
@@ -123,10 +407,12 @@ IcmpRequest(interp, hosts, icmpPtr)
     
     code = Tcl_ListObjGetElements(interp, hosts, &objc, &objv);
     if (code != TCL_OK) {
+	TnmIcmpFreeRequest(icmpPtr);
 	return TCL_ERROR;
     }
 
     icmpPtr->numTargets = objc;
+    icmpPtr->numPending = objc;
     icmpPtr->targets = (TnmIcmpTarget *) ckalloc(objc*sizeof(TnmIcmpTarget));
     memset((char *) icmpPtr->targets, 0, objc * sizeof(TnmIcmpTarget));
 
@@ -135,80 +421,62 @@ IcmpRequest(interp, hosts, icmpPtr)
 	code = TnmSetIPAddress(interp, 
 			       Tcl_GetStringFromObj(objv[i], NULL), &addr);
 	if (code != TCL_OK) {
-	    ckfree((char *) icmpPtr->targets);
+	    TnmIcmpFreeRequest(icmpPtr);
 	    return TCL_ERROR;
 	}
-	Tcl_MutexLock(&icmpMutex);
-	targetPtr->tid = lastTid++;
-	Tcl_MutexUnlock(&icmpMutex);
 	targetPtr->dst = addr.sin_addr;
 	targetPtr->res = addr.sin_addr;
 	targetPtr->res.s_addr = 0;
     }
 
+    /*
+     * Assign consecutive transaction identifiers so that responses
+     * can be mapped to targets without searching.
+     */
+
+    Tcl_MutexLock(&icmpMutex);
+    for (i = 0; i < icmpPtr->numTargets; i++) {
+	icmpPtr->targets[i].tid = lastTid++;
+    }
+    Tcl_MutexUnlock(&icmpMutex);
+
+    if (icmpPtr->numTargets == 0) {
+	TnmIcmpFreeRequest(icmpPtr);
+	Tcl_ResetResult(interp);
+	return TCL_OK;
+    }
+
     code = TnmIcmp(interp, icmpPtr);
     if (code != TCL_OK) {
-	ckfree((char *) icmpPtr->targets);
+	TnmIcmpFreeRequest(icmpPtr);
 	return TCL_ERROR;
     }
 
     Tcl_ResetResult(interp);
+    if (icmpPtr->cmdObj) {
+	return TCL_OK;
+    }
+
     listPtr = Tcl_GetObjResult(interp);
     Tcl_SetStringObj(listPtr, NULL, 0);
 
     for (i = 0; i < icmpPtr->numTargets; i++) {
 	TnmIcmpTarget *targetPtr = &(icmpPtr->targets[i]);
-	switch (icmpPtr->type) {
-	case TNM_ICMP_TYPE_ECHO:
-	case TNM_ICMP_TYPE_MASK:
-	case TNM_ICMP_TYPE_TIMESTAMP:
-	    Tcl_ListObjAppendElement(interp, listPtr, objv[i]);
-	    break;
-	case TNM_ICMP_TYPE_TRACE:
-	    if (icmpPtr->flags & TNM_ICMP_FLAG_LASTHOP 
-		&& targetPtr->flags & TNM_ICMP_FLAG_LASTHOP) {
-		Tcl_ListObjAppendElement(interp, listPtr,
-			 Tcl_NewStringObj(inet_ntoa(targetPtr->dst), -1));
-	    } else {
-		Tcl_ListObjAppendElement(interp, listPtr,
-			 Tcl_NewStringObj(inet_ntoa(targetPtr->res), -1));
-	    }
-	    break;
-	}
-	if (targetPtr->status == TNM_ICMP_STATUS_NOERROR) {
-	    switch (icmpPtr->type) {
-	    case TNM_ICMP_TYPE_ECHO:
-	    case TNM_ICMP_TYPE_TRACE:
-	    case TNM_ICMP_TYPE_TIMESTAMP:
-#if 0 /* return ms as float instead of int for usec resolution */
-	        /* This is to be discussed: if we get ping-times below
-		   1 ms reported as 0 ms, we silently adjust this. */
-		Tcl_ListObjAppendElement(interp, listPtr, 
-			 Tcl_NewLongObj(targetPtr->u.rtt 
-					? (long) targetPtr->u.rtt : 1));
-#else
-		Tcl_ListObjAppendElement(interp, listPtr, 
-			 Tcl_NewDoubleObj((double)(targetPtr->u.rtt / 1000.0)));
-#endif
-		break;
-	    case TNM_ICMP_TYPE_MASK: {
-		struct in_addr ipaddr;
-		ipaddr.s_addr = htonl(targetPtr->u.mask);
-		Tcl_ListObjAppendElement(interp, listPtr,
-				 Tcl_NewStringObj(inet_ntoa(ipaddr), -1));
-		break;
-		}
-	    }
-	} else {
+	if (icmpPtr->type == TNM_ICMP_TYPE_TRACE) {
 	    Tcl_ListObjAppendElement(interp, listPtr,
-				     Tcl_NewStringObj(NULL, 0));
+		     Tcl_NewStringObj(inet_ntoa(TargetAddress(icmpPtr,
+							      targetPtr)), -1));
+	} else {
+	    Tcl_ListObjAppendElement(interp, listPtr, objv[i]);
 	}
+	Tcl_ListObjAppendElement(interp, listPtr,
+				 TargetValue(icmpPtr, targetPtr));
     }
     
-    ckfree((char *) icmpPtr->targets);
+    TnmIcmpFreeRequest(icmpPtr);
     return TCL_OK;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -238,10 +506,12 @@ Tnm_IcmpObjCmd(clientData, interp, objc, objv)
     int actSize = -1;		/* actually used size */
     int actDelay = -1;		/* actually used delay */
     int actWindow = -1;		/* actually used window size */
+    int actCount = -1;		/* actually used echo count */
 
     int type = 0;		/* the request type */
     int ttl = -1;		/* the time to live field */
     int flags = 0;		/* the flags for this request */
+    Tcl_Obj *cmdObj = NULL;	/* the callback of an async request */
     int x, code;
 
     enum commands { 
@@ -264,13 +534,14 @@ Tnm_IcmpObjCmd(clientData, interp, objc, objv)
 	control->size = 64;
 	control->delay = 0;
 	control->window = 10;
+	control->count = 1;
 	Tcl_SetAssocData(interp, tnmIcmpControl, AssocDeleteProc, 
 			 (ClientData) control);
     }
 
     if (objc == 1) {
       icmpWrongArgs:
-	Tcl_WrongNumArgs(interp, 1, objv, "?-retries n? ?-timeout n? ?-size n? ?-delay n? ?-window size? option ?arg? hosts");
+	Tcl_WrongNumArgs(interp, 1, objv, "?-retries n? ?-timeout n? ?-size n? ?-delay n? ?-window size? ?-count n? ?-command script? option ?arg? hosts");
 	return TCL_ERROR;
     }
 
@@ -292,6 +563,24 @@ Tnm_IcmpObjCmd(clientData, interp, objc, objv)
 	}
 	x++;
 	switch ((enum options) code) {
+	case optCommand:
+	    if (x == objc) {
+		goto icmpWrongArgs;
+	    }
+	    cmdObj = objv[x];
+	    x++;
+	    break;
+	case optCount:
+	    if (x == objc) {
+		Tcl_SetObjResult(interp, Tcl_NewIntObj(control->count));
+		return TCL_OK;
+	    }
+	    if (TnmGetIntRangeFromObj(interp, objv[x],
+				      1, 65535, &actCount) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    x++;
+	    break;
 	case optDelay:
 	    if (x == objc) {
                 Tcl_SetObjResult(interp, Tcl_NewIntObj(control->delay));
@@ -355,6 +644,9 @@ Tnm_IcmpObjCmd(clientData, interp, objc, objv)
      */
 
     if (objc == x) {
+	if (cmdObj) {
+	    goto icmpWrongArgs;
+	}
         if (actRetries >= 0) {
             control->retries = actRetries;
         }
@@ -370,6 +662,9 @@ Tnm_IcmpObjCmd(clientData, interp, objc, objv)
 	if (actWindow >= 0) {
 	    control->window = actWindow;
 	}
+	if (actCount > 0) {
+	    control->count = actCount;
+	}
         return TCL_OK;
     }
 
@@ -386,6 +681,7 @@ Tnm_IcmpObjCmd(clientData, interp, objc, objv)
     actSize  = actSize  < 0 ? control->size  : actSize;
     actDelay = actDelay < 0 ? control->delay : actDelay;
     actWindow = actWindow < 0 ? control->window : actWindow;
+    actCount = actCount < 0 ? control->count : actCount;
 
     /*
      * Get the query type.
@@ -456,9 +752,17 @@ Tnm_IcmpObjCmd(clientData, interp, objc, objv)
     icmpPtr->delay = actDelay;
     icmpPtr->size = actSize;
     icmpPtr->window = actWindow;
+    icmpPtr->count = type == TNM_ICMP_TYPE_ECHO ? actCount : 1;
     icmpPtr->flags = flags;
 
-    code = IcmpRequest(interp, objv[objc-1], icmpPtr);
-    ckfree((char *) icmpPtr);
-    return code;
+    if (cmdObj) {
+	icmpPtr->interp = interp;
+	Tcl_Preserve((ClientData) interp);
+	icmpPtr->hosts = objv[objc-1];
+	Tcl_IncrRefCount(icmpPtr->hosts);
+	icmpPtr->cmdObj = cmdObj;
+	Tcl_IncrRefCount(icmpPtr->cmdObj);
+    }
+
+    return IcmpRequest(interp, objv[objc-1], icmpPtr);
 }
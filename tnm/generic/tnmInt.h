@@ -364,12 +364,18 @@ typedef struct TnmIcmpTarget {
     struct in_addr dst;		/* The address of the ICMP target. */
     struct in_addr res;		/* The address contained in the response. */
     union {
-	unsigned rtt;		/* The round trip time in ms. */
+	unsigned rtt;		/* The round trip time in us. */
 	int tdiff;		/* The time stamp difference. */
 	int mask;		/* The address mask. */
     } u;
     u_char status;		/* The status of this entry (see below). */
     u_char flags;		/* Some flags (see below). */
+    unsigned short sent;	/* The number of echo probes sent. */
+    unsigned short received;	/* The number of replies received. */
+    TnmUnsigned64 rttMin;	/* The minimum round trip time in ns. */
+    TnmUnsigned64 rttAvg;	/* The average round trip time in ns. */
+    TnmUnsigned64 rttMax;	/* The maximum round trip time in ns. */
+    TnmUnsigned64 jitter;	/* The mean round trip time variation. */
 } TnmIcmpTarget;
 
 #define TNM_ICMP_TYPE_ECHO		0x01
@@ -382,6 +388,7 @@ typedef struct TnmIcmpTarget {
 #define TNM_ICMP_STATUS_GENERROR	0x02
 
 #define TNM_ICMP_FLAG_LASTHOP		0x01
+#define TNM_ICMP_FLAG_PENDING		0x80
 
 typedef struct TnmIcmpRequest {
     int type;			/* The ICMP request type (see above). */
@@ -391,15 +398,25 @@ typedef struct TnmIcmpRequest {
     int delay;			/* The delay value (ms) for this request. */
     int size;			/* The size of the ICMP packet. */
     int window;			/* The window size for this request. */
+    int count;			/* The number of echo probes per target. */
     int flags;			/* The flags for this particular request. */
     int numTargets;		/* The number of targets for this request. */
+    int numPending;		/* The number of targets without a result. */
     TnmIcmpTarget *targets;	/* The vector of targets. */
+    Tcl_Interp *interp;		/* The interpreter of an async request. */
+    Tcl_Obj *hosts;		/* The hosts given for an async request. */
+    Tcl_Obj *cmdObj;		/* The callback of an async request. */
     struct TnmIcmpRequest *nextPtr;	/* Next queued request. */
 } TnmIcmpRequest;
 
 EXTERN int
 TnmIcmp			_ANSI_ARGS_((Tcl_Interp *interp, 
 				     TnmIcmpRequest *icmpPtr));
+EXTERN void
+TnmIcmpEvalCallback	_ANSI_ARGS_((TnmIcmpRequest *icmpPtr,
+				     TnmIcmpTarget *targetPtr));
+EXTERN void
+TnmIcmpFreeRequest	_ANSI_ARGS_((TnmIcmpRequest *icmpPtr));
 
 /*
  *----------------------------------------------------------------
@@ -473,6 +490,31 @@ TnmSocketRecvFrom	_ANSI_ARGS_((int s, char *buf, size_t len, int flags,
 EXTERN int
 TnmSocketClose		_ANSI_ARGS_((int s));
 
+/*
+ * The following structure describes one datagram sent or received
+ * by a call to TnmSocketSendMulti() or TnmSocketRecvMulti(). The
+ * buffer and the address must be supplied by the caller. When
+ * receiving, the len and addrlen fields contain the sizes of the
+ * buffers on input and the received lengths on output. The drops
+ * field is set to the number of datagrams dropped by the socket
+ * if the system reports it (SO_RXQ_OVFL) and 0 otherwise.
+ */
+
+typedef struct TnmSocketMsg {
+    char *buf;			/* The buffer for the datagram. */
+    size_t len;			/* The length of the buffer/datagram. */
+    struct sockaddr *addr;	/* The address of the sender/receiver. */
+    socklen_t addrlen;		/* The length of the address. */
+    unsigned int drops;		/* The number of dropped datagrams. */
+} TnmSocketMsg;
+
+EXTERN int
+TnmSocketSendMulti	_ANSI_ARGS_((int s, TnmSocketMsg *msgs, int n,
+				     int flags));
+EXTERN int
+TnmSocketRecvMulti	_ANSI_ARGS_((int s, TnmSocketMsg *msgs, int n,
+				     int flags));
+
 typedef void (TnmSocketProc) _ANSI_ARGS_((ClientData clientData, int mask));
 
 EXTERN void
@@ -18,12 +18,6 @@
 #include "tnmPort.h"
 #include "tnmMap.h"
 
-/*
- * Mutex used to serialize access to static variables in this module.
- */
-
-TCL_DECLARE_MUTEX(mapEventMutex)
-
 /*
  * Forward declarations for procedures defined later in this file:
  */
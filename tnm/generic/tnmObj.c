@@ -565,7 +565,7 @@ UpdateStringOfUnsigned32(objPtr)
     TnmUnsigned32 u = (TnmUnsigned32) objPtr->internalRep.longValue;
 
     objPtr->bytes = Tcl_Alloc(30);
-    objPtr->length = sprintf(objPtr->bytes, "%lu", u);
+    objPtr->length = sprintf(objPtr->bytes, "%lu", (unsigned long) u);
 }
 
 /*
@@ -862,7 +862,7 @@ UpdateStringOfOctetString(objPtr)
     Tcl_Obj *objPtr;
 {
     objPtr->bytes = Tcl_Alloc(
-			(size_t) objPtr->internalRep.twoPtrValue.ptr2 * 3);
+			(size_t) objPtr->internalRep.twoPtrValue.ptr2 * 3 + 1);
     TnmHexEnc(objPtr->internalRep.twoPtrValue.ptr1,
 	      (int) objPtr->internalRep.twoPtrValue.ptr2,
 	      objPtr->bytes);
@@ -305,81 +305,19 @@ proc TnmSnmp::Table {s table name} {
     }
     if {[Tnm::mib syntax $table] != "SEQUENCE OF"} return
 
-    set exception(noSuchObject)   1
-    set exception(noSuchInstance) 1
-    set exception(endOfMibView)   1
+    # Retrieve all accessible columns. The table command walks the
+    # columns in parallel and returns the instance identifiers in
+    # lexicographic order. The values of the index variables are
+    # extracted from the instance identifiers.
 
-    # Get all the columns in the table that are accessible. Exclude
-    # those variables that are part of the indexing structure of the
-    # table.
+    set order [$s table $table value]
 
-    set cols ""
     set index [Tnm::mib index $table]
-    foreach name $index {
-	set idx([Tnm::mib oid $name]) $name
-    }
-    foreach var [Tnm::mib children [Tnm::mib children $table]] {
-	if [info exists idx($var)] {
-	    continue
-	}
-	if {[Tnm::mib access $var] != "not-accessible"} {
-	    lappend cols $var
-	}
-    }
-    if {[llength $cols] == 0} {
-	set cols $var
-    }
-
-    # Check if we can walk the columns simultaneously. We start a walk
-    # and if we get a result, we will be happy. Otherwise, we will
-    # start a very silly walk to collect the table element by element.
-
-    foreach attempt [list $cols $table] {
-	catch {unset value}
-	set status 1
-
-	# Now walk through the table and fill the array named value,
-	# indexed by row name : instance identifier, e.g.
-	#	value(ifType:1) "le0"
-	#	value(ifType:2) "le1"
-	# The list called order maintains the order of the retrieved
-	# rows.
-
-	set order ""
-	if [catch {
-	    $s walk vbl $attempt {
-		set oid [Tnm::snmp oid $vbl 0]
-		set inst [lindex [Tnm::mib split $oid] 1]
-		if {[lsearch $order $inst] < 0} {
-		    lappend order $inst
-		}
-		
-		foreach i $index v [Tnm::mib unpack $oid] {
-		    set value([Tnm::mib label $i]:$inst) $v
-		}
-		
-		foreach vb $vbl {
-		    set oid  [lindex $vb 0]
-		    set syn  [lindex $vb 1]
-		    set val  [lindex $vb 2]
-		    if {[info exists exception($syn)]} continue
-		    set value([Tnm::mib label $oid]:$inst) $val
-		}
-	    }
-	} msg] {
-	    set status 0
-	    if {[string match tooBig* $msg]} {
-		continue
-	    }
-	}
-	if {! [info exists value]} {
-	    continue
+    set column [lindex [Tnm::mib children [Tnm::mib children $table]] 0]
+    foreach inst $order {
+	foreach i $index v [Tnm::mib unpack $column.$inst] {
+	    set value([Tnm::mib label $i]:$inst) $v
 	}
-	break
-    }
-
-    if {! $status} {
-	error $msg
     }
 
     return $order
@@ -84,10 +84,11 @@ EncodeLength		_ANSI_ARGS_((u_char *packet, int *packetlen,
  * TnmOidToStr --
  *
  *	This procedure converts an object identifier into string
- *	in dotted notation.
+ *	in dotted notation. The buffer provided by the caller must
+ *	hold at least TNM_OID_STR_SIZE bytes.
  *
  * Results:
- *	Returns the pointer to the string in static memory.
+ *	Returns the pointer to the string in the buffer.
  *
  * Side effects:
  *	None.
@@ -96,12 +97,12 @@ EncodeLength		_ANSI_ARGS_((u_char *packet, int *packetlen,
  */
 
 char*
-TnmOidToStr(oid, oidLen)
+TnmOidToStr(oid, oidLen, buf)
     Tnm_Oid *oid;
     int oidLen;
+    char *buf;
 {
     int i;
-    static char buf[TNM_OID_MAX_SIZE * 8];
     char *cp;
 
     if (oid == NULL) return NULL;
@@ -135,9 +136,11 @@ TnmOidToStr(oid, oidLen)
  *
  *	This procedure converts a string with an object identifier
  *	in dotted representation into an object identifier vector.
+ *	The vector provided by the caller must hold at least
+ *	TNM_OID_MAX_SIZE sub-identifiers.
  *
  * Results:
- *	Returns the pointer to the vector in static memory or a
+ *	Returns the pointer to the vector provided by the caller or a
  *	NULL pointer if the string contains illegal characters or
  *	exceeds the maximum length of an object identifier.
  *
@@ -148,16 +151,15 @@ TnmOidToStr(oid, oidLen)
  */
 
 Tnm_Oid*
-TnmStrToOid(str, len)
+TnmStrToOid(str, oid, len)
     char *str;
+    Tnm_Oid *oid;
     int *len;
 {
-    static Tnm_Oid oid[TNM_OID_MAX_SIZE];
-
     if (str == NULL) return NULL;
     if (*str == '.') str++;
 
-    memset((char *) oid, 0, sizeof(oid));
+    memset((char *) oid, 0, TNM_OID_MAX_SIZE * sizeof(Tnm_Oid));
 
     if (! *str) {
 	*len = 0;
@@ -186,6 +188,65 @@ TnmStrToOid(str, len)
     return oid;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmBerInit --
+ *
+ *	This procedure initializes a BER stream owned by the caller
+ *	(usually allocated on the stack) so that it encodes into or
+ *	decodes from the given packet buffer.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmBerInit(ber, packet, packetlen)
+    TnmBer *ber;
+    u_char *packet;
+    int packetlen;
+{
+    if (packet && packetlen > 0) {
+	ber->start = packet;
+	ber->end = packet + packetlen;
+	ber->current = packet;
+    } else {
+	ber->start = ber->end = ber->current = NULL;
+    }
+    ber->error[0] = '\0';
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmBerReset --
+ *
+ *	This procedure rewinds a BER stream to the start of its
+ *	packet buffer so that it can be used for the next message.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The error message is cleared.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmBerReset(ber)
+    TnmBer *ber;
+{
+    ber->current = ber->start;
+    ber->error[0] = '\0';
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -197,7 +258,8 @@ TnmStrToOid(str, len)
  *	The new BER stream or NULL
  *
  * Side effects:
- *	None.
+ *	Memory is allocated which must be released by calling
+ *	TnmBerDelete().
  *
  *----------------------------------------------------------------------
  */
@@ -210,13 +272,7 @@ TnmBerCreate(packet, packetlen)
     TnmBer *ber;
 
     ber = (TnmBer *) ckalloc(sizeof(TnmBer));
-    memset((char *) ber, 0, sizeof(TnmBer));
-
-    if (packet && packetlen > 0) {
-	ber->start = packet;
-	ber->end = packet + packetlen;
-	ber->current = packet;
-    }
+    TnmBerInit(ber, packet, packetlen);
     return ber;
 }
 
@@ -583,7 +639,7 @@ TnmBerEncLength(ber, position, length)
     u_char *position;
     int length;
 {
-    int i, d;
+    int d;
 
     if (! ber) {
 	return NULL;
@@ -602,9 +658,8 @@ TnmBerEncLength(ber, position, length)
 	    return NULL;
 	}
 
-    	for (i = ber->current - position - 1; i > 0; i--) {
-	    position[i + d] = position[i];
-        }
+	memmove((char *) position + 1 + d, (char *) position + 1,
+		(size_t) (ber->current - position - 1));
 	ber->current += d;
 	*position++ = 0x80 + d;
 
@@ -1374,7 +1429,6 @@ TnmBerEncOctetString(ber, tag, octets, octets_len)
     char *octets;
     int octets_len;
 {
-    int	i;
     u_char *length;
 
     ber = TnmBerEncByte(ber, tag);
@@ -1384,9 +1438,17 @@ TnmBerEncOctetString(ber, tag, octets, octets_len)
 
     length = ber->current;
     ber = TnmBerEncByte(ber, 0);
+    if (! ber) {
+	return NULL;
+    }
 
-    for (i = 0; ber && i < octets_len; i++) {
-	ber = TnmBerEncByte(ber, octets[i]);
+    if (octets_len > 0) {
+	if (ber->current + octets_len > ber->end) {
+	    TnmBerSetError(ber, "BER buffer size exceeded");
+	    return NULL;
+	}
+	memcpy((char *) ber->current, octets, (size_t) octets_len);
+	ber->current += octets_len;
     }
 
     ber = TnmBerEncLength(ber, length, octets_len);
@@ -115,15 +115,25 @@ EXTERN TnmTable tnmSnmpPDUTable[];
 
 typedef u_int Tnm_Oid;
 
+/*
+ * The size of a buffer large enough to hold an object identifier
+ * of maximum length in dotted notation.
+ */
+
+#define TNM_OID_STR_SIZE (TNM_OID_MAX_SIZE * 11)
+
 EXTERN char*
-TnmOidToStr		_ANSI_ARGS_((Tnm_Oid *oid, int len));
+TnmOidToStr		_ANSI_ARGS_((Tnm_Oid *oid, int len, char *buf));
 
 EXTERN Tnm_Oid*
-TnmStrToOid		_ANSI_ARGS_((char *str, int *len));
+TnmStrToOid		_ANSI_ARGS_((char *str, Tnm_Oid *oid, int *len));
 
 /*
  *----------------------------------------------------------------
- * Structure to hold a BER encode/decode buffer.
+ * Structure to hold a BER encode/decode buffer. The structure is
+ * usually owned by the caller and initialized with TnmBerInit(),
+ * which does not allocate any memory. TnmBerReset() rewinds the
+ * stream so that it can be reused for the next message.
  *----------------------------------------------------------------
  */
 
@@ -134,6 +144,12 @@ typedef struct TnmBer {
     char error[256];
 } TnmBer;
 
+EXTERN void
+TnmBerInit		_ANSI_ARGS_((TnmBer *ber, u_char *packet,
+				     int packetlen));
+EXTERN void
+TnmBerReset		_ANSI_ARGS_((TnmBer *ber));
+
 EXTERN TnmBer*
 TnmBerCreate		_ANSI_ARGS_((u_char *packet, int packetlen));
 
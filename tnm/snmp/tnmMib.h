@@ -153,7 +153,9 @@ typedef struct TnmMibType {
  *----------------------------------------------------------------
  * The following structure is used to hold a MIB tree node in 
  * memory. Every node is linked with its parent, a list of child 
- * nodes and the next node on the current MIB level.
+ * nodes and the next node on the current MIB level. The children
+ * are also kept in a vector sorted by subidentifier so that they
+ * can be found by binary search.
  *----------------------------------------------------------------
  */
 
@@ -175,6 +177,8 @@ typedef struct TnmMibNode {
     struct TnmMibNode *parentPtr; /* The parent of this node.	            */
     struct TnmMibNode *childPtr;  /* List of child nodes.	            */
     struct TnmMibNode *nextPtr;   /* List of peer nodes.		    */
+    struct TnmMibNode **childVec; /* Child nodes sorted by subid.	    */
+    int numChildren;		/* Number of nodes in childVec.		    */
 } TnmMibNode;
 
 EXTERN Tcl_Obj *tnmMibModulesLoaded;
@@ -261,6 +265,10 @@ EXTERN TnmMibType *tnmMibTypeSaveMark;	/* The first already saved */
 EXTERN int
 TnmMibLoadFile		_ANSI_ARGS_((Tcl_Interp *interp, Tcl_Obj *objPtr));
 
+EXTERN int
+TnmMibLoadFiles		_ANSI_ARGS_((Tcl_Interp *interp, int objc,
+				     Tcl_Obj *CONST objv[], int numThreads));
+
 EXTERN int
 TnmMibLoadCore		_ANSI_ARGS_((Tcl_Interp *interp));
 
@@ -268,7 +276,8 @@ EXTERN int
 TnmMibLoad		_ANSI_ARGS_((Tcl_Interp *interp));
 
 EXTERN char*
-TnmMibGetString		_ANSI_ARGS_((char *fileName, int fileOffset));
+TnmMibGetString		_ANSI_ARGS_((char *fileName, int fileOffset,
+				     Tcl_DString *dsPtr));
 
 EXTERN TnmMibNode*
 TnmMibNodeFromOid	_ANSI_ARGS_((TnmOid *oidPtr, TnmOid *nodeOidPtr));
@@ -323,12 +332,26 @@ TnmMibUnpack		_ANSI_ARGS_((Tcl_Interp *interp, TnmOid *oidPtr,
 EXTERN char*
 TnmMibParse		_ANSI_ARGS_((char *file, char *frozen));
 
+EXTERN int
+TnmMibParseFiles	_ANSI_ARGS_((int numFiles, char **files,
+				     char **frozen, char **modules,
+				     int numThreads));
+
 EXTERN TnmMibNode*
 TnmMibReadFrozen	_ANSI_ARGS_((FILE *fp));
 
 EXTERN void
 TnmMibWriteFrozen	_ANSI_ARGS_((FILE *fp, TnmMibNode *nodePtr));
 
+EXTERN int
+TnmMibReadImage		_ANSI_ARGS_((FILE *fp, Tcl_Obj *filesPtr,
+				     Tcl_Obj *modulesPtr));
+EXTERN void
+TnmMibWriteImage	_ANSI_ARGS_((FILE *fp, Tcl_Obj *filesPtr,
+				     Tcl_Obj *modulesPtr));
+EXTERN int
+TnmMibFindImageNode	_ANSI_ARGS_((char *name, TnmMibNode **nodePtrPtr));
+
 /*
  *----------------------------------------------------------------
  * Functions used by the parser or the frozen file reader to
@@ -2,6 +2,9 @@
  * tnmMibFrozen.c --
  *
  *	Save and load MIB-Definitions in/from a frozen-format file.
+ *	A MIB image is a frozen file which contains the whole MIB
+ *	tree of a set of MIB modules, including the tree structure
+ *	and an index of the node names.
  *
  * Copyright (c) 1994-1996 Technical University of Braunschweig.
  * Copyright (c) 1996-1997 University of Twente.
@@ -14,6 +17,134 @@
 #include "tnmSnmp.h"
 #include "tnmMib.h"
 
+/*
+ * A frozen MIB file starts with the following header. All references
+ * inside of a frozen MIB file are byte offsets from the start of the
+ * file or indexes into the arrays of restrictions and types. There
+ * are no pointers which must be relocated. The header is followed by
+ * the string pool and the arrays of restrictions, types and nodes.
+ * The file is mapped read-only into memory if possible. The strings
+ * are used directly from the mapped file and the mapping is shared by
+ * all processes which load the same frozen MIB file.
+ */
+
+#define FROZEN_MAGIC	"TnmMIB\r\n"
+#define FROZEN_VERSION	2
+
+typedef struct FrozenHeader {
+    char magic[8];		/* The FROZEN_MAGIC string. */
+    u_int version;		/* The FROZEN_VERSION of the file format. */
+    u_int size;			/* The size of the whole file. */
+    u_int tnmVersion;		/* The Tnm version which wrote the file. */
+    u_int source;		/* The MIB file which has been frozen. */
+    u_int pool;			/* The start of the string pool. */
+    u_int poolSize;		/* The size of the string pool. */
+    u_int rests;		/* The start of the restriction array. */
+    u_int numRests;		/* The number of restrictions. */
+    u_int types;		/* The start of the type array. */
+    u_int numTypes;		/* The number of types. */
+    u_int nodes;		/* The start of the node array. */
+    u_int numNodes;		/* The number of nodes. */
+} FrozenHeader;
+
+typedef struct FrozenRest {
+    u_int first;		/* The enumerated value or the minimum. */
+    u_int second;		/* The enumeration label or the maximum. */
+} FrozenRest;
+
+typedef struct FrozenType {
+    u_int name;			/* The name of the MIB type. */
+    u_int moduleName;		/* The name of the MIB module. */
+    u_int fileName;		/* The file with the textual description. */
+    u_int displayHint;		/* The display hint, eg. 2d. */
+    int fileOffset;		/* Offset for the textual description. */
+    short syntax;		/* The ASN.1 base syntax, e.g. INTEGER. */
+    u_char macro;		/* The macro used to define this type. */
+    u_char status;		/* The status of this definition. */
+    u_char restKind;		/* The kind of restriction for this type. */
+    u_int rests;		/* The index of the first restriction. */
+    u_int numRests;		/* The number of restrictions. */
+} FrozenType;
+
+typedef struct FrozenNode {
+    u_int subid;		/* This node's integer subidentifier. */
+    u_int label;		/* Node's textual name. */
+    u_int parentName;		/* Name of parent node. */
+    u_int moduleName;		/* The name of the MIB module. */
+    u_int fileName;		/* The file with the textual description. */
+    u_int index;		/* The list of index nodes in a table entry. */
+    int fileOffset;		/* Offset for the textual description. */
+    u_short syntax;		/* This node's object type syntax. */
+    u_char access;		/* The access mode of the object. */
+    u_char macro;		/* The ASN.1 macro used for the definition. */
+    u_char status;		/* The status of this definition. */
+    u_char implied;		/* Indicates that the last index is IMPLIED. */
+    u_char augment;		/* Indicates an AUGMENTS condition. */
+    u_int type;			/* The index of the type plus one or 0. */
+} FrozenNode;
+
+#define FROZEN_ALIGN(n)	(((n) + 7) & ~7)
+
+/*
+ * A MIB image starts with a frozen file header which is followed by
+ * the sections described below. The nodes are saved in depth-first
+ * order so that the children of a node always follow the node. The
+ * children of every node are saved as a range of node indexes in the
+ * children array, sorted by subidentifier. The same applies to the
+ * roots of the MIB tree.
+ */
+
+#define IMAGE_MAGIC	"TnmIMG\r\n"
+
+typedef struct ImageHeader {
+    FrozenHeader frozen;	/* The header of the frozen sections. */
+    u_int modules;		/* The start of the module array. */
+    u_int numModules;		/* The number of modules. */
+    u_int links;		/* The start of the link array. */
+    u_int children;		/* The start of the children array. */
+    u_int numChildren;		/* The number of entries in the array. */
+    u_int roots;		/* The index of the first root node. */
+    u_int numRoots;		/* The number of root nodes. */
+    u_int slots;		/* The start of the name index. */
+    u_int numSlots;		/* The number of slots (a power of two). */
+} ImageHeader;
+
+typedef struct ImageModule {
+    u_int file;			/* The file name used to load the module. */
+    u_int module;		/* The name of the MIB module. */
+} ImageModule;
+
+typedef struct ImageLink {
+    u_int parent;		/* The index of the parent plus one or 0. */
+    u_int children;		/* The index of the first child. */
+    u_int numChildren;		/* The number of children. */
+} ImageLink;
+
+/*
+ * The name index is a hash table with open addressing. Every node
+ * is entered with its label and with its label qualified by the
+ * module name. The slot refers to a node with the name and marks
+ * names which are used by more than one node.
+ */
+
+#define IMAGE_QUALIFIED	0x01
+#define IMAGE_AMBIGUOUS	0x02
+
+typedef struct ImageSlot {
+    u_int hash;			/* The hash value of the name. */
+    u_int node;			/* The index of the node plus one or 0. */
+    u_int flags;		/* The IMAGE_QUALIFIED and IMAGE_AMBIGUOUS. */
+} ImageSlot;
+
+/*
+ * The name index of the MIB image which has been loaded into an
+ * empty MIB tree. The index refers to the array of image nodes.
+ */
+
+static ImageSlot *imageSlots = NULL;
+static u_int imageMask = 0;
+static TnmMibNode *imageNodes = NULL;
+
 /*
  * Strings are collected in a hashtable for every parsed mib. This allows
  * us to write all strings in one big chunk so that we do not need to
@@ -24,6 +155,25 @@
 static Tcl_HashTable *poolHashTable = NULL;
 static int poolOffset = 0;
 
+/*
+ * The types saved in a frozen file are collected in the following
+ * vector. The typeIndexTable maps every type to its index plus one.
+ */
+
+static Tcl_HashTable *typeIndexTable = NULL;
+static TnmMibType **typeVec = NULL;
+static int numTypes = 0;
+
+/*
+ * The nodes saved in a MIB image are collected in depth-first order
+ * in the following vector. The nodeIndexTable maps every node to its
+ * index plus one.
+ */
+
+static Tcl_HashTable *nodeIndexTable = NULL;
+static TnmMibNode **nodeVec = NULL;
+static int numNodeVec = 0;
+
 /*
  * Forward declarations for procedures defined later in this file:
  */
@@ -41,32 +191,86 @@ static int
 PoolGetOffset		_ANSI_ARGS_((char *string));
 
 static void
-PoolSave		_ANSI_ARGS_((FILE *fp));
+PoolSave		_ANSI_ARGS_((FILE *fp, int base));
+
+static void
+TypesInit		_ANSI_ARGS_((void));
+
+static void
+TypesDelete		_ANSI_ARGS_((void));
+
+static void
+AddType			_ANSI_ARGS_((TnmMibType *typePtr));
+
+static int
+NumRests		_ANSI_ARGS_((TnmMibType *typePtr));
+
+static void
+CollectData		_ANSI_ARGS_((int *numRests, int *numNodes,
+				     TnmMibNode *nodePtr));
+static void
+SaveTypes		_ANSI_ARGS_((FILE *fp));
+
+static void
+SaveNode		_ANSI_ARGS_((FILE *fp, TnmMibNode *nodePtr));
 
 static void
-SaveRest		_ANSI_ARGS_((TnmMibRest *restPtr, int restKind, 
-				     FILE *fp));
+HeaderInit		_ANSI_ARGS_((FrozenHeader *hdrPtr, char *magic,
+				     u_int headerSize, u_int numRests,
+				     u_int numNodes));
 static void
-SaveType		_ANSI_ARGS_((TnmMibType *typePtr, int *i, FILE *fp));
+CollectTree		_ANSI_ARGS_((TnmMibNode *nodePtr));
 
+static u_int
+HashName		_ANSI_ARGS_((char *name));
+
+static int
+MatchName		_ANSI_ARGS_((TnmMibNode *nodePtr, char *name,
+				     u_int flags));
 static void
-SaveNode		_ANSI_ARGS_((TnmMibNode *nodePtr, int *i, FILE *fp));
+IndexName		_ANSI_ARGS_((ImageSlot *slots, u_int mask, char *name,
+				     u_int node, u_int flags));
 
+static char*
+MapFile			_ANSI_ARGS_((FILE *fp, size_t *sizePtr,
+				     int *mappedPtr, size_t minSize));
 static void
-CollectData		_ANSI_ARGS_((int *numRests, int *numTcs,
-				     int *numNodes, TnmMibNode *nodePtr));
+UnmapFile		_ANSI_ARGS_((char *image, size_t size, int mapped));
+
+static int
+CheckString		_ANSI_ARGS_((FrozenHeader *hdrPtr, u_int offset));
+
+static int
+CheckHeader		_ANSI_ARGS_((FrozenHeader *hdrPtr, char *image,
+				     size_t size, char *magic,
+				     u_int headerSize));
+static int
+CheckData		_ANSI_ARGS_((FrozenHeader *hdrPtr, char *image));
+
+static int
+CheckImage		_ANSI_ARGS_((ImageHeader *ihdrPtr, char *image));
+
+static TnmMibType**
+CreateTypes		_ANSI_ARGS_((FrozenHeader *hdrPtr, char *image));
+
+static TnmMibNode*
+CreateNodes		_ANSI_ARGS_((FrozenHeader *hdrPtr, char *image,
+				     TnmMibType **typeMap));
 static void
-SaveData		_ANSI_ARGS_((FILE *fp, int numRests, int numTcs, 
-				     int numNodes, TnmMibNode *nodePtr));
+LinkImage		_ANSI_ARGS_((ImageHeader *ihdrPtr, char *image,
+				     TnmMibNode *nodes));
+static int
+MergeImage		_ANSI_ARGS_((ImageHeader *ihdrPtr, char *image,
+				     TnmMibNode *nodes, Tcl_Obj *filesPtr,
+				     Tcl_Obj *modulesPtr));
 
-
 /*
  *----------------------------------------------------------------------
  *
  * PoolInit --
  *
  *	This procedure initializes the hash table that is used to
- *	create a string pool. The pool is used to eliminate 
+ *	create a string pool. The pool is used to eliminate
  *	duplicated strings.
  *
  * Results:
@@ -87,7 +291,7 @@ PoolInit()
     }
     Tcl_InitHashTable(poolHashTable, TCL_STRING_KEYS);
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -113,16 +317,16 @@ PoolDelete()
         Tcl_DeleteHashTable(poolHashTable);
     }
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
  * PoolAddString --
  *
- *	This procedure adds a string to the pool if it is not yet 
+ *	This procedure adds a string to the pool if it is not yet
  *	there. The value is initialized to mark this entry as used.
- *	The total offset is incremented to get total memory required 
- *	for the string pool. 
+ *	The total offset is incremented to get total memory required
+ *	for the string pool.
  *
  * Results:
  *	None.
@@ -149,14 +353,14 @@ PoolAddString(s)
     Tcl_SetHashValue(entryPtr, 1);
     poolOffset += strlen(s) + 1;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
  * PoolGetOffset --
  *
- *	This procedure returns the offset to the given string in the 
- *	string pool or 0 if the string is not in the pool.
+ *	This procedure returns the offset to the given string in the
+ *	frozen file or 0 if the string is not in the pool.
  *
  * Results:
  *	None.
@@ -177,70 +381,59 @@ PoolGetOffset(s)
 
     entryPtr = Tcl_FindHashEntry(poolHashTable, s);
     if (entryPtr) {
-        return (int) Tcl_GetHashValue(entryPtr);
+        return (int) (long) Tcl_GetHashValue(entryPtr);
     } else {
 	return 0;
     }
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
  * PoolSave --
  *
  *	This procedure writes the string pool to the given file pointer.
+ *	The pool starts at the offset base in the frozen file.
  *
  * Results:
  *	None.
  *
  * Side effects:
- *	None.
+ *	The offset of every string is saved in the pool hash table.
  *
  *----------------------------------------------------------------------
  */
 
 static void
-PoolSave(fp)
+PoolSave(fp, base)
     FILE *fp;
+    int base;
 {
-    Tcl_HashSearch searchPtr;
+    Tcl_HashSearch search;
     Tcl_HashEntry *entryPtr;
+    int offset = base;
 
-    /*
-     * Save magic and size:
-     */
-
-    poolOffset += strlen(TNM_VERSION) + 1;
-    fwrite((char *) &poolOffset, sizeof(int), 1, fp);
-    fwrite(TNM_VERSION, 1, strlen(TNM_VERSION) + 1, fp);
-
-    /*
-     * Save the strings in the pool:
-     */
-
-    poolOffset = strlen(TNM_VERSION) + 1;
-    entryPtr = Tcl_FirstHashEntry(poolHashTable, &searchPtr);
+    entryPtr = Tcl_FirstHashEntry(poolHashTable, &search);
     while (entryPtr) {
 	char *s = Tcl_GetHashKey(poolHashTable, entryPtr);
 	unsigned int len = strlen(s) + 1;
-	Tcl_SetHashValue(entryPtr, poolOffset);
+	Tcl_SetHashValue(entryPtr, (ClientData) (long) offset);
 	fwrite(s, 1, len, fp);
-	poolOffset += len;
-	entryPtr = Tcl_NextHashEntry(&searchPtr);
+	offset += len;
+	entryPtr = Tcl_NextHashEntry(&search);
     }
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * CollectData --
+ * TypesInit --
  *
- *	This procedure collects the strings (by adding them to the pool)
- *	and counts the number of enum/range restrictions, tcs and nodes
- *	to be saved.
+ *	This procedure initializes the vector of types saved in a
+ *	frozen file and the hash table which maps types to indexes.
  *
  * Results:
- *	Returns the number of enum/range restrictions, tcs and nodes.
+ *	None.
  *
  * Side effects:
  *	None.
@@ -249,68 +442,20 @@ PoolSave(fp)
  */
 
 static void
-CollectData(numEnums, numTcs, numNodes, nodePtr)
-    int *numEnums, *numTcs, *numNodes;
-    TnmMibNode *nodePtr;
+TypesInit()
 {
-    TnmMibNode *ptr;
-    TnmMibRest *restPtr;
-    TnmMibType *typePtr;
-
-    *numEnums = *numTcs = *numNodes = 0;
-    for (ptr = nodePtr; ptr; (*numNodes)++, ptr = ptr->nextPtr) {
-	PoolAddString(ptr->label);
-	PoolAddString(ptr->parentName);
-	PoolAddString(ptr->fileName);
-	PoolAddString(ptr->moduleName);
-	PoolAddString(ptr->index);
-	if (ptr->typePtr) {
-	    (*numTcs)++;
-	    PoolAddString(ptr->typePtr->name);
-	    PoolAddString(ptr->typePtr->fileName);
-	    PoolAddString(ptr->typePtr->moduleName);
-	    PoolAddString(ptr->typePtr->displayHint);
-	    if (ptr->typePtr->restKind == TNM_MIB_REST_ENUMS
-		|| ptr->typePtr->restKind == TNM_MIB_REST_RANGE
-		|| ptr->typePtr->restKind == TNM_MIB_REST_SIZE) {
-		for (restPtr = ptr->typePtr->restList;
-		     restPtr;
-		     (*numEnums)++, restPtr = restPtr->nextPtr) {
-		    if (ptr->typePtr->restKind == TNM_MIB_REST_ENUMS) {
-			PoolAddString(restPtr->rest.intEnum.enumLabel);
-		    }
-		}
-	    }
-	}
-    }
-    for (typePtr = tnmMibTypeList; 
-	 typePtr != tnmMibTypeSaveMark; typePtr = typePtr->nextPtr) {
-        (*numTcs)++;
-	PoolAddString(typePtr->name);
-	PoolAddString(typePtr->fileName);
-	PoolAddString(typePtr->moduleName);
-	PoolAddString(typePtr->displayHint);
-	if (typePtr->restKind == TNM_MIB_REST_ENUMS
-	    || typePtr->restKind == TNM_MIB_REST_RANGE
-	    || typePtr->restKind == TNM_MIB_REST_SIZE) {
-	    for (restPtr = typePtr->restList;
-		 restPtr;
-		 (*numEnums)++, restPtr = restPtr->nextPtr) {
-		if (typePtr->restKind == TNM_MIB_REST_ENUMS) {
-		    PoolAddString(restPtr->rest.intEnum.enumLabel);
-		}
-	    }
-	}
-    }
+    typeIndexTable = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+    Tcl_InitHashTable(typeIndexTable, TCL_ONE_WORD_KEYS);
+    typeVec = NULL;
+    numTypes = 0;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * SaveRest --
+ * TypesDelete --
  *
- *	This procedure writes a TnmMibRest structure. The char*
- *	pointers are used to store the offset into the string pool.
+ *	This procedure frees the memory used by TypesInit().
  *
  * Results:
  *	None.
@@ -322,74 +467,114 @@ CollectData(numEnums, numTcs, numNodes, nodePtr)
  */
 
 static void
-SaveRest(restPtr, restKind, fp)
-    TnmMibRest *restPtr;
-    FILE *fp;
+TypesDelete()
 {
-    TnmMibRest rest;
-
-    if (restKind == TNM_MIB_REST_ENUMS) {
-	memcpy((char *) &rest, (char *) restPtr, sizeof(TnmMibRest));
-	rest.rest.intEnum.enumLabel = 
-	    (char *) PoolGetOffset(restPtr->rest.intEnum.enumLabel);
-	rest.nextPtr = (TnmMibRest *) (restPtr->nextPtr ? 1 : 0);
-	restPtr = &rest;
+    Tcl_DeleteHashTable(typeIndexTable);
+    ckfree((char *) typeIndexTable);
+    typeIndexTable = NULL;
+    if (typeVec) {
+	ckfree((char *) typeVec);
+	typeVec = NULL;
     }
-
-    fwrite((char *) restPtr, sizeof(TnmMibRest), 1, fp);
+    numTypes = 0;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * SaveType --
+ * AddType --
  *
- *	This procedure writes a TnmMibType structure. The char*
- *	pointers are used to store the offset into the string pool.
+ *	This procedure adds a type to the vector of types saved in
+ *	the frozen file unless the type is already known. The strings
+ *	of the type are added to the string pool.
  *
  * Results:
  *	None.
  *
  * Side effects:
- *	None.
+ *	The type vector grows in powers of two.
  *
  *----------------------------------------------------------------------
  */
 
 static void
-SaveType(typePtr, i, fp)
+AddType(typePtr)
     TnmMibType *typePtr;
-    int *i;
-    FILE *fp;
 {
-    TnmMibType tc;
+    Tcl_HashEntry *entryPtr;
+    TnmMibRest *restPtr;
+    int isnew;
 
-    memcpy((char *) &tc, (char *) typePtr, sizeof(TnmMibType));
-    tc.name = (char *) PoolGetOffset(typePtr->name);
-    tc.fileName = (char *) PoolGetOffset(typePtr->fileName);
-    tc.moduleName = (char *) PoolGetOffset(typePtr->moduleName);
-    tc.displayHint = (char *) PoolGetOffset(typePtr->displayHint);
-    if (typePtr->restList) {
-	TnmMibRest *e;
-	tc.restList = (TnmMibRest *) (*i + 1);
-	for (e = typePtr->restList; e; (*i)++, e = e->nextPtr) ;
+    entryPtr = Tcl_CreateHashEntry(typeIndexTable, (char *) typePtr, &isnew);
+    if (! isnew) {
+	return;
+    }
+
+    if ((numTypes & (numTypes - 1)) == 0) {
+	typeVec = (TnmMibType **) ckrealloc((char *) typeVec,
+		   (numTypes ? 2 * numTypes : 1) * sizeof(TnmMibType *));
     }
-    tc.nextPtr = (TnmMibType *) (typePtr->nextPtr ? 1 : 0);
+    typeVec[numTypes++] = typePtr;
+    Tcl_SetHashValue(entryPtr, (ClientData) (long) numTypes);
 
-    fwrite((char *) &tc, sizeof(TnmMibType), 1, fp);
+    PoolAddString(typePtr->name);
+    PoolAddString(typePtr->fileName);
+    PoolAddString(typePtr->moduleName);
+    PoolAddString(typePtr->displayHint);
+    if (typePtr->restKind == TNM_MIB_REST_ENUMS) {
+	for (restPtr = typePtr->restList; restPtr; restPtr = restPtr->nextPtr) {
+	    PoolAddString(restPtr->rest.intEnum.enumLabel);
+	}
+    }
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * SaveNode --
+ * NumRests --
  *
- *	This procedure writes a TnmMibNode structure. The char*
- *	pointers are used to store the offset into the string pool.
+ *	This procedure counts the restrictions of a type which are
+ *	saved in the frozen file.
  *
  * Results:
+ *	The number of restrictions.
+ *
+ * Side effects:
  *	None.
  *
+ *----------------------------------------------------------------------
+ */
+
+static int
+NumRests(typePtr)
+    TnmMibType *typePtr;
+{
+    TnmMibRest *restPtr;
+    int n = 0;
+
+    if (typePtr->restKind == TNM_MIB_REST_ENUMS
+	|| typePtr->restKind == TNM_MIB_REST_RANGE
+	|| typePtr->restKind == TNM_MIB_REST_SIZE) {
+	for (restPtr = typePtr->restList; restPtr; restPtr = restPtr->nextPtr) {
+	    n++;
+	}
+    }
+    return n;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CollectData --
+ *
+ *	This procedure collects the strings (by adding them to the pool)
+ *	and the types and counts the number of enum/range restrictions
+ *	and nodes to be saved. The types defined by the current module
+ *	come first, followed by the types only used by the nodes.
+ *
+ * Results:
+ *	Returns the number of enum/range restrictions and nodes.
+ *
  * Side effects:
  *	None.
  *
@@ -397,45 +582,45 @@ SaveType(typePtr, i, fp)
  */
 
 static void
-SaveNode(nodePtr, i, fp)
+CollectData(numRests, numNodes, nodePtr)
+    int *numRests, *numNodes;
     TnmMibNode *nodePtr;
-    int *i;
-    FILE *fp;
 {
-    struct TnmMibNode no;
+    TnmMibNode *ptr;
+    TnmMibType *typePtr;
+    int i;
 
-    memcpy((char *) &no, (char *) nodePtr, sizeof(TnmMibNode));
-    no.label = (char *) PoolGetOffset(nodePtr->label);
-    no.parentName = (char *) PoolGetOffset(nodePtr->parentName);
-    no.fileName = (char *) PoolGetOffset(nodePtr->fileName);
-    no.moduleName = (char *) PoolGetOffset(nodePtr->moduleName);
-    no.index = (char *) PoolGetOffset(nodePtr->index);
-    no.childPtr = 0;
-    if (nodePtr->typePtr) {
-	no.typePtr = (TnmMibType *) ++(*i);
+    for (typePtr = tnmMibTypeList;
+	 typePtr != tnmMibTypeSaveMark; typePtr = typePtr->nextPtr) {
+	AddType(typePtr);
+    }
+
+    *numNodes = 0;
+    for (ptr = nodePtr; ptr; (*numNodes)++, ptr = ptr->nextPtr) {
+	PoolAddString(ptr->label);
+	PoolAddString(ptr->parentName);
+	PoolAddString(ptr->fileName);
+	PoolAddString(ptr->moduleName);
+	PoolAddString(ptr->index);
+	if (ptr->typePtr) {
+	    AddType(ptr->typePtr);
+	}
+    }
+
+    *numRests = 0;
+    for (i = 0; i < numTypes; i++) {
+	*numRests += NumRests(typeVec[i]);
     }
-    no.nextPtr = (TnmMibNode *) (nodePtr->nextPtr ? 1 : 0);
-    
-    fwrite((char *) &no, sizeof(TnmMibNode), 1, fp);
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * SaveData --
- *
- *	This procedure writes the node list as an index file to fp.
- *
- *	int (#enum elements)
- *  		followed by #enum structs
- * 	int (#tc elements)
- *		followed by #tc structs
- *      int (#node elements)
- *		followed by n TnmMibNode structs.
+ * SaveTypes --
  *
- *	String pointer are saved as offsets relative to the pool,
- *	enum pointer are saved as offset to the saved enums (+ 1)
- *	tc pointer dito.
+ *	This procedure writes the arrays of restrictions and types to
+ *	fp. Strings are saved as offsets into the frozen file,
+ *	restrictions are saved as indexes into their array.
  *
  * Results:
  *	None.
@@ -447,58 +632,139 @@ SaveNode(nodePtr, i, fp)
  */
 
 static void
-SaveData(fp, numEnums, numTCs, numNodes, nodePtr)
+SaveTypes(fp)
     FILE *fp;
-    int numEnums, numTCs, numNodes;
-    TnmMibNode *nodePtr;
 {
-    TnmMibNode *nPtr;
-    TnmMibRest *ePtr;
-    TnmMibType *tPtr;
-    int i;
-    
-    /*
-     * Save numEnums TnmMibRest structures:
-     */
+    TnmMibRest *restPtr;
+    TnmMibType *typePtr;
+    FrozenRest rest;
+    FrozenType type;
+    int i, n;
 
-    fwrite((char *) &numEnums, sizeof(int), 1, fp);
-    for (nPtr = nodePtr; nPtr; nPtr = nPtr->nextPtr) {
-	if (nPtr->typePtr) {
-	    for (ePtr = nPtr->typePtr->restList; ePtr; ePtr = ePtr->nextPtr) {
-		SaveRest(ePtr, nPtr->typePtr->restKind, fp);
+    for (i = 0; i < numTypes; i++) {
+	typePtr = typeVec[i];
+	n = NumRests(typePtr);
+	for (restPtr = typePtr->restList; n > 0;
+	     n--, restPtr = restPtr->nextPtr) {
+	    if (typePtr->restKind == TNM_MIB_REST_ENUMS) {
+		rest.first = restPtr->rest.intEnum.enumValue;
+		rest.second = PoolGetOffset(restPtr->rest.intEnum.enumLabel);
+	    } else {
+		rest.first = restPtr->rest.unsRange.min;
+		rest.second = restPtr->rest.unsRange.max;
 	    }
+	    fwrite((char *) &rest, sizeof(FrozenRest), 1, fp);
 	}
     }
-    for (tPtr=tnmMibTypeList; tPtr != tnmMibTypeSaveMark; tPtr = tPtr->nextPtr) {
-	for (ePtr = tPtr->restList; ePtr; ePtr = ePtr->nextPtr) {
-	    SaveRest(ePtr, tPtr->restKind, fp);
-	}
+
+    for (i = 0, n = 0; i < numTypes; i++) {
+	typePtr = typeVec[i];
+	memset((char *) &type, 0, sizeof(FrozenType));
+	type.name = PoolGetOffset(typePtr->name);
+	type.moduleName = PoolGetOffset(typePtr->moduleName);
+	type.fileName = PoolGetOffset(typePtr->fileName);
+	type.displayHint = PoolGetOffset(typePtr->displayHint);
+	type.fileOffset = typePtr->fileOffset;
+	type.syntax = typePtr->syntax;
+	type.macro = typePtr->macro;
+	type.status = typePtr->status;
+	type.restKind = typePtr->restKind;
+	type.rests = n;
+	type.numRests = NumRests(typePtr);
+	n += type.numRests;
+	fwrite((char *) &type, sizeof(FrozenType), 1, fp);
     }
+}
 
-    /*
-     * Save numTCs Tnm_MibTC structures:
-     */
+/*
+ *----------------------------------------------------------------------
+ *
+ * SaveNode --
+ *
+ *	This procedure writes a single node to fp. Strings are saved
+ *	as offsets into the frozen file and the type is saved as an
+ *	index into the array of types.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    fwrite((char *) &numTCs, sizeof(int), 1, fp);
-    for (i = 0, nPtr = nodePtr; nPtr; nPtr = nPtr->nextPtr) {
-	if (nPtr->typePtr) {
-	    SaveType(nPtr->typePtr, &i, fp);
-	}
-    }
-    for (tPtr=tnmMibTypeList; tPtr != tnmMibTypeSaveMark; tPtr = tPtr->nextPtr) {
-	SaveType(tPtr, &i, fp);
-    }
-    
-    /*
-     * Save numNodes TnmMibNode structures:
-     */
+static void
+SaveNode(fp, nodePtr)
+    FILE *fp;
+    TnmMibNode *nodePtr;
+{
+    Tcl_HashEntry *entryPtr;
+    FrozenNode node;
 
-    fwrite((char *) &numNodes, sizeof(int), 1, fp);
-    for (i = 0, nPtr = nodePtr; nPtr; nPtr = nPtr->nextPtr) {
-	SaveNode(nPtr, &i, fp);
+    memset((char *) &node, 0, sizeof(FrozenNode));
+    node.subid = nodePtr->subid;
+    node.label = PoolGetOffset(nodePtr->label);
+    node.parentName = PoolGetOffset(nodePtr->parentName);
+    node.moduleName = PoolGetOffset(nodePtr->moduleName);
+    node.fileName = PoolGetOffset(nodePtr->fileName);
+    node.index = PoolGetOffset(nodePtr->index);
+    node.fileOffset = nodePtr->fileOffset;
+    node.syntax = nodePtr->syntax;
+    node.access = nodePtr->access;
+    node.macro = nodePtr->macro;
+    node.status = nodePtr->status;
+    node.implied = nodePtr->implied;
+    node.augment = nodePtr->augment;
+    if (nodePtr->typePtr) {
+	entryPtr = Tcl_FindHashEntry(typeIndexTable, (char *) nodePtr->typePtr);
+	node.type = (u_int) (long) Tcl_GetHashValue(entryPtr);
     }
+    fwrite((char *) &node, sizeof(FrozenNode), 1, fp);
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HeaderInit --
+ *
+ *	This procedure initializes the header of a frozen file. The
+ *	string pool follows the header of the given size. The arrays
+ *	of restrictions, types and nodes follow the string pool. The
+ *	offsets of the version and source strings are set when the
+ *	string pool has been written.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HeaderInit(hdrPtr, magic, headerSize, numRests, numNodes)
+    FrozenHeader *hdrPtr;
+    char *magic;
+    u_int headerSize;
+    u_int numRests;
+    u_int numNodes;
+{
+    memset((char *) hdrPtr, 0, sizeof(FrozenHeader));
+    memcpy(hdrPtr->magic, magic, sizeof(hdrPtr->magic));
+    hdrPtr->version = FROZEN_VERSION;
+    hdrPtr->pool = headerSize;
+    hdrPtr->poolSize = poolOffset;
+    hdrPtr->rests = FROZEN_ALIGN(hdrPtr->pool + hdrPtr->poolSize);
+    hdrPtr->numRests = numRests;
+    hdrPtr->types = hdrPtr->rests + numRests * sizeof(FrozenRest);
+    hdrPtr->numTypes = numTypes;
+    hdrPtr->nodes = hdrPtr->types + numTypes * sizeof(FrozenType);
+    hdrPtr->numNodes = numNodes;
+    hdrPtr->size = hdrPtr->nodes + numNodes * sizeof(FrozenNode);
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -521,207 +787,1207 @@ TnmMibWriteFrozen(fp, nodePtr)
     FILE *fp;
     TnmMibNode *nodePtr;
 {
-    int numEnums, numTcs, numNodes; 
+    static char zeros[8];
+    FrozenHeader hdr;
+    int numRests, numNodes;
+
     PoolInit();
-    CollectData(&numEnums, &numTcs, &numNodes, nodePtr);
-    PoolSave(fp);
-    SaveData(fp, numEnums, numTcs, numNodes, nodePtr);
+    TypesInit();
+
+    PoolAddString(TNM_VERSION);
+    PoolAddString(tnmMibFileName);
+    CollectData(&numRests, &numNodes, nodePtr);
+    HeaderInit(&hdr, FROZEN_MAGIC, sizeof(FrozenHeader), numRests, numNodes);
+
+    fseek(fp, (long) sizeof(FrozenHeader), SEEK_SET);
+    PoolSave(fp, hdr.pool);
+    fwrite(zeros, 1, hdr.rests - hdr.pool - hdr.poolSize, fp);
+    SaveTypes(fp);
+    for (; nodePtr; nodePtr = nodePtr->nextPtr) {
+	SaveNode(fp, nodePtr);
+    }
+
+    hdr.tnmVersion = PoolGetOffset(TNM_VERSION);
+    hdr.source = PoolGetOffset(tnmMibFileName);
+    fseek(fp, 0, SEEK_SET);
+    fwrite((char *) &hdr, sizeof(FrozenHeader), 1, fp);
+
     PoolDelete();
+    TypesDelete();
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * TnmMibReadFrozen --
- *
- *	This procedure reads a frozen MIB file that was written by 
- *	TnmMibWriteFrozen(). The expected format is:
+ * CollectTree --
  *
- *	int (stringpool size)
- *		pool_size bytes
- *	int (number of enum structs)
- *		#enum structs
- *	int (number of textual conventions)
- *		#tc structs
- *	int (number of nodes)
- *		#node structs
+ *	This procedure appends a node and all its descendants in
+ *	depth-first order to the vector of nodes saved in a MIB image.
+ *	The strings and the types of the nodes are collected as well.
  *
  * Results:
- *	A pointer to the MIB root node or NULL if there was an error.
+ *	None.
  *
  * Side effects:
- *	None.
+ *	The node vector grows in powers of two.
  *
  *----------------------------------------------------------------------
  */
 
-TnmMibNode*
-TnmMibReadFrozen(fp)
-    FILE *fp;
+static void
+CollectTree(nodePtr)
+    TnmMibNode *nodePtr;
 {
-    TnmMibNode *root = NULL;
-    size_t poolSize;
-    char *pool;
-    size_t numEnums;
-    TnmMibRest *enums = NULL;
-    size_t numTcs;
-    TnmMibType *tcs = NULL;
-    size_t numNodes;
-    TnmMibNode *nodes;
-
-    /*
-     * First, read the string space: 
-     */
-
-    if (1 != fread((char *) &poolSize, sizeof(int), 1, fp)) {
-	TnmWriteLogMessage(NULL, TNM_LOG_DEBUG, TNM_LOG_USER,
-			   "error reading string pool size...\n");
-	return NULL;
-    }
+    Tcl_HashEntry *entryPtr;
+    int i, isnew;
 
-    pool = ckalloc(poolSize);
-    if (poolSize != fread(pool, 1, poolSize, fp)) {
-        TnmWriteLogMessage(NULL, TNM_LOG_DEBUG, TNM_LOG_USER,
-			   "error reading string pool...\n");
-	return NULL;
-    }
-    if (strcmp(pool, TNM_VERSION) != 0) {
-       TnmWriteLogMessage(NULL, TNM_LOG_DEBUG, TNM_LOG_USER,
-			   "wrong .idy file version...\n");
-	return NULL;
+    if ((numNodeVec & (numNodeVec - 1)) == 0) {
+	nodeVec = (TnmMibNode **) ckrealloc((char *) nodeVec,
+		   (numNodeVec ? 2 * numNodeVec : 1) * sizeof(TnmMibNode *));
     }
+    nodeVec[numNodeVec++] = nodePtr;
+    entryPtr = Tcl_CreateHashEntry(nodeIndexTable, (char *) nodePtr, &isnew);
+    Tcl_SetHashValue(entryPtr, (ClientData) (long) numNodeVec);
 
-    /*
-     * Next, read the restrictions:
-     */
-
-    if (1 != fread((char *) &numEnums, sizeof(numEnums), 1, fp)) {
-        TnmWriteLogMessage(NULL, TNM_LOG_DEBUG, TNM_LOG_USER,
-			   "error reading enum counter...\n");
-	return NULL;
+    PoolAddString(nodePtr->label);
+    PoolAddString(nodePtr->parentName);
+    PoolAddString(nodePtr->fileName);
+    PoolAddString(nodePtr->moduleName);
+    PoolAddString(nodePtr->index);
+    if (nodePtr->typePtr) {
+	AddType(nodePtr->typePtr);
     }
 
-    if (numEnums > 0) {
-	TnmMibRest *restPtr;
-	int i;
-	enums = (TnmMibRest *) ckalloc(numEnums * sizeof(TnmMibRest));
-	if (numEnums != fread(enums, sizeof(TnmMibRest), numEnums, fp)) {
-	    TnmWriteLogMessage(NULL, TNM_LOG_DEBUG, TNM_LOG_USER,
-			       "error reading enums...\n");
-	    ckfree((char *) enums);
-	    return NULL;
-	}
-    
-	/* 
-	 * Chain the pointers:
-	 */
-	
-	for (i = 0, restPtr = enums; i < (int) numEnums; i++, restPtr++) {
-	    restPtr->nextPtr = restPtr->nextPtr ? restPtr + 1 : 0;
-	}
+    for (i = 0; i < nodePtr->numChildren; i++) {
+	CollectTree(nodePtr->childVec[i]);
     }
+}
 
-    /*
-     * Next, read the textual conventions: 
-     */
-
-    if (1 != fread((char *) &numTcs, sizeof(numTcs), 1, fp)) {
-	TnmWriteLogMessage(NULL, TNM_LOG_DEBUG, TNM_LOG_USER,
-			   "error reading tc counter...\n");
-	return NULL;
-    }
+/*
+ *----------------------------------------------------------------------
+ *
+ * HashName --
+ *
+ *	This procedure computes the hash value of a name in the name
+ *	index of a MIB image (FNV-1a). The hash value is part of the
+ *	image format and must not change.
+ *
+ * Results:
+ *	The hash value.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    if (numTcs > 0) {
-	TnmMibType *typePtr;
-	int i;
+static u_int
+HashName(name)
+    char *name;
+{
+    u_int hash = 2166136261U;
 
-	tcs = (TnmMibType *) ckalloc(numTcs * sizeof(TnmMibType));
-	if (numTcs != fread(tcs, sizeof(TnmMibType), numTcs, fp)) {
-	    TnmWriteLogMessage(NULL, TNM_LOG_DEBUG, TNM_LOG_USER,
-			       "error reading tcs...\n");
-	    ckfree((char *) tcs);
-	    return NULL;
-	}
-	
-	/* 
-	 * Adjust string and enum pointers: 
-	 */
+    while (*name) {
+	hash ^= (u_char) *name++;
+	hash *= 16777619U;
+    }
+    return hash;
+}
 
-	for (i = 0, typePtr = tcs; i < (int) numTcs; i++, typePtr++) {
-	    typePtr->name = (int) typePtr->name + pool;
-	    if (typePtr->fileName) {
-	        typePtr->fileName = (int) typePtr->fileName + pool;
-	    }
-	    if (typePtr->moduleName) {
-	        typePtr->moduleName = (int) typePtr->moduleName + pool;
+/*
+ *----------------------------------------------------------------------
+ *
+ * MatchName --
+ *
+ *	This procedure checks whether a name refers to a node. The
+ *	name is a label or, if IMAGE_QUALIFIED is set in flags, a
+ *	label qualified by the module name (module::label).
+ *
+ * Results:
+ *	1 if the name matches the node, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+MatchName(nodePtr, name, flags)
+    TnmMibNode *nodePtr;
+    char *name;
+    u_int flags;
+{
+    size_t len;
+
+    if (! (flags & IMAGE_QUALIFIED)) {
+	return (strcmp(nodePtr->label, name) == 0);
+    }
+
+    len = strlen(nodePtr->moduleName);
+    return (strncmp(nodePtr->moduleName, name, len) == 0
+	    && name[len] == ':' && name[len+1] == ':'
+	    && strcmp(nodePtr->label, name + len + 2) == 0);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * IndexName --
+ *
+ *	This procedure enters a name of the node with the given index
+ *	into the name index of a MIB image. The slot is marked with
+ *	IMAGE_AMBIGUOUS if the name is already used by another node.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+IndexName(slots, mask, name, node, flags)
+    ImageSlot *slots;
+    u_int mask;
+    char *name;
+    u_int node;
+    u_int flags;
+{
+    u_int hash = HashName(name);
+    u_int i;
+
+    for (i = hash & mask; slots[i].node; i = (i + 1) & mask) {
+	if (slots[i].hash == hash
+	    && (slots[i].flags & IMAGE_QUALIFIED) == flags
+	    && MatchName(nodeVec[slots[i].node - 1], name, flags)) {
+	    if (slots[i].node != node + 1) {
+		slots[i].flags |= IMAGE_AMBIGUOUS;
 	    }
-	    if (typePtr->displayHint) {
-		typePtr->displayHint = (int) typePtr->displayHint + pool;
+	    return;
+	}
+    }
+
+    slots[i].hash = hash;
+    slots[i].node = node + 1;
+    slots[i].flags = flags;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmMibWriteImage --
+ *
+ *	This procedure writes a MIB image which contains the whole
+ *	MIB tree, all known types and the list of loaded MIB files
+ *	and modules. See the description of TnmMibReadImage() for an
+ *	explanation of the format.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmMibWriteImage(fp, filesPtr, modulesPtr)
+    FILE *fp;
+    Tcl_Obj *filesPtr;
+    Tcl_Obj *modulesPtr;
+{
+    static char zeros[8];
+    ImageHeader hdr;
+    ImageModule module;
+    ImageLink link;
+    ImageSlot *slots;
+    TnmMibNode *nodePtr;
+    TnmMibType *typePtr;
+    Tcl_HashEntry *entryPtr;
+    Tcl_Obj **fileObjv, **moduleObjv;
+    Tcl_DString ds;
+    int i, j, numRests, numFiles, numModules, numKeys = 0;
+    u_int child, numSlots = 1;
+
+    PoolInit();
+    TypesInit();
+    nodeIndexTable = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+    Tcl_InitHashTable(nodeIndexTable, TCL_ONE_WORD_KEYS);
+    nodeVec = NULL;
+    numNodeVec = 0;
+
+    PoolAddString(TNM_VERSION);
+    Tcl_ListObjGetElements(NULL, filesPtr, &numFiles, &fileObjv);
+    Tcl_ListObjGetElements(NULL, modulesPtr, &numModules, &moduleObjv);
+    if (numFiles < numModules) {
+	numModules = numFiles;
+    }
+    for (i = 0; i < numModules; i++) {
+	PoolAddString(Tcl_GetString(fileObjv[i]));
+	PoolAddString(Tcl_GetString(moduleObjv[i]));
+    }
+
+    for (typePtr = tnmMibTypeList; typePtr; typePtr = typePtr->nextPtr) {
+	AddType(typePtr);
+    }
+    for (nodePtr = tnmMibTree; nodePtr; nodePtr = nodePtr->nextPtr) {
+	CollectTree(nodePtr);
+    }
+    for (i = 0, numRests = 0; i < numTypes; i++) {
+	numRests += NumRests(typeVec[i]);
+    }
+
+    /*
+     * Build the name index. The roots of the MIB tree are not
+     * indexed since they are not registered by the parser either.
+     */
+
+    for (i = 0; i < numNodeVec; i++) {
+	if (nodeVec[i]->parentPtr) {
+	    numKeys += nodeVec[i]->moduleName ? 2 : 1;
+	}
+    }
+    while (numSlots < 2 * (u_int) numKeys) {
+	numSlots <<= 1;
+    }
+    slots = (ImageSlot *) ckalloc(numSlots * sizeof(ImageSlot));
+    memset((char *) slots, 0, numSlots * sizeof(ImageSlot));
+    for (i = 0; i < numNodeVec; i++) {
+	nodePtr = nodeVec[i];
+	if (! nodePtr->parentPtr) {
+	    continue;
+	}
+	IndexName(slots, numSlots - 1, nodePtr->label, i, 0);
+	if (nodePtr->moduleName) {
+	    Tcl_DStringInit(&ds);
+	    Tcl_DStringAppend(&ds, nodePtr->moduleName, -1);
+	    Tcl_DStringAppend(&ds, "::", 2);
+	    Tcl_DStringAppend(&ds, nodePtr->label, -1);
+	    IndexName(slots, numSlots - 1, Tcl_DStringValue(&ds), i,
+		      IMAGE_QUALIFIED);
+	    Tcl_DStringFree(&ds);
+	}
+    }
+
+    memset((char *) &hdr, 0, sizeof(ImageHeader));
+    HeaderInit(&hdr.frozen, IMAGE_MAGIC, sizeof(ImageHeader),
+	       numRests, numNodeVec);
+    hdr.modules = hdr.frozen.size;
+    hdr.numModules = numModules;
+    hdr.links = hdr.modules + numModules * sizeof(ImageModule);
+    hdr.children = hdr.links + numNodeVec * sizeof(ImageLink);
+    for (nodePtr = tnmMibTree; nodePtr; nodePtr = nodePtr->nextPtr) {
+	hdr.numRoots++;
+    }
+    hdr.roots = 0;
+    hdr.numChildren = hdr.numRoots;
+    for (i = 0; i < numNodeVec; i++) {
+	hdr.numChildren += nodeVec[i]->numChildren;
+    }
+    hdr.slots = hdr.children + hdr.numChildren * sizeof(u_int);
+    hdr.numSlots = numSlots;
+    hdr.frozen.size = hdr.slots + numSlots * sizeof(ImageSlot);
+
+    fseek(fp, (long) sizeof(ImageHeader), SEEK_SET);
+    PoolSave(fp, hdr.frozen.pool);
+    fwrite(zeros, 1, hdr.frozen.rests - hdr.frozen.pool
+	   - hdr.frozen.poolSize, fp);
+    SaveTypes(fp);
+    for (i = 0; i < numNodeVec; i++) {
+	SaveNode(fp, nodeVec[i]);
+    }
+
+    for (i = 0; i < numModules; i++) {
+	module.file = PoolGetOffset(Tcl_GetString(fileObjv[i]));
+	module.module = PoolGetOffset(Tcl_GetString(moduleObjv[i]));
+	fwrite((char *) &module, sizeof(ImageModule), 1, fp);
+    }
+
+    for (i = 0, child = hdr.numRoots; i < numNodeVec; i++) {
+	nodePtr = nodeVec[i];
+	link.parent = 0;
+	if (nodePtr->parentPtr) {
+	    entryPtr = Tcl_FindHashEntry(nodeIndexTable,
+					 (char *) nodePtr->parentPtr);
+	    link.parent = (u_int) (long) Tcl_GetHashValue(entryPtr);
+	}
+	link.children = child;
+	link.numChildren = nodePtr->numChildren;
+	child += nodePtr->numChildren;
+	fwrite((char *) &link, sizeof(ImageLink), 1, fp);
+    }
+
+    for (nodePtr = tnmMibTree; nodePtr; nodePtr = nodePtr->nextPtr) {
+	entryPtr = Tcl_FindHashEntry(nodeIndexTable, (char *) nodePtr);
+	child = (u_int) (long) Tcl_GetHashValue(entryPtr) - 1;
+	fwrite((char *) &child, sizeof(u_int), 1, fp);
+    }
+    for (i = 0; i < numNodeVec; i++) {
+	nodePtr = nodeVec[i];
+	for (j = 0; j < nodePtr->numChildren; j++) {
+	    entryPtr = Tcl_FindHashEntry(nodeIndexTable,
+					 (char *) nodePtr->childVec[j]);
+	    child = (u_int) (long) Tcl_GetHashValue(entryPtr) - 1;
+	    fwrite((char *) &child, sizeof(u_int), 1, fp);
+	}
+    }
+
+    fwrite((char *) slots, sizeof(ImageSlot), numSlots, fp);
+
+    hdr.frozen.tnmVersion = PoolGetOffset(TNM_VERSION);
+    fseek(fp, 0, SEEK_SET);
+    fwrite((char *) &hdr, sizeof(ImageHeader), 1, fp);
+
+    ckfree((char *) slots);
+    PoolDelete();
+    TypesDelete();
+    Tcl_DeleteHashTable(nodeIndexTable);
+    ckfree((char *) nodeIndexTable);
+    nodeIndexTable = NULL;
+    if (nodeVec) {
+	ckfree((char *) nodeVec);
+	nodeVec = NULL;
+    }
+    numNodeVec = 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MapFile --
+ *
+ *	This procedure maps a frozen file read-only into memory. The
+ *	file is read into allocated memory if it can not be mapped.
+ *	Files smaller than minSize are rejected.
+ *
+ * Results:
+ *	A pointer to the file contents or NULL if the file can not
+ *	be read. The size of the file is left in sizePtr and mappedPtr
+ *	is set to 1 if the file has been mapped.
+ *
+ * Side effects:
+ *	Memory is mapped or allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char*
+MapFile(fp, sizePtr, mappedPtr, minSize)
+    FILE *fp;
+    size_t *sizePtr;
+    int *mappedPtr;
+    size_t minSize;
+{
+    struct stat st;
+    char *image;
+
+    *mappedPtr = 0;
+    if (fstat(fileno(fp), &st) != 0 || (size_t) st.st_size < minSize) {
+	return NULL;
+    }
+    *sizePtr = (size_t) st.st_size;
+
+#ifdef HAVE_MMAP
+    image = (char *) mmap(NULL, *sizePtr, PROT_READ, MAP_SHARED,
+			  fileno(fp), 0);
+    if (image != (char *) MAP_FAILED) {
+	*mappedPtr = 1;
+	return image;
+    }
+#endif
+
+    image = ckalloc(*sizePtr);
+    if (fread(image, 1, *sizePtr, fp) != *sizePtr) {
+	ckfree(image);
+	return NULL;
+    }
+    return image;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UnmapFile --
+ *
+ *	This procedure releases a file image returned by MapFile().
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory is unmapped or freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+UnmapFile(image, size, mapped)
+    char *image;
+    size_t size;
+    int mapped;
+{
+#ifdef HAVE_MMAP
+    if (mapped) {
+	munmap(image, size);
+	return;
+    }
+#endif
+    ckfree(image);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CheckString --
+ *
+ *	This procedure checks that an offset refers to a string in
+ *	the string pool of a frozen file.
+ *
+ * Results:
+ *	1 if the offset is 0 or inside of the string pool, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CheckString(hdrPtr, offset)
+    FrozenHeader *hdrPtr;
+    u_int offset;
+{
+    return (offset == 0 || (offset >= hdrPtr->pool
+			    && offset < hdrPtr->pool + hdrPtr->poolSize));
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CheckHeader --
+ *
+ *	This procedure checks the header of a frozen file or a MIB
+ *	image. The file must have been written by this version of
+ *	the Tnm extension and all sections must be inside of the file.
+ *
+ * Results:
+ *	1 if the header is valid, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CheckHeader(hdrPtr, image, size, magic, headerSize)
+    FrozenHeader *hdrPtr;
+    char *image;
+    size_t size;
+    char *magic;
+    u_int headerSize;
+{
+    if (memcmp(hdrPtr->magic, magic, sizeof(hdrPtr->magic)) != 0
+	|| hdrPtr->version != FROZEN_VERSION || hdrPtr->size != size) {
+	return 0;
+    }
+
+    if (hdrPtr->pool != headerSize || hdrPtr->poolSize == 0
+	|| hdrPtr->poolSize > size
+	|| hdrPtr->pool + hdrPtr->poolSize > size
+	|| image[hdrPtr->pool + hdrPtr->poolSize - 1] != '\0') {
+	return 0;
+    }
+
+    if (hdrPtr->numRests > size / sizeof(FrozenRest)
+	|| hdrPtr->numTypes > size / sizeof(FrozenType)
+	|| hdrPtr->numNodes > size / sizeof(FrozenNode)
+	|| hdrPtr->rests < hdrPtr->pool + hdrPtr->poolSize
+	|| hdrPtr->rests > size
+	|| hdrPtr->types != hdrPtr->rests
+	                    + hdrPtr->numRests * sizeof(FrozenRest)
+	|| hdrPtr->nodes != hdrPtr->types
+	                    + hdrPtr->numTypes * sizeof(FrozenType)
+	|| hdrPtr->nodes + hdrPtr->numNodes * sizeof(FrozenNode) > size) {
+	return 0;
+    }
+
+    if (! CheckString(hdrPtr, hdrPtr->tnmVersion)
+	|| ! hdrPtr->tnmVersion
+	|| strcmp(image + hdrPtr->tnmVersion, TNM_VERSION) != 0) {
+	return 0;
+    }
+
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CheckData --
+ *
+ *	This procedure checks all references in the arrays of types
+ *	and nodes of a frozen file or a MIB image.
+ *
+ * Results:
+ *	1 if all references are valid, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CheckData(hdrPtr, image)
+    FrozenHeader *hdrPtr;
+    char *image;
+{
+    FrozenRest *frest = (FrozenRest *) (image + hdrPtr->rests);
+    FrozenType *ftype = (FrozenType *) (image + hdrPtr->types);
+    FrozenNode *fnode = (FrozenNode *) (image + hdrPtr->nodes);
+    u_int i, j;
+
+    for (i = 0; i < hdrPtr->numTypes; i++) {
+	if (! CheckString(hdrPtr, ftype[i].name) || ! ftype[i].name
+	    || ! CheckString(hdrPtr, ftype[i].moduleName)
+	    || ! CheckString(hdrPtr, ftype[i].fileName)
+	    || ! CheckString(hdrPtr, ftype[i].displayHint)
+	    || ftype[i].rests > hdrPtr->numRests
+	    || ftype[i].numRests > hdrPtr->numRests - ftype[i].rests) {
+	    return 0;
+	}
+	for (j = 0; ftype[i].restKind == TNM_MIB_REST_ENUMS
+		 && j < ftype[i].numRests; j++) {
+	    if (! CheckString(hdrPtr, frest[ftype[i].rests + j].second)) {
+		return 0;
 	    }
-	    if (typePtr->restList) {
-		typePtr->restList = (int) typePtr->restList + enums - 1;
-		if (typePtr->restKind == TNM_MIB_REST_ENUMS) {
-		    /* Adjust the string pool pointers. */
-		    TnmMibRest *restPtr;
-		    for (restPtr = typePtr->restList;
-			 restPtr;
-			 restPtr = restPtr->nextPtr) {
-			restPtr->rest.intEnum.enumLabel = 
-			    (int) restPtr->rest.intEnum.enumLabel + pool;
-		    }
-		}
+	}
+    }
+
+    for (i = 0; i < hdrPtr->numNodes; i++) {
+	if (! CheckString(hdrPtr, fnode[i].label) || ! fnode[i].label
+	    || ! CheckString(hdrPtr, fnode[i].parentName)
+	    || ! CheckString(hdrPtr, fnode[i].moduleName)
+	    || ! CheckString(hdrPtr, fnode[i].fileName)
+	    || ! CheckString(hdrPtr, fnode[i].index)
+	    || fnode[i].type > hdrPtr->numTypes) {
+	    return 0;
+	}
+    }
+
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CreateTypes --
+ *
+ *	This procedure converts the restrictions and types of a frozen
+ *	file or a MIB image into arrays of TnmMibRest and TnmMibType
+ *	structures. The strings are used in place. The named types are
+ *	registered in reverse order so that the list of types has the
+ *	same order as after parsing the MIB file. A saved type which
+ *	is already registered for its module is replaced by the
+ *	registered type, just like the parser resolves the type.
+ *
+ * Results:
+ *	A pointer to a vector which maps the index of every saved type
+ *	to the type used by the nodes or NULL if there are no types.
+ *	The vector must be freed by the caller.
+ *
+ * Side effects:
+ *	Memory is allocated and the types are registered.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmMibType**
+CreateTypes(hdrPtr, image)
+    FrozenHeader *hdrPtr;
+    char *image;
+{
+    FrozenRest *frest = (FrozenRest *) (image + hdrPtr->rests);
+    FrozenType *ftype = (FrozenType *) (image + hdrPtr->types);
+    TnmMibRest *rests = NULL;
+    TnmMibType *types = NULL;
+    TnmMibType **typeMap = NULL;
+    int i, j;
+
+#define STRING(offset)	((offset) ? image + (offset) : NULL)
+
+    if (hdrPtr->numRests) {
+	rests = (TnmMibRest *) ckalloc(hdrPtr->numRests * sizeof(TnmMibRest));
+	memset((char *) rests, 0, hdrPtr->numRests * sizeof(TnmMibRest));
+    }
+
+    if (hdrPtr->numTypes) {
+	types = (TnmMibType *) ckalloc(hdrPtr->numTypes * sizeof(TnmMibType));
+	memset((char *) types, 0, hdrPtr->numTypes * sizeof(TnmMibType));
+	typeMap = (TnmMibType **)
+	    ckalloc(hdrPtr->numTypes * sizeof(TnmMibType *));
+    }
+
+    for (i = 0; i < (int) hdrPtr->numTypes; i++) {
+	TnmMibType *typePtr = types + i;
+	typePtr->name = STRING(ftype[i].name);
+	typePtr->moduleName = STRING(ftype[i].moduleName);
+	typePtr->fileName = STRING(ftype[i].fileName);
+	typePtr->displayHint = STRING(ftype[i].displayHint);
+	typePtr->fileOffset = ftype[i].fileOffset;
+	typePtr->syntax = ftype[i].syntax;
+	typePtr->macro = ftype[i].macro;
+	typePtr->status = ftype[i].status;
+	typePtr->restKind = ftype[i].restKind;
+	for (j = 0; j < (int) ftype[i].numRests; j++) {
+	    TnmMibRest *restPtr = rests + ftype[i].rests + j;
+	    FrozenRest *frestPtr = frest + ftype[i].rests + j;
+	    if (ftype[i].restKind == TNM_MIB_REST_ENUMS) {
+		restPtr->rest.intEnum.enumValue = (int) frestPtr->first;
+		restPtr->rest.intEnum.enumLabel = STRING(frestPtr->second);
+	    } else {
+		restPtr->rest.unsRange.min = frestPtr->first;
+		restPtr->rest.unsRange.max = frestPtr->second;
 	    }
-	    if (typePtr->name[0] != '_') {
-		TnmMibAddType(typePtr);
+	    restPtr->nextPtr = (j + 1 < (int) ftype[i].numRests)
+		? restPtr + 1 : NULL;
+	}
+	if (ftype[i].numRests) {
+	    typePtr->restList = rests + ftype[i].rests;
+	}
+    }
+
+    for (i = (int) hdrPtr->numTypes - 1; i >= 0; i--) {
+	typeMap[i] = types + i;
+	if (types[i].name[0] != '_') {
+	    TnmMibType *typePtr = TnmMibAddType(types + i);
+	    if (typePtr) {
+		typeMap[i] = typePtr;
 	    }
-	}	
+	}
     }
 
-    /*
-     * Next, read the MIB nodes:
-     */
+    return typeMap;
+
+#undef STRING
+}
 
-    if (1 != fread((char *) &numNodes, sizeof(numNodes), 1, fp)) {
+/*
+ *----------------------------------------------------------------------
+ *
+ * CreateNodes --
+ *
+ *	This procedure converts the nodes of a frozen file or a MIB
+ *	image into an array of TnmMibNode structures. The strings are
+ *	used in place. The nodes are not linked.
+ *
+ * Results:
+ *	A pointer to the array of nodes or NULL if there are no nodes.
+ *
+ * Side effects:
+ *	Memory is allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmMibNode*
+CreateNodes(hdrPtr, image, typeMap)
+    FrozenHeader *hdrPtr;
+    char *image;
+    TnmMibType **typeMap;
+{
+    FrozenNode *fnode = (FrozenNode *) (image + hdrPtr->nodes);
+    TnmMibNode *nodes = NULL;
+    int i;
+
+#define STRING(offset)	((offset) ? image + (offset) : NULL)
+
+    if (hdrPtr->numNodes) {
+	nodes = (TnmMibNode *) ckalloc(hdrPtr->numNodes * sizeof(TnmMibNode));
+	memset((char *) nodes, 0, hdrPtr->numNodes * sizeof(TnmMibNode));
+    }
+
+    for (i = 0; i < (int) hdrPtr->numNodes; i++) {
+	TnmMibNode *nodePtr = nodes + i;
+	nodePtr->subid = fnode[i].subid;
+	nodePtr->label = STRING(fnode[i].label);
+	nodePtr->parentName = STRING(fnode[i].parentName);
+	nodePtr->moduleName = STRING(fnode[i].moduleName);
+	nodePtr->fileName = STRING(fnode[i].fileName);
+	nodePtr->index = STRING(fnode[i].index);
+	nodePtr->fileOffset = fnode[i].fileOffset;
+	nodePtr->syntax = fnode[i].syntax;
+	nodePtr->access = fnode[i].access;
+	nodePtr->macro = fnode[i].macro;
+	nodePtr->status = fnode[i].status;
+	nodePtr->implied = fnode[i].implied;
+	nodePtr->augment = fnode[i].augment;
+	if (fnode[i].type) {
+	    nodePtr->typePtr = typeMap[fnode[i].type - 1];
+	}
+    }
+
+    return nodes;
+
+#undef STRING
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmMibReadFrozen --
+ *
+ *	This procedure reads a frozen MIB file that was written by
+ *	TnmMibWriteFrozen(). The expected format is:
+ *
+ *	FrozenHeader
+ *	string pool (poolSize bytes)
+ *	FrozenRest[numRests]
+ *	FrozenType[numTypes]
+ *	FrozenNode[numNodes]
+ *
+ *	The strings are used in place. The restrictions, types and
+ *	nodes are converted into arrays of TnmMibRest, TnmMibType and
+ *	TnmMibNode structures since they are linked into the MIB tree.
+ *
+ * Results:
+ *	A pointer to the list of MIB nodes or NULL if there was an
+ *	error or if the file does not contain any nodes.
+ *
+ * Side effects:
+ *	The frozen file remains mapped into memory.
+ *
+ *----------------------------------------------------------------------
+ */
+
+TnmMibNode*
+TnmMibReadFrozen(fp)
+    FILE *fp;
+{
+    FrozenHeader hdr;
+    TnmMibType **typeMap;
+    TnmMibNode *nodes;
+    char *image;
+    size_t size;
+    int i, mapped;
+
+    image = MapFile(fp, &size, &mapped, sizeof(FrozenHeader));
+    if (! image) {
+	TnmWriteLogMessage(NULL, TNM_LOG_DEBUG, TNM_LOG_USER,
+			   "error reading frozen MIB file...\n");
+	return NULL;
+    }
+
+    memcpy((char *) &hdr, image, sizeof(FrozenHeader));
+    if (! CheckHeader(&hdr, image, size, FROZEN_MAGIC, sizeof(FrozenHeader))
+	|| hdr.nodes + hdr.numNodes * sizeof(FrozenNode) != size
+	|| ! CheckString(&hdr, hdr.source) || ! hdr.source
+	|| ! tnmMibFileName
+	|| strcmp(image + hdr.source, tnmMibFileName) != 0) {
+	TnmWriteLogMessage(NULL, TNM_LOG_DEBUG, TNM_LOG_USER,
+			   "wrong .idy file version...\n");
+	UnmapFile(image, size, mapped);
+	return NULL;
+    }
+
+    if (! CheckData(&hdr, image)) {
 	TnmWriteLogMessage(NULL, TNM_LOG_DEBUG, TNM_LOG_USER,
-			   "error reading node counter...\n");
+			   "corrupted .idy file...\n");
+	UnmapFile(image, size, mapped);
 	return NULL;
     }
 
-    if (numNodes > 0) {
-	TnmMibNode *ptr;
-	int i;
+    typeMap = CreateTypes(&hdr, image);
+    nodes = CreateNodes(&hdr, image, typeMap);
+    if (typeMap) {
+	ckfree((char *) typeMap);
+    }
+    for (i = 0; i + 1 < (int) hdr.numNodes; i++) {
+	nodes[i].nextPtr = nodes + i + 1;
+    }
+
+    if (! hdr.numTypes && ! hdr.numNodes) {
+	UnmapFile(image, size, mapped);
+    }
+
+    return nodes;
+}
 
-	nodes = (TnmMibNode *) ckalloc(numNodes * sizeof(TnmMibNode));
-	if (numNodes != fread(nodes, sizeof(TnmMibNode), numNodes, fp)) {
-	    TnmWriteLogMessage(NULL, TNM_LOG_DEBUG, TNM_LOG_USER,
-			       "error reading nodes...\n");
-	    ckfree((char *) nodes);
-	    return NULL;
+/*
+ *----------------------------------------------------------------------
+ *
+ * CheckImage --
+ *
+ *	This procedure checks the sections of a MIB image which follow
+ *	the frozen sections. The parent of a node and the children of
+ *	a node must be consistent, the children must follow their
+ *	parent and they must be sorted by subidentifier so that the
+ *	tree can be linked without further checks.
+ *
+ * Results:
+ *	1 if the sections are valid, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CheckImage(ihdrPtr, image)
+    ImageHeader *ihdrPtr;
+    char *image;
+{
+    FrozenHeader *hdrPtr = &ihdrPtr->frozen;
+    FrozenNode *fnode = (FrozenNode *) (image + hdrPtr->nodes);
+    ImageModule *modules;
+    ImageLink *links;
+    ImageSlot *slots;
+    u_int *children;
+    u_int i, j, c, size = hdrPtr->size, numNodes = hdrPtr->numNodes;
+    int empty = 0;
+
+    if (ihdrPtr->numModules > size / sizeof(ImageModule)
+	|| ihdrPtr->numChildren > size / sizeof(u_int)
+	|| ihdrPtr->numSlots > size / sizeof(ImageSlot)
+	|| ihdrPtr->modules != hdrPtr->nodes + numNodes * sizeof(FrozenNode)
+	|| ihdrPtr->links != ihdrPtr->modules
+	                     + ihdrPtr->numModules * sizeof(ImageModule)
+	|| ihdrPtr->children != ihdrPtr->links + numNodes * sizeof(ImageLink)
+	|| ihdrPtr->slots != ihdrPtr->children
+	                     + ihdrPtr->numChildren * sizeof(u_int)
+	|| size != ihdrPtr->slots + ihdrPtr->numSlots * sizeof(ImageSlot)) {
+	return 0;
+    }
+
+    if (ihdrPtr->numSlots == 0
+	|| (ihdrPtr->numSlots & (ihdrPtr->numSlots - 1)) != 0
+	|| ihdrPtr->roots > ihdrPtr->numChildren
+	|| ihdrPtr->numRoots > ihdrPtr->numChildren - ihdrPtr->roots) {
+	return 0;
+    }
+
+    modules = (ImageModule *) (image + ihdrPtr->modules);
+    for (i = 0; i < ihdrPtr->numModules; i++) {
+	if (! CheckString(hdrPtr, modules[i].file) || ! modules[i].file
+	    || ! CheckString(hdrPtr, modules[i].module)
+	    || ! modules[i].module) {
+	    return 0;
 	}
-	
+    }
+
+    links = (ImageLink *) (image + ihdrPtr->links);
+    children = (u_int *) (image + ihdrPtr->children);
+    for (i = 0; i < ihdrPtr->numRoots; i++) {
+	c = children[ihdrPtr->roots + i];
+	if (c >= numNodes || links[c].parent != 0
+	    || (i > 0 && fnode[children[ihdrPtr->roots + i - 1]].subid
+		>= fnode[c].subid)) {
+	    return 0;
+	}
+    }
+    for (i = 0; i < numNodes; i++) {
+	if (links[i].children > ihdrPtr->numChildren
+	    || links[i].numChildren > ihdrPtr->numChildren
+	                              - links[i].children) {
+	    return 0;
+	}
+	for (j = 0; j < links[i].numChildren; j++) {
+	    c = children[links[i].children + j];
+	    if (c >= numNodes || c <= i || links[c].parent != i + 1
+		|| (j > 0 && fnode[children[links[i].children + j - 1]].subid
+		    >= fnode[c].subid)) {
+		return 0;
+	    }
+	}
+    }
+
+    slots = (ImageSlot *) (image + ihdrPtr->slots);
+    for (i = 0; i < ihdrPtr->numSlots; i++) {
+	if (slots[i].node == 0) {
+	    empty++;
+	} else if (slots[i].node > numNodes
+		   || ((slots[i].flags & IMAGE_QUALIFIED)
+		       && ! fnode[slots[i].node - 1].moduleName)) {
+	    return 0;
+	}
+    }
+
+    return (empty > 0);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LinkImage --
+ *
+ *	This procedure links the nodes of a MIB image into an empty
+ *	MIB tree and makes the name index of the image available to
+ *	TnmMibFindImageNode().
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The MIB tree is initialized.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+LinkImage(ihdrPtr, image, nodes)
+    ImageHeader *ihdrPtr;
+    char *image;
+    TnmMibNode *nodes;
+{
+    ImageLink *links = (ImageLink *) (image + ihdrPtr->links);
+    u_int *children = (u_int *) (image + ihdrPtr->children);
+    TnmMibNode *nodePtr;
+    u_int i, j, n;
+
+    for (i = 0; i < ihdrPtr->frozen.numNodes; i++) {
+	nodePtr = nodes + i;
+	if (links[i].parent) {
+	    nodePtr->parentPtr = nodes + links[i].parent - 1;
+	}
+	if (links[i].numChildren == 0) {
+	    continue;
+	}
+
 	/*
-	 * Adjust string and tc pointers:
+	 * The vector of children grows in powers of two when new
+	 * nodes are linked into the tree. Allocate it accordingly.
 	 */
 
-	for (i = 0, ptr = nodes; i < (int) numNodes; i++, ptr++) {
-	    ptr->label = (int) ptr->label + pool;
-	    ptr->parentName = (int) ptr->parentName + pool;
-	    if (ptr->fileName) {
-	        ptr->fileName = (int) ptr->fileName + pool;
+	for (n = 1; n < links[i].numChildren; n <<= 1) ;
+	nodePtr->childVec = (TnmMibNode **) ckalloc(n * sizeof(TnmMibNode *));
+	nodePtr->numChildren = links[i].numChildren;
+	for (j = 0; j < links[i].numChildren; j++) {
+	    nodePtr->childVec[j] = nodes + children[links[i].children + j];
+	    if (j > 0) {
+		nodePtr->childVec[j-1]->nextPtr = nodePtr->childVec[j];
 	    }
-	    if (ptr->moduleName) {
-	        ptr->moduleName = (int) ptr->moduleName + pool;
+	}
+	nodePtr->childPtr = nodePtr->childVec[0];
+    }
+
+    for (i = ihdrPtr->numRoots; i > 0; i--) {
+	nodePtr = nodes + children[ihdrPtr->roots + i - 1];
+	nodePtr->nextPtr = tnmMibTree;
+	tnmMibTree = nodePtr;
+    }
+
+    imageSlots = (ImageSlot *) (image + ihdrPtr->slots);
+    imageMask = ihdrPtr->numSlots - 1;
+    imageNodes = nodes;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MergeImage --
+ *
+ *	This procedure adds the modules of a MIB image which are not
+ *	loaded yet to an existing MIB tree. The nodes of every module
+ *	are passed to TnmMibAddNode() just like the nodes of a frozen
+ *	file.
+ *
+ * Results:
+ *	TCL_OK on success, TCL_ERROR if a module can not be added.
+ *
+ * Side effects:
+ *	The files and modules added are appended to filesPtr and
+ *	modulesPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+MergeImage(ihdrPtr, image, nodes, filesPtr, modulesPtr)
+    ImageHeader *ihdrPtr;
+    char *image;
+    TnmMibNode *nodes;
+    Tcl_Obj *filesPtr;
+    Tcl_Obj *modulesPtr;
+{
+    ImageModule *modules = (ImageModule *) (image + ihdrPtr->modules);
+    TnmMibNode *nodeList;
+    Tcl_Obj **objv;
+    char *file, *module;
+    int i, j, objc;
+
+    for (i = 0; i < (int) ihdrPtr->numModules; i++) {
+	file = image + modules[i].file;
+	module = image + modules[i].module;
+	Tcl_ListObjGetElements(NULL, filesPtr, &objc, &objv);
+	for (j = 0; j < objc; j++) {
+	    if (strcmp(Tcl_GetString(objv[j]), file) == 0) {
+		break;
+	    }
+	}
+	if (j < objc) {
+	    continue;
+	}
+
+	/*
+	 * Collect the nodes of the module such that the first node
+	 * in depth-first order is the last node in the list, which
+	 * is what TnmMibAddNode() expects.
+	 */
+
+	nodeList = NULL;
+	for (j = 0; j < (int) ihdrPtr->frozen.numNodes; j++) {
+	    if (nodes[j].moduleName == module && nodes[j].parentName) {
+		nodes[j].nextPtr = nodeList;
+		nodeList = nodes + j;
 	    }
-	    if (ptr->index) {
-	        ptr->index = (int) ptr->index + pool;
+	}
+	if (nodeList) {
+	    tnmMibFileName = nodeList->fileName;
+	    if (TnmMibAddNode(&tnmMibTree, nodeList) == -1) {
+		return TCL_ERROR;
 	    }
-	    if (ptr->typePtr) {
-	        ptr->typePtr = (int) ptr->typePtr + tcs - 1;
+	}
+	Tcl_ListObjAppendElement(NULL, filesPtr, Tcl_NewStringObj(file, -1));
+	Tcl_ListObjAppendElement(NULL, modulesPtr,
+				 Tcl_NewStringObj(module, -1));
+    }
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmMibReadImage --
+ *
+ *	This procedure reads a MIB image that was written by
+ *	TnmMibWriteImage(). The expected format is:
+ *
+ *	ImageHeader
+ *	string pool (poolSize bytes)
+ *	FrozenRest[numRests]
+ *	FrozenType[numTypes]
+ *	FrozenNode[numNodes]
+ *	ImageModule[numModules]
+ *	ImageLink[numNodes]
+ *	u_int[numChildren]
+ *	ImageSlot[numSlots]
+ *
+ *	If the MIB tree is empty, the nodes are linked as saved and
+ *	the name index is used in place. No parsing, hashing or
+ *	merging is needed. Otherwise, the modules which are not
+ *	loaded yet are merged into the MIB tree.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	The MIB image remains mapped into memory. The files and
+ *	modules loaded are appended to filesPtr and modulesPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmMibReadImage(fp, filesPtr, modulesPtr)
+    FILE *fp;
+    Tcl_Obj *filesPtr;
+    Tcl_Obj *modulesPtr;
+{
+    ImageHeader hdr;
+    ImageModule *modules;
+    TnmMibType **typeMap;
+    TnmMibNode *nodes;
+    char *image;
+    size_t size;
+    int i, mapped;
+
+    image = MapFile(fp, &size, &mapped, sizeof(ImageHeader));
+    if (! image) {
+	return TCL_ERROR;
+    }
+
+    memcpy((char *) &hdr, image, sizeof(ImageHeader));
+    if (! CheckHeader(&hdr.frozen, image, size, IMAGE_MAGIC,
+		      sizeof(ImageHeader))
+	|| ! CheckData(&hdr.frozen, image)
+	|| ! CheckImage(&hdr, image)) {
+	UnmapFile(image, size, mapped);
+	return TCL_ERROR;
+    }
+
+    typeMap = CreateTypes(&hdr.frozen, image);
+    nodes = CreateNodes(&hdr.frozen, image, typeMap);
+    if (typeMap) {
+	ckfree((char *) typeMap);
+    }
+
+    if (tnmMibTree) {
+	return MergeImage(&hdr, image, nodes, filesPtr, modulesPtr);
+    }
+
+    LinkImage(&hdr, image, nodes);
+    modules = (ImageModule *) (image + hdr.modules);
+    for (i = 0; i < (int) hdr.numModules; i++) {
+	Tcl_ListObjAppendElement(NULL, filesPtr,
+		 Tcl_NewStringObj(image + modules[i].file, -1));
+	Tcl_ListObjAppendElement(NULL, modulesPtr,
+		 Tcl_NewStringObj(image + modules[i].module, -1));
+    }
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmMibFindImageNode --
+ *
+ *	This procedure searches for a name in the name index of the
+ *	MIB image which has been loaded into the empty MIB tree. The
+ *	name is a label or a label qualified by the module name
+ *	(module::label).
+ *
+ * Results:
+ *	1 if the name is in the index, 0 otherwise. The node is left
+ *	in nodePtrPtr. It is set to NULL if the name is not unique.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmMibFindImageNode(name, nodePtrPtr)
+    char *name;
+    TnmMibNode **nodePtrPtr;
+{
+    u_int hash, flags, i;
+
+    *nodePtrPtr = NULL;
+    if (! imageSlots) {
+	return 0;
+    }
+
+    hash = HashName(name);
+    flags = strstr(name, "::") ? IMAGE_QUALIFIED : 0;
+    for (i = hash & imageMask; imageSlots[i].node; i = (i + 1) & imageMask) {
+	if (imageSlots[i].hash == hash
+	    && (imageSlots[i].flags & IMAGE_QUALIFIED) == flags
+	    && MatchName(imageNodes + imageSlots[i].node - 1, name, flags)) {
+	    if (! (imageSlots[i].flags & IMAGE_AMBIGUOUS)) {
+		*nodePtrPtr = imageNodes + imageSlots[i].node - 1;
 	    }
-	    ptr->nextPtr = ptr->nextPtr ? ptr + 1 : 0;
+	    return 1;
 	}
-	root = nodes;
     }
-    
-    return root;
+
+    return 0;
 }
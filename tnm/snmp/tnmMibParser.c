@@ -248,13 +248,64 @@ struct subid {			/* Element of an object identifier          */
 };
 
 /*
- * Some other useful module global variables:
+ * The tokens of a MIB file can be scanned in advance by another
+ * thread. Every token records the syntax and the keyword returned by
+ * ScanKeyword(), the line number after the token and the file offset
+ * before the token.
  */
 
-static int lastchar = ' ';	/* The last read character. */
-static int line = 1;		/* The current line number. */
+typedef struct Token {
+    int syntax;			/* The syntax of the token. */
+    int line;			/* The line number after the token. */
+    long offset;		/* The file offset before the token. */
+    size_t keyword;		/* The offset of the keyword in text. */
+} Token;
+
+/*
+ * The state of a parser is kept in a Parser structure so that several
+ * MIB files can be scanned at the same time by different threads. The
+ * MIB file is read into memory and the parser scans the tokens unless
+ * they have been scanned before. Types and names are always resolved
+ * by the thread which owns the MIB tree while the tokens are parsed.
+ */
+
+typedef struct Parser {
+    char *data;			/* The contents of the MIB file. */
+    size_t size;		/* The size of the MIB file. */
+    size_t pos;			/* The offset of the next character. */
+    char *fileName;		/* The name of the MIB file. */
+    char *moduleName;		/* The name of the current MIB module. */
+    int lastchar;		/* The last read character. */
+    int line;			/* The current line number. */
+    Token *tokens;		/* The tokens scanned before or NULL. */
+    int numTokens;		/* The number of tokens scanned. */
+    int maxTokens;		/* The size of the tokens array. */
+    int nextToken;		/* The next token to be parsed. */
+    char *text;			/* The keywords of the tokens. */
+    size_t textLength;		/* The length of the keywords. */
+    size_t textSize;		/* The size of the text buffer. */
+} Parser;
 
 static Keyword *hashtab[HASHTAB_SIZE];
+static int keywordsHashed = 0;
+
+/*
+ * The mutex protects the keyword hash table and the list of files
+ * waiting to be scanned.
+ */
+
+TCL_DECLARE_MUTEX(parserMutex)
+
+/*
+ * The list of files scanned in parallel. The next element is the
+ * index of the next file that will be picked up by a thread.
+ */
+
+typedef struct Batch {
+    Parser *parsers;		/* The parsers of the batch. */
+    int numParsers;		/* The number of parsers. */
+    int next;			/* The next parser to run. */
+} Batch;
 
 /*
  * A faster strcmp(). Note, some compiler optimize strcmp() et.al.
@@ -264,14 +315,51 @@ static Keyword *hashtab[HASHTAB_SIZE];
 #define fstrcmp(a,b)  ((a)[0] != (b)[0] || (a)[1] != (b)[1] || \
 			strcmp((a), (b)))
 
+/*
+ * Get the next character of the MIB file read into memory.
+ */
+
+#define NextChar(p)   ((p)->pos < (p)->size \
+		       ? (unsigned char) (p)->data[(p)->pos++] : EOF)
+
 
 /*
  * Forward declarations for procedures defined later in this file:
  */
 
 static void
-AddNewNode		_ANSI_ARGS_((TnmMibNode **nodeList, char *label, 
-				     char *parentName, u_int subid));
+InitParser		_ANSI_ARGS_((Parser *parserPtr, char *fileName));
+
+static void
+FreeParser		_ANSI_ARGS_((Parser *parserPtr));
+
+static int
+ReadFile		_ANSI_ARGS_((Parser *parserPtr));
+
+static void
+ScanFile		_ANSI_ARGS_((Parser *parserPtr));
+
+#ifdef TCL_THREADS
+static Tcl_ThreadCreateType
+ScanThread		_ANSI_ARGS_((ClientData clientData));
+#endif
+
+static int
+UseFrozen		_ANSI_ARGS_((char *file, char *frozen));
+
+static void
+WriteFrozen		_ANSI_ARGS_((char *frozen, TnmMibNode *nodePtr));
+
+static char*
+LinkNodes		_ANSI_ARGS_((char *frozen, TnmMibNode *nodePtr));
+
+static char*
+LoadFile		_ANSI_ARGS_((Parser *parserPtr, char *frozen));
+
+static void
+AddNewNode		_ANSI_ARGS_((Parser *parserPtr, TnmMibNode **nodeList,
+				     char *label, char *parentName,
+				     u_int subid));
 static TnmMibRest*
 ScanIntEnums		_ANSI_ARGS_((char *str));
 
@@ -279,67 +367,74 @@ static TnmMibRest*
 ScanRange		_ANSI_ARGS_((char *str));
 
 static int
-ReadIntEnums		_ANSI_ARGS_((FILE *fp, char **strPtr));
+ReadIntEnums		_ANSI_ARGS_((Parser *parserPtr, char **strPtr));
 
 static int
-ReadRange		_ANSI_ARGS_((FILE *fp, char **strPtr));
+ReadRange		_ANSI_ARGS_((Parser *parserPtr, char **strPtr));
 
 static char*
-ReadNameList		_ANSI_ARGS_((FILE *fp));
+ReadNameList		_ANSI_ARGS_((Parser *parserPtr));
 
 static TnmMibType*
-CreateType		_ANSI_ARGS_((char *name, int syntax, char *displayHint,
+CreateType		_ANSI_ARGS_((Parser *parserPtr, char *name,
+				     int syntax, char *displayHint,
 				     char *enums));
 static TnmMibNode*
-ParseFile		_ANSI_ARGS_((FILE *fp));
+ParseFile		_ANSI_ARGS_((Parser *parserPtr));
 
 static int
-ParseHeader		_ANSI_ARGS_((FILE *fp, char *keyword));
+ParseHeader		_ANSI_ARGS_((Parser *parserPtr, char *keyword));
 
 static int
-ParseASN1Type		_ANSI_ARGS_((FILE *fp, char *keyword));
+ParseASN1Type		_ANSI_ARGS_((Parser *parserPtr, char *keyword));
 
 static TnmMibNode*
-ParseModuleCompliance	_ANSI_ARGS_((FILE *fp, char *name, 
+ParseModuleCompliance	_ANSI_ARGS_((Parser *parserPtr, char *name, 
 				     TnmMibNode **nodeList));
 static TnmMibNode*
-ParseModuleIdentity	_ANSI_ARGS_((FILE *fp, char *name, 
+ParseModuleIdentity	_ANSI_ARGS_((Parser *parserPtr, char *name, 
 				     TnmMibNode **nodeList));
 static TnmMibNode*
-ParseNotificationType	_ANSI_ARGS_((FILE *fp, char *name,
+ParseNotificationType	_ANSI_ARGS_((Parser *parserPtr, char *name,
 				     TnmMibNode **nodeList));
 static TnmMibNode*
-ParseNotificationGroup	_ANSI_ARGS_((FILE *fp, char *name,
+ParseNotificationGroup	_ANSI_ARGS_((Parser *parserPtr, char *name,
 				     TnmMibNode **nodeList));
 static TnmMibNode*
-ParseCapabilitiesType	_ANSI_ARGS_((FILE *fp, char *name,
+ParseCapabilitiesType	_ANSI_ARGS_((Parser *parserPtr, char *name,
 				     TnmMibNode **nodeList));
 static TnmMibNode*
-ParseTrapType		_ANSI_ARGS_((FILE *fp, char *name, 
+ParseTrapType		_ANSI_ARGS_((Parser *parserPtr, char *name, 
 				     TnmMibNode **nodeList));
 static TnmMibNode*
-ParseObjectGroup	_ANSI_ARGS_((FILE *fp, char *name,
+ParseObjectGroup	_ANSI_ARGS_((Parser *parserPtr, char *name,
 				     TnmMibNode **nodeList));
 static TnmMibNode*
-ParseObjectIdentity	_ANSI_ARGS_((FILE *fp, char *name,
+ParseObjectIdentity	_ANSI_ARGS_((Parser *parserPtr, char *name,
 				     TnmMibNode **nodeList));
 static TnmMibNode*
-ParseObjectID		_ANSI_ARGS_((FILE *fp, char *name,
+ParseObjectID		_ANSI_ARGS_((Parser *parserPtr, char *name,
 				     TnmMibNode **nodeList));
 static TnmMibNode*
-ParseObjectType		_ANSI_ARGS_((FILE *fp, char *name,
+ParseObjectType		_ANSI_ARGS_((Parser *parserPtr, char *name,
 				     TnmMibNode **nodeList));
 static int
-ParseNodeList		_ANSI_ARGS_((FILE *fp, TnmMibNode **nodeList,
+ParseNodeList		_ANSI_ARGS_((Parser *parserPtr, TnmMibNode **nodeList,
 				     TnmMibNode *nodePtr));
 static void
 HashKeywords		_ANSI_ARGS_((void));
 
 static int
-ReadKeyword		_ANSI_ARGS_((FILE *fp, char *keyword));
+ScanKeyword		_ANSI_ARGS_((Parser *parserPtr, char *keyword));
+
+static int
+ReadKeyword		_ANSI_ARGS_((Parser *parserPtr, char *keyword));
+
+static long
+FileOffset		_ANSI_ARGS_((Parser *parserPtr));
 
 static struct subid *
-ReadSubID		_ANSI_ARGS_((FILE *fp));
+ReadSubID		_ANSI_ARGS_((Parser *parserPtr));
 
 
 /*
@@ -347,7 +442,8 @@ ReadSubID		_ANSI_ARGS_((FILE *fp));
  */
 
 static void
-AddNewNode(nodeList, label, parentName, subid)
+AddNewNode(parserPtr, nodeList, label, parentName, subid)
+     Parser *parserPtr;
      TnmMibNode **nodeList;
      char *label;
      char *parentName;
@@ -355,7 +451,7 @@ AddNewNode(nodeList, label, parentName, subid)
 {
     TnmMibNode *newPtr = TnmMibNewNode(label);
     newPtr->parentName = ckstrdup(parentName);
-    newPtr->moduleName = tnmMibModuleName;
+    newPtr->moduleName = parserPtr->moduleName;
     newPtr->syntax = ASN1_OTHER;
     newPtr->subid = subid;
     newPtr->nextPtr = *nodeList;
@@ -363,23 +459,133 @@ AddNewNode(nodeList, label, parentName, subid)
 }
 
 /*
- * TnmMibParse() opens a MIB file specified by file and returns a 
- * tree of objects in that MIB. The function returns a pointer to 
- * the "root" of the MIB, or NULL if an error occurred.
+ * InitParser() initializes the state of a parser for the given file.
  */
 
-char*
-TnmMibParse(file, frozen)
+static void
+InitParser(parserPtr, fileName)
+    Parser *parserPtr;
+    char *fileName;
+{
+    Tcl_MutexLock(&parserMutex);
+    if (! keywordsHashed) {
+	HashKeywords();
+	keywordsHashed = 1;
+    }
+    Tcl_MutexUnlock(&parserMutex);
+
+    memset((char *) parserPtr, 0, sizeof(Parser));
+    parserPtr->fileName = fileName;
+    parserPtr->lastchar = ' ';
+    parserPtr->line = 1;
+}
+
+/*
+ * FreeParser() releases the MIB file and the tokens of a parser.
+ */
+
+static void
+FreeParser(parserPtr)
+    Parser *parserPtr;
+{
+    if (parserPtr->data) {
+	ckfree(parserPtr->data);
+	parserPtr->data = NULL;
+    }
+    if (parserPtr->tokens) {
+	ckfree((char *) parserPtr->tokens);
+	parserPtr->tokens = NULL;
+    }
+    if (parserPtr->text) {
+	ckfree(parserPtr->text);
+	parserPtr->text = NULL;
+    }
+    parserPtr->numTokens = parserPtr->maxTokens = 0;
+    parserPtr->textLength = parserPtr->textSize = 0;
+}
+
+/*
+ * ReadFile() reads the MIB file of a parser into memory. The function
+ * returns 1 on success and 0 if the file can not be read.
+ */
+
+static int
+ReadFile(parserPtr)
+    Parser *parserPtr;
+{
+    struct stat st;
+    FILE *fp;
+
+    fp = fopen(parserPtr->fileName, "rb");
+    if (fp == NULL) {
+	return 0;
+    }
+    if (fstat(fileno(fp), &st) != 0) {
+	fclose(fp);
+	return 0;
+    }
+    parserPtr->data = ckalloc((size_t) st.st_size + 1);
+    parserPtr->size = fread(parserPtr->data, 1, (size_t) st.st_size, fp);
+    parserPtr->pos = 0;
+    fclose(fp);
+    return 1;
+}
+
+/*
+ * ScanFile() scans all tokens of the MIB file of a parser. The MIB
+ * file can then be parsed without scanning the file again. The last
+ * token is always EOF.
+ */
+
+static void
+ScanFile(parserPtr)
+    Parser *parserPtr;
+{
+    char keyword[SYMBOL_MAXLEN];
+    Token *tokenPtr;
+    size_t len;
+
+    do {
+	if (parserPtr->numTokens == parserPtr->maxTokens) {
+	    parserPtr->maxTokens = parserPtr->maxTokens
+		? 2 * parserPtr->maxTokens : 1024;
+	    parserPtr->tokens = (Token *) ckrealloc((char *) parserPtr->tokens,
+			    parserPtr->maxTokens * sizeof(Token));
+	}
+	tokenPtr = parserPtr->tokens + parserPtr->numTokens++;
+	tokenPtr->offset = (long) parserPtr->pos;
+	tokenPtr->syntax = ScanKeyword(parserPtr, keyword);
+	tokenPtr->line = parserPtr->line;
+	len = strlen(keyword) + 1;
+	while (parserPtr->textLength + len > parserPtr->textSize) {
+	    parserPtr->textSize = parserPtr->textSize
+		? 2 * parserPtr->textSize : 16384;
+	    parserPtr->text = ckrealloc(parserPtr->text, parserPtr->textSize);
+	}
+	memcpy(parserPtr->text + parserPtr->textLength, keyword, len);
+	tokenPtr->keyword = parserPtr->textLength;
+	parserPtr->textLength += len;
+    } while (tokenPtr->syntax != EOF);
+}
+
+/*
+ * UseFrozen() returns 1 if the frozen file exists and is not older
+ * than the MIB file.
+ */
+
+static int
+UseFrozen(file, frozen)
     char *file;
     char *frozen;
 {
-    FILE *fp;		/* The current FILE pointer. */
-    TnmMibNode *nodePtr = NULL;
     Tcl_StatBuf stbuf;
     time_t mib_mtime = 0, frozen_mtime = 0;
     Tcl_Obj *obj = NULL;
 
-    tnmMibFileName = ckstrdup(file);
+    if (frozen == NULL) {
+	return 0;
+    }
+
     obj = Tcl_NewStringObj(file, -1);
     Tcl_IncrRefCount(obj);
     if (Tcl_FSStat(obj, &stbuf) == 0) {
@@ -387,38 +593,62 @@ TnmMibParse(file, frozen)
     }
     Tcl_DecrRefCount(obj);
 
-    if (! frozen || mib_mtime == 0 || frozen_mtime == 0 || frozen_mtime < mib_mtime) {
-	fp = fopen(file, "rb");
-	if (fp == NULL) {
-	    return NULL;
-	}
-	/* save pointer to still known tt's: */
-	tnmMibTypeSaveMark = tnmMibTypeList;
-	nodePtr = ParseFile(fp);
-	fclose(fp);
-	if (frozen) {
-	    if (nodePtr == NULL && tnmMibTypeList == tnmMibTypeSaveMark) {
-		unlink(frozen);
-		return NULL;
-	    } else {
-		fp = fopen(frozen, "wb");
-		if (fp != NULL) {
-		    TnmMibWriteFrozen(fp, nodePtr);
-				fclose(fp);
-		}
-	    }
-	}
-    } else {
-	nodePtr = NULL;
-	fp = fopen(frozen, "rb");
-	if (fp) {
-	    nodePtr = TnmMibReadFrozen(fp);
-	    fclose(fp);
+    obj = Tcl_NewStringObj(frozen, -1);
+    Tcl_IncrRefCount(obj);
+    if (Tcl_FSStat(obj, &stbuf) == 0) {
+	frozen_mtime = stbuf.st_mtime;
+    }
+    Tcl_DecrRefCount(obj);
+
+    return (mib_mtime != 0 && frozen_mtime >= mib_mtime);
+}
+
+/*
+ * WriteFrozen() writes the nodes and the types of the MIB file just
+ * parsed into the frozen file. The frozen file is written under a
+ * temporary name which is renamed when complete. Processes which
+ * have mapped the previous frozen file are not affected.
+ */
+
+static void
+WriteFrozen(frozen, nodePtr)
+    char *frozen;
+    TnmMibNode *nodePtr;
+{
+    FILE *fp;
+    Tcl_DString tmp;
+    char buf[20];
+
+    Tcl_DStringInit(&tmp);
+    Tcl_DStringAppend(&tmp, frozen, -1);
+    sprintf(buf, ".%d", (int) getpid());
+    Tcl_DStringAppend(&tmp, buf, -1);
+    fp = fopen(Tcl_DStringValue(&tmp), "wb");
+    if (fp != NULL) {
+	TnmMibWriteFrozen(fp, nodePtr);
+	if (fclose(fp) != 0 
+	    || rename(Tcl_DStringValue(&tmp), frozen) != 0) {
+	    unlink(Tcl_DStringValue(&tmp));
 	}
     }
+    Tcl_DStringFree(&tmp);
+}
 
+/*
+ * LinkNodes() adds the nodes of a MIB file to the MIB tree. The
+ * function returns the name of the MIB module, or NULL if an error
+ * occurred.
+ */
+
+static char*
+LinkNodes(frozen, nodePtr)
+    char *frozen;
+    TnmMibNode *nodePtr;
+{
     if (TnmMibAddNode(&tnmMibTree, nodePtr) == -1) {
-	unlink(frozen);
+	if (frozen) {
+	    unlink(frozen);
+	}
 	return NULL;
     }
 
@@ -431,6 +661,215 @@ TnmMibParse(file, frozen)
     return NULL;
 }
 
+/*
+ * LoadFile() adds the objects of the MIB file of a parser to the MIB
+ * tree. A frozen file which is not older than the MIB file is loaded
+ * instead of parsing the MIB file. Otherwise, the MIB file is parsed
+ * and the frozen file is written. The tokens scanned before are used
+ * if there are any. The function returns the name of the MIB module,
+ * or NULL if an error occurred.
+ */
+
+static char*
+LoadFile(parserPtr, frozen)
+    Parser *parserPtr;
+    char *frozen;
+{
+    TnmMibNode *nodePtr = NULL;
+
+    tnmMibFileName = ckstrdup(parserPtr->fileName);
+
+    /* save pointer to still known tt's: */
+    tnmMibTypeSaveMark = tnmMibTypeList;
+
+    if (UseFrozen(tnmMibFileName, frozen)) {
+	FILE *fp = fopen(frozen, "rb");
+	if (fp) {
+	    nodePtr = TnmMibReadFrozen(fp);
+	    fclose(fp);
+	}
+    }
+
+    if (nodePtr == NULL && tnmMibTypeList == tnmMibTypeSaveMark) {
+	parserPtr->fileName = tnmMibFileName;
+	if (parserPtr->tokens == NULL && ! ReadFile(parserPtr)) {
+	    return NULL;
+	}
+	nodePtr = ParseFile(parserPtr);
+	FreeParser(parserPtr);
+	if (frozen) {
+	    if (nodePtr == NULL && tnmMibTypeList == tnmMibTypeSaveMark) {
+		unlink(frozen);
+		return NULL;
+	    }
+	    WriteFrozen(frozen, nodePtr);
+	}
+    }
+
+    return LinkNodes(frozen, nodePtr);
+}
+
+/*
+ * TnmMibParse() opens a MIB file specified by file and adds the 
+ * objects in that MIB to the MIB tree. A frozen file which is not
+ * older than the MIB file is loaded instead of parsing the MIB file.
+ * Otherwise, the MIB file is parsed and the frozen file is written.
+ * The function returns the name of the MIB module, or NULL if an
+ * error occurred.
+ */
+
+char*
+TnmMibParse(file, frozen)
+    char *file;
+    char *frozen;
+{
+    Parser parser;
+
+    InitParser(&parser, file);
+    return LoadFile(&parser, frozen);
+}
+
+#ifdef TCL_THREADS
+/*
+ * ScanThread() scans the files of a batch until all files of the
+ * batch have been picked up by some thread.
+ */
+
+static Tcl_ThreadCreateType
+ScanThread(clientData)
+    ClientData clientData;
+{
+    Batch *batchPtr = (Batch *) clientData;
+    Parser *parserPtr;
+    int i;
+
+    while (1) {
+	Tcl_MutexLock(&parserMutex);
+	i = batchPtr->next++;
+	Tcl_MutexUnlock(&parserMutex);
+	if (i >= batchPtr->numParsers) {
+	    break;
+	}
+	parserPtr = batchPtr->parsers + i;
+	if (ReadFile(parserPtr)) {
+	    ScanFile(parserPtr);
+	    ckfree(parserPtr->data);
+	    parserPtr->data = NULL;
+	}
+    }
+
+    TCL_THREAD_CREATE_RETURN;
+}
+#endif
+
+/*
+ * TnmMibParseFiles() adds the objects of a set of MIB files to the MIB
+ * tree. The MIB files without a usable frozen file are scanned by up
+ * to numThreads threads. The tokens are parsed and linked in the order
+ * of the files by the calling thread so that the MIB tree is the same
+ * as if the files were loaded one after the other. The files are read
+ * one by one if Tcl has been built without threads. The names of the
+ * MIB modules are left in the modules array. The function returns the
+ * number of files loaded before the first error.
+ */
+
+int
+TnmMibParseFiles(numFiles, files, frozen, modules, numThreads)
+    int numFiles;
+    char **files;
+    char **frozen;
+    char **modules;
+    int numThreads;
+{
+    Batch batch;
+    Parser parser;
+    int *parserIndex;
+    int i, j;
+
+    if (numFiles <= 0) {
+	return 0;
+    }
+
+#ifndef TCL_THREADS
+    numThreads = 1;
+#endif
+    parserIndex = (int *) ckalloc(numFiles * sizeof(int));
+    for (i = 0, j = 0; i < numFiles; i++) {
+	parserIndex[i] = -1;
+	if (numThreads > 1 && ! UseFrozen(files[i], frozen[i])) {
+	    parserIndex[i] = j++;
+	}
+    }
+
+    /*
+     * Create a parser for every file that must be parsed. Start the
+     * threads and take part in the scanning. Threads which can not be
+     * created are simply not used.
+     */
+
+    batch.parsers = NULL;
+    batch.numParsers = 0;
+    batch.next = 0;
+#ifdef TCL_THREADS
+    if (j > 1) {
+	Tcl_ThreadId *threads;
+	int result, numStarted = 0;
+
+	batch.parsers = (Parser *) ckalloc(j * sizeof(Parser));
+	batch.numParsers = j;
+	for (i = 0; i < numFiles; i++) {
+	    if (parserIndex[i] >= 0) {
+		InitParser(batch.parsers + parserIndex[i], files[i]);
+	    }
+	}
+	if (numThreads > batch.numParsers) {
+	    numThreads = batch.numParsers;
+	}
+	threads = (Tcl_ThreadId *) ckalloc(numThreads * sizeof(Tcl_ThreadId));
+	for (j = 0; j < numThreads - 1; j++) {
+	    if (Tcl_CreateThread(threads + numStarted, ScanThread,
+				 (ClientData) &batch,
+				 TCL_THREAD_STACK_DEFAULT,
+				 TCL_THREAD_JOINABLE) == TCL_OK) {
+		numStarted++;
+	    }
+	}
+	ScanThread((ClientData) &batch);
+	for (j = 0; j < numStarted; j++) {
+	    Tcl_JoinThread(threads[j], &result);
+	}
+	ckfree((char *) threads);
+    }
+#endif
+
+    /*
+     * Parse and link the files in the order given and stop at the
+     * first error. The tokens of a file are released once it has
+     * been parsed.
+     */
+
+    for (i = 0; i < numFiles; i++) {
+	if (batch.parsers && parserIndex[i] >= 0) {
+	    modules[i] = LoadFile(batch.parsers + parserIndex[i], frozen[i]);
+	} else {
+	    InitParser(&parser, files[i]);
+	    modules[i] = LoadFile(&parser, frozen[i]);
+	}
+	if (modules[i] == NULL) {
+	    break;
+	}
+    }
+
+    for (j = 0; j < batch.numParsers; j++) {
+	FreeParser(batch.parsers + j);
+    }
+    if (batch.parsers) {
+	ckfree((char *) batch.parsers);
+    }
+    ckfree((char *) parserIndex);
+
+    return i;
+}
 
 /*
  * ScanIntEnums() converts a string containing pairs of labels and integer
@@ -557,17 +996,34 @@ ScanRange (str)
 }
 
 
+/*
+ * CreateType() creates a new type unless the current module already
+ * defines a type with the same name. Types of other modules are never
+ * reused since the caller may modify the type returned.
+ */
+
 static TnmMibType*
-CreateType(name, syntax, displayHint, enums)
+CreateType(parserPtr, name, syntax, displayHint, enums)
+    Parser *parserPtr;
     char *name;
     int syntax;
     char *displayHint;
     char *enums;
 {
-    TnmMibType *typePtr = TnmMibFindType(name);
-
-    if (typePtr) {
-	return typePtr;
+    TnmMibType *typePtr;
+
+    if (parserPtr->moduleName) {
+	Tcl_DString dst;
+	Tcl_DStringInit(&dst);
+	Tcl_DStringAppend(&dst, parserPtr->moduleName, -1);
+	Tcl_DStringAppend(&dst, "!", 1);
+	Tcl_DStringAppend(&dst, name, -1);
+	typePtr = TnmMibFindType(Tcl_DStringValue(&dst));
+	Tcl_DStringFree(&dst);
+	if (typePtr && typePtr->moduleName
+	    && strcmp(typePtr->moduleName, parserPtr->moduleName) == 0) {
+	    return typePtr;
+	}
     }
 
     typePtr = (TnmMibType *) ckalloc(sizeof(TnmMibType));
@@ -576,8 +1032,8 @@ CreateType(name, syntax, displayHint, enums)
     if (name) {
 	typePtr->name = ckstrdup(name);
     }
-    typePtr->fileName = tnmMibFileName;
-    typePtr->moduleName = tnmMibModuleName;
+    typePtr->fileName = parserPtr->fileName;
+    typePtr->moduleName = parserPtr->moduleName;
     typePtr->syntax = syntax;
     typePtr->macro = TNM_MIB_TEXTUALCONVENTION;
     if (displayHint) {
@@ -599,7 +1055,7 @@ CreateType(name, syntax, displayHint, enums)
 	    typePtr->restKind = TNM_MIB_REST_NONE;
 	}
     }
-    
+
     return TnmMibAddType(typePtr);
 }
 
@@ -613,8 +1069,8 @@ CreateType(name, syntax, displayHint, enums)
  */
 
 static int
-ReadIntEnums(fp, strPtr)
-    FILE *fp;
+ReadIntEnums(parserPtr, strPtr)
+    Parser *parserPtr;
     char **strPtr;
 {
     Tcl_DString result;
@@ -632,16 +1088,16 @@ ReadIntEnums(fp, strPtr)
 	char num [SYMBOL_MAXLEN];
 	char keyword [SYMBOL_MAXLEN];
 
-	syntax = ReadKeyword(fp, str);
+	syntax = ReadKeyword(parserPtr, str);
 #if 0
 /** XXX: dont check - all we need is a string */
 	if (syntax != LABEL) { fail = 1; break; }
 #endif
 	/* got the string:  ``{ foo'' */
-	syntax = ReadKeyword(fp, keyword);
+	syntax = ReadKeyword(parserPtr, keyword);
 	if (syntax != LEFTPAREN) { fail = 1; break; }
 	/* ``{ foo ('' */
-	syntax = ReadKeyword(fp, num);
+	syntax = ReadKeyword(parserPtr, num);
 	if (syntax != NUMBER && syntax != SIGNEDNUMBER) { fail = 1; break; }
 	/* append to the collecting string: */
 	Tcl_DStringAppend(&result, " ", 1);
@@ -649,19 +1105,20 @@ ReadIntEnums(fp, strPtr)
 	Tcl_DStringAppend(&result, " ", 1);
 	Tcl_DStringAppend(&result, num, -1);
 	/* ``{ foo (99'' */
-        syntax = ReadKeyword(fp, keyword);
+        syntax = ReadKeyword(parserPtr, keyword);
 	if (syntax != RIGHTPAREN) { fail = 1; break; }
 	/* ``{ foo (99)'' */
 	/* now there must follow either a ``,'' or a ``}'' */
-        syntax = ReadKeyword(fp, keyword);
+        syntax = ReadKeyword(parserPtr, keyword);
 
     } while (syntax == COMMA);
     
     /* the list is scanned, now there must be a ``}'' */
     
     if (fail || syntax != RIGHTBRACKET) {
-	fprintf(stderr, "%s:%d: Warning: can not scan enums - ignored\n",
-		tnmMibFileName, line);
+	fprintf(stderr,
+		"%s:%d: Warning: can not scan enums - ignored\n",
+		parserPtr->fileName, parserPtr->line);
     }
 
     *strPtr = ckstrdup(Tcl_DStringValue(&result));
@@ -680,8 +1137,8 @@ ReadIntEnums(fp, strPtr)
  */
 
 static int
-ReadRange(fp, strPtr)
-    FILE *fp;
+ReadRange(parserPtr, strPtr)
+    Parser *parserPtr;
     char **strPtr;
 {
     Tcl_DString result;
@@ -700,7 +1157,7 @@ ReadRange(fp, strPtr)
     
     /* got LEFTPAREN:  ``('' */
     do {
-	syntax = ReadKeyword(fp, value);
+	syntax = ReadKeyword(parserPtr, value);
 
 	switch (syntax) {
 	case NUMBER:
@@ -721,10 +1178,10 @@ ReadRange(fp, strPtr)
 	}
 	/* got the string:  ``( 1'' */
 	/* now there must follow either a ``|'', a ``..'', or a ``)'' */
-	syntax = ReadKeyword(fp, keyword);
+	syntax = ReadKeyword(parserPtr, keyword);
 	if (syntax == UPTO) {
 	    /* ``( 1..'' */
-	    syntax = ReadKeyword(fp, value);
+	    syntax = ReadKeyword(parserPtr, value);
 	    
 	    switch (syntax) {
 	    case NUMBER:
@@ -745,7 +1202,7 @@ ReadRange(fp, strPtr)
 	    }
 	    /* got the string:  ``( 1..10'' */
 	    /* now there must follow either a ``|'' or a ``)'' */
-	    syntax = ReadKeyword(fp, keyword);
+	    syntax = ReadKeyword(parserPtr, keyword);
 	} else {
 	    /* just a single number, not a range like ``1..10'' */
 	    *end = 0;
@@ -764,8 +1221,9 @@ ReadRange(fp, strPtr)
     /* the list is scanned, now there must be a ``)'' */
     
     if (fail || syntax != RIGHTPAREN) {
-	fprintf(stderr, "%s:%d: Warning: can not scan range - ignored\n",
-		tnmMibFileName, line);
+	fprintf(stderr,
+		"%s:%d: Warning: can not scan range - ignored\n",
+		parserPtr->fileName, parserPtr->line);
     }
     
     *strPtr = ckstrdup(Tcl_DStringValue(&result));
@@ -779,20 +1237,20 @@ ReadRange(fp, strPtr)
  */
 
 static char*
-ReadNameList(fp)
-    FILE *fp;
+ReadNameList(parserPtr)
+    Parser *parserPtr;
 {
     int syntax;
     Tcl_DString dst;
     char keyword[SYMBOL_MAXLEN];
     char *result;
     
-    if ((syntax = ReadKeyword(fp, keyword)) != LEFTBRACKET) {
+    if ((syntax = ReadKeyword(parserPtr, keyword)) != LEFTBRACKET) {
 	return NULL;
     }
 
     Tcl_DStringInit(&dst);
-    while ((syntax = ReadKeyword(fp, keyword)) != RIGHTBRACKET) {
+    while ((syntax = ReadKeyword(parserPtr, keyword)) != RIGHTBRACKET) {
 	switch (syntax) {
 	case COMMA:
 	    continue;
@@ -813,13 +1271,13 @@ ReadNameList(fp)
 
 
 /*
- * ParseFile() reads a MIB file specified by *fp and return a
+ * ParseFile() reads a MIB file specified by *parserPtr and return a
  * linked list of objects in that MIB.
  */
 
 static TnmMibNode*
-ParseFile (fp)
-     FILE *fp;
+ParseFile (parserPtr)
+     Parser *parserPtr;
 {
     char name[SYMBOL_MAXLEN];
     char keyword[SYMBOL_MAXLEN];
@@ -839,14 +1297,8 @@ ParseFile (fp)
 
     char tt_name[SYMBOL_MAXLEN];
     TnmMibType *typePtr = NULL;
-    /*
-     * init hashtable and parse mib 
-     */
-
-    HashKeywords();
-    line = 1;
 
-    while ((syntax = ReadKeyword(fp, keyword)) != EOF) {
+    while ((syntax = ReadKeyword(parserPtr, keyword)) != EOF) {
 	
 	if (state == OUT_OF_MIB) {
 
@@ -857,10 +1309,11 @@ ParseFile (fp)
 	    switch (syntax) {
 	      case DEFINITIONS:
 		state = IN_MIB;
-		syntax = ParseHeader(fp, name);
+		syntax = ParseHeader(parserPtr, name);
 		if (syntax == EOF || syntax == ERROR) {
-		    fprintf(stderr, "%s:%d: bad format in MIB header\n",
-			    tnmMibFileName, line);
+		    fprintf(stderr,
+			    "%s:%d: bad format in MIB header\n",
+			    parserPtr->fileName, parserPtr->line);
 		    return NULL;
 		}
 
@@ -870,11 +1323,11 @@ ParseFile (fp)
 		break;
 	      case END:
 		fprintf(stderr, "%s: end before start of MIB.\n", 
-			tnmMibFileName);
+			parserPtr->fileName);
 		return NULL;
 	      case ERROR:
 		fprintf(stderr, "%s:%d: error in MIB\n", 
-			tnmMibFileName, line);
+			parserPtr->fileName, parserPtr->line);
 		return NULL;
 	      case LABEL:
 		strncpy (name, keyword, SYMBOL_MAXLEN);
@@ -884,7 +1337,7 @@ ParseFile (fp)
 		  for (;;) {
 		      char buf [SYMBOL_MAXLEN];
 		      int syntax;
-		      if ((syntax = ReadKeyword(fp, buf)) == LEFTBRACKET)
+		      if ((syntax = ReadKeyword(parserPtr, buf)) == LEFTBRACKET)
 			cnt ++;
 		      else if (syntax == RIGHTBRACKET)
 			cnt--;
@@ -895,7 +1348,7 @@ ParseFile (fp)
 		break;
 	      default:
 		fprintf(stderr, "%s:%d: %s is a reserved word\n", 
-			tnmMibFileName, line, keyword);
+			parserPtr->fileName, parserPtr->line, keyword);
 		return NULL;
 	    }
 
@@ -907,16 +1360,17 @@ ParseFile (fp)
 	
 	    switch (syntax) {
 	      case DEFINITIONS:
-		fprintf(stderr, "%s: Fatal: nested MIBS\n", tnmMibFileName);
+		fprintf(stderr, "%s: Fatal: nested MIBS\n",
+			parserPtr->fileName);
 		return NULL;
 	      case END:
-		tnmMibModuleName = NULL;
+		parserPtr->moduleName = NULL;
 		state = OUT_OF_MIB;
 		break;
 	      case EQUALS:
-		syntax = ParseASN1Type (fp, name);
+		syntax = ParseASN1Type (parserPtr, name);
 		if (syntax == END) {
-		    tnmMibModuleName = NULL;
+		    parserPtr->moduleName = NULL;
 		    state = OUT_OF_MIB;
 		}
 
@@ -943,7 +1397,7 @@ ParseFile (fp)
 		     * ignore and use the existing one (but this may
 		     * hurt -- you have been warned) */
 		      
-		      typePtr = CreateType(tt_name, syntax, 0, 0);
+		      typePtr = CreateType(parserPtr, tt_name, syntax, 0, 0);
 		      typePtr->macro = TNM_MIB_TYPE_ASSIGNMENT;
 		  } else if (syntax == ASN1_SEQUENCE 
 			     && lastOTPtr && lastOTPtr->syntax == LABEL) {
@@ -952,7 +1406,7 @@ ParseFile (fp)
 		break;
 	      case ERROR:
 		fprintf(stderr, "%s:%d: error in MIB\n", 
-			tnmMibFileName, line);
+			parserPtr->fileName, parserPtr->line);
 		return NULL;
 	      case LABEL:
 		strncpy (name, keyword, SYMBOL_MAXLEN);
@@ -960,132 +1414,132 @@ ParseFile (fp)
 		strncpy (tt_name, keyword, SYMBOL_MAXLEN);
 		break;
 	      case MODULECOMP:
-		nodePtr = ParseModuleCompliance(fp, name, &nodeList);
+		nodePtr = ParseModuleCompliance(parserPtr, name, &nodeList);
 		if (nodePtr == NULL) {
 		    fprintf(stderr,
 			    "%s:%d: bad format in MODULE-COMPLIANCE\n",
-			    tnmMibFileName, line);
+			    parserPtr->fileName, parserPtr->line);
 		    return NULL;
 		}
 		nodePtr->macro = TNM_MIB_COMPLIANCE;
-		nodePtr->moduleName = tnmMibModuleName;
+		nodePtr->moduleName = parserPtr->moduleName;
 		nodePtr->nextPtr = nodeList;
 		nodeList = nodePtr;
 		break;
 	      case MODULEIDENTITY:
-		nodePtr = ParseModuleIdentity(fp, name, &nodeList);
+		nodePtr = ParseModuleIdentity(parserPtr, name, &nodeList);
 		if (nodePtr == NULL) {
 		    fprintf(stderr,
 			    "%s:%d: bad format in MODULE-IDENTIY\n",
-			    tnmMibFileName, line);
+			    parserPtr->fileName, parserPtr->line);
 		    return NULL;
 		}
 		nodePtr->macro = TNM_MIB_MODULEIDENTITY;
-		nodePtr->moduleName = tnmMibModuleName;
+		nodePtr->moduleName = parserPtr->moduleName;
 		nodePtr->nextPtr = nodeList;
 		nodeList = nodePtr;
 		break;
 	      case NOTIFYTYPE:
-		nodePtr = ParseNotificationType(fp, name, &nodeList);
+		nodePtr = ParseNotificationType(parserPtr, name, &nodeList);
 		if (nodePtr == NULL) {
 		    fprintf(stderr,
 			    "%s:%d: bad format in NOTIFICATION-TYPE\n",
-			    tnmMibFileName, line);
+			    parserPtr->fileName, parserPtr->line);
 		    return NULL;
 		}
 		nodePtr->macro = TNM_MIB_NOTIFICATIONTYPE;
-		nodePtr->moduleName = tnmMibModuleName;
+		nodePtr->moduleName = parserPtr->moduleName;
 		nodePtr->nextPtr = nodeList;
 		nodeList = nodePtr;
 		break;
 	      case NOTIFYGROUP:
-		nodePtr = ParseNotificationGroup(fp, name, &nodeList);
+		nodePtr = ParseNotificationGroup(parserPtr, name, &nodeList);
 		if (nodePtr == NULL) {
 		    fprintf(stderr,
 			    "%s:%d: bad format in NOTIFICATION-GROUP\n",
-			    tnmMibFileName, line);
+			    parserPtr->fileName, parserPtr->line);
 		    return NULL;
 		}
 		nodePtr->macro = TNM_MIB_NOTIFICATIONGROUP;
-		nodePtr->moduleName = tnmMibModuleName;
+		nodePtr->moduleName = parserPtr->moduleName;
 		nodePtr->nextPtr = nodeList;
 		nodeList = nodePtr;
 		break;
 	      case CAPABILITIES:
-		nodePtr = ParseCapabilitiesType(fp, name, &nodeList);
+		nodePtr = ParseCapabilitiesType(parserPtr, name, &nodeList);
 		if (nodePtr == NULL) {
 		    fprintf(stderr, 
 			    "%s:%d: bad format in AGENT-CAPABILITIES\n",
-			    tnmMibFileName, line);
+			    parserPtr->fileName, parserPtr->line);
                     return NULL;
 		}
 		nodePtr->macro = TNM_MIB_CAPABILITIES;
-		nodePtr->moduleName = tnmMibModuleName;
+		nodePtr->moduleName = parserPtr->moduleName;
 		nodePtr->nextPtr = nodeList;
 		nodeList = nodePtr;
 		break;
 	      case TRAPTYPE:
-		nodePtr = ParseTrapType(fp, name, &nodeList);
+		nodePtr = ParseTrapType(parserPtr, name, &nodeList);
 		if (nodePtr == NULL) {
 		    fprintf(stderr,
 			    "%s:%d: bad format in TRAP-TYPE\n",
-			    tnmMibFileName, line);
+			    parserPtr->fileName, parserPtr->line);
 		    return NULL;
 		}
 		nodePtr->macro = TNM_MIB_TRAPTYPE;
-		nodePtr->moduleName = tnmMibModuleName;
+		nodePtr->moduleName = parserPtr->moduleName;
 		nodePtr->nextPtr = nodeList;
 		nodeList = nodePtr;
 		break;
 	      case OBJGROUP:
-		nodePtr = ParseObjectGroup(fp, name, &nodeList);
+		nodePtr = ParseObjectGroup(parserPtr, name, &nodeList);
 		if (nodePtr == NULL) {
 		    fprintf(stderr,
 			    "%s:%d: bad format in OBJECT-GROUP\n",
-			    tnmMibFileName, line);
+			    parserPtr->fileName, parserPtr->line);
 		    return NULL;
 		}
 		nodePtr->macro = TNM_MIB_OBJECTGROUP;
-		nodePtr->moduleName = tnmMibModuleName;
+		nodePtr->moduleName = parserPtr->moduleName;
 		nodePtr->nextPtr = nodeList;
 		nodeList = nodePtr;
 		break;
 	      case OBJECTIDENTITY:
-		nodePtr = ParseObjectIdentity(fp, name, &nodeList);
+		nodePtr = ParseObjectIdentity(parserPtr, name, &nodeList);
 		if (nodePtr == NULL) {
 		    fprintf(stderr,
 			    "%s:%d: bad format in OBJECT-IDENTITY\n",
-			    tnmMibFileName, line);
+			    parserPtr->fileName, parserPtr->line);
 		    return NULL;
 		}
 		nodePtr->macro = TNM_MIB_OBJECTIDENTITY;
-		nodePtr->moduleName = tnmMibModuleName;
+		nodePtr->moduleName = parserPtr->moduleName;
 		nodePtr->nextPtr = nodeList;
 		nodeList = nodePtr;
 		break;
 	      case ASN1_OBJECT_IDENTIFIER:
-		nodePtr = ParseObjectID(fp, name, &nodeList);
+		nodePtr = ParseObjectID(parserPtr, name, &nodeList);
 		if (nodePtr == NULL) {
 		    fprintf(stderr,
 			    "%s:%d: bad format in OBJECT-IDENTIFIER\n",
-			    tnmMibFileName, line);
+			    parserPtr->fileName, parserPtr->line);
 		    return NULL;
 		}
 		nodePtr->nextPtr = nodeList;
 		nodePtr->macro = TNM_MIB_VALUE_ASSIGNEMENT;
-		nodePtr->moduleName = tnmMibModuleName;
+		nodePtr->moduleName = parserPtr->moduleName;
 		nodeList = nodePtr;
 		break;
 	      case OBJTYPE:
-		nodePtr = ParseObjectType(fp, name, &nodeList);
+		nodePtr = ParseObjectType(parserPtr, name, &nodeList);
 		if (nodePtr == NULL) {
 		    fprintf(stderr,
 			    "%s:%d: bad format in OBJECT-TYPE\n",
-			    tnmMibFileName, line);
+			    parserPtr->fileName, parserPtr->line);
 		    return NULL;
 		}
 		nodePtr->macro = TNM_MIB_OBJECTTYPE;
-		nodePtr->moduleName = tnmMibModuleName;
+		nodePtr->moduleName = parserPtr->moduleName;
 		nodePtr->nextPtr = nodeList;
 		nodeList = nodePtr;
 		/* save for SEQUENCE hack: */
@@ -1101,29 +1555,30 @@ ParseFile (fp)
 		if (typePtr &&
 		    ((typePtr->syntax != ASN1_OCTET_STRING) ||
 		     ((typePtr->syntax == ASN1_OCTET_STRING) &&
-		      ((syntax = ReadKeyword(fp, keyword)) != EOF) &&
+		      ((syntax = ReadKeyword(parserPtr, keyword)) != EOF) &&
 		      (syntax == SIZE) &&
-		      ((syntax = ReadKeyword(fp, keyword)) != EOF) &&
+		      ((syntax = ReadKeyword(parserPtr, keyword)) != EOF) &&
 		      (syntax == LEFTPAREN)))) {
 		   char *ranges;
 
-		   if ((ReadRange(fp, &ranges) != RIGHTPAREN) ||
+		   if ((ReadRange(parserPtr, &ranges) != RIGHTPAREN) ||
 		       (typePtr &&
 		        ((typePtr->syntax == ASN1_OCTET_STRING) &&
-		         (((syntax = ReadKeyword(fp, keyword)) == EOF) ||
+		         (((syntax = ReadKeyword(parserPtr, keyword)) == EOF) ||
 		          (syntax != RIGHTPAREN))))) {
 			ckfree (ranges);
 		   } else if (typePtr) {
 			typePtr->restKind = TNM_MIB_REST_RANGE;
 			typePtr->restList = ScanRange(ranges);
 			if (! typePtr->restList) {
-			    fprintf(stderr, "%s:%d: bad range definition1\n",
-				    tnmMibFileName, line);
+			    fprintf(stderr,
+				    "%s:%d: bad range definition1\n",
+				    parserPtr->fileName, parserPtr->line);
 			}
 		   }
 		} else {
 		    fprintf(stderr, "%s:%d: bad range definition\n",
-			    tnmMibFileName, line);
+			    parserPtr->fileName, parserPtr->line);
 		}
  		break;
 #else
@@ -1131,7 +1586,7 @@ ParseFile (fp)
 		  for (;;) {
 		      char buf [SYMBOL_MAXLEN];
 		      int syntax;
-		      if ((syntax = ReadKeyword(fp, buf)) == LEFTPAREN)
+		      if ((syntax = ReadKeyword(parserPtr, buf)) == LEFTPAREN)
 			cnt ++;
 		      else if (syntax == RIGHTPAREN)
 			cnt--;
@@ -1145,9 +1600,9 @@ ParseFile (fp)
 	      case LEFTBRACKET:
 		{ 
 		    char *enums;
-		    if (ReadIntEnums(fp, &enums) != RIGHTBRACKET) {
+		    if (ReadIntEnums(parserPtr, &enums) != RIGHTBRACKET) {
 			fprintf(stderr, "%s:%d: bad mib format\n",
-				tnmMibFileName, line);
+				parserPtr->fileName, parserPtr->line);
 			ckfree (enums);
 		    } else if (typePtr) {
 			typePtr->restKind = TNM_MIB_REST_ENUMS;
@@ -1158,7 +1613,7 @@ ParseFile (fp)
 
 	      default:
 		fprintf(stderr, "%s:%d: bad mib format\n", 
-			tnmMibFileName, line);
+			parserPtr->fileName, parserPtr->line);
 		return NULL;
 	    }
 	}
@@ -1172,7 +1627,8 @@ ParseFile (fp)
 	return nodeList;
     }
 
-    fprintf(stderr, "%s: Fatal: incomplete MIB module\n", tnmMibFileName);
+    fprintf(stderr,
+	    "%s: Fatal: incomplete MIB module\n", parserPtr->fileName);
     return NULL;
 }
 
@@ -1185,33 +1641,33 @@ ParseFile (fp)
  */
 
 static int
-ParseHeader (fp, keyword)
-    FILE *fp;
+ParseHeader (parserPtr, keyword)
+    Parser *parserPtr;
     char *keyword;
 {
     int syntax;
 
-    tnmMibModuleName = ckstrdup(keyword);
+    parserPtr->moduleName = ckstrdup(keyword);
    
-    if ((syntax = ReadKeyword(fp, keyword)) != EQUALS) {
+    if ((syntax = ReadKeyword(parserPtr, keyword)) != EQUALS) {
 	return ERROR;
     }
 
-    if ((syntax = ReadKeyword(fp, keyword)) != BEGIN) {
+    if ((syntax = ReadKeyword(parserPtr, keyword)) != BEGIN) {
 	return ERROR;
     }
 
-    syntax = ReadKeyword(fp, keyword);
+    syntax = ReadKeyword(parserPtr, keyword);
 
     /*
      * if it's EXPORTS clause, read the next keyword after SEMICOLON
      */
 
     if (syntax == EXPORTS) {
-	while ((syntax = ReadKeyword(fp, keyword)) != SEMICOLON) {
+	while ((syntax = ReadKeyword(parserPtr, keyword)) != SEMICOLON) {
 	    if (syntax == EOF) return EOF;
 	}
-	syntax = ReadKeyword(fp, keyword);
+	syntax = ReadKeyword(parserPtr, keyword);
     }
 
     
@@ -1220,10 +1676,10 @@ ParseHeader (fp, keyword)
      */
 
     if (syntax == IMPORTS) {
-	while ((syntax = ReadKeyword(fp, keyword)) != SEMICOLON) {
+	while ((syntax = ReadKeyword(parserPtr, keyword)) != SEMICOLON) {
 	    switch (syntax) {
 	    case FROM:
-		syntax = ReadKeyword(fp, keyword);
+		syntax = ReadKeyword(parserPtr, keyword);
 		if (syntax == EOF) return EOF;
 		if (syntax != LABEL) return ERROR;
 		/* fprintf(stderr, " module %s\n", keyword); */
@@ -1246,8 +1702,9 @@ ParseHeader (fp, keyword)
 			}	
 		    }
 		    if (i != -1) {
-			fprintf(stderr, "unknown module %s imported from %s\n",
-				keyword, tnmMibModuleName);
+			fprintf(stderr,
+				"unknown module %s imported from %s\n",
+				keyword, parserPtr->moduleName);
 		    }
 		}
 #endif
@@ -1263,7 +1720,7 @@ ParseHeader (fp, keyword)
 		break;
 	    }
 	}
-	syntax = ReadKeyword(fp, keyword);
+	syntax = ReadKeyword(parserPtr, keyword);
     }
 
     /*
@@ -1280,8 +1737,8 @@ ParseHeader (fp, keyword)
  */
 
 static int
-ParseASN1Type (fp, keyword)
-     FILE *fp;
+ParseASN1Type (parserPtr, keyword)
+     Parser *parserPtr;
      char *keyword;
 {
 #ifndef USE_RANGES
@@ -1297,7 +1754,7 @@ ParseASN1Type (fp, keyword)
     /* save passed name: */
     strcpy (name, keyword);
     
-    syntax = ReadKeyword(fp, keyword);
+    syntax = ReadKeyword(parserPtr, keyword);
 
     /*
      * Accept more primitive types than required by the
@@ -1319,7 +1776,7 @@ ParseASN1Type (fp, keyword)
 	
 	break;
     case ASN1_SEQUENCE:
-	while ((syntax = ReadKeyword(fp, keyword)) != RIGHTBRACKET)
+	while ((syntax = ReadKeyword(parserPtr, keyword)) != RIGHTBRACKET)
 	    if (syntax == EOF) return 0;
 	syntax = ASN1_SEQUENCE;
 	break;
@@ -1328,22 +1785,22 @@ ParseASN1Type (fp, keyword)
 	/* default: no convention/enums seen: */
 	convention [0] = 0;
 	
-	while ((syntax = ReadKeyword(fp, keyword)) != SYNTAX
+	while ((syntax = ReadKeyword(parserPtr, keyword)) != SYNTAX
 	       && syntax != DISPLAYHINT) {
 	    switch (syntax) {
 	    case STATUS:
-		syntax = ReadKeyword(fp, keyword);
+		syntax = ReadKeyword(parserPtr, keyword);
 		if (syntax != CURRENT
 		    && syntax != OBSOLETE && syntax != DEPRECATED) {
 		    fprintf(stderr, "%s:%d: scan error near `%s'\n", 
-			    tnmMibFileName, line, keyword);
+			    parserPtr->fileName, parserPtr->line, keyword);
 		    return 0;
 		}
 		status = TnmGetTableKey(tnmMibStatusTable, keyword);
 		break;
 	    case DESCRIPTION:
-		offset = ftell(fp);
-		if ((syntax = ReadKeyword(fp, keyword)) != QUOTESTRING) {
+		offset = FileOffset(parserPtr);
+		if ((syntax = ReadKeyword(parserPtr, keyword)) != QUOTESTRING) {
 		    return 0;
 		}
 		break;
@@ -1356,13 +1813,13 @@ ParseASN1Type (fp, keyword)
 	 * read the keyword following SYNTAX or DISPLAYHINT
 	 */
 	
-	merk = ReadKeyword(fp, keyword);
+	merk = ReadKeyword(parserPtr, keyword);
 	/* ugh. and yet another ugly hack to this ugly parser... */
 	if (syntax == SYNTAX && merk == LABEL)
 	{
 	    TnmMibType *newTypePtr, *typePtr = TnmMibFindType(keyword);
 	    if (typePtr) {
-		newTypePtr = CreateType(name, typePtr->syntax, 0, 0);
+		newTypePtr = CreateType(parserPtr, name, typePtr->syntax, 0, 0);
 		newTypePtr->displayHint = typePtr->displayHint;
 		newTypePtr->restKind = typePtr->restKind;
 		newTypePtr->restList = typePtr->restList;
@@ -1380,21 +1837,23 @@ ParseASN1Type (fp, keyword)
 	    strcpy (convention, keyword);
 	    
 	    /* skip to SYNTAX: */
-	    while ((syntax = ReadKeyword(fp, keyword)) != SYNTAX) {
+	    while ((syntax = ReadKeyword(parserPtr, keyword)) != SYNTAX) {
 		switch (syntax) {
 		case STATUS:
-		    syntax = ReadKeyword(fp, keyword);
+		    syntax = ReadKeyword(parserPtr, keyword);
 		    if (syntax != CURRENT
 			&& syntax != OBSOLETE && syntax != DEPRECATED) {
-			fprintf(stderr, "%s:%d: scan error near `%s'\n", 
-				tnmMibFileName, line, keyword);
+			fprintf(stderr,
+				"%s:%d: scan error near `%s'\n", 
+				parserPtr->fileName, parserPtr->line, keyword);
 			return 0;
 		    }
 		    status = TnmGetTableKey(tnmMibStatusTable, keyword);
 		    break;
 		case DESCRIPTION:
-		    offset = ftell(fp);
-		    if ((syntax = ReadKeyword(fp, keyword)) != QUOTESTRING) {
+		    offset = FileOffset(parserPtr);
+		    syntax = ReadKeyword(parserPtr, keyword);
+		    if (syntax != QUOTESTRING) {
 			return 0;
 		    }
 		    break;
@@ -1403,7 +1862,7 @@ ParseASN1Type (fp, keyword)
 		}
 	    }
 	    
-	    if ((merk = ReadKeyword(fp, keyword)) == LABEL)
+	    if ((merk = ReadKeyword(parserPtr, keyword)) == LABEL)
 		return 0;
 	}
 	
@@ -1416,42 +1875,42 @@ ParseASN1Type (fp, keyword)
 	 * if next keyword is a bracket, we have to continue
 	 */
 	
-	if ((syntax = ReadKeyword(fp, keyword)) == LEFTPAREN) {
+	if ((syntax = ReadKeyword(parserPtr, keyword)) == LEFTPAREN) {
 #ifdef USE_RANGES
 	    if ((osyntax != ASN1_OCTET_STRING) ||
 		((osyntax == ASN1_OCTET_STRING) &&
-		 ((syntax = ReadKeyword(fp, keyword)) != EOF) &&
+		 ((syntax = ReadKeyword(parserPtr, keyword)) != EOF) &&
 		 (syntax == SIZE) &&
-		 ((syntax = ReadKeyword(fp, keyword)) != EOF) &&
+		 ((syntax = ReadKeyword(parserPtr, keyword)) != EOF) &&
 		 (syntax == LEFTPAREN))) {
-		if ((ReadRange(fp, &enums) != RIGHTPAREN) ||
+		if ((ReadRange(parserPtr, &enums) != RIGHTPAREN) ||
 		    ((osyntax == ASN1_OCTET_STRING) &&
-		     (((syntax = ReadKeyword(fp, keyword)) == EOF) ||
+		     (((syntax = ReadKeyword(parserPtr, keyword)) == EOF) ||
 		      (syntax != RIGHTPAREN)))) {
 		    fprintf(stderr, "%s:%d: bad range definition\n",
-		            tnmMibFileName, line);
+		            parserPtr->fileName, parserPtr->line);
 		    ckfree(enums);
 		}
 	    } else {
 		fprintf(stderr, "%s:%d: bad range definition\n",
-			tnmMibFileName, line);
+			parserPtr->fileName, parserPtr->line);
 	    }
 #else
 	    level = 1;
 	    while (level != 0) {
-		if ((syntax = ReadKeyword(fp, keyword)) == EOF)
+		if ((syntax = ReadKeyword(parserPtr, keyword)) == EOF)
 		    return 0;
 		if (syntax == LEFTPAREN)
 		    ++level;
 		if (syntax == RIGHTPAREN)
 		    --level;
 	    }
-	    syntax = ReadKeyword(fp, keyword);
+	    syntax = ReadKeyword(parserPtr, keyword);
 #endif
 	}
 	
 	if (syntax == LEFTBRACKET) {
-	    syntax = ReadIntEnums(fp, &enums);
+	    syntax = ReadIntEnums(parserPtr, &enums);
 	}
 	
 	/* found MIB_TextConv: */
@@ -1465,7 +1924,7 @@ ParseASN1Type (fp, keyword)
 	}
 
 	{
-	    TnmMibType *typePtr = CreateType(name, osyntax, 
+	    TnmMibType *typePtr = CreateType(parserPtr, name, osyntax, 
 					     displayHint, enums);
 	    typePtr->fileOffset = offset;
 	    typePtr->status = status;
@@ -1481,7 +1940,7 @@ ParseASN1Type (fp, keyword)
 	{ TnmMibType *typePtr = TnmMibFindType(keyword);
 	  if (typePtr) {
 	      TnmMibType *newTypePtr;
-	      newTypePtr = CreateType(name, typePtr->syntax, 0, 0);
+	      newTypePtr = CreateType(parserPtr, name, typePtr->syntax, 0, 0);
 	      newTypePtr->displayHint = typePtr->displayHint;
 	      newTypePtr->restKind = typePtr->restKind;
 	      newTypePtr->restList = typePtr->restList;
@@ -1489,8 +1948,9 @@ ParseASN1Type (fp, keyword)
 	      newTypePtr->status = status;
 	      return typePtr->syntax;
 	  } else {
-	      fprintf(stderr, "%s:%d: Warning: unknown syntax \"%s\"\n",
-		      tnmMibFileName, line, keyword);
+	      fprintf(stderr,
+		      "%s:%d: Warning: unknown syntax \"%s\"\n",
+		      parserPtr->fileName, parserPtr->line, keyword);
 	      return 0;
 	  }
         }
@@ -1506,8 +1966,8 @@ ParseASN1Type (fp, keyword)
  */
 
 static TnmMibNode*
-ParseModuleCompliance (fp, name, nodeList)
-     FILE *fp;
+ParseModuleCompliance (parserPtr, name, nodeList)
+     Parser *parserPtr;
      char *name;
      TnmMibNode **nodeList;
 {
@@ -1521,12 +1981,12 @@ ParseModuleCompliance (fp, name, nodeList)
      * read keywords until syntax EQUALS is found
      */
     
-    while ((syntax = ReadKeyword(fp, keyword)) != EQUALS) {
+    while ((syntax = ReadKeyword(parserPtr, keyword)) != EQUALS) {
 	switch (syntax) {
 	case DESCRIPTION:
 	    if (nodePtr->fileOffset <= 0) {
-		nodePtr->fileOffset = ftell (fp);
-		if ((syntax = ReadKeyword(fp, keyword)) != QUOTESTRING) {
+		nodePtr->fileOffset = FileOffset(parserPtr);
+		if ((syntax = ReadKeyword(parserPtr, keyword)) != QUOTESTRING) {
 		    fprintf(stderr, "%d --> %s\n", syntax, keyword);
 		    return NULL;
 		}
@@ -1539,7 +1999,7 @@ ParseModuleCompliance (fp, name, nodeList)
 	}
     }
 
-    if (ParseNodeList(fp, nodeList, nodePtr) < 0) {
+    if (ParseNodeList(parserPtr, nodeList, nodePtr) < 0) {
 	return NULL;
     }
     
@@ -1552,8 +2012,8 @@ ParseModuleCompliance (fp, name, nodeList)
  */
 
 static TnmMibNode*
-ParseModuleIdentity (fp, name, nodeList)
-     FILE *fp;
+ParseModuleIdentity (parserPtr, name, nodeList)
+     Parser *parserPtr;
      char *name;
      TnmMibNode **nodeList;
 {
@@ -1567,12 +2027,13 @@ ParseModuleIdentity (fp, name, nodeList)
      * read keywords until syntax EQUALS is found
      */
 
-    while ((syntax = ReadKeyword(fp, keyword)) != EQUALS) {
+    while ((syntax = ReadKeyword(parserPtr, keyword)) != EQUALS) {
 	switch (syntax) {
 	  case DESCRIPTION:
 	      if (nodePtr->fileOffset <= 0) {
-		  nodePtr->fileOffset = ftell(fp);
-		  if ((syntax = ReadKeyword(fp, keyword)) != QUOTESTRING) {
+		  nodePtr->fileOffset = FileOffset(parserPtr);
+		  syntax = ReadKeyword(parserPtr, keyword);
+		  if (syntax != QUOTESTRING) {
 		      fprintf(stderr, "%d --> %s\n", syntax, keyword);
 		      return NULL;
 		  }
@@ -1585,7 +2046,7 @@ ParseModuleIdentity (fp, name, nodeList)
 	}
     }
 
-    if (ParseNodeList(fp, nodeList, nodePtr) < 0) {
+    if (ParseNodeList(parserPtr, nodeList, nodePtr) < 0) {
 	return NULL;
     }
 
@@ -1598,8 +2059,8 @@ ParseModuleIdentity (fp, name, nodeList)
  */
 
 static TnmMibNode*
-ParseNotificationType (fp, name, nodeList)
-     FILE *fp;
+ParseNotificationType (parserPtr, name, nodeList)
+     Parser *parserPtr;
      char *name;
      TnmMibNode **nodeList;
 {
@@ -1613,27 +2074,27 @@ ParseNotificationType (fp, name, nodeList)
      * read keywords until syntax EQUALS is found
      */
 
-    while ((syntax = ReadKeyword(fp, keyword)) != EQUALS) {
+    while ((syntax = ReadKeyword(parserPtr, keyword)) != EQUALS) {
 	switch (syntax) {
 	  case STATUS:
-	    syntax = ReadKeyword(fp, keyword);
+	    syntax = ReadKeyword(parserPtr, keyword);
 	    if (syntax != CURRENT
 		&& syntax != OBSOLETE && syntax != DEPRECATED) {
 		fprintf(stderr, "%s:%d: scan error near `%s'\n", 
-			tnmMibFileName, line, keyword);
+			parserPtr->fileName, parserPtr->line, keyword);
 		return NULL;
 	    }
 	    nodePtr->status = TnmGetTableKey(tnmMibStatusTable, keyword);
 	    break;
 	case OBJECTS:
-	    nodePtr->index = ReadNameList(fp);
+	    nodePtr->index = ReadNameList(parserPtr);
 	    if (! nodePtr->index) {
 		return NULL;
 	    }
 	    break;
 	  case DESCRIPTION:
-            nodePtr->fileOffset = ftell (fp);
-            if ((syntax = ReadKeyword(fp, keyword)) != QUOTESTRING) {
+            nodePtr->fileOffset = FileOffset(parserPtr);
+            if ((syntax = ReadKeyword(parserPtr, keyword)) != QUOTESTRING) {
 		fprintf(stderr, "%d --> %s\n", syntax, keyword);
 		return NULL;
             }
@@ -1645,7 +2106,7 @@ ParseNotificationType (fp, name, nodeList)
 	}
     }
     
-    if (ParseNodeList(fp, nodeList, nodePtr) < 0) {
+    if (ParseNodeList(parserPtr, nodeList, nodePtr) < 0) {
 	return NULL;
     }
     
@@ -1659,8 +2120,8 @@ ParseNotificationType (fp, name, nodeList)
  */
 
 static TnmMibNode*
-ParseCapabilitiesType (fp, name, nodeList)
-     FILE *fp;
+ParseCapabilitiesType (parserPtr, name, nodeList)
+     Parser *parserPtr;
      char *name;
      TnmMibNode **nodeList;
 {
@@ -1670,11 +2131,11 @@ ParseCapabilitiesType (fp, name, nodeList)
 
     nodePtr = TnmMibNewNode(name);
 
-    while ((syntax = ReadKeyword(fp, keyword)) != EQUALS) {
+    while ((syntax = ReadKeyword(parserPtr, keyword)) != EQUALS) {
 	switch (syntax) {
           case DESCRIPTION:
-            nodePtr->fileOffset = ftell (fp);
-            if ((syntax = ReadKeyword(fp, keyword)) != QUOTESTRING) {
+            nodePtr->fileOffset = FileOffset(parserPtr);
+            if ((syntax = ReadKeyword(parserPtr, keyword)) != QUOTESTRING) {
 		fprintf(stderr, "%d --> %s\n", syntax, keyword);
 		return NULL;
             }
@@ -1686,7 +2147,7 @@ ParseCapabilitiesType (fp, name, nodeList)
 	}
     }
 
-    if (ParseNodeList(fp, nodeList, nodePtr) < 0) {
+    if (ParseNodeList(parserPtr, nodeList, nodePtr) < 0) {
 	return NULL;
     }
     
@@ -1699,8 +2160,8 @@ ParseCapabilitiesType (fp, name, nodeList)
  */
 
 static TnmMibNode*
-ParseTrapType (fp, name, nodeList)
-     FILE *fp;
+ParseTrapType (parserPtr, name, nodeList)
+     Parser *parserPtr;
      char *name;
      TnmMibNode **nodeList;
 {
@@ -1715,30 +2176,31 @@ ParseTrapType (fp, name, nodeList)
      * read keywords until syntax EQUALS is found
      */
 
-    while ((syntax = ReadKeyword(fp, keyword)) != EQUALS) {
+    while ((syntax = ReadKeyword(parserPtr, keyword)) != EQUALS) {
 	switch (syntax) {
 	case DESCRIPTION:
-	    nodePtr->fileOffset = ftell (fp);
-	    if ((syntax = ReadKeyword(fp, keyword)) != QUOTESTRING) {
+	    nodePtr->fileOffset = FileOffset(parserPtr);
+	    if ((syntax = ReadKeyword(parserPtr, keyword)) != QUOTESTRING) {
 		fprintf(stderr, "%d --> %s\n", syntax, keyword);
 		return NULL;
 	    }
             break;
 	case VARIABLES:
-	    nodePtr->index = ReadNameList(fp);
+	    nodePtr->index = ReadNameList(parserPtr);
 	    if (! nodePtr->index) {
 		return NULL;
 	    }
 	    break;
 	case ENTERPRISE:
-	    syntax = ReadKeyword(fp, keyword);
+	    syntax = ReadKeyword(parserPtr, keyword);
 	    if (syntax == LEFTBRACKET) {
 		bracket = 1;
-		syntax = ReadKeyword(fp, keyword);
+		syntax = ReadKeyword(parserPtr, keyword);
 	    }
 	    if (syntax != LABEL) {
-		fprintf(stderr, "%s:%d: unable to parse ENTERPRISE %s\n",
-			tnmMibFileName, line, keyword);
+		fprintf(stderr,
+			"%s:%d: unable to parse ENTERPRISE %s\n",
+			parserPtr->fileName, parserPtr->line, keyword);
 		return NULL;
 	    }
 	    enterprise = ckstrdup(keyword);
@@ -1770,10 +2232,11 @@ ParseTrapType (fp, name, nodeList)
 	    }
 #endif
 	    if (bracket) {
-		syntax = ReadKeyword(fp, keyword);
+		syntax = ReadKeyword(parserPtr, keyword);
 		if (syntax != RIGHTBRACKET) {
-		    fprintf(stderr, "%s:%d: expected bracket but got %s\n",
-			    tnmMibFileName, line, keyword);
+		    fprintf(stderr,
+			    "%s:%d: expected bracket but got %s\n",
+			    parserPtr->fileName, parserPtr->line, keyword);
 		    return NULL;
 		}
 	    }
@@ -1788,7 +2251,7 @@ ParseTrapType (fp, name, nodeList)
     /*
      * parse a number defining the trap number */
 
-    syntax = ReadKeyword(fp, keyword);
+    syntax = ReadKeyword(parserPtr, keyword);
     if (syntax != NUMBER || enterprise == NULL) {
 	return NULL;
     }
@@ -1798,7 +2261,7 @@ ParseTrapType (fp, name, nodeList)
      * and a node for the trap type itself (see RFC 1908).
      */
 
-    AddNewNode (nodeList, nodePtr->parentName, enterprise, 0);
+    AddNewNode(parserPtr, nodeList, nodePtr->parentName, enterprise, 0);
     nodePtr->subid = atoi(keyword);
     return nodePtr;
 }
@@ -1809,8 +2272,8 @@ ParseTrapType (fp, name, nodeList)
  */
 
 static TnmMibNode*
-ParseObjectGroup (fp, name, nodeList)
-     FILE *fp;
+ParseObjectGroup (parserPtr, name, nodeList)
+     Parser *parserPtr;
      char *name;
      TnmMibNode **nodeList;
 {
@@ -1822,12 +2285,12 @@ ParseObjectGroup (fp, name, nodeList)
      * next keyword must be OBJECTS
      */
     
-    if ((syntax = ReadKeyword(fp, keyword)) != OBJECTS)
+    if ((syntax = ReadKeyword(parserPtr, keyword)) != OBJECTS)
 	return NULL;
     
     nodePtr = TnmMibNewNode(name);
     
-    nodePtr->index = ReadNameList(fp);
+    nodePtr->index = ReadNameList(parserPtr);
     if (! nodePtr->index) {
 	return NULL;
     }
@@ -1836,21 +2299,21 @@ ParseObjectGroup (fp, name, nodeList)
      * read keywords until EQUALS are found
      */
     
-    while ((syntax = ReadKeyword(fp, keyword)) != EQUALS) {
+    while ((syntax = ReadKeyword(parserPtr, keyword)) != EQUALS) {
 	switch (syntax) {
 	  case STATUS:
-	    syntax = ReadKeyword(fp, keyword);
+	    syntax = ReadKeyword(parserPtr, keyword);
 	    if (syntax != CURRENT
 		&& syntax != OBSOLETE && syntax != DEPRECATED) {
 		fprintf(stderr, "%s:%d: scan error near `%s'\n", 
-			tnmMibFileName, line, keyword);
+			parserPtr->fileName, parserPtr->line, keyword);
 		return NULL;
 	    }
 	    nodePtr->status = TnmGetTableKey(tnmMibStatusTable, keyword);
 	    break;
 	  case DESCRIPTION:
-	    nodePtr->fileOffset = ftell (fp);
-	    if ((syntax = ReadKeyword(fp, keyword)) != QUOTESTRING) {
+	    nodePtr->fileOffset = FileOffset(parserPtr);
+	    if ((syntax = ReadKeyword(parserPtr, keyword)) != QUOTESTRING) {
 		fprintf(stderr, "%d --> %s\n", syntax, keyword);
 		return NULL;
 	    }
@@ -1862,7 +2325,7 @@ ParseObjectGroup (fp, name, nodeList)
 	}
     }
     
-    if (ParseNodeList(fp, nodeList, nodePtr) < 0) {
+    if (ParseNodeList(parserPtr, nodeList, nodePtr) < 0) {
 	return NULL;
     }
 
@@ -1877,8 +2340,8 @@ ParseObjectGroup (fp, name, nodeList)
  */
 
 static TnmMibNode*
-ParseNotificationGroup (fp, name, nodeList)
-    FILE *fp;
+ParseNotificationGroup (parserPtr, name, nodeList)
+    Parser *parserPtr;
     char *name;
     TnmMibNode **nodeList;
 {
@@ -1890,13 +2353,13 @@ ParseNotificationGroup (fp, name, nodeList)
      * next keyword must be NOTIFICATIONS
      */
     
-    if ((syntax = ReadKeyword(fp, keyword)) != NOTIFICATIONS) {
+    if ((syntax = ReadKeyword(parserPtr, keyword)) != NOTIFICATIONS) {
 	return NULL;
     }
 
     nodePtr = TnmMibNewNode(name);
 
-    nodePtr->index = ReadNameList(fp);
+    nodePtr->index = ReadNameList(parserPtr);
     if (! nodePtr->index) {
 	return NULL;
     }
@@ -1905,21 +2368,21 @@ ParseNotificationGroup (fp, name, nodeList)
      * read keywords until EQUALS are found
      */
     
-    while ((syntax = ReadKeyword(fp, keyword)) != EQUALS) {
+    while ((syntax = ReadKeyword(parserPtr, keyword)) != EQUALS) {
 	switch (syntax) {
 	  case STATUS:
-	    syntax = ReadKeyword(fp, keyword);
+	    syntax = ReadKeyword(parserPtr, keyword);
 	    if (syntax != CURRENT
 		&& syntax != OBSOLETE && syntax != DEPRECATED) {
 		fprintf(stderr, "%s:%d: scan error near `%s'\n", 
-			tnmMibFileName, line, keyword);
+			parserPtr->fileName, parserPtr->line, keyword);
 		return NULL;
 	    }
 	    nodePtr->status = TnmGetTableKey(tnmMibStatusTable, keyword);
 	    break;
 	  case DESCRIPTION:
-	    nodePtr->fileOffset = ftell (fp);
-	    if ((syntax = ReadKeyword(fp, keyword)) != QUOTESTRING) {
+	    nodePtr->fileOffset = FileOffset(parserPtr);
+	    if ((syntax = ReadKeyword(parserPtr, keyword)) != QUOTESTRING) {
 		fprintf(stderr, "%d --> %s\n", syntax, keyword);
 		return NULL;
 	    }
@@ -1931,7 +2394,7 @@ ParseNotificationGroup (fp, name, nodeList)
 	}
     }
     
-    if (ParseNodeList(fp, nodeList, nodePtr) < 0) {
+    if (ParseNodeList(parserPtr, nodeList, nodePtr) < 0) {
 	return NULL;
     }
     
@@ -1946,8 +2409,8 @@ ParseNotificationGroup (fp, name, nodeList)
  */
 
 static TnmMibNode*
-ParseObjectIdentity (fp, name, nodeList)
-     FILE *fp;
+ParseObjectIdentity (parserPtr, name, nodeList)
+     Parser *parserPtr;
      char *name;
      TnmMibNode **nodeList;
 {
@@ -1961,21 +2424,21 @@ ParseObjectIdentity (fp, name, nodeList)
      * read keywords until EQUALS are found
      */
 
-    while ((syntax = ReadKeyword(fp, keyword)) != EQUALS) {
+    while ((syntax = ReadKeyword(parserPtr, keyword)) != EQUALS) {
 	switch (syntax) {
 	  case STATUS:
-            syntax = ReadKeyword(fp, keyword);
+            syntax = ReadKeyword(parserPtr, keyword);
             if (syntax != CURRENT
 		&& syntax != OBSOLETE && syntax != DEPRECATED) {
 		fprintf(stderr, "%s:%d: scan error near `%s'\n", 
-			tnmMibFileName, line, keyword);
+			parserPtr->fileName, parserPtr->line, keyword);
 		return NULL;
             }
 	    nodePtr->status = TnmGetTableKey(tnmMibStatusTable, keyword);
             break;
           case DESCRIPTION:
-            nodePtr->fileOffset = ftell (fp);
-            if ((syntax = ReadKeyword(fp, keyword)) != QUOTESTRING) {
+            nodePtr->fileOffset = FileOffset(parserPtr);
+            if ((syntax = ReadKeyword(parserPtr, keyword)) != QUOTESTRING) {
 		fprintf(stderr, "%d --> %s\n", syntax, keyword);
 		return NULL;
             }
@@ -1987,7 +2450,7 @@ ParseObjectIdentity (fp, name, nodeList)
 	}
     }
     
-    if (ParseNodeList(fp, nodeList, nodePtr) < 0) {
+    if (ParseNodeList(parserPtr, nodeList, nodePtr) < 0) {
 	return NULL;
     }
 
@@ -2002,8 +2465,8 @@ ParseObjectIdentity (fp, name, nodeList)
  */
 
 static TnmMibNode*
-ParseObjectID(fp, name, nodeList)
-     FILE *fp;
+ParseObjectID(parserPtr, name, nodeList)
+     Parser *parserPtr;
      char *name;
      TnmMibNode **nodeList;
 {
@@ -2015,13 +2478,13 @@ ParseObjectID(fp, name, nodeList)
      * next keyword must be EQUALS
      */
 
-    if ((syntax = ReadKeyword(fp, keyword)) != EQUALS)
+    if ((syntax = ReadKeyword(parserPtr, keyword)) != EQUALS)
       return NULL;
     
     nodePtr = TnmMibNewNode(name);
     nodePtr->syntax = ASN1_OTHER;
     
-    if (ParseNodeList(fp, nodeList, nodePtr) < 0) {
+    if (ParseNodeList(parserPtr, nodeList, nodePtr) < 0) {
 	return NULL;
     }
     
@@ -2035,8 +2498,8 @@ ParseObjectID(fp, name, nodeList)
  */
 
 static TnmMibNode*
-ParseObjectType (fp, name, nodeList)
-    FILE *fp;
+ParseObjectType (parserPtr, name, nodeList)
+    Parser *parserPtr;
     char *name;
     TnmMibNode **nodeList;
 {
@@ -2050,7 +2513,7 @@ ParseObjectType (fp, name, nodeList)
      * next keyword must be SYNTAX
      */
 
-    if ((syntax = ReadKeyword(fp, keyword)) != SYNTAX)
+    if ((syntax = ReadKeyword(parserPtr, keyword)) != SYNTAX)
       return NULL;
     
     nodePtr = TnmMibNewNode(name);
@@ -2060,7 +2523,7 @@ ParseObjectType (fp, name, nodeList)
      * next keyword defines OBECT-TYPE syntax
      */
 
-    if ((syntax = ReadKeyword(fp, keyword)) == ACCESS)
+    if ((syntax = ReadKeyword(parserPtr, keyword)) == ACCESS)
       return NULL;
     
     nodePtr->syntax = syntax;
@@ -2082,7 +2545,7 @@ ParseObjectType (fp, name, nodeList)
 	    nodePtr->syntax = ASN1_SEQUENCE;
 #if 0
 	    fprintf(stderr, "%s:%d: Warning: unknown syntax \"%s\"\n",
-		    tnmMibFileName, line, keyword);
+		    parserPtr->fileName, parserPtr->line, keyword);
 #endif
 	}
 
@@ -2090,7 +2553,7 @@ ParseObjectType (fp, name, nodeList)
 	 * old eat-it-up code: skip anything to the ACCESS keyword: 
 	 */
 	
-	while ((syntax = ReadKeyword(fp, keyword)) != ACCESS)
+	while ((syntax = ReadKeyword(parserPtr, keyword)) != ACCESS)
 	  if (syntax == EOF)
 	    return NULL;
 
@@ -2110,37 +2573,37 @@ ParseObjectType (fp, name, nodeList)
 	 * ``(0..99)'' or nothing.
 	 */ 
 
-	syntax = ReadKeyword(fp, keyword);
+	syntax = ReadKeyword(parserPtr, keyword);
 	if (syntax == LEFTBRACKET) {
-	    syntax = ReadIntEnums(fp, &restrictions);
+	    syntax = ReadIntEnums(parserPtr, &restrictions);
 	} else if (syntax == LEFTPAREN) {
 
 #ifdef USE_RANGES
 	    if ((baseType != ASN1_OCTET_STRING) ||
 		((baseType == ASN1_OCTET_STRING) &&
-		 ((syntax = ReadKeyword(fp, keyword)) != EOF) &&
+		 ((syntax = ReadKeyword(parserPtr, keyword)) != EOF) &&
 		 (syntax == SIZE) &&
-		 ((syntax = ReadKeyword(fp, keyword)) != EOF) &&
+		 ((syntax = ReadKeyword(parserPtr, keyword)) != EOF) &&
 		 (syntax == LEFTPAREN))) {
-		if ((ReadRange(fp, &restrictions) != RIGHTPAREN) ||
+		if ((ReadRange(parserPtr, &restrictions) != RIGHTPAREN) ||
 		    ((baseType == ASN1_OCTET_STRING) &&
-		     (((syntax = ReadKeyword(fp, keyword)) == EOF) ||
+		     (((syntax = ReadKeyword(parserPtr, keyword)) == EOF) ||
 		      (syntax != RIGHTPAREN)))) {
 		    fprintf(stderr, "%s:%d: bad range definition\n",
-		            tnmMibFileName, line);
+		            parserPtr->fileName, parserPtr->line);
 		    ckfree(restrictions);
 		    return NULL;
 		}
 	    } else {
 		fprintf(stderr, "%s:%d: bad range definition\n",
-			tnmMibFileName, line);
+			parserPtr->fileName, parserPtr->line);
 	    }
 #else
 	    /* got LEFTPAREN: ``('' */
 	    /* XXX: fetch here ranges... -- we simply skip */
 	    int level = 1;
 	    
-	    while ((syntax = ReadKeyword(fp, keyword)) != RIGHTPAREN
+	    while ((syntax = ReadKeyword(parserPtr, keyword)) != RIGHTPAREN
 		   && level > 0) 
 	      {
 		  if (syntax == EOF)
@@ -2157,7 +2620,7 @@ ParseObjectType (fp, name, nodeList)
 	 */
 	
 	while (syntax != ACCESS) {
-	    syntax = ReadKeyword(fp, keyword);
+	    syntax = ReadKeyword(parserPtr, keyword);
 	    if (syntax == EOF) {
 		return NULL;
 	    }
@@ -2171,7 +2634,7 @@ ParseObjectType (fp, name, nodeList)
 	    if (islower(nodePtr->label[0])) {
 		nodePtr->label[0] =  toupper(nodePtr->label[0]);
 	    }
-	    nodePtr->typePtr = CreateType(nodePtr->label, 
+	    nodePtr->typePtr = CreateType(parserPtr, nodePtr->label, 
 					  baseType, 0, restrictions);
 	    nodePtr->typePtr->macro = TNM_MIB_OBJECTTYPE;
 	    nodePtr->label[0] = c;
@@ -2180,11 +2643,11 @@ ParseObjectType (fp, name, nodeList)
 	}
 
     } else if (syntax == ASN1_SEQUENCE) {
-	if ((syntax = ReadKeyword(fp, keyword)) == ASN1_SEQUENCE_OF) {
+	if ((syntax = ReadKeyword(parserPtr, keyword)) == ASN1_SEQUENCE_OF) {
 	    nodePtr->syntax = syntax;
 	}
 	while (syntax != ACCESS) {
-            syntax = ReadKeyword(fp, keyword);
+            syntax = ReadKeyword(parserPtr, keyword);
             if (syntax == EOF) {
                 return NULL;
             }
@@ -2196,7 +2659,7 @@ ParseObjectType (fp, name, nodeList)
 	* old eat-it-up code: skip anything to the ACCESS keyword: 
 	*/
 	
-	while ((syntax = ReadKeyword(fp, keyword)) != ACCESS)
+	while ((syntax = ReadKeyword(parserPtr, keyword)) != ACCESS)
 	  if (syntax == EOF)
 	    return NULL;
     }
@@ -2205,10 +2668,10 @@ ParseObjectType (fp, name, nodeList)
      * next keyword defines ACCESS mode for object
      */
 
-    syntax = ReadKeyword(fp, keyword);
+    syntax = ReadKeyword(parserPtr, keyword);
     if (syntax < READONLY || syntax > NOACCESS) {
 	fprintf(stderr, "%s:%d: scan error near `%s'\n", 
-		tnmMibFileName, line, keyword);
+		parserPtr->fileName, parserPtr->line, keyword);
 	return NULL;
     }
 
@@ -2236,17 +2699,17 @@ ParseObjectType (fp, name, nodeList)
      * next keyword must be STATUS
      */
 
-    if ((syntax = ReadKeyword(fp, keyword)) != STATUS)
+    if ((syntax = ReadKeyword(parserPtr, keyword)) != STATUS)
 	return NULL;
     
     /*
      * next keyword defines status of object
      */
 
-    syntax = ReadKeyword(fp, keyword);
+    syntax = ReadKeyword(parserPtr, keyword);
     if (syntax < MANDATORY || syntax > DEPRECATED) {
 	fprintf(stderr, "%s:%d: scan error near `%s'\n", 
-		tnmMibFileName, line, keyword);
+		parserPtr->fileName, parserPtr->line, keyword);
 	return NULL;
     }
     switch (syntax) {
@@ -2268,23 +2731,23 @@ ParseObjectType (fp, name, nodeList)
      * now determine optional parts of OBJECT-TYPE macro
      */
 
-    while ((syntax = ReadKeyword(fp, keyword)) != EQUALS) {
+    while ((syntax = ReadKeyword(parserPtr, keyword)) != EQUALS) {
 	switch (syntax) {
 	  case DESCRIPTION:
-            nodePtr->fileOffset = ftell (fp);
-            if ((syntax = ReadKeyword(fp, keyword)) != QUOTESTRING) {
+            nodePtr->fileOffset = FileOffset(parserPtr);
+            if ((syntax = ReadKeyword(parserPtr, keyword)) != QUOTESTRING) {
 		return NULL;
             }
             break;
 	  case AUGMENTS:
-	    if ((syntax = ReadKeyword(fp, keyword)) != LEFTBRACKET) {
+	    if ((syntax = ReadKeyword(parserPtr, keyword)) != LEFTBRACKET) {
 		return NULL;
 	    }
-	    if ((syntax = ReadKeyword(fp, keyword)) != LABEL) {
+	    if ((syntax = ReadKeyword(parserPtr, keyword)) != LABEL) {
 		return NULL;
 	    }
 	    nodePtr->index = ckstrdup(keyword);
-	    if ((syntax = ReadKeyword(fp, keyword)) != RIGHTBRACKET) {
+	    if ((syntax = ReadKeyword(parserPtr, keyword)) != RIGHTBRACKET) {
 		ckfree(nodePtr->index);
 		nodePtr->index = NULL;
 		return NULL;
@@ -2293,10 +2756,10 @@ ParseObjectType (fp, name, nodeList)
 	    break;
 	  case INDEX:
 	    Tcl_DStringInit(&dst);
-	    if ((syntax = ReadKeyword(fp, keyword)) != LEFTBRACKET) {
+	    if ((syntax = ReadKeyword(parserPtr, keyword)) != LEFTBRACKET) {
 	        return NULL;
 	    }
-	    while ((syntax = ReadKeyword(fp, keyword)) != RIGHTBRACKET) {
+	    while ((syntax = ReadKeyword(parserPtr, keyword)) != RIGHTBRACKET) {
 		switch (syntax) {
 		case COMMA:
 		    break;
@@ -2304,8 +2767,9 @@ ParseObjectType (fp, name, nodeList)
 		    if (! nodePtr->implied) {
 			nodePtr->implied = 1;
 		    } else {
-			fprintf(stderr, "%s:%d: multiple uses of IMPLIED\n",
-				tnmMibFileName, line);
+			fprintf(stderr,
+				"%s:%d: multiple uses of IMPLIED\n",
+				parserPtr->fileName, parserPtr->line);
 			return NULL;
 		    }
 		    break;
@@ -2321,10 +2785,10 @@ ParseObjectType (fp, name, nodeList)
 	    Tcl_DStringFree(&dst);
 	    break;
 	  case DEFVAL:
-	    if ((syntax = ReadKeyword(fp, keyword)) != LEFTBRACKET) {
+	    if ((syntax = ReadKeyword(parserPtr, keyword)) != LEFTBRACKET) {
                 return NULL;
             }
-            while ((syntax = ReadKeyword(fp, keyword)) != RIGHTBRACKET) {
+            while ((syntax = ReadKeyword(parserPtr, keyword)) != RIGHTBRACKET) {
 		if (syntax == EOF) {
 		    return NULL;
 		}
@@ -2368,7 +2832,7 @@ ParseObjectType (fp, name, nodeList)
 	}
     }
 
-    if (ParseNodeList(fp, nodeList, nodePtr) < 0) {
+    if (ParseNodeList(parserPtr, nodeList, nodePtr) < 0) {
 	return NULL;
     }
     
@@ -2382,14 +2846,14 @@ ParseObjectType (fp, name, nodeList)
  */
 
 static int
-ParseNodeList(fp, nodeList, nodePtr)
-    FILE *fp;
+ParseNodeList(parserPtr, nodeList, nodePtr)
+    Parser *parserPtr;
     TnmMibNode **nodeList;
     TnmMibNode *nodePtr;
 {
     struct subid *subidList, *freePtr;
 
-    subidList = ReadSubID(fp);
+    subidList = ReadSubID(parserPtr);
     if (subidList == NULL) {
 	return -1;
     }
@@ -2405,7 +2869,7 @@ ParseNodeList(fp, nodeList, nodePtr)
 	    nodePtr->parentName = ckstrdup(subidList->parentName);
 	    nodePtr->subid = subidList->subid;
 	} else {
-	    AddNewNode(nodeList, subidList->label, 
+	    AddNewNode(parserPtr, nodeList, subidList->label, 
 		       subidList->parentName,
 		       (unsigned) subidList->subid);
 	}
@@ -2450,18 +2914,59 @@ HashKeywords()
 }
 
 /*
- * ReadKeyword() parses a keyword from the MIB file and places it in
+ * ReadKeyword() returns the next token of the MIB file. The token is
+ * taken from the tokens scanned before if there are any. Otherwise,
+ * the token is read from the MIB file.
+ */
+
+static int
+ReadKeyword(parserPtr, keyword)
+     Parser *parserPtr;
+     char *keyword;
+{
+    Token *tokenPtr;
+
+    if (parserPtr->tokens == NULL) {
+	return ScanKeyword(parserPtr, keyword);
+    }
+
+    tokenPtr = parserPtr->tokens + parserPtr->nextToken;
+    if (tokenPtr->syntax != EOF) {
+	parserPtr->nextToken++;
+    }
+    strcpy(keyword, parserPtr->text + tokenPtr->keyword);
+    parserPtr->line = tokenPtr->line;
+    return tokenPtr->syntax;
+}
+
+/*
+ * FileOffset() returns the offset of the next token in the MIB file.
+ */
+
+static long
+FileOffset(parserPtr)
+     Parser *parserPtr;
+{
+    if (parserPtr->tokens == NULL) {
+	return (long) parserPtr->pos;
+    }
+
+    return parserPtr->tokens[parserPtr->nextToken].offset;
+}
+
+/*
+ * ScanKeyword() parses a keyword from the MIB file and places it in
  * the string pointed to by keyword. Returns the syntax of keyword or
  * EOF if any error.
  */
 
 static int
-ReadKeyword(fp, keyword)
-     FILE *fp;
+ScanKeyword(parserPtr, keyword)
+     Parser *parserPtr;
      char *keyword;
 {
     char *cp = keyword;
-    int	ch = lastchar;
+    int	ch = parserPtr->lastchar;
     int	hash_val = 0;
     char quoteChar = '\0';
 
@@ -2474,8 +2979,8 @@ ReadKeyword(fp, keyword)
      */
 
     while (isspace (ch) && ch != EOF) {
-	if (ch == '\n') line++;
-	ch = getc (fp);
+	if (ch == '\n') parserPtr->line++;
+	ch = NextChar(parserPtr);
     }
 
     if (ch == EOF) return EOF;
@@ -2492,22 +2997,22 @@ ReadKeyword(fp, keyword)
     if (ch == quoteChar) {
 	int len = 0;
 	*keyword = '\0';
-	while ((ch = getc (fp)) != EOF) {
+	while ((ch = NextChar(parserPtr)) != EOF) {
 	    if (ch == '\n') {
-		line++;
+		parserPtr->line++;
 	    } else if (ch == quoteChar) {
-		lastchar = ' ';
+		parserPtr->lastchar = ' ';
 		if (quoteChar == '"') {
 		    return QUOTESTRING;
 		} else {
-		    if ((ch = getc (fp)) != EOF) {
+		    if ((ch = NextChar(parserPtr)) != EOF) {
 			switch (toupper(ch)) {
 			case 'B':
 			    return BINVALUE;
 			case 'H':
 			    return HEXVALUE;
 			default:
-			    ungetc( ch, fp );
+			    parserPtr->pos--;
 			    break;
 			}
 		    }
@@ -2528,18 +3033,18 @@ ReadKeyword(fp, keyword)
 	hash_val += ch;
 	*cp++ = ch;
 	
-	if ((ch = getc (fp)) == '-') {
+	if ((ch = NextChar(parserPtr)) == '-') {
 	    *keyword = '\0';
-	    while ((ch = getc (fp)) != EOF) {
+	    while ((ch = NextChar(parserPtr)) != EOF) {
 		if (ch == '\n') {
-		    line++;
+		    parserPtr->line++;
 		    break;
 		}
 	    }
 	    if (ch == EOF) return EOF;
 	    
-	    lastchar = ' ';
-	    return ReadKeyword(fp, keyword);
+	    parserPtr->lastchar = ' ';
+	    return ScanKeyword(parserPtr, keyword);
 	}
     }
    
@@ -2548,18 +3053,18 @@ ReadKeyword(fp, keyword)
      */
 
     do {
-	if (ch == '\n') line++;
+	if (ch == '\n') parserPtr->line++;
 	
 	if (isspace (ch) || ch == '(' || ch == ')' || ch =='{' ||
 	    ch == '}' || ch == ',' || ch == ';' || ch == '.' ||
 	    ch == '|') {
 
-	    if ((ch == '.') && (lastchar == '.')) {
-		*cp++ = lastchar;
+	    if ((ch == '.') && (parserPtr->lastchar == '.')) {
+		*cp++ = parserPtr->lastchar;
 		*cp++ = ch;
 		*cp = 0;
-		ch = getc(fp);
-		lastchar = ' ';
+		ch = NextChar(parserPtr);
+		parserPtr->lastchar = ' ';
 		return UPTO;
 	    }
 
@@ -2570,11 +3075,11 @@ ReadKeyword(fp, keyword)
 	    if (!isspace (ch) && *keyword == '\0') {
 		hash_val += ch;
 		*cp++ = ch;
-		lastchar = ' ';
+		parserPtr->lastchar = ' ';
 	    } else if (ch == '\n') {
-		lastchar = ' ';
+		parserPtr->lastchar = ' ';
 	    } else {
-		lastchar = ch;
+		parserPtr->lastchar = ch;
 	    }
 	       
 	    *cp = '\0';
@@ -2595,7 +3100,7 @@ ReadKeyword(fp, keyword)
 		 */
 		
 		if (tp->key == CONTINUE) {
-		    lastchar = ch;
+		    parserPtr->lastchar = ch;
 		    continue;
 		}
 		return tp->key;
@@ -2626,7 +3131,7 @@ ReadKeyword(fp, keyword)
 	    hash_val += ch;
 	    *cp++ = ch;
 	}
-    } while ((ch = getc (fp)) != EOF);
+    } while ((ch = NextChar(parserPtr)) != EOF);
     
     return EOF;
 }
@@ -2641,8 +3146,8 @@ ReadKeyword(fp, keyword)
  */
 
 static struct subid*
-ReadSubID (fp)
-    FILE *fp;
+ReadSubID (parserPtr)
+    Parser *parserPtr;
 {
    char	name[SYMBOL_MAXLEN]; 
    char	keyword[SYMBOL_MAXLEN]; 
@@ -2655,13 +3160,13 @@ ReadSubID (fp)
     * EQUALS are passed, so first keyword must be LEFTBRACKET
     */
 
-   if ((syntax = ReadKeyword(fp, keyword)) != LEFTBRACKET) return NULL;
+   if ((syntax = ReadKeyword(parserPtr, keyword)) != LEFTBRACKET) return NULL;
 
    /*
     * now read keywords until RIGHTBRACKET is passed
     */
 
-   while ((syntax = ReadKeyword(fp, keyword)) != RIGHTBRACKET) {
+   while ((syntax = ReadKeyword(parserPtr, keyword)) != RIGHTBRACKET) {
        switch (syntax) {
 	 case EOF:
 	   return NULL;
@@ -2690,9 +3195,10 @@ ReadSubID (fp)
 	   strcpy (name, keyword);
 	   break;
          case LEFTPAREN:
-	   if ((syntax = ReadKeyword(fp, keyword)) != NUMBER) return NULL;
+	   syntax = ReadKeyword(parserPtr, keyword);
+	   if (syntax != NUMBER) return NULL;
 	   np->subid = atoi (keyword);
-	   if ((syntax = ReadKeyword(fp, keyword)) != RIGHTPAREN)
+	   if ((syntax = ReadKeyword(parserPtr, keyword)) != RIGHTPAREN)
 	     return NULL;
 	   break;            
          case NUMBER:
@@ -18,10 +18,12 @@
 
 /*
  * A Tcl list variable which keeps the list of the MIB files loaded
- * into the Tnm extension.
+ * into the Tnm extension. The list of MIB images keeps the images
+ * loaded with the mib load -image command.
  */
 
 static Tcl_Obj *mibFilesLoaded = NULL;
+static Tcl_Obj *mibImagesLoaded = NULL;
 Tcl_Obj *tnmMibModulesLoaded = NULL;
 
 TCL_DECLARE_MUTEX(mibMutex)	/* To serialize access to the mib command. */
@@ -50,6 +52,14 @@ static int
 WalkTree	_ANSI_ARGS_((Tcl_Interp *interp, Tcl_Obj *varName, 
 			     Tcl_Obj *body, TnmMibNode* nodePtr, 
 			     TnmOid *oidPtr, TnmOid *rootPtr));
+static int
+FindFile	_ANSI_ARGS_((Tcl_Interp *interp, Tcl_Obj *objPtr,
+			     Tcl_Obj **fileObjPtr, Tcl_Obj **frozenObjPtr));
+static int
+LoadImage	_ANSI_ARGS_((Tcl_Interp *interp, Tcl_Obj *objPtr));
+
+static int
+SaveImage	_ANSI_ARGS_((Tcl_Interp *interp, Tcl_Obj *objPtr));
 
 /*
  *----------------------------------------------------------------------
@@ -349,38 +359,42 @@ GetIndexList(interp, nodePtr, indexNodeList, implied)
 /*
  *----------------------------------------------------------------------
  *
- * TnmMibLoadFile --
+ * FindFile --
  *
- *	This procedure reads MIB definitions from a file and adds the
- *	objects to the internal MIB tree. This function expands ~
+ *	This procedure locates a MIB file. This function expands ~
  *	filenames and searches $tnm(library)/site and $tnm(library)/mibs
- *	for the given filename. The frozen image of MIB definitions is 
- *	written into a machine specific directory.
+ *	for the given filename. It also constructs the name of the
+ *	frozen file in a machine specific directory.
  *
  * Results:
- *	A standard Tcl result.
+ *	A standard Tcl result. The native name of the MIB file is left
+ *	in fileObjPtr or NULL if the file has already been loaded. The
+ *	native name of the frozen file is left in frozenObjPtr or NULL
+ *	if we can't write a frozen file.
  *
  * Side effects:
- *	New frozen MIB files may be created.
+ *	The machine specific directory may be created.
  *
  *----------------------------------------------------------------------
  */
 
-int
-TnmMibLoadFile(interp, objPtr)
+static int
+FindFile(interp, objPtr, fileObjPtr, frozenObjPtr)
     Tcl_Interp *interp;
     Tcl_Obj *objPtr;
+    Tcl_Obj **fileObjPtr;
+    Tcl_Obj **frozenObjPtr;
 {
-    Tcl_DString fileBuffer, frozenFileBuffer;
+    Tcl_DString frozenFileBuffer;
     CONST char *library, *cache, *arch;
     char *fileName, *frozenFileName = NULL;
-    char *file = NULL, *module;
     int code = TCL_OK;
     Tcl_Obj *splitList;
     int splitListLen;
     Tcl_Obj *filePath = NULL;
 
-    Tcl_DStringInit(&fileBuffer);
+    *fileObjPtr = NULL;
+    *frozenObjPtr = NULL;
     Tcl_DStringInit(&frozenFileBuffer);
 
     if (! mibFilesLoaded) {
@@ -403,7 +417,6 @@ TnmMibLoadFile(interp, objPtr)
     cache = Tcl_GetVar2(interp, "tnm", "cache", TCL_GLOBAL_ONLY);
     arch = Tcl_GetVar2(interp, "tnm", "arch", TCL_GLOBAL_ONLY);
 
-#if 0
     /* 
      * Check if we can write a frozen file. Construct the path to the
      * directory where we keep frozen files. Create a machine specific
@@ -415,26 +428,22 @@ TnmMibLoadFile(interp, objPtr)
     if (cache != NULL && arch != NULL) {
 	Tcl_Obj *path;
 	Tcl_Obj *elem = NULL;
-	Tcl_Obj *obj;
 
 	path = Tcl_NewStringObj("", 0);
 	Tcl_IncrRefCount(path);
 	Tcl_AppendStringsToObj(path, cache, "/", arch, NULL);
-	obj = Tcl_NewStringObj(path,-1);
-	Tcl_IncrRefCount(obj);
-	(void) TnmMkDir(interp, obj);
-	Tcl_DecrRefCount(obj);
-
-	Tcl_ListObjIndex(NULL, splitList, splitListLen-1, &elem);
-	Tcl_AppendStringsToObj(path, cache, "/",
-			       Tcl_GetStringFromObj(elem, NULL),
-			       ".idy", NULL);
-	frozenFileName = Tcl_TranslateFileName(interp,
+	if (TnmMkDir(interp, path) == TCL_OK) {
+	    Tcl_ListObjIndex(NULL, splitList, splitListLen-1, &elem);
+	    Tcl_AppendStringsToObj(path, "/",
+				   Tcl_GetStringFromObj(elem, NULL),
+				   ".idy", NULL);
+	    frozenFileName = Tcl_TranslateFileName(interp,
 				Tcl_GetStringFromObj(path, NULL),
 			        &frozenFileBuffer);
+	}
+	Tcl_ResetResult(interp);
 	Tcl_DecrRefCount(path);
     }
-#endif
 
     /* 
      * Search for the MIB file we are trying to load. First try the
@@ -503,25 +512,11 @@ TnmMibLoadFile(interp, objPtr)
 	}
     }
 
-    /*
-     * If we have the file name now, call the parser to do its job.
-     */
-    
-    if (fileName) {
-	module = TnmMibParse(fileName, frozenFileName);
-	if (module == NULL) {
-	    Tcl_AppendResult(interp, "couldn't parse MIB file \"",
-			     fileName,"\"", (char *) NULL);
-	    code = TCL_ERROR;
-	} else {
-	    Tcl_ListObjAppendElement(NULL, mibFilesLoaded, objPtr);
-	    Tcl_ListObjAppendElement(NULL, tnmMibModulesLoaded,
-				     Tcl_NewStringObj(module, -1));
-	}
-    } else {
-	Tcl_AppendResult(interp, "couldn't open MIB file \"", file,
-			 "\": ", Tcl_PosixError(interp), (char *) NULL);
-	code = TCL_ERROR;
+    *fileObjPtr = Tcl_NewStringObj(fileName, -1);
+    Tcl_IncrRefCount(*fileObjPtr);
+    if (frozenFileName) {
+	*frozenObjPtr = Tcl_NewStringObj(frozenFileName, -1);
+	Tcl_IncrRefCount(*frozenObjPtr);
     }
 
  exit:
@@ -529,14 +524,281 @@ TnmMibLoadFile(interp, objPtr)
      * Free up all the memory that we have allocated.
      */
 
-    Tcl_DStringFree(&fileBuffer);
     Tcl_DStringFree(&frozenFileBuffer);
     if (filePath != NULL) {
 	Tcl_DecrRefCount(filePath);
     }
     return code;
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmMibLoadFiles --
+ *
+ *	This procedure reads MIB definitions from a set of files and
+ *	adds the objects to the internal MIB tree. MIB files without
+ *	an up to date frozen file are parsed by up to numThreads
+ *	threads. Files are added to the MIB tree in the given order
+ *	until the first error occurs.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	New frozen MIB files may be created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmMibLoadFiles(interp, objc, objv, numThreads)
+    Tcl_Interp *interp;
+    int objc;
+    Tcl_Obj *CONST objv[];
+    int numThreads;
+{
+    Tcl_Obj **fileObjv, **frozenObjv, **nameObjv;
+    char **files, **frozen, **modules;
+    int i, j, n = 0, loaded, code = TCL_OK;
+
+    fileObjv = (Tcl_Obj **) ckalloc(3 * (objc + 1) * sizeof(Tcl_Obj *));
+    frozenObjv = fileObjv + objc + 1;
+    nameObjv = frozenObjv + objc + 1;
+    files = (char **) ckalloc(3 * (objc + 1) * sizeof(char *));
+    frozen = files + objc + 1;
+    modules = frozen + objc + 1;
+
+    /*
+     * Locate all files until the first file which can not be found.
+     * Files which are given more than once are loaded only once.
+     */
+
+    for (i = 0; i < objc; i++) {
+	code = FindFile(interp, objv[i], fileObjv + n, frozenObjv + n);
+	if (code != TCL_OK) {
+	    break;
+	}
+	if (fileObjv[n] == NULL) {
+	    continue;
+	}
+	for (j = 0; j < n; j++) {
+	    if (strcmp(Tcl_GetString(nameObjv[j]),
+		       Tcl_GetString(objv[i])) == 0) {
+		break;
+	    }
+	}
+	if (j < n) {
+	    Tcl_DecrRefCount(fileObjv[n]);
+	    if (frozenObjv[n]) {
+		Tcl_DecrRefCount(frozenObjv[n]);
+	    }
+	    continue;
+	}
+	nameObjv[n] = objv[i];
+	files[n] = Tcl_GetString(fileObjv[n]);
+	frozen[n] = frozenObjv[n] ? Tcl_GetString(frozenObjv[n]) : NULL;
+	n++;
+    }
+
+    /*
+     * If we have the file names now, call the parser to do its job.
+     */
+
+    loaded = TnmMibParseFiles(n, files, frozen, modules, numThreads);
+    for (i = 0; i < loaded; i++) {
+	Tcl_ListObjAppendElement(NULL, mibFilesLoaded, nameObjv[i]);
+	Tcl_ListObjAppendElement(NULL, tnmMibModulesLoaded,
+				 Tcl_NewStringObj(modules[i], -1));
+    }
+    if (loaded < n) {
+	Tcl_ResetResult(interp);
+	Tcl_AppendResult(interp, "couldn't parse MIB file \"",
+			 files[loaded], "\"", (char *) NULL);
+	code = TCL_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+	Tcl_DecrRefCount(fileObjv[i]);
+	if (frozenObjv[i]) {
+	    Tcl_DecrRefCount(frozenObjv[i]);
+	}
+    }
+    ckfree((char *) fileObjv);
+    ckfree((char *) files);
+    return code;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmMibLoadFile --
+ *
+ *	This procedure reads MIB definitions from a file and adds the
+ *	objects to the internal MIB tree. See TnmMibLoadFiles() for
+ *	details.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	New frozen MIB files may be created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmMibLoadFile(interp, objPtr)
+    Tcl_Interp *interp;
+    Tcl_Obj *objPtr;
+{
+    return TnmMibLoadFiles(interp, 1, &objPtr, 1);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LoadImage --
+ *
+ *	This procedure loads a MIB image which has been written by
+ *	SaveImage(). Images which have already been loaded are
+ *	ignored.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	The MIB modules contained in the image are loaded.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+LoadImage(interp, objPtr)
+    Tcl_Interp *interp;
+    Tcl_Obj *objPtr;
+{
+    Tcl_DString fileBuffer;
+    Tcl_Obj **objv;
+    char *fileName;
+    FILE *fp;
+    int i, objc, code = TCL_OK;
+
+    if (! mibFilesLoaded) {
+	mibFilesLoaded = Tcl_NewListObj(0, NULL);
+    }
+    if (! tnmMibModulesLoaded) {
+	tnmMibModulesLoaded = Tcl_NewListObj(0, NULL);
+    }
+    if (! mibImagesLoaded) {
+	mibImagesLoaded = Tcl_NewListObj(0, NULL);
+    }
+
+    Tcl_ListObjGetElements(NULL, mibImagesLoaded, &objc, &objv);
+    for (i = 0; i < objc; i++) {
+	if (strcmp(Tcl_GetString(objv[i]), Tcl_GetString(objPtr)) == 0) {
+	    return TCL_OK;
+	}
+    }
+
+    fileName = Tcl_TranslateFileName(interp, Tcl_GetString(objPtr),
+				     &fileBuffer);
+    if (! fileName) {
+	return TCL_ERROR;
+    }
+
+    fp = fopen(fileName, "rb");
+    if (! fp) {
+	Tcl_AppendResult(interp, "couldn't open MIB image \"",
+			 Tcl_GetString(objPtr), "\": ",
+			 Tcl_PosixError(interp), (char *) NULL);
+	code = TCL_ERROR;
+    } else {
+	if (TnmMibReadImage(fp, mibFilesLoaded, tnmMibModulesLoaded)
+	    != TCL_OK) {
+	    Tcl_AppendResult(interp, "couldn't load MIB image \"",
+			     Tcl_GetString(objPtr), "\"", (char *) NULL);
+	    code = TCL_ERROR;
+	} else {
+	    Tcl_ListObjAppendElement(NULL, mibImagesLoaded, objPtr);
+	}
+	fclose(fp);
+    }
+
+    Tcl_DStringFree(&fileBuffer);
+    return code;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SaveImage --
+ *
+ *	This procedure saves all loaded MIB modules in a MIB image.
+ *	The image is written to a temporary file which is renamed
+ *	when complete so that processes which have mapped a previous
+ *	version of the image are not affected.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	The MIB image is written.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SaveImage(interp, objPtr)
+    Tcl_Interp *interp;
+    Tcl_Obj *objPtr;
+{
+    Tcl_DString fileBuffer, tmpBuffer;
+    char *fileName, buf[20];
+    FILE *fp;
+    int code = TCL_OK;
+
+    if (! mibFilesLoaded) {
+	mibFilesLoaded = Tcl_NewListObj(0, NULL);
+    }
+    if (! tnmMibModulesLoaded) {
+	tnmMibModulesLoaded = Tcl_NewListObj(0, NULL);
+    }
+
+    fileName = Tcl_TranslateFileName(interp, Tcl_GetString(objPtr),
+				     &fileBuffer);
+    if (! fileName) {
+	return TCL_ERROR;
+    }
+
+    Tcl_DStringInit(&tmpBuffer);
+    Tcl_DStringAppend(&tmpBuffer, fileName, -1);
+    sprintf(buf, ".%d", (int) getpid());
+    Tcl_DStringAppend(&tmpBuffer, buf, -1);
+
+    fp = fopen(Tcl_DStringValue(&tmpBuffer), "wb");
+    if (! fp) {
+	Tcl_AppendResult(interp, "couldn't open MIB image \"",
+			 Tcl_GetString(objPtr), "\": ",
+			 Tcl_PosixError(interp), (char *) NULL);
+	code = TCL_ERROR;
+    } else {
+	TnmMibWriteImage(fp, mibFilesLoaded, tnmMibModulesLoaded);
+	if (ferror(fp) || fclose(fp) != 0
+	    || rename(Tcl_DStringValue(&tmpBuffer), fileName) != 0) {
+	    Tcl_AppendResult(interp, "couldn't write MIB image \"",
+			     Tcl_GetString(objPtr), "\": ",
+			     Tcl_PosixError(interp), (char *) NULL);
+	    unlink(Tcl_DStringValue(&tmpBuffer));
+	    code = TCL_ERROR;
+	}
+    }
+
+    Tcl_DStringFree(&tmpBuffer);
+    Tcl_DStringFree(&fileBuffer);
+    return code;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -659,6 +921,11 @@ TnmMibLoad(interp)
  *	assemble the current path in the tree in the buffer pointed to
  *	by oidPtr.
  *
+ *	The caller must hold the mib mutex. The mutex is released
+ *	while the body is evaluated since the body usually invokes
+ *	the mib command again. This is safe because MIB nodes are
+ *	never removed from the tree.
+ *
  * Results:
  *	A standard Tcl result.
  *
@@ -685,13 +952,16 @@ WalkTree(interp, varName, body, nodePtr, oidPtr, rootPtr)
 	TnmOidSet(oidPtr, length-1, nodePtr->subid);
 	if (! TnmOidInTree(rootPtr, oidPtr)) break;
 
+	Tcl_MutexUnlock(&mibMutex);
 	if (!Tcl_ObjSetVar2(interp, varName, NULL, TnmNewOidObj(oidPtr), 
 			    TCL_LEAVE_ERR_MSG | TCL_PARSE_PART1)) {
+	    Tcl_MutexLock(&mibMutex);
 	    result = TCL_ERROR;
 	    goto loopDone;
 	}
-
 	result = Tcl_EvalObj(interp, body);
+	Tcl_MutexLock(&mibMutex);
+
         if ((result == TCL_OK || result == TCL_CONTINUE) 
 	    && nodePtr->childPtr) {
 	    TnmOidSetLength(oidPtr, length+1);
@@ -752,6 +1022,7 @@ Tnm_MibObjCmd(clientData, interp, objc, objv)
     TnmMibType *typePtr;
     TnmOid *oidPtr;
     Tcl_Obj *objPtr, *listPtr;
+    Tcl_DString ds;
     char *result = NULL;
     static int initialized = 0;
     int code;
@@ -761,7 +1032,7 @@ Tnm_MibObjCmd(clientData, interp, objc, objv)
 	cmdDisplay, cmdEnums, cmdExists, cmdFile, cmdFormat, cmdIndex,
 	cmdInfo, cmdLabel, cmdLength, cmdLoad, cmdMacro,
 	cmdMember, cmdModule, cmdName, cmdOid, cmdPack, cmdParent,
-	cmdRange, cmdScan, cmdSize, cmdSplit, cmdStatus, cmdSubtree,
+	cmdRange, cmdSave, cmdScan, cmdSize, cmdSplit, cmdStatus, cmdSubtree,
 	cmdSyntax, cmdType, cmdUnpack, cmdVariables, cmdWalk
     } cmd;
 
@@ -770,7 +1041,7 @@ Tnm_MibObjCmd(clientData, interp, objc, objv)
 	"displayhint", "enums", "exists", "file", "format", "index",
 	"info", "label", "length", "load", "macro", 
 	"member", "module", "name", "oid", "pack", "parent",
-	"range", "scan", "size", "split", "status", "subtree",
+	"range", "save", "scan", "size", "split", "status", "subtree",
 	"syntax", "type", "unpack", "variables", "walk",
 	(char *) NULL
     };
@@ -806,6 +1077,19 @@ Tnm_MibObjCmd(clientData, interp, objc, objv)
 
     Tcl_MutexLock(&mibMutex);
     if (! initialized) {
+
+	/*
+	 * A MIB image is loaded into the empty MIB tree before the
+	 * core MIB definitions, which are usually part of the image.
+	 */
+
+	if (cmd == cmdLoad && objc == 4
+	    && strcmp(Tcl_GetString(objv[2]), "-image") == 0) {
+	    if (LoadImage(interp, objv[3]) != TCL_OK) {
+		Tcl_MutexUnlock(&mibMutex);
+		return TCL_ERROR;
+	    }
+	}
 	if (TnmMibLoadCore(interp) != TCL_OK) {
 	    Tcl_MutexUnlock(&mibMutex);
 	    return TCL_ERROR;
@@ -1017,16 +1301,20 @@ Tnm_MibObjCmd(clientData, interp, objc, objv)
 	if (code != TCL_OK) {
 	    return TCL_ERROR;
 	}
+	Tcl_DStringInit(&ds);
 	if (typePtr) {
-	    result = TnmMibGetString(typePtr->fileName, typePtr->fileOffset);
+	    result = TnmMibGetString(typePtr->fileName, typePtr->fileOffset,
+				     &ds);
 	} else {
-	    result = TnmMibGetString(nodePtr->fileName, nodePtr->fileOffset);
+	    result = TnmMibGetString(nodePtr->fileName, nodePtr->fileOffset,
+				     &ds);
 	}
 	if (objc == 4) {
 	    if (result) {
 		if (Tcl_ObjSetVar2(interp, objv[3], NULL,
 			   Tcl_NewStringObj(result, -1),
 			   TCL_LEAVE_ERR_MSG | TCL_PARSE_PART1) == NULL) {
+		    Tcl_DStringFree(&ds);
 		    return TCL_ERROR;
 		}
 	    }
@@ -1036,6 +1324,7 @@ Tnm_MibObjCmd(clientData, interp, objc, objv)
 		Tcl_SetStringObj(Tcl_GetObjResult(interp), result, -1);
 	    }
 	}
+	Tcl_DStringFree(&ds);
         break;
 
 	/* XXX add mutex locks below XXX */
@@ -1191,12 +1480,33 @@ Tnm_MibObjCmd(clientData, interp, objc, objv)
 	}
         break;
 
-    case cmdLoad:
+    case cmdLoad: {
+	int first = 2, threads = 1;
+	if (objc == 4
+	    && strcmp(Tcl_GetString(objv[2]), "-image") == 0) {
+	    return LoadImage(interp, objv[3]);
+	}
+	if (objc >= 4
+	    && strcmp(Tcl_GetString(objv[2]), "-threads") == 0) {
+	    if (TnmGetPositiveFromObj(interp, objv[3], &threads) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    first = 4;
+	}
+	if (objc <= first) {
+	    Tcl_WrongNumArgs(interp, 2, objv,
+			     "?-image? ?-threads n? file ?file ...?");
+	    return TCL_ERROR;
+	}
+	return TnmMibLoadFiles(interp, objc - first, objv + first, threads);
+    }
+
+    case cmdSave:
 	if (objc != 3) {
 	    Tcl_WrongNumArgs(interp, 2, objv, "file");
 	    return TCL_ERROR;
 	}
-	return TnmMibLoadFile(interp, objv[2]);
+	return SaveImage(interp, objv[2]);
 
     case cmdMacro:
 	if (objc != 3) {
@@ -18,32 +18,68 @@
 #include "tnmMib.h"
 
 /*
- * The following table is used to hash nodes by name before building
- * the MIB tree. This has the nice effect that nodes with the same
- * parent can be found in the list that saves the collisions.
+ * The following table is used to hash nodes by the name of their
+ * parent before building the MIB tree. Every entry holds the list
+ * of nodes with the same parent, linked by the nextPtr field.
  */
 
-#define NODEHASHSIZE	127
-static TnmMibNode	*nodehashtab[NODEHASHSIZE];
+static Tcl_HashTable *parentHashTable = NULL;
 
 /*
  * Hashtable used to store textual conventions by name. This
  * allows fast lookups. The nodeHashTable is used to lookup
- * MIB names.
+ * MIB nodes by label and by module::label.
  */
 
 static Tcl_HashTable *typeHashTable = NULL;
 static Tcl_HashTable *nodeHashTable = NULL;
 
+/*
+ * A small cache of recently resolved object identifiers. Every entry
+ * holds a MIB node and its object identifier. Lookups by object
+ * identifier start at the deepest cached node whose object identifier
+ * is a prefix of the one we are looking for. The least recently used
+ * entry is replaced. Nodes are never removed from the MIB tree so the
+ * cached entries remain valid when new MIB modules are loaded.
+ */
+
+#define OIDCACHESIZE	8
+
+typedef struct OidCacheEntry {
+    TnmMibNode *nodePtr;	/* The cached node or NULL if unused. */
+    int length;			/* The length of the object identifier. */
+    u_int used;			/* The time of the last use. */
+    u_int oid[TNM_OID_MAX_SIZE]; /* The object identifier of the node. */
+} OidCacheEntry;
+
+static OidCacheEntry oidCache[OIDCACHESIZE];
+static u_int oidCacheClock = 0;
+
+TCL_DECLARE_MUTEX(oidCacheMutex)
+
 /*
  * Forward declarations for procedures defined later in this file:
  */
 
+static int
+ChildIndex		_ANSI_ARGS_((TnmMibNode *nodePtr, u_int subid));
+
 static TnmMibNode*
-LookupOID		_ANSI_ARGS_((TnmMibNode *root, char *label,
-				     int *offset, int exact));
+FindChild		_ANSI_ARGS_((TnmMibNode *nodePtr, u_int subid));
+
+static void
+LinkChild		_ANSI_ARGS_((TnmMibNode *parentPtr,
+				     TnmMibNode *nodePtr, int index));
+static TnmMibNode*
+WalkOid			_ANSI_ARGS_((u_int *oid, int length, int *depthPtr));
+
 static TnmMibNode*
-LookupLabelOID		_ANSI_ARGS_((TnmMibNode *root, char *label,
+LookupOID		_ANSI_ARGS_((char *label, int *offset, int exact));
+static TnmMibNode*
+FindLabel		_ANSI_ARGS_((char *moduleName, char *label));
+
+static TnmMibNode*
+LookupLabelOID		_ANSI_ARGS_((char *moduleName, char *label,
 				     int *offset, int exact));
 static TnmMibNode*
 LookupLabel		_ANSI_ARGS_((TnmMibNode *root, char *start, 
@@ -59,10 +95,10 @@ static void
 BuildSubTree		_ANSI_ARGS_((TnmMibNode *root));
 
 static void
-HashNodeList		_ANSI_ARGS_((TnmMibNode *nlist));
+HashNodeName		_ANSI_ARGS_((char *name, TnmMibNode *nodePtr));
 
-static int
-HashNodeLabel		_ANSI_ARGS_((char *label));
+static void
+HashNodeList		_ANSI_ARGS_((TnmMibNode *nlist));
 
 
 /*
@@ -89,41 +125,227 @@ TnmMibNodeFromOid(oidPtr, nodeOidPtr)
     TnmOid *oidPtr;
     TnmOid *nodeOidPtr;
 {
-    int i;
-    TnmMibNode *p, *q = NULL;
+    int i, depth;
+    TnmMibNode *nodePtr;
 
     if (nodeOidPtr) {
 	TnmOidFree(nodeOidPtr);
     }
 
-    for (p = tnmMibTree; p ; p = p->nextPtr) {
-	if (TnmOidGet(oidPtr, 0) == p->subid) break;
+    nodePtr = WalkOid(TnmOidGetElements(oidPtr),
+		      TnmOidGetLength(oidPtr), &depth);
+
+    if (nodeOidPtr) {
+	for (i = 0; i < depth; i++) {
+	    TnmOidAppend(nodeOidPtr, TnmOidGet(oidPtr, i));
+	}
     }
-    if (!p) {
+
+    return nodePtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ChildIndex --
+ *
+ *	This procedure searches the sorted vector of child nodes for
+ *	the given subidentifier by binary search.
+ *
+ * Results:
+ *	The index of the first child whose subidentifier is not less
+ *	than subid. This is the number of children if there is no
+ *	such child.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ChildIndex(nodePtr, subid)
+    TnmMibNode *nodePtr;
+    u_int subid;
+{
+    int mid, lo = 0, hi = nodePtr->numChildren;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (nodePtr->childVec[mid]->subid < subid) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+
+    return lo;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FindChild --
+ *
+ *	This procedure searches for the child node with the given
+ *	subidentifier.
+ *
+ * Results:
+ *	The pointer to the child node or NULL if there is no child
+ *	with this subidentifier.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmMibNode*
+FindChild(nodePtr, subid)
+    TnmMibNode *nodePtr;
+    u_int subid;
+{
+    int i = ChildIndex(nodePtr, subid);
+
+    if (i < nodePtr->numChildren && nodePtr->childVec[i]->subid == subid) {
+	return nodePtr->childVec[i];
+    }
+    return NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LinkChild --
+ *
+ *	This procedure links a node into the list and into the sorted
+ *	vector of the children of parentPtr. The index must be the
+ *	position returned by ChildIndex().
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The vector of child nodes grows in powers of two.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+LinkChild(parentPtr, nodePtr, index)
+    TnmMibNode *parentPtr;
+    TnmMibNode *nodePtr;
+    int index;
+{
+    int n = parentPtr->numChildren;
+
+    if (n == 0) {
+	parentPtr->childVec = (TnmMibNode **) ckalloc(sizeof(TnmMibNode *));
+    } else if ((n & (n - 1)) == 0) {
+	parentPtr->childVec = (TnmMibNode **)
+	    ckrealloc((char *) parentPtr->childVec,
+		      2 * n * sizeof(TnmMibNode *));
+    }
+
+    memmove((char *) (parentPtr->childVec + index + 1),
+	    (char *) (parentPtr->childVec + index),
+	    (n - index) * sizeof(TnmMibNode *));
+    parentPtr->childVec[index] = nodePtr;
+    parentPtr->numChildren++;
+
+    nodePtr->nextPtr = (index < n) ? parentPtr->childVec[index + 1] : NULL;
+    if (index > 0) {
+	parentPtr->childVec[index - 1]->nextPtr = nodePtr;
+    } else {
+	parentPtr->childPtr = nodePtr;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WalkOid --
+ *
+ *	This procedure follows the subidentifiers of an object
+ *	identifier from the root of the MIB tree as far as possible.
+ *	The walk starts at the deepest matching node in the cache of
+ *	recently resolved object identifiers.
+ *
+ * Results:
+ *	The pointer to the deepest node found or NULL if not even the
+ *	first subidentifier is known. The number of subidentifiers
+ *	that lead to the node is written to depthPtr.
+ *
+ * Side effects:
+ *	The node found is added to the cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmMibNode*
+WalkOid(oid, length, depthPtr)
+    u_int *oid;
+    int length;
+    int *depthPtr;
+{
+    TnmMibNode *nodePtr = NULL, *childPtr;
+    OidCacheEntry *entryPtr, *lruPtr;
+    int i, cached = 0, depth = 0;
+
+    *depthPtr = 0;
+    if (length <= 0) {
 	return NULL;
     }
 
-    if (nodeOidPtr) {
-	TnmOidAppend(nodeOidPtr, TnmOidGet(oidPtr, 0));
+    Tcl_MutexLock(&oidCacheMutex);
+    for (i = 0, entryPtr = oidCache; i < OIDCACHESIZE; i++, entryPtr++) {
+	if (entryPtr->nodePtr && entryPtr->length <= length
+	    && entryPtr->length > cached
+	    && memcmp((char *) entryPtr->oid, (char *) oid,
+		      entryPtr->length * sizeof(u_int)) == 0) {
+	    nodePtr = entryPtr->nodePtr;
+	    cached = entryPtr->length;
+	    entryPtr->used = ++oidCacheClock;
+	}
     }
+    Tcl_MutexUnlock(&oidCacheMutex);
 
-    for (q = p, i = 1; i < TnmOidGetLength(oidPtr); p = q, i++) {
-	for (q = p->childPtr; q; q = q->nextPtr) {
-	    if (q->subid == TnmOidGet(oidPtr, i)) {
-		if (nodeOidPtr) {
-		    TnmOidAppend(nodeOidPtr, TnmOidGet(oidPtr, i));
-		}
-		break;
-	    }
+    if (nodePtr) {
+	depth = cached;
+    } else {
+	for (nodePtr = tnmMibTree; nodePtr; nodePtr = nodePtr->nextPtr) {
+	    if (nodePtr->subid == oid[0]) break;
+	}
+	if (! nodePtr) {
+	    return NULL;
 	}
-	if (!q) {
-	    return p;
+	depth = 1;
+    }
+
+    while (depth < length && (childPtr = FindChild(nodePtr, oid[depth]))) {
+	nodePtr = childPtr;
+	depth++;
+    }
+
+    if (depth > cached) {
+	Tcl_MutexLock(&oidCacheMutex);
+	lruPtr = oidCache;
+	for (i = 1, entryPtr = oidCache + 1; i < OIDCACHESIZE; i++, entryPtr++) {
+	    if (entryPtr->used < lruPtr->used) {
+		lruPtr = entryPtr;
+	    }
 	}
+	lruPtr->nodePtr = nodePtr;
+	lruPtr->length = depth;
+	lruPtr->used = ++oidCacheClock;
+	memcpy((char *) lruPtr->oid, (char *) oid, depth * sizeof(u_int));
+	Tcl_MutexUnlock(&oidCacheMutex);
     }
 
-    return q;
+    *depthPtr = depth;
+    return nodePtr;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -145,15 +367,14 @@ TnmMibNodeFromOid(oidPtr, nodeOidPtr)
  */
 
 static TnmMibNode*
-LookupOID(root, label, offset, exact)
-    TnmMibNode *root;
+LookupOID(label, offset, exact)
     char *label;
     int *offset;
     int exact;
 {
     TnmOid oid;
-    int i;
-    TnmMibNode *p, *q = NULL;
+    int i, depth;
+    TnmMibNode *nodePtr;
     char *s = label;
 
     if (offset) *offset = -1;
@@ -177,41 +398,74 @@ LookupOID(root, label, offset, exact)
 	return NULL;
     }
 
-    for (p = root; p ; p = p->nextPtr) {
-	if (TnmOidGet(&oid, 0) == p->subid) break;
-    }
-    if (!p) {
-	TnmOidFree(&oid);
-	return NULL;
-    }
+    nodePtr = WalkOid(TnmOidGetElements(&oid), TnmOidGetLength(&oid), &depth);
 
-    while (offset && s && ispunct(*s)) s++;
-    while (offset && s && isdigit(*s)) s++;
-
-    for (q = p, i = 1; i < TnmOidGetLength(&oid); p = q, i++) {
-	for (q = p->childPtr; q; q = q->nextPtr) {
-	    if (q->subid == TnmOidGet(&oid, i)) break;
-	}
-	if (!q) {
-	    if (! exact) {
-		if (offset) {
-		    *offset = s - label;
-		}
-		TnmOidFree(&oid);
-		return p;
-	    } else {
-		TnmOidFree(&oid);
-		return NULL; 
+    if (nodePtr && depth < TnmOidGetLength(&oid)) {
+	if (exact) {
+	    nodePtr = NULL;
+	} else if (offset) {
+	    for (i = 0; i < depth; i++) {
+		while (*s && ispunct(*s)) s++;
+		while (*s && isdigit(*s)) s++;
 	    }
+	    *offset = s - label;
 	}
-	while (offset && s && ispunct(*s)) s++;
-	while (offset && s && isdigit(*s)) s++;
     }
 
     TnmOidFree(&oid);
-    return q;
+    return nodePtr;
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FindLabel --
+ *
+ *	This procedure searches for a MIB node by label in the node
+ *	hash table and in the name index of a MIB image. The label is
+ *	qualified with the module name if moduleName is not empty.
+ *
+ * Results:
+ *	The pointer to the node or NULL if the node was not found or
+ *	if the label is not unique.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmMibNode*
+FindLabel(moduleName, label)
+    char *moduleName;
+    char *label;
+{
+    Tcl_HashEntry *entryPtr = NULL;
+    TnmMibNode *nodePtr = NULL;
+    Tcl_DString ds;
+    char *name = label;
+
+    Tcl_DStringInit(&ds);
+    if (moduleName && *moduleName) {
+	Tcl_DStringAppend(&ds, moduleName, -1);
+	Tcl_DStringAppend(&ds, "::", 2);
+	Tcl_DStringAppend(&ds, label, -1);
+	name = Tcl_DStringValue(&ds);
+    }
+
+    if (nodeHashTable) {
+	entryPtr = Tcl_FindHashEntry(nodeHashTable, name);
+    }
+    if (entryPtr) {
+	nodePtr = (TnmMibNode *) Tcl_GetHashValue(entryPtr);
+    } else {
+	TnmMibFindImageNode(name, &nodePtr);
+    }
+
+    Tcl_DStringFree(&ds);
+    return nodePtr;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -237,20 +491,19 @@ LookupOID(root, label, offset, exact)
  */
 
 static TnmMibNode*
-LookupLabelOID(root, label, offset, exact)
-    TnmMibNode *root;
+LookupLabelOID(moduleName, label, offset, exact)
+    char *moduleName;
     char *label;
     int *offset;
     int exact;
 {
-    Tcl_HashEntry *entryPtr = NULL;
     TnmMibNode *nodePtr = NULL;
 
     if (exact) {
 	return NULL;
     }
 
-    if (nodeHashTable) {
+    if (tnmMibTree) {
 	char *name = ckstrdup(label);
 	char *oid = name;
 	while (*oid && *oid != '.') {
@@ -258,10 +511,7 @@ LookupLabelOID(root, label, offset, exact)
 	}
 	if (*oid && TnmIsOid(oid)) {
 	    *oid++ = '\0';
-	    entryPtr = Tcl_FindHashEntry(nodeHashTable, name);
-	    if (entryPtr) {
-		nodePtr = (TnmMibNode *) Tcl_GetHashValue(entryPtr);
-	    }
+	    nodePtr = FindLabel(moduleName, name);
 	    if (nodePtr) {
 		if (offset) {
 		    *offset = oid - name - 1;
@@ -278,14 +528,9 @@ LookupLabelOID(root, label, offset, exact)
 			TnmOidInit(&o);
 			TnmOidFromString(&o, label+*offset);
 			for (i = 0; i < TnmOidGetLength(&o); i++) {
-			    for (nPtr = nodePtr->childPtr; 
-				 nPtr; nPtr = nPtr->nextPtr) {
-				if (nPtr->subid == TnmOidGet(&o, i)) {
-				    nodePtr = nPtr;
-				    break;
-				}
-			    }
+			    nPtr = FindChild(nodePtr, TnmOidGet(&o, i));
 			    if (! nPtr) break;
+			    nodePtr = nPtr;
 			}
 			TnmOidFree(&o);
 
@@ -460,17 +705,11 @@ TnmMibFindNode(name, offset, exact)
     if (expanded) name = expanded;
 
     if (TnmIsOid(name)) {
-	nodePtr = LookupOID(tnmMibTree, name, offset, exact);
+	nodePtr = LookupOID(name, offset, exact);
     } else {
-	Tcl_HashEntry *entryPtr = NULL;
-	if (nodeHashTable) {
-	    entryPtr = Tcl_FindHashEntry(nodeHashTable, name);
-	}
-	if (entryPtr) {
-	    nodePtr = (TnmMibNode *) Tcl_GetHashValue(entryPtr);
-	}
+	nodePtr = FindLabel(moduleName, name);
 	if (! nodePtr) {
-	    nodePtr = LookupLabelOID(tnmMibTree, name, offset, exact);
+	    nodePtr = LookupLabelOID(moduleName, name, offset, exact);
 	}
 	if (! nodePtr) {
 	    nodePtr = LookupLabel(tnmMibTree, name, name, moduleName, 
@@ -502,11 +741,15 @@ TnmMibFindNode(name, offset, exact)
  * TnmMibAddType --
  *
  *	This procedure adds a TnmMibType structure to the set of
- *	known MIB types which are saved in a hash table. The
- *	TnmMibType structure is also linked into the tnmMibTypeList.
+ *	known MIB types which are saved in a hash table. Every type
+ *	is entered with its name qualified by the module name. The
+ *	unqualified name refers to the first type registered with
+ *	this name. The TnmMibType structure is also linked into the
+ *	tnmMibTypeList unless the module already defines the type.
  *
  * Results:
- *	The pointer to the Tnm_MibTC structure.
+ *	The pointer to the TnmMibType structure registered for the
+ *	qualified name or NULL if the type has no module name.
  *
  * Side effects:
  *	None.
@@ -519,6 +762,7 @@ TnmMibAddType(typePtr)
     TnmMibType *typePtr;
 {
     Tcl_HashEntry *entryPtr;
+    Tcl_DString dst;
     int isnew;
 
     if (! typeHashTable) {
@@ -530,41 +774,36 @@ TnmMibAddType(typePtr)
 	/* This should not happen! */
 	return NULL;
     }
-    
-    entryPtr = Tcl_CreateHashEntry(typeHashTable, typePtr->name, &isnew);
-    
+
+    Tcl_DStringInit(&dst);
+    Tcl_DStringAppend(&dst, typePtr->moduleName, -1);
+    Tcl_DStringAppend(&dst, "!", 1);
+    Tcl_DStringAppend(&dst, typePtr->name, -1);
+    entryPtr = Tcl_CreateHashEntry(typeHashTable,
+				   Tcl_DStringValue(&dst), &isnew);
+    Tcl_DStringFree(&dst);
+
     if (! isnew) {
 	return (TnmMibType *) Tcl_GetHashValue(entryPtr);
     }
 
+    Tcl_SetHashValue(entryPtr, (ClientData) typePtr);
     typePtr->nextPtr = tnmMibTypeList;
     tnmMibTypeList = typePtr;
-    
-    Tcl_SetHashValue(entryPtr, (ClientData) typePtr);
 
     /*
-     * Create another entry with a full name. The previous entry
-     * is actually not correct because the label itself must not
-     * be globally unique.
+     * Create another entry for the plain name. The label itself
+     * is not globally unique so that the first type wins.
      */
 
-    {
-	Tcl_DString dst;
-	Tcl_DStringInit(&dst);
-	Tcl_DStringAppend(&dst, typePtr->moduleName, -1);
-	Tcl_DStringAppend(&dst, "!", 1);
-	Tcl_DStringAppend(&dst, typePtr->name, -1);
-	entryPtr = Tcl_CreateHashEntry(typeHashTable, 
-				       Tcl_DStringValue(&dst), &isnew);
-	if (isnew) {
-	    Tcl_SetHashValue(entryPtr, (ClientData) typePtr);
-	}
-	Tcl_DStringFree(&dst);
+    entryPtr = Tcl_CreateHashEntry(typeHashTable, typePtr->name, &isnew);
+    if (isnew) {
+	Tcl_SetHashValue(entryPtr, (ClientData) typePtr);
     }
 
     return typePtr;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -726,8 +965,10 @@ TnmMibNewNode(label)
  * HashNode --
  *
  *	This procedure maintans a hash table which is used to lookup
- *	MIB nodes by names. This works well as long as the label of
- *	the node is unique. Otherwise, we have to recurse on the tree.
+ *	MIB nodes by names. Every node is entered with its label and
+ *	with its label qualified by the module name. This works well
+ *	as long as the name of the node is unique. Otherwise, we have
+ *	to recurse on the tree.
  *
  * Results:
  *	None.
@@ -742,14 +983,51 @@ static void
 HashNode(nodePtr)
     TnmMibNode *nodePtr;
 {
-    char *name = nodePtr->label;
-    Tcl_HashEntry *entryPtr;
-    int isnew;
-    
+    Tcl_DString ds;
+
     if (! nodeHashTable) {
 	nodeHashTable = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
 	Tcl_InitHashTable(nodeHashTable, TCL_STRING_KEYS);
     }
+
+    HashNodeName(nodePtr->label, nodePtr);
+
+    if (nodePtr->moduleName) {
+	Tcl_DStringInit(&ds);
+	Tcl_DStringAppend(&ds, nodePtr->moduleName, -1);
+	Tcl_DStringAppend(&ds, "::", 2);
+	Tcl_DStringAppend(&ds, nodePtr->label, -1);
+	HashNodeName(Tcl_DStringValue(&ds), nodePtr);
+	Tcl_DStringFree(&ds);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HashNodeName --
+ *
+ *	This procedure enters a node into the node hash table under
+ *	the given name.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The hash entry is marked with a NULL pointer if the name is
+ *	already used by another node.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HashNodeName(name, nodePtr)
+    char *name;
+    TnmMibNode *nodePtr;
+{
+    Tcl_HashEntry *entryPtr;
+    TnmMibNode *imageNodePtr;
+    int isnew;
     
     entryPtr = Tcl_CreateHashEntry(nodeHashTable, name, &isnew);
     
@@ -765,9 +1043,19 @@ HashNode(nodePtr)
 	return;
     }
 
+    /*
+     * The name may also be used by a node of a MIB image, which
+     * is not entered into the hash table.
+     */
+
+    if (TnmMibFindImageNode(name, &imageNodePtr)
+	&& imageNodePtr != nodePtr) {
+	nodePtr = NULL;
+    }
+
     Tcl_SetHashValue(entryPtr, (ClientData) nodePtr);
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -852,60 +1140,61 @@ static void
 BuildSubTree(root)
     TnmMibNode *root;
 {
-    TnmMibNode **np, **ptr;
-    int	hash = HashNodeLabel(root->label);
+    Tcl_HashEntry *entryPtr = NULL;
+    TnmMibNode *thisNode, *nodeList;
+    int	i;
 
     /*
      * Loop through all nodes whose parent is root. They are all
-     * members of the list which starts at the same hash key.
+     * members of the list saved under the name of the parent.
      */
 
-    for (np = &nodehashtab[hash]; *np != NULL; ) {
-	
-	if (root->label[0] == ((*np)->parentName)[0]
-	    && (strcmp(root->label, (*np)->parentName) == 0)) {
+    if (parentHashTable) {
+	entryPtr = Tcl_FindHashEntry(parentHashTable, root->label);
+    }
+    if (! entryPtr) {
+	return;
+    }
+    nodeList = (TnmMibNode *) Tcl_GetHashValue(entryPtr);
+    Tcl_DeleteHashEntry(entryPtr);
 
-	    TnmMibNode *thisNode = *np;
-	    *np = (*np)->nextPtr;
+    while (nodeList) {
+	thisNode = nodeList;
+	nodeList = nodeList->nextPtr;
 
-	    thisNode->fileName = tnmMibFileName;
+	thisNode->fileName = tnmMibFileName;
 
 /*** XXX: This should be freed if the data came from the parser but
           it may not be freed if the data came from a frozen file.
           Same below.
-	    if (thisNode->parentName) {
-		ckfree(thisNode->parentName);
-		thisNode->parentName = NULL;
-	    }
+	if (thisNode->parentName) {
+	    ckfree(thisNode->parentName);
+	    thisNode->parentName = NULL;
+	}
 ***/
-	    thisNode->parentPtr = root;
-	    thisNode->childPtr = NULL;
-	    thisNode->nextPtr  = NULL;
-	    
-	    /* 
-	     * Link node in the tree. First skip over all nodes with a
-	     * subid less than the new subid. Insert the node if the
-	     * node does not already exist. Otherwise free this node.
-	     */
-
-	    ptr = &root->childPtr;
-	    while (*ptr && (*ptr)->subid < thisNode->subid) {
-		ptr = &(*ptr)->nextPtr;
-	    }
-	    if (*ptr && (*ptr)->subid == thisNode->subid) {
+	thisNode->parentPtr = root;
+	thisNode->childPtr = NULL;
+	thisNode->nextPtr  = NULL;
+	thisNode->childVec = NULL;
+	thisNode->numChildren = 0;
+	
+	/* 
+	 * Link node in the tree. First search the position of the
+	 * new subid in the sorted children. Insert the node if the
+	 * node does not already exist. Otherwise free this node.
+	 */
+
+	i = ChildIndex(root, thisNode->subid);
+	if (i < root->numChildren
+	    && root->childVec[i]->subid == thisNode->subid) {
 /*** XXX	if (thisNode->label) ckfree((char *) thisNode->label);
-		ckfree((char *) thisNode);		***/
-	    } else {
-		thisNode->nextPtr = *ptr;
-                *ptr = thisNode;
-		HashNode(thisNode);
-	    }
-
-	    BuildSubTree(*ptr);			/* recurse on child */
-
+	    ckfree((char *) thisNode);		***/
 	} else {
-	    np = &(*np)->nextPtr;
+	    LinkChild(root, thisNode, i);
+	    HashNode(thisNode);
 	}
+
+	BuildSubTree(root->childVec[i]);	/* recurse on child */
     }
 }
 
@@ -937,28 +1226,32 @@ TnmMibAddNode(rootPtr, nodeList)
     TnmMibNode *nodePtr;
     TnmMibNode *tree;
     TnmMibNode *root = *rootPtr;
-    int i, result = 0;
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+    char *parentName;
+    int result = 0;
 
     if (! nodeList) {
 	return 0;
     }
 
-    if (! root) {
-	*rootPtr = BuildTree(nodeList);
-    }
-
    /*
     * Test if the parent of the first node exists. We expect that we
     * load individual subtrees where the parent of the first node
     * defines the anchor. This must already exist. Note, the first 
-    * node is the last node in our nodeList.
+    * node is the last node in our nodeList. BuildTree() has already
+    * hashed and linked the nodes if there is no tree yet.
     */
 
-    for (nodePtr = nodeList; nodePtr->nextPtr; nodePtr = nodePtr->nextPtr) ;
-    tree = TnmMibFindNode(nodePtr->parentName, NULL, 1);
-    HashNodeList(nodeList);
-    if (tree) {
-	BuildSubTree(tree);
+    if (! root) {
+	*rootPtr = BuildTree(nodeList);
+    } else {
+	for (nodePtr = nodeList; nodePtr->nextPtr; nodePtr = nodePtr->nextPtr) ;
+	tree = TnmMibFindNode(nodePtr->parentName, NULL, 1);
+	HashNodeList(nodeList);
+	if (tree) {
+	    BuildSubTree(tree);
+	}
     }
     
    /*
@@ -973,13 +1266,13 @@ TnmMibAddNode(rootPtr, nodeList)
     */
 
   repeat:
-    for (i = 0; i < NODEHASHSIZE; i++) {
-	for (nodePtr = nodehashtab[i]; nodePtr; nodePtr = nodePtr->nextPtr) {
-	    tree = TnmMibFindNode(nodePtr->parentName, NULL, 1);
-	    if (tree) {
-		BuildSubTree(tree);
-		goto repeat;
-	    }
+    entryPtr = Tcl_FirstHashEntry(parentHashTable, &search);
+    for (; entryPtr; entryPtr = Tcl_NextHashEntry(&search)) {
+	parentName = Tcl_GetHashKey(parentHashTable, entryPtr);
+	tree = TnmMibFindNode(parentName, NULL, 1);
+	if (tree && strcmp(tree->label, parentName) == 0) {
+	    BuildSubTree(tree);
+	    goto repeat;
 	}
     }
 
@@ -989,8 +1282,10 @@ TnmMibAddNode(rootPtr, nodeList)
      * MIB load commands.
      */
     
-    for (i = 0; i < NODEHASHSIZE; i++) {
-	for (nodePtr = nodehashtab[i]; nodePtr; nodePtr = nodePtr->nextPtr) {
+    entryPtr = Tcl_FirstHashEntry(parentHashTable, &search);
+    for (; entryPtr; entryPtr = Tcl_NextHashEntry(&search)) {
+	nodePtr = (TnmMibNode *) Tcl_GetHashValue(entryPtr);
+	for (; nodePtr; nodePtr = nodePtr->nextPtr) {
 	    fprintf(stderr, "%s: no parent %s for node %s\n", 
 		    tnmMibFileName, nodePtr->parentName, nodePtr->label);
 	    result = -1;
@@ -1006,9 +1301,9 @@ TnmMibAddNode(rootPtr, nodeList)
  * HashNodeList --
  *
  *	This procedure moves the nodes from the nodeList parameter
- *	into the node hash table. The hash function is computed
- *	upon the parent names so that all nodes with the same parent 
- *	are in one collision list.
+ *	into the parent hash table. The nodes are hashed by the name
+ *	of the parent so that all nodes with the same parent are in 
+ *	one list. Nodes left over from a previous call are dropped.
  *
  * Results:
  *	None.
@@ -1024,10 +1319,16 @@ static void
 HashNodeList(nodeList)
     TnmMibNode *nodeList;
 {
-    int	hash;
+    Tcl_HashEntry *entryPtr;
     TnmMibNode *nodePtr, *nextp;
+    int isnew;
 
-    memset((char *) nodehashtab, 0, sizeof(nodehashtab));
+    if (parentHashTable) {
+	Tcl_DeleteHashTable(parentHashTable);
+    } else {
+	parentHashTable = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+    }
+    Tcl_InitHashTable(parentHashTable, TCL_STRING_KEYS);
 
     for (nodePtr = nodeList; nodePtr != NULL; ) {
 	if (! nodePtr->parentName) {
@@ -1036,45 +1337,16 @@ HashNodeList(nodeList)
 	    return;
 	}
 
-	hash = HashNodeLabel(nodePtr->parentName);
+	entryPtr = Tcl_CreateHashEntry(parentHashTable,
+				       nodePtr->parentName, &isnew);
 
 	nextp = nodePtr->nextPtr;
-	nodePtr->nextPtr = nodehashtab[hash];
-	nodehashtab[hash] = nodePtr;
+	nodePtr->nextPtr = isnew ? NULL
+	    : (TnmMibNode *) Tcl_GetHashValue(entryPtr);
+	Tcl_SetHashValue(entryPtr, (ClientData) nodePtr);
 	nodePtr = nextp;
     }
 }
-
-/*
- *----------------------------------------------------------------------
- *
- * HashNodeLabel --
- *
- *	This procedure computes the hash function used to hash
- *	MIB nodes by parent name.
- *
- * Results:
- *	The hash value of the given label.
- *
- * Side effects:
- *	None.
- *
- *----------------------------------------------------------------------
- */
-
-static int
-HashNodeLabel(label)
-    char *label;
-{
-    int hash = 0;
-    char *cp;
-    
-    for (cp = label; *cp; cp++) {
-	hash += *cp;
-    }
-
-    return (hash % NODEHASHSIZE);
-}
 
 /*
  * Local Variables:
@@ -27,6 +27,41 @@ TnmMibType *tnmMibTypeList = NULL;	/* List of textual conventions.	   */
 TnmMibType *tnmMibTypeSaveMark = NULL;	/* The first already saved	   */
 					/* element of tnmMibTypeList.	   */
 
+/*
+ * MIB files are kept in a cache so that descriptions can be retrieved
+ * without reading the MIB file again. The cache is keyed by the file
+ * name. The contents are copied into memory since a mapped file which
+ * is truncated raises SIGBUS. A file which has been modified since it
+ * was read is read again. The least recently used file is released
+ * when the cache is full.
+ */
+
+#define SOURCE_CACHE_SIZE 256
+
+typedef struct SourceFile {
+    char *data;				/* The contents of the MIB file.   */
+    size_t size;			/* The size of the MIB file.	   */
+    dev_t dev;				/* The device and the inode of	   */
+    ino_t ino;				/* the MIB file which was read.	   */
+    time_t mtime;			/* The modification time and the   */
+    off_t length;			/* length of the MIB file.	   */
+    unsigned long used;			/* Time stamp of the last use.	   */
+} SourceFile;
+
+static Tcl_HashTable *sourceTable = NULL;
+static unsigned long sourceClock = 0;
+TCL_DECLARE_MUTEX(sourceMutex)
+
+/*
+ * Forward declarations for procedures defined later in this file:
+ */
+
+static SourceFile*
+GetSourceFile		_ANSI_ARGS_((char *fileName));
+
+static void
+FreeSourceFile		_ANSI_ARGS_((Tcl_HashEntry *entryPtr));
+
 TnmTable tnmMibAccessTable[] = {
     { TNM_MIB_NOACCESS,   "not-accessible" },
     { TNM_MIB_READONLY,   "read-only" },
@@ -273,6 +308,125 @@ TnmMibGetName(label, exact)
     return NULL;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeSourceFile --
+ *
+ *	This procedure removes a MIB file from the cache.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeSourceFile(entryPtr)
+    Tcl_HashEntry *entryPtr;
+{
+    SourceFile *sourcePtr = (SourceFile *) Tcl_GetHashValue(entryPtr);
+
+    ckfree(sourcePtr->data);
+    ckfree((char *) sourcePtr);
+    Tcl_DeleteHashEntry(entryPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetSourceFile --
+ *
+ *	This procedure returns the cache entry for the given MIB file.
+ *	The file is read into memory if it is not yet in the cache or
+ *	if its size, modification time or inode has changed. The caller
+ *	must hold the sourceMutex.
+ *
+ * Results:
+ *	A pointer to the cache entry or NULL if the file is not
+ *	accessible.
+ *
+ * Side effects:
+ *	The least recently used cache entry may be released.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static SourceFile*
+GetSourceFile(fileName)
+    char *fileName;
+{
+    Tcl_HashEntry *entryPtr, *oldPtr = NULL;
+    Tcl_HashSearch search;
+    SourceFile *sourcePtr;
+    struct stat st;
+    FILE *fp;
+    int isnew;
+
+    if (sourceTable == NULL) {
+	sourceTable = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+	Tcl_InitHashTable(sourceTable, TCL_STRING_KEYS);
+    }
+
+    entryPtr = Tcl_FindHashEntry(sourceTable, fileName);
+    if (entryPtr) {
+	sourcePtr = (SourceFile *) Tcl_GetHashValue(entryPtr);
+	if (stat(fileName, &st) == 0
+	    && st.st_dev == sourcePtr->dev && st.st_ino == sourcePtr->ino
+	    && st.st_mtime == sourcePtr->mtime
+	    && st.st_size == sourcePtr->length) {
+	    sourcePtr->used = ++sourceClock;
+	    return sourcePtr;
+	}
+	FreeSourceFile(entryPtr);
+    }
+
+    fp = fopen(fileName, "rb");
+    if (fp == NULL) {
+	perror(fileName);
+	return NULL;
+    }
+    if (fstat(fileno(fp), &st) != 0) {
+	perror(fileName);
+	fclose(fp);
+	return NULL;
+    }
+    sourcePtr = (SourceFile *) ckalloc(sizeof(SourceFile));
+    sourcePtr->data = ckalloc((size_t) st.st_size + 1);
+    sourcePtr->size = fread(sourcePtr->data, 1, (size_t) st.st_size, fp);
+    sourcePtr->dev = st.st_dev;
+    sourcePtr->ino = st.st_ino;
+    sourcePtr->mtime = st.st_mtime;
+    sourcePtr->length = st.st_size;
+    sourcePtr->used = ++sourceClock;
+    fclose(fp);
+
+    /*
+     * Release the least recently used file if the cache is full.
+     */
+
+    if (sourceTable->numEntries >= SOURCE_CACHE_SIZE) {
+	for (entryPtr = Tcl_FirstHashEntry(sourceTable, &search);
+	     entryPtr; entryPtr = Tcl_NextHashEntry(&search)) {
+	    SourceFile *usedPtr = (SourceFile *) Tcl_GetHashValue(entryPtr);
+	    if (oldPtr == NULL || usedPtr->used
+		< ((SourceFile *) Tcl_GetHashValue(oldPtr))->used) {
+		oldPtr = entryPtr;
+	    }
+	}
+	if (oldPtr) {
+	    FreeSourceFile(oldPtr);
+	}
+    }
+
+    entryPtr = Tcl_CreateHashEntry(sourceTable, fileName, &isnew);
+    Tcl_SetHashValue(entryPtr, (ClientData) sourcePtr);
+    return sourcePtr;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -280,36 +434,32 @@ TnmMibGetName(label, exact)
  *
  * 	This procedure reads the next quoted string from the given
  *	file starting at the given file offset. White spaces following
- *	newline characters are removed.
+ *	newline characters are removed. The file is taken from the
+ *	cache of MIB files.
  *
  * Results:
- *	A pointer to a static string containing the string or NULL
- *	if the description does not exist or is not accessible.
+ *	A pointer to the string in the initialized dynamic string
+ *	dsPtr or NULL if the description does not exist or is not
+ *	accessible.
  *
  * Side effects:
- *	None.
+ *	The file is added to the cache of MIB files.
  *
  *----------------------------------------------------------------------
  */
 
 char*
-TnmMibGetString(fileName, fileOffset)
+TnmMibGetString(fileName, fileOffset, dsPtr)
     char *fileName;
     int fileOffset;
+    Tcl_DString *dsPtr;
 {
-    static Tcl_DString *result = NULL;
-    FILE *fp;
-    int ch, indent = 0;
-    
-    if (result == NULL) {
-	result = (Tcl_DString *) ckalloc(sizeof(Tcl_DString));
-	Tcl_DStringInit(result);
-    } else {
-	Tcl_DStringFree(result);
-    }
+    SourceFile *sourcePtr;
+    char *p, *end, *start;
+    int indent = 0;
 
     /*
-     * Ignore bogus arguments, open the file and seek to the beginning
+     * Ignore bogus arguments, get the file and skip to the beginning
      * of the quoted string (this allows some fuzz in the offset
      * value).
      */
@@ -318,17 +468,17 @@ TnmMibGetString(fileName, fileOffset)
 	return NULL;
     }
 
-    fp = fopen(fileName, "rb");
-    if (fp == NULL) {
-	perror(fileName);
-	return NULL;
-    }
-    if (fseek(fp, fileOffset, 0) < 0) {
-	perror(fileName);
+    Tcl_MutexLock(&sourceMutex);
+    sourcePtr = GetSourceFile(fileName);
+    if (sourcePtr == NULL) {
+	Tcl_MutexUnlock(&sourceMutex);
 	return NULL;
     }
-    while ((ch = getc(fp)) != EOF) {
-	if (ch == '"') break;
+    end = sourcePtr->data + sourcePtr->size;
+    p = sourcePtr->data + ((size_t) fileOffset < sourcePtr->size
+			   ? (size_t) fileOffset : sourcePtr->size);
+    while (p < end && *p++ != '"') {
+	continue;
     }
 
     /*
@@ -338,34 +488,36 @@ TnmMibGetString(fileName, fileOffset)
      * indentation in the MIB file. Calculate the first indentation
      * and strip away this many white spaces to preserve intended
      * lines. Newlines only separated by white space characters are
-     * also preserved to allow for empty lines.
+     * also preserved to allow for empty lines. Text between line
+     * breaks is appended in one piece.
      */
 
-    for (ch = getc(fp); ch != EOF && ch != '"'; ch = getc(fp)) {
-	char c = ch;
-	Tcl_DStringAppend(result, &c, 1);
-	if (ch == '\n') {
+    while (p < end && *p != '"') {
+	for (start = p; p < end && *p != '"' && *p != '\n'; p++) {
+	    continue;
+	}
+	if (p < end && *p == '\n') {
 	    int n = 0;
-	    while ((ch = getc(fp)) != EOF) {
-		if (ch == '\n') {
-		    Tcl_DStringAppend(result, "\n", 1);
+	    Tcl_DStringAppend(dsPtr, start, ++p - start);
+	    for (; p < end; p++) {
+		if (*p == '\n') {
+		    Tcl_DStringAppend(dsPtr, "\n", 1);
 		    n = 0;
 		    continue;
 		}
-		if (!isspace(ch)) break;
+		if (!isspace((unsigned char) *p)) break;
 		if (++n == indent) break;
 	    }
 	    if (! indent && n) indent = n + 1;
-	    if (ch == EOF || ch == '"') break;
-	    c = ch;
-	    Tcl_DStringAppend(result, &c, 1);
+	} else {
+	    Tcl_DStringAppend(dsPtr, start, p - start);
 	}
     }
+    Tcl_MutexUnlock(&sourceMutex);
 
-    fclose(fp);
-    return Tcl_DStringValue(result);
+    return Tcl_DStringValue(dsPtr);
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -97,16 +97,19 @@ EXTERN TnmTable tnmSnmpErrorTable[];
 #define TNM_SNMP_TIMEOUT	5
 #define TNM_SNMP_WINDOW		10
 #define TNM_SNMP_DELAY		0
+#define TNM_SNMP_REPETITIONS	8
+#define TNM_SNMP_REPSPROBE	4
 
 /*
  *----------------------------------------------------------------
  * The size of the internal buffer used to decode or assemble 
- * SNMP packets and the size of MD5 keys.
+ * SNMP packets and the size of MD5 and SHA keys.
  *----------------------------------------------------------------
  */
 
 #define TNM_SNMP_MAXSIZE	16384
 #define TNM_MD5_SIZE		16
+#define TNM_SHA_SIZE		20
 
 /*
  *----------------------------------------------------------------
@@ -168,6 +171,9 @@ EXTERN TnmSnmpMark tnmSnmpBenchMark;
 #define TNM_SNMP_PRIV_DES	0x10
 #define TNM_SNMP_PRIV_MASK	0xf0
 
+#define TNM_SNMP_AUTH_PARAMS	12	/* Size of HMAC-MD5-96, HMAC-SHA-96. */
+#define TNM_SNMP_AUTH_KEYSIZE	20	/* Large enough for MD5 and SHA. */
+
 extern TnmTable tnmSnmpSecurityLevelTable[];
 #endif
 
@@ -192,6 +198,7 @@ typedef struct TnmSnmpSocket {
     struct sockaddr *peername;		/* peer name (if any) */
     int flags;				/* special flags (if any) */
     int refCount;			/* reference count */
+    unsigned int drops;			/* datagrams dropped by the kernel */
     struct TnmSnmpSocket *nextPtr;	/* pointer to next socket */
 } TnmSnmpSocket;
 
@@ -218,6 +225,31 @@ typedef enum {
 
 extern TnmTable tnmSnmpApplTable[];
 
+/*
+ *----------------------------------------------------------------
+ * Every queued request is linked into two doubly linked queues: The
+ * global queue and the queue of its session. Requests move from the
+ * waiting queues to the active queues once they have been sent.
+ * Active requests are also linked into a slot of the timing wheel
+ * which schedules retransmissions and timeouts.
+ *----------------------------------------------------------------
+ */
+
+#define TNM_SNMP_QUEUE_GLOBAL	0
+#define TNM_SNMP_QUEUE_SESSION	1
+#define TNM_SNMP_QUEUE_TIMER	2
+
+typedef struct TnmSnmpLink {
+    struct TnmSnmpRequest *nextPtr;  /* Next request in this queue. */
+    struct TnmSnmpRequest *prevPtr;  /* Previous request in this queue. */
+} TnmSnmpLink;
+
+typedef struct TnmSnmpQueue {
+    struct TnmSnmpRequest *firstPtr; /* First request in this queue. */
+    struct TnmSnmpRequest *lastPtr;  /* Last request in this queue. */
+    int length;			     /* Number of requests in this queue. */
+} TnmSnmpQueue;
+
 /*
  *----------------------------------------------------------------
  * The TnmSnmp structure contains all infomation needed to handle
@@ -242,6 +274,7 @@ typedef struct TnmSnmp {
     Tcl_Obj *privPassWord;	  /* The password to compute the privKey. */
     Tcl_Obj *usmAuthKey;	  /* The USM authentication key. */
     Tcl_Obj *usmPrivKey;	  /* The USM privacy key. */
+    struct TnmSnmpUsmKey *usmKeyPtr; /* The registered authentication key. */
     char securityLevel;		  /* The security level. */
 #ifdef TNM_SNMPv2U
     u_char qos;
@@ -257,8 +290,11 @@ typedef struct TnmSnmp {
     int timeout;                  /* Milliseconds before we timeout. */
     int window;                   /* Max. number of active async. requests. */
     int delay;                    /* Minimum delay between requests. */
-    int active;                   /* Number of active async. requests. */
-    int waiting;                  /* Number of waiting async. requests. */
+    int maxReps;		  /* Learned # of varbinds per getbulk. */
+    int maxRepsLimit;		  /* Upper bound for maxReps or 0. */
+    int maxRepsGood;		  /* Complete responses at the limit. */
+    TnmSnmpQueue activeQueue;	  /* Queue of active async. requests. */
+    TnmSnmpQueue waitingQueue;	  /* Queue of waiting async. requests. */
     Tcl_Obj *tagList;		  /* The tags associated with this session. */
     struct TnmSnmpBinding *bindPtr; /* Commands bound to this session. */
     Tcl_Interp *interp;		  /* Tcl interpreter owning this session. */
@@ -323,7 +359,11 @@ Tnm_SnmpMergeVBList	_ANSI_ARGS_((int varBindSize,
 
 /*
  *----------------------------------------------------------------
- * Structure to describe a SNMP PDU.
+ * Structure to describe a SNMP PDU. Received PDUs carry their
+ * varbinds in vbList, a list of {oid syntax value} lists whose
+ * elements keep their internal representation. PDUs created by
+ * scripts use the varbind string. The vbList takes precedence if
+ * it is not NULL.
  *----------------------------------------------------------------
  */
 
@@ -340,9 +380,7 @@ typedef struct TnmSnmpPdu {
     int engineIDLength;
     char *engineID;
 #endif
-#if 1
     Tcl_Obj *vbList;		/* The list of varbinds as a Tcl_Obj.  */
-#endif
     Tcl_DString varbind;	/* The list of varbinds as Tcl string. */
 } TnmSnmpPdu;
 
@@ -360,11 +398,15 @@ typedef struct TnmSnmpRequest {
     int sends;                       /* Number of send operations. */
     u_char *packet;                  /* The encoded SNMP message. */
     int packetlen;		     /* The length of the encoded message. */
-    Tcl_TimerToken timer;	     /* Token used by Tcl Timer Handler. */
+    TnmSnmpQueue *timer;	     /* Timing wheel slot we are linked in. */
+    unsigned long expire;	     /* Tick when the timer expires. */
     TnmSnmp *session;		     /* The SNMP session for this request. */
     TnmSnmpRequestProc *proc;        /* The callback functions. */
     ClientData clientData;           /* The argument of the callback. */
-    struct TnmSnmpRequest *nextPtr;  /* Pointer to next pending request. */
+    int bulk;			     /* # of varbinds asked by a getbulk. */
+    Tcl_Time sendTime;		     /* Time of the first transmission. */
+    TnmSnmpLink link[3];	     /* Links into queues and timing wheel. */
+    TnmSnmpQueue *queue;	     /* The session queue we are linked in. */
 #ifdef TNM_SNMP_BENCH
     TnmSnmpMark stats;              /* Statistics for this SNMP operation. */
 #endif
@@ -388,6 +430,28 @@ TnmSnmpDeleteRequest	_ANSI_ARGS_((TnmSnmpRequest *request));
 EXTERN int
 TnmSnmpGetRequestId	_ANSI_ARGS_((void));
 
+/*
+ *----------------------------------------------------------------
+ * All retransmissions and timeouts of asynchronous requests are
+ * driven by a single hierarchical timing wheel. The tick defines
+ * the resolution of the wheel in milliseconds.
+ *----------------------------------------------------------------
+ */
+
+#define TNM_SNMP_TICK		10
+
+EXTERN void
+TnmSnmpStartTimer	_ANSI_ARGS_((TnmSnmpRequest *request, int ms));
+
+EXTERN void
+TnmSnmpStopTimer	_ANSI_ARGS_((TnmSnmpRequest *request));
+
+EXTERN int
+TnmSnmpGetTick		_ANSI_ARGS_((void));
+
+EXTERN void
+TnmSnmpSetTick		_ANSI_ARGS_((int ms));
+
 /*
  *----------------------------------------------------------------
  * The event types currently supported for SNMP bindings.
@@ -438,15 +502,54 @@ EXTERN int
 TnmSnmpEvalBinding	_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
                                      TnmSnmpPdu *pdu, int event));
 
+/*
+ *----------------------------------------------------------------
+ * Functions to learn the number of repetitions of getbulk
+ * requests that an agent handles well. The number is learned
+ * from the size and round trip time of responses and from 
+ * tooBig errors and timeouts.
+ *----------------------------------------------------------------
+ */
+
+EXTERN int
+TnmSnmpGetRepetitions	_ANSI_ARGS_((TnmSnmp *session, int repeaters));
+
+EXTERN void
+TnmSnmpAdaptRepetitions	_ANSI_ARGS_((TnmSnmp *session, int bulk,
+				     int status, Tcl_Obj *vbList, int size,
+				     Tcl_Time *sendTime));
+
 /*
  *----------------------------------------------------------------
  * Structure to describe a MIB node known by a session handle.
  * MIB nodes are either used to keep information about session 
  * bindings or to store data needed to process incoming SNMP 
- * requests in the agent role.
+ * requests in the agent role. The children of a node are kept in
+ * an array sorted by sub identifier so that lookups and searches
+ * for the lexicographic next instance use binary searches.
+ *
+ * Instances can also be served by C code without a Tcl variable.
+ * The value of a counter instance is read from an unsigned int.
+ * An instance procedure serves all instances in the subtree it is
+ * registered for. It is called with the oid of an instance and
+ * returns an SNMP error status. TNM_SNMP_INST_GET leaves the value
+ * of the instance in valuePtr. TNM_SNMP_INST_NEXT replaces the oid
+ * with the next instance in the subtree and leaves its value in
+ * valuePtr or returns TNM_SNMP_NOSUCHNAME if there is no next
+ * instance. TNM_SNMP_INST_SET assigns the value in valuePtr. Values
+ * use the same string format as the Tcl variables of instances.
+ * Bindings are not evaluated for instances served by C code and
+ * set requests are not rolled back for them.
  *----------------------------------------------------------------
  */
 
+#define TNM_SNMP_INST_GET	1
+#define TNM_SNMP_INST_NEXT	2
+#define TNM_SNMP_INST_SET	3
+
+typedef int (TnmSnmpInstProc)	_ANSI_ARGS_((ClientData clientData,
+		int op, TnmOid *oidPtr, Tcl_Obj *valuePtr));
+
 typedef struct TnmSnmpNode {
     char *label;			/* The complete OID.	    */
     int offset;				/* Offset to instance id.   */
@@ -455,18 +558,35 @@ typedef struct TnmSnmpNode {
     char *tclVarName;			/* Tcl variable name.	    */
     TnmSnmpBinding *bindings;		/* List of bindings.        */ 
     u_int subid;			/* Sub identifier in Tree.  */
-    struct TnmSnmpNode *childPtr;       /* List of child nodes.	    */
-    struct TnmSnmpNode *nextPtr;	/* List of peer node.	    */
+    struct TnmSnmpNode *parentPtr;	/* The parent node.	    */
+    struct TnmSnmpNode **children;	/* Sorted child nodes.	    */
+    int numChildren;			/* Number of child nodes.   */
+    int sizeChildren;			/* Size of children array.  */
+    int instances;			/* Instances in subtree.    */
+    struct TnmSnmpNode *varNextPtr;	/* Next node of variable.   */
+    u_int *counterPtr;			/* Counter of C instance.   */
+    TnmSnmpInstProc *instProc;		/* Procedure for subtree.   */
+    ClientData clientData;		/* Argument of instProc.    */
 } TnmSnmpNode;
 
 EXTERN int
 TnmSnmpCreateNode	_ANSI_ARGS_((Tcl_Interp *interp, char *id,
 				     char *varName, char *defval));
+EXTERN int
+TnmSnmpCreateCounter	_ANSI_ARGS_((Tcl_Interp *interp, char *id,
+				     u_int *counterPtr));
+EXTERN int
+TnmSnmpCreateInstProc	_ANSI_ARGS_((Tcl_Interp *interp, char *id,
+				     TnmSnmpInstProc *proc,
+				     ClientData clientData));
 EXTERN TnmSnmpNode*
 TnmSnmpFindNode		_ANSI_ARGS_((TnmSnmp *session, TnmOid *oidPtr));
 
 EXTERN TnmSnmpNode*
-TnmSnmpFindNextNode	_ANSI_ARGS_((TnmSnmp *session, TnmOid *oidPtr));
+TnmSnmpFindNextNode	_ANSI_ARGS_((TnmSnmp *session, TnmOid *oidPtr,
+				     TnmOid *nextPtr, Tcl_Obj *valuePtr));
+EXTERN TnmSnmpNode*
+TnmSnmpFindInstProc	_ANSI_ARGS_((TnmSnmp *session, TnmOid *oidPtr));
 
 EXTERN int
 TnmSnmpSetNodeBinding	_ANSI_ARGS_((TnmSnmp *session, TnmOid *oidPtr,
@@ -569,11 +689,33 @@ TnmSnmpEncode		_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
 				     TnmSnmpPdu *pdu, TnmSnmpRequestProc *proc,
 				     ClientData clientData));
 EXTERN int
+TnmSnmpEncodeResponse	_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
+				     TnmSnmpPdu *pdu, Tcl_Obj *packetObj));
+EXTERN int
 TnmSnmpDecode		_ANSI_ARGS_((Tcl_Interp *interp, 
 				     u_char *packet, int packetlen,
 				     struct sockaddr_in *from,
 				     TnmSnmp *session, int *reqid,
 				     int *status, int *index));
+
+/*
+ * Received packets are decoded in two steps. TnmSnmpParse() does not
+ * touch any Tcl or MIB state and may run in a receive worker thread.
+ * TnmSnmpDecodeMsg() creates the Tcl objects and dispatches the
+ * message in the thread that owns the sessions.
+ */
+
+typedef struct TnmSnmpMsg TnmSnmpMsg;
+
+EXTERN TnmSnmpMsg*
+TnmSnmpParse		_ANSI_ARGS_((u_char *packet, int packetlen));
+EXTERN int
+TnmSnmpDecodeMsg	_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmpMsg *msg,
+				     struct sockaddr_in *from,
+				     TnmSnmp *session, int *reqid,
+				     int *status, int *index));
+EXTERN void
+TnmSnmpFreeMsg		_ANSI_ARGS_((TnmSnmpMsg *msg));
 EXTERN void
 TnmSnmpTimeoutProc	_ANSI_ARGS_((ClientData clientData));
 
@@ -583,6 +725,27 @@ TnmSnmpAgentInit	_ANSI_ARGS_((Tcl_Interp *interp,
 EXTERN int
 TnmSnmpAgentRequest	_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
 				     TnmSnmpPdu *pdu));
+
+/*
+ * Responses of the command responder are cached so that retransmitted
+ * requests are answered without processing them again. The cache holds
+ * at most tnmSnmpAgentCache responses for tnmSnmpAgentCacheTTL seconds.
+ * TnmSnmpAgentSetCache applies changes of these variables and
+ * TnmSnmpAgentClearCache removes the responses sent by a session.
+ */
+
+#define TNM_SNMP_AGENTCACHE	64
+#define TNM_SNMP_AGENTCACHETTL	5
+
+EXTERN int tnmSnmpAgentCache;
+EXTERN int tnmSnmpAgentCacheTTL;
+
+EXTERN void
+TnmSnmpAgentSetCache	_ANSI_ARGS_((void));
+
+EXTERN void
+TnmSnmpAgentClearCache	_ANSI_ARGS_((TnmSnmp *session));
+
 EXTERN int
 TnmSnmpEvalCallback	_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
 				     TnmSnmpPdu *pdu,
@@ -654,12 +817,42 @@ TnmSnmpNmtrapdClose	_ANSI_ARGS_((void));
 /*
  *----------------------------------------------------------------
  * Functions used to send and receive SNMP messages. The 
- * TnmSnmpWait function is used to wait for an answer.
+ * TnmSnmpWait function is used to wait for an answer. The
+ * asynchronous sockets read up to tnmSnmpRecvBatch messages
+ * whenever they become readable. Messages sent with the
+ * TNM_SNMP_QUEUED flag are collected and transmitted together
+ * by TnmSnmpFlush when the event loop becomes idle or when
+ * tnmSnmpSendBatch messages are queued.
+ *
+ * Asynchronous manager messages are spread over a pool of
+ * tnmSnmpSockets sockets. All messages to a peer use the same
+ * socket. The receive buffer of the pool sockets is set to
+ * tnmSnmpRecvBuffer bytes unless it is 0. The pool sockets are
+ * read by tnmSnmpThreads worker threads if tnmSnmpThreads is not 0
+ * and Tnm is built with thread support. TnmSnmpSetSockets applies
+ * changes of these variables to the open pool.
  *----------------------------------------------------------------
  */
 
 #define TNM_SNMP_SYNC	0x01
 #define TNM_SNMP_ASYNC	0x02
+#define TNM_SNMP_QUEUED	0x04
+
+#define TNM_SNMP_RECVBATCH	16
+#define TNM_SNMP_SENDBATCH	32
+#define TNM_SNMP_SOCKETS	1
+
+EXTERN int tnmSnmpRecvBatch;
+EXTERN int tnmSnmpSendBatch;
+EXTERN int tnmSnmpSockets;
+EXTERN int tnmSnmpRecvBuffer;
+EXTERN int tnmSnmpThreads;
+
+EXTERN int
+TnmSnmpSetSockets	_ANSI_ARGS_((Tcl_Interp *interp));
+
+EXTERN Tcl_Obj*
+TnmSnmpGetSockets	_ANSI_ARGS_((char *pattern));
 
 EXTERN int
 TnmSnmpSend		_ANSI_ARGS_((Tcl_Interp *interp,
@@ -670,6 +863,9 @@ EXTERN int
 TnmSnmpRecv		_ANSI_ARGS_((Tcl_Interp *interp, 
 				     u_char *packet, int *packetlen,
 				     struct sockaddr_in *from, int flags));
+EXTERN void
+TnmSnmpFlush		_ANSI_ARGS_((void));
+
 EXTERN int 
 TnmSnmpWait		_ANSI_ARGS_((int ms, int flags));
 
@@ -693,13 +889,47 @@ TnmSnmpMD5Digest	_ANSI_ARGS_((u_char *packet, int packetlen,
 EXTERN void
 TnmSnmpComputeKeys	_ANSI_ARGS_((TnmSnmp *session));
 
+/*
+ * Keys computed from passwords are cached by all interpreters. The
+ * caches for master keys and localized keys hold at most
+ * tnmSnmpKeyCache keys each. TnmSnmpSetKeyCache applies changes of
+ * tnmSnmpKeyCache and TnmSnmpGetKeyCache returns the cache statistics.
+ */
+
+#define TNM_SNMP_KEYCACHE	256
+
+EXTERN int tnmSnmpKeyCache;
+
+EXTERN void
+TnmSnmpSetKeyCache	_ANSI_ARGS_((void));
+
+EXTERN Tcl_Obj*
+TnmSnmpGetKeyCache	_ANSI_ARGS_((void));
+
 EXTERN void
 TnmSnmpComputeDigest	_ANSI_ARGS_(());
 
+/*
+ * Authenticated SNMPv3 messages are signed with TnmSnmpAuthOutMsg
+ * right before they are sent. The authentication keys of all sessions
+ * are registered by user name and engineID so that TnmSnmpAuthInMsg
+ * can verify the digest of a received message without looking at the
+ * sessions. Both procedures may be called from any thread.
+ */
+
 EXTERN void
-TnmSnmpAuthOutMsg	_ANSI_ARGS_((int algorithm, Tcl_Obj *authKey,
+TnmSnmpDeleteKeys	_ANSI_ARGS_((TnmSnmp *session));
+
+EXTERN int
+TnmSnmpAuthOutMsg	_ANSI_ARGS_((int algorithm,
+				     u_char *key, int keyLength,
+				     u_char *msg, int msgLen));
+EXTERN int
+TnmSnmpAuthInMsg	_ANSI_ARGS_((char *user, int userLength,
+				     char *engineID, int engineIDLength,
 				     u_char *msg, int msgLen,
-				     u_char *msgAuthenticationParameters));
+				     u_char *authParams, int *algorithm,
+				     u_char *key, int *keyLength));
 #endif
 
 #ifdef TNM_SNMPv2U
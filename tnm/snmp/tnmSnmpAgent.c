@@ -15,30 +15,65 @@
 
 #include "tnmSnmp.h"
 #include "tnmMib.h"
+#include "tnmMD5.h"
 
 /*
- * The following structure is used to implement a cache that
- * is used to remember queries so that we can respond to
+ * The following structures are used to implement a cache that
+ * is used to remember responses so that we can respond to
  * retries quickly. This is needed because side effects can
- * break the agent down if we do them for each retry.
+ * break the agent down if we do them for each retry. A cached
+ * response is found by the session, the address of the manager,
+ * the request id and a digest of the request. The cache holds
+ * the encoded response so that it can be sent again without any
+ * further processing. The entries are kept in a list in the order
+ * they were added so that the oldest entries are removed first.
  */
 
-typedef struct CacheElement {
-    TnmSnmp *session;
-    TnmSnmpPdu request;
-    TnmSnmpPdu response;
-    time_t timestamp;
-} CacheElement;
-
-#define CACHE_SIZE 64
-static CacheElement cache[CACHE_SIZE];
+typedef struct CacheKey {
+    TnmSnmp *session;			/* The session of the request. */
+    unsigned int addr;			/* The address of the manager. */
+    unsigned int port;			/* The port of the manager. */
+    int requestId;			/* The request id of the request. */
+    u_char digest[TNM_MD5_SIZE];	/* The digest of the request. */
+} CacheKey;
+
+typedef struct CacheEntry {
+    Tcl_HashEntry *entryPtr;		/* The entry in the hash table. */
+    time_t timestamp;			/* The time the response was sent. */
+    Tcl_Obj *packetObj;			/* The encoded response message. */
+    struct CacheEntry *prevPtr;		/* The next older cache entry. */
+    struct CacheEntry *nextPtr;		/* The next younger cache entry. */
+} CacheEntry;
+
+static Tcl_HashTable cacheTable;
+static CacheEntry *cacheFirst = NULL;
+static CacheEntry *cacheLast = NULL;
+static int cacheInitialized = 0;
+
+int tnmSnmpAgentCache = TNM_SNMP_AGENTCACHE;
+int tnmSnmpAgentCacheTTL = TNM_SNMP_AGENTCACHETTL;
 
 /*
  * Flags used by the SNMP set processing code to keep state information
  * about individual variables in the varbind list.
  */
 
-#define NODE_CREATED 0x01
+#define NODE_CREATED	0x01
+#define NODE_INSTPROC	0x02
+
+/*
+ * The values of the snmpEngine group of the SNMP-FRAMEWORK-MIB. They
+ * are served by an instance procedure and copied from the session
+ * that initialized the agent.
+ */
+
+static struct {
+    TnmOid oid;			/* The oid of the snmpEngine group. */
+    char *engineID;		/* The engineID in hex notation. */
+    u_int engineBoots;		/* The number of engine boots. */
+    time_t engineTime;		/* The time of the last boot. */
+    int maxSize;		/* The maximum message size. */
+} engine;
 
 /*
  * Forward declarations for procedures defined later in this file:
@@ -47,11 +82,20 @@ static CacheElement cache[CACHE_SIZE];
 static void
 CacheInit		_ANSI_ARGS_((void));
 
-static TnmSnmpPdu*
-CacheGet		_ANSI_ARGS_((TnmSnmp *session, TnmSnmpPdu *pdu));
+static void
+CacheKeyInit		_ANSI_ARGS_((CacheKey *keyPtr, TnmSnmp *session,
+				     TnmSnmpPdu *pdu));
+static CacheEntry*
+CacheHit		_ANSI_ARGS_((CacheKey *keyPtr));
 
-static TnmSnmpPdu*
-CacheHit		_ANSI_ARGS_((TnmSnmp *session, TnmSnmpPdu *pdu));
+static void
+CacheAdd		_ANSI_ARGS_((CacheKey *keyPtr, Tcl_Obj *packetObj));
+
+static void
+CacheRemove		_ANSI_ARGS_((CacheEntry *cachePtr));
+
+static void
+CacheTrim		_ANSI_ARGS_((int size));
 
 static char*
 TraceSysUpTime		_ANSI_ARGS_((ClientData clientData,
@@ -64,15 +108,18 @@ TraceAgentTime		_ANSI_ARGS_((ClientData clientData,
 				     char *name1, char *name2, int flags));
 #endif
 
-static char*
-TraceUnsignedInt	_ANSI_ARGS_((ClientData clientData,
-				     Tcl_Interp *interp,
-				     char *name1, char *name2, int flags));
+static int
+EngineInstProc		_ANSI_ARGS_((ClientData clientData, int op,
+				     TnmOid *oidPtr, Tcl_Obj *valuePtr));
+static int
+InstanceSyntax		_ANSI_ARGS_((TnmOid *oidPtr, int *accessPtr));
+
 static TnmSnmpNode*
 FindInstance		_ANSI_ARGS_((TnmSnmp *session, TnmOid *oidPtr));
 
 static TnmSnmpNode*
-FindNextInstance	_ANSI_ARGS_((TnmSnmp *session, TnmOid *oidPtr));
+FindNextInstance	_ANSI_ARGS_((TnmSnmp *session, TnmOid *oidPtr,
+				     TnmOid *nextPtr, Tcl_Obj *valuePtr));
 
 static int
 GetRequest		_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
@@ -164,8 +211,8 @@ static struct StatReg statTable[] = {
  *
  * CacheInit --
  *
- *	This procedure initializes the cache of answered requests.
- *	This procedure is only called once when we become an agent.
+ *	This procedure initializes the cache of answered requests
+ *	when it is used for the first time.
  *
  * Results:
  *	None.
@@ -179,63 +226,73 @@ static struct StatReg statTable[] = {
 static void
 CacheInit()
 {
-    int i;
-    memset((char *) cache, 0, sizeof(cache));
-    for (i = 0; i < CACHE_SIZE; i++) {
-	Tcl_DStringInit(&cache[i].request.varbind);
-	Tcl_DStringInit(&cache[i].response.varbind);
+    if (! cacheInitialized) {
+	Tcl_InitHashTable(&cacheTable, sizeof(CacheKey) / sizeof(int));
+	cacheInitialized = 1;
     }
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * CacheGet --
+ * CacheKeyInit --
  *
- *	This procedure gets a free cache element. The cache is a
- *	simple FIFO ring buffer, so we just return the next element.
+ *	This procedure fills in the key used to lookup the response
+ *	to a request. The digest covers the PDU type, the getbulk
+ *	parameters and the varbind list of the request.
  *
  * Results:
- *	A pointer to a free cache element.
+ *	None.
  *
  * Side effects:
- *	None.
+ *	The key pointed to by keyPtr is modified.
  *
  *----------------------------------------------------------------------
  */
 
-static TnmSnmpPdu*
-CacheGet(session, pdu)
+static void
+CacheKeyInit(keyPtr, session, pdu)
+    CacheKey *keyPtr;
     TnmSnmp *session;
     TnmSnmpPdu *pdu;
 {
-    static int last = 0;
-    last = (last + 1 ) % CACHE_SIZE;
-    Tcl_DStringFree(&cache[last].request.varbind);
-    Tcl_DStringFree(&cache[last].response.varbind);
-    cache[last].session = session;
-    cache[last].response.requestId = 0;
-    cache[last].response.errorStatus = TNM_SNMP_NOERROR;
-    cache[last].response.errorIndex = 0;
-    cache[last].response.addr = pdu->addr;
-    Tcl_DStringAppend(&cache[last].request.varbind, 
-		      Tcl_DStringValue(&pdu->varbind), 
-		      Tcl_DStringLength(&pdu->varbind));
-    cache[last].timestamp = time((time_t *) NULL);
-    return &(cache[last].response);
+    MD5_CTX MD;
+    int header[3], length;
+    char *varbind;
+
+    /*
+     * Clear the whole key first because the padding bytes are
+     * part of the hash key as well.
+     */
+
+    memset((char *) keyPtr, 0, sizeof(CacheKey));
+    keyPtr->session = session;
+    keyPtr->addr = pdu->addr.sin_addr.s_addr;
+    keyPtr->port = pdu->addr.sin_port;
+    keyPtr->requestId = pdu->requestId;
+
+    header[0] = pdu->type;
+    header[1] = pdu->errorStatus;
+    header[2] = pdu->errorIndex;
+    varbind = Tcl_GetStringFromObj(pdu->vbList, &length);
+
+    TnmMD5Init(&MD);
+    TnmMD5Update(&MD, (unsigned char *) header, sizeof(header));
+    TnmMD5Update(&MD, (unsigned char *) varbind, (unsigned) length);
+    TnmMD5Final(keyPtr->digest, &MD);
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
  * CacheHit --
  *
- *	This procedure checks if the request identified by session and
- *	request id is in the cache so we can send the answer without
- *	further processing.
+ *	This procedure checks if the response to the request identified
+ *	by the key is in the cache so we can send the answer without
+ *	further processing. Expired entries are removed.
  *
  * Results:
- *      A pointer to the PDU or NULL if the lookup failed.
+ *      A pointer to the cache entry or NULL if the lookup failed.
  *
  * Side effects:
  *	None.
@@ -243,49 +300,168 @@ CacheGet(session, pdu)
  *----------------------------------------------------------------------
  */
 
-static TnmSnmpPdu*
-CacheHit(session, pdu)
-    TnmSnmp *session;
-    TnmSnmpPdu *pdu;
+static CacheEntry*
+CacheHit(keyPtr)
+    CacheKey *keyPtr;
 {
-    int i;
-    time_t now = time((time_t *) NULL);
+    Tcl_HashEntry *entryPtr;
+    CacheEntry *cachePtr;
 
-    /*
-     * Never try to lookup request id 0 because there are some
-     * management applications that always use the request id 0.
-     */
-
-    if (pdu->requestId == 0) {
+    entryPtr = Tcl_FindHashEntry(&cacheTable, (char *) keyPtr);
+    if (! entryPtr) {
+	return NULL;
+    }
+    cachePtr = (CacheEntry *) Tcl_GetHashValue(entryPtr);
+    if (time((time_t *) NULL) - cachePtr->timestamp > tnmSnmpAgentCacheTTL) {
+	CacheRemove(cachePtr);
 	return NULL;
     }
+    return cachePtr;
+}
 
-    for (i = 0; i < CACHE_SIZE; i++) {
-	if (cache[i].response.requestId != pdu->requestId
-            || cache[i].session != session) {
-	    continue;
-	}
-	if (!cache[i].timestamp || now - cache[i].timestamp > 5) {
-	    continue;
-	}
-	if (cache[i].response.requestId == pdu->requestId
-	    && cache[i].session == session
-	    && Tcl_DStringLength(&pdu->varbind) 
-	       == Tcl_DStringLength(&cache[i].request.varbind)
-	    && strcmp(Tcl_DStringValue(&pdu->varbind), 
-		      Tcl_DStringValue(&cache[i].request.varbind)) == 0
-	    ) {
-	    cache[i].response.addr = pdu->addr;
-	    return &cache[i].response;
-	}
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheAdd --
+ *
+ *	This procedure adds an encoded response to the cache. The
+ *	oldest entries are removed if the cache is full.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The cache holds a reference to packetObj.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CacheAdd(keyPtr, packetObj)
+    CacheKey *keyPtr;
+    Tcl_Obj *packetObj;
+{
+    Tcl_HashEntry *entryPtr;
+    CacheEntry *cachePtr;
+    int isNew;
+
+    CacheTrim(tnmSnmpAgentCache - 1);
+
+    entryPtr = Tcl_CreateHashEntry(&cacheTable, (char *) keyPtr, &isNew);
+    if (! isNew) {
+	CacheRemove((CacheEntry *) Tcl_GetHashValue(entryPtr));
+	entryPtr = Tcl_CreateHashEntry(&cacheTable, (char *) keyPtr, &isNew);
     }
-    return NULL;
+
+    cachePtr = (CacheEntry *) ckalloc(sizeof(CacheEntry));
+    cachePtr->entryPtr = entryPtr;
+    cachePtr->timestamp = time((time_t *) NULL);
+    cachePtr->packetObj = packetObj;
+    Tcl_IncrRefCount(packetObj);
+    cachePtr->nextPtr = NULL;
+    cachePtr->prevPtr = cacheLast;
+    if (cacheLast) {
+	cacheLast->nextPtr = cachePtr;
+    } else {
+	cacheFirst = cachePtr;
+    }
+    cacheLast = cachePtr;
+    Tcl_SetHashValue(entryPtr, (ClientData) cachePtr);
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheRemove --
+ *
+ *	This procedure removes an entry from the cache.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The memory of the cache entry is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CacheRemove(cachePtr)
+    CacheEntry *cachePtr;
+{
+    if (cachePtr->prevPtr) {
+	cachePtr->prevPtr->nextPtr = cachePtr->nextPtr;
+    } else {
+	cacheFirst = cachePtr->nextPtr;
+    }
+    if (cachePtr->nextPtr) {
+	cachePtr->nextPtr->prevPtr = cachePtr->prevPtr;
+    } else {
+	cacheLast = cachePtr->prevPtr;
+    }
+    Tcl_DeleteHashEntry(cachePtr->entryPtr);
+    Tcl_DecrRefCount(cachePtr->packetObj);
+    ckfree((char *) cachePtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheTrim --
+ *
+ *	This procedure removes expired entries and the oldest entries
+ *	until the cache holds at most size entries.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CacheTrim(size)
+    int size;
+{
+    time_t now = time((time_t *) NULL);
+
+    while (cacheFirst && (cacheTable.numEntries > size
+			  || now - cacheFirst->timestamp > tnmSnmpAgentCacheTTL)) {
+	CacheRemove(cacheFirst);
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
- * CacheClear --
+ * TnmSnmpAgentSetCache --
+ *
+ *	This procedure applies changes of the size and the lifetime
+ *	of cached responses.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Entries are removed from the cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmSnmpAgentSetCache()
+{
+    if (cacheInitialized) {
+	CacheTrim(tnmSnmpAgentCache);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpAgentClearCache --
  *
  *	This procedure clears the cache for a given session.
  *
@@ -298,19 +474,26 @@ CacheHit(session, pdu)
  *----------------------------------------------------------------------
  */
 
-static void
-CacheClear(session)
+void
+TnmSnmpAgentClearCache(session)
     TnmSnmp *session;
 {
-    int i;
+    CacheEntry *cachePtr, *nextPtr;
+    CacheKey *keyPtr;
+
+    if (! cacheInitialized) {
+	return;
+    }
 
-    for (i = 0; i < CACHE_SIZE; i++) {
-	if (cache[i].session == session) {
-	    cache[i].timestamp = 0;
+    for (cachePtr = cacheFirst; cachePtr; cachePtr = nextPtr) {
+	nextPtr = cachePtr->nextPtr;
+	keyPtr = (CacheKey *) Tcl_GetHashKey(&cacheTable, cachePtr->entryPtr);
+	if (keyPtr->session == session) {
+	    CacheRemove(cachePtr);
 	}
     }
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -378,35 +561,90 @@ TraceAgentTime(clientData, interp, name1, name2, flags)
 /*
  *----------------------------------------------------------------------
  *
- * TraceUnsignedInt --
+ * EngineInstProc --
  *
- *	This procedure writes the unsigned value pointed to by
- *	clientData into the Tcl variable under trace. Used to
- *	implement snmp statistics.
+ *	This procedure is the instance procedure of the snmpEngine
+ *	group. The group contains the four read-only scalars
+ *	snmpEngineID, snmpEngineBoots, snmpEngineTime and
+ *	snmpEngineMaxMessageSize.
  *
  * Results:
- *      Always NULL.
+ *	An SNMP error status.
  *
  * Side effects:
- *	None.
+ *	The oid is modified for TNM_SNMP_INST_NEXT.
  *
  *----------------------------------------------------------------------
  */
 
-static char*
-TraceUnsignedInt(clientData, interp, name1, name2, flags)
+static int
+EngineInstProc(clientData, op, oidPtr, valuePtr)
     ClientData clientData;
-    Tcl_Interp *interp;
-    char *name1;
-    char *name2;
-    int flags;
+    int op;
+    TnmOid *oidPtr;
+    Tcl_Obj *valuePtr;
 {
-    char buf[20];
-    sprintf(buf, "%u", *(unsigned *) clientData);
-    Tcl_SetVar2(interp, name1, name2, buf, TCL_GLOBAL_ONLY);
-    return NULL;    
+    int len = TnmOidGetLength(&engine.oid);
+    u_int subid;
+
+    switch (op) {
+    case TNM_SNMP_INST_GET:
+	if (TnmOidGetLength(oidPtr) != len + 2
+	    || TnmOidGet(oidPtr, len + 1) != 0) {
+	    return TNM_SNMP_NOSUCHNAME;
+	}
+	subid = TnmOidGet(oidPtr, len);
+	break;
+    case TNM_SNMP_INST_NEXT:
+
+	/*
+	 * Every scalar has the single instance 0. The next instance
+	 * of oids up to snmpEngine.s is snmpEngine.s.0 and the next
+	 * instance of all longer oids is snmpEngine.s+1.0.
+	 */
+
+	if (TnmOidGetLength(oidPtr) <= len) {
+	    subid = 1;
+	} else {
+	    subid = TnmOidGet(oidPtr, len);
+	    if (TnmOidGetLength(oidPtr) > len + 1) {
+		subid++;
+	    }
+	    if (subid < 1) {
+		subid = 1;
+	    }
+	}
+	if (subid > 4) {
+	    return TNM_SNMP_NOSUCHNAME;
+	}
+	TnmOidCopy(oidPtr, &engine.oid);
+	TnmOidAppend(oidPtr, subid);
+	TnmOidAppend(oidPtr, 0);
+	break;
+    default:
+	return TNM_SNMP_NOTWRITABLE;
+    }
+
+    switch (subid) {
+    case 1:
+	Tcl_SetStringObj(valuePtr, engine.engineID, -1);
+	break;
+    case 2:
+	Tcl_SetLongObj(valuePtr, (long) engine.engineBoots);
+	break;
+    case 3:
+	Tcl_SetLongObj(valuePtr, (long) (time((time_t *) NULL)
+					 - engine.engineTime));
+	break;
+    case 4:
+	Tcl_SetIntObj(valuePtr, engine.maxSize);
+	break;
+    default:
+	return TNM_SNMP_NOSUCHNAME;
+    }
+    return TNM_SNMP_NOERROR;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -430,14 +668,43 @@ TnmSnmpAgentInit(interp, session)
     TnmSnmp *session;
 {
     static int done = 0;
-    char tclvar[80], buffer[255];
+    char buffer[255];
     const char *value;
     struct StatReg *p;
+    int length;
 
     if (TnmSnmpResponderOpen(session->interp, session) != TCL_OK) {
 	return TCL_ERROR;
     }
 
+    /*
+     * Here we build up our engineID value unless the session has
+     * been configured with an engineID. This roughly conformes to
+     * the "description" in RFC 2271, which is IMHO not a real cool
+     * thing. The engineID is an octet string like the engineIDs of
+     * all other sessions so that the USM keys are localized for it.
+     */
+
+    if (TnmGetOctetStringFromObj(NULL, session->engineID, &length) == NULL
+	|| length == 0) {
+	u_char engineID[12], *bp = engineID;
+	int id = 1575;
+	*bp++ = (id >> 24) & 0xff;
+	*bp++ = (id >> 16) & 0xff;
+	*bp++ = (id >> 8) & 0xff;
+	*bp++ = id & 0xff;
+	*bp++ = 0x04;
+	memcpy(bp, "smile:)", 7);
+	if (Tcl_IsShared(session->engineID)) {
+	    Tcl_DecrRefCount(session->engineID);
+	    session->engineID = Tcl_NewObj();
+	    Tcl_IncrRefCount(session->engineID);
+	}
+	TnmSetOctetStringObj(session->engineID, (char *) engineID, 12);
+	session->engineTime = time((time_t *) NULL);
+	session->engineBoots = session->engineTime - 849394800;
+    }
+
     /*
      * Make sure we are only called once - at least until we support
      * multiple agent entities in one scotty process.
@@ -448,27 +715,6 @@ TnmSnmpAgentInit(interp, session)
     }
 
     done = 1;
-    CacheInit();
-
-    /*
-     * Here we build up our engineID value. This roughly conformes to
-     * the "description" in RFC 2271, which is IMHO not a real cool
-     * thing.
-     */
-    
-    Tcl_SetObjLength(session->engineID, 12);
-    {
-	u_char *p = Tcl_GetStringFromObj(session->engineID, NULL);
-	int id = 1575;
-	*p++ = (id >> 24) & 0xff;
-	*p++ = (id >> 16) & 0xff;
-	*p++ = (id >> 8) & 0xff;
-	*p++ = id & 0xff;
-	*p++ = 0x04;
-	memcpy(p, "smile:)", 7);
-    }
-    session->engineTime = time((time_t *) NULL);
-    session->engineBoots = session->engineTime - 849394800;
 
 #ifdef TNM_SNMPv2U
     /*
@@ -534,13 +780,25 @@ TnmSnmpAgentInit(interp, session)
 		       "tnm_system(sysServices)", "72");
 
     for (p = statTable; p->name; p++) {
-	strcpy(tclvar, "tnm_snmp(");
-	strcat(tclvar, p->name);
-	strcat(tclvar, ")");
-	TnmSnmpCreateNode(interp, p->name, tclvar, "0");
-	Tcl_TraceVar2(interp, "tnm_snmp", p->name, 
-		      TCL_TRACE_READS | TCL_GLOBAL_ONLY,
-		      TraceUnsignedInt, (ClientData) p->value);
+	TnmSnmpCreateCounter(interp, p->name, p->value);
+    }
+
+    {
+	char *soid = TnmMibGetOid("snmpEngine");
+	if (soid) {
+	    int len;
+	    char *bytes = TnmGetOctetStringFromObj(NULL, session->engineID,
+						   &len);
+	    engine.engineID = ckalloc(len * 3 + 1);
+	    TnmHexEnc(bytes, len, engine.engineID);
+	    engine.engineBoots = session->engineBoots;
+	    engine.engineTime = session->engineTime;
+	    engine.maxSize = session->maxSize;
+	    TnmOidInit(&engine.oid);
+	    TnmOidFromString(&engine.oid, soid);
+	    TnmSnmpCreateInstProc(interp, "snmpEngine",
+				  EngineInstProc, (ClientData) NULL);
+	}
     }
 
     /* XXX snmpEnableAuthenTraps.0 should be implemented */
@@ -608,12 +866,52 @@ FindInstance(session, oidPtr)
  */
 
 static TnmSnmpNode*
-FindNextInstance(session, oidPtr)
+FindNextInstance(session, oidPtr, nextPtr, valuePtr)
     TnmSnmp *session;
     TnmOid *oidPtr;
+    TnmOid *nextPtr;
+    Tcl_Obj *valuePtr;
 {
-    TnmSnmpNode *inst = TnmSnmpFindNextNode(session, oidPtr);
-    return (inst && inst->syntax) ? inst : NULL;
+    TnmSnmpNode *inst = TnmSnmpFindNextNode(session, oidPtr,
+					    nextPtr, valuePtr);
+    return (inst && (inst->syntax || inst->instProc)) ? inst : NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * InstanceSyntax --
+ *
+ *	This procedure looks up the base syntax and the access mode
+ *	of an instance served by an instance procedure in the MIB.
+ *
+ * Results:
+ *      The syntax of the instance or ASN1_OTHER if the MIB does
+ *	not define the object. The access mode is left in accessPtr.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+InstanceSyntax(oidPtr, accessPtr)
+    TnmOid *oidPtr;
+    int *accessPtr;
+{
+    TnmMibNode *nodePtr = TnmMibNodeFromOid(oidPtr, NULL);
+
+    if (accessPtr) {
+	*accessPtr = nodePtr ? nodePtr->access : TNM_MIB_NOACCESS;
+    }
+    if (! nodePtr) {
+	return ASN1_OTHER;
+    }
+    if (nodePtr->typePtr && nodePtr->typePtr->name) {
+	return nodePtr->typePtr->syntax;
+    }
+    return nodePtr->syntax;
 }
 
 /*
@@ -640,12 +938,14 @@ GetRequest(interp, session, request, response)
     TnmSnmpPdu *request;
     TnmSnmpPdu *response;
 {
-    int i, code;
+    int i, code, status;
     TnmSnmpNode *inst;
-    Tcl_Obj *vbList, **vbListElems;
+    Tcl_Obj *vbList = request->vbList, **vbListElems;
+    Tcl_Obj *valuePtr;
+    TnmOid next;
     int vbListLen;
 
-    vbList = Tcl_NewStringObj(Tcl_DStringValue(&request->varbind), -1);
+    Tcl_IncrRefCount(vbList);
     code = Tcl_ListObjGetElements((Tcl_Interp *) NULL, vbList,
 				  &vbListLen, &vbListElems);
     if (code != TCL_OK) {
@@ -653,10 +953,15 @@ GetRequest(interp, session, request, response)
 	return TCL_ERROR;
     }
 
+    TnmOidInit(&next);
+    valuePtr = Tcl_NewObj();
+    Tcl_IncrRefCount(valuePtr);
+
     for (i = 0; i < vbListLen; i++) {
 
 	char *syntax;
 	const char *value;
+	char buffer[20];
 	Tcl_Obj *objPtr;
 	TnmOid *oidPtr;
 
@@ -669,9 +974,26 @@ GetRequest(interp, session, request, response)
 	}
 	if (request->type == ASN1_SNMP_GETNEXT 
 	    || request->type == ASN1_SNMP_GETBULK) {
-	    inst = FindNextInstance(session, oidPtr);
+	    inst = FindNextInstance(session, oidPtr, &next, valuePtr);
+	    if (inst && inst->instProc) {
+		oidPtr = &next;
+	    }
 	} else {
-	    inst = FindInstance(session, oidPtr);
+	    inst = TnmSnmpFindInstProc(session, oidPtr);
+	    if (inst) {
+		status = (inst->instProc)(inst->clientData, TNM_SNMP_INST_GET,
+					  oidPtr, valuePtr);
+		if (status == TNM_SNMP_NOSUCHNAME) {
+		    inst = NULL;
+		} else if (status != TNM_SNMP_NOERROR) {
+		    response->errorStatus = status;
+		    tnmSnmpStats.snmpOutGenErrs += 
+			(status == TNM_SNMP_GENERR);
+		    goto varBindError;
+		}
+	    } else {
+		inst = FindInstance(session, oidPtr);
+	    }
 	}
 
 	if (! inst) {
@@ -710,11 +1032,38 @@ GetRequest(interp, session, request, response)
 	    continue;
 	}
 
+	/*
+	 * Instances served by C code are answered without calling
+	 * the Tcl interpreter.
+	 */
+
+	if (inst->instProc) {
+	    Tcl_DStringStartSublist(&response->varbind);
+	    Tcl_DStringAppendElement(&response->varbind,
+				     TnmOidToString(oidPtr));
+	    syntax = TnmGetTableValue(tnmSnmpTypeTable,
+			      (unsigned) InstanceSyntax(oidPtr, NULL));
+	    Tcl_DStringAppendElement(&response->varbind, syntax ? syntax : "");
+	    Tcl_DStringAppendElement(&response->varbind,
+				     Tcl_GetString(valuePtr));
+	    tnmSnmpStats.snmpInTotalReqVars++;
+	    Tcl_DStringEndSublist(&response->varbind);
+	    continue;
+	}
+
 	Tcl_DStringStartSublist(&response->varbind);
 	Tcl_DStringAppendElement(&response->varbind, inst->label);
 	syntax = TnmGetTableValue(tnmSnmpTypeTable, (unsigned) inst->syntax);
 	Tcl_DStringAppendElement(&response->varbind, syntax ? syntax : "");
 
+	if (inst->counterPtr) {
+	    sprintf(buffer, "%u", *inst->counterPtr);
+	    Tcl_DStringAppendElement(&response->varbind, buffer);
+	    tnmSnmpStats.snmpInTotalReqVars++;
+	    Tcl_DStringEndSublist(&response->varbind);
+	    continue;
+	}
+
 	(void) Tcl_ListObjIndex(interp, vbListElems[i], 2, &objPtr);
 	code = TnmSnmpEvalNodeBinding(session, request, inst, 
 				      TNM_SNMP_GET_EVENT, 
@@ -764,6 +1113,8 @@ GetRequest(interp, session, request, response)
 	response->errorIndex = 0;
     }
 
+    Tcl_DecrRefCount(valuePtr);
+    TnmOidFree(&next);
     Tcl_DecrRefCount(vbList);
     return TCL_OK;
 }
@@ -798,15 +1149,19 @@ SetRequest(interp, session, request, response)
     int inVarBindSize;
     TnmSnmpNode *inst;
     int varsToRollback = 0;
+    Tcl_Obj *valuePtr;
 
     TnmOidInit(&oid);
 
-    code = Tnm_SnmpSplitVBList(interp, Tcl_DStringValue(&request->varbind),
+    code = Tnm_SnmpSplitVBList(interp, Tcl_GetString(request->vbList),
 			       &inVarBindSize, &inVarBindPtr);
     if (code != TCL_OK) {
 	return TCL_ERROR;
     }
 
+    valuePtr = Tcl_NewObj();
+    Tcl_IncrRefCount(valuePtr);
+
     for (i = 0; i < inVarBindSize; i++) {
 
 	const char *value;
@@ -815,6 +1170,47 @@ SetRequest(interp, session, request, response)
 	varsToRollback = i;
 
 	TnmOidFromString(&oid, inVarBindPtr[i].soid);
+
+	/*
+	 * Instances served by an instance procedure are modified
+	 * right away since they take no part in the commit and
+	 * rollback phases.
+	 */
+
+	inst = TnmSnmpFindInstProc(session, &oid);
+	if (inst) {
+	    int access, status;
+	    int type = InstanceSyntax(&oid, &access);
+	    if (access != TNM_MIB_READWRITE && access != TNM_MIB_READCREATE) {
+		status = TNM_SNMP_NOTWRITABLE;
+	    } else if (TnmGetTableKey(tnmSnmpTypeTable, 
+				      inVarBindPtr[i].syntax) != type) {
+		status = TNM_SNMP_WRONGTYPE;
+	    } else {
+		Tcl_SetStringObj(valuePtr, inVarBindPtr[i].value, -1);
+		status = (inst->instProc)(inst->clientData, TNM_SNMP_INST_SET,
+					  &oid, valuePtr);
+	    }
+	    TnmOidFree(&oid);
+	    if (status != TNM_SNMP_NOERROR) {
+		response->errorStatus = status;
+		tnmSnmpStats.snmpOutGenErrs += (status == TNM_SNMP_GENERR);
+		varsToRollback--;
+		goto varBindError;
+	    }
+	    inVarBindPtr[i].flags |= NODE_INSTPROC;
+	    tnmSnmpStats.snmpInTotalSetVars++;
+
+	    Tcl_DStringStartSublist(&response->varbind);
+	    Tcl_DStringAppendElement(&response->varbind, inVarBindPtr[i].soid);
+	    syntax = TnmGetTableValue(tnmSnmpTypeTable, (unsigned) type);
+	    Tcl_DStringAppendElement(&response->varbind, syntax ? syntax : "");
+	    Tcl_DStringAppendElement(&response->varbind, 
+				     Tcl_GetString(valuePtr));
+	    Tcl_DStringEndSublist(&response->varbind);
+	    continue;
+	}
+
 	inst = FindInstance(session, &oid);
 	TnmOidFree(&oid);
 
@@ -866,7 +1262,7 @@ SetRequest(interp, session, request, response)
 	     * Check if the instance is writable.
 	     */
 
-	    if (inst->access == TNM_MIB_READONLY) {
+	    if (inst->access == TNM_MIB_READONLY || inst->counterPtr) {
 		response->errorStatus = TNM_SNMP_NOTWRITABLE;
 		varsToRollback--;
 		goto varBindError;
@@ -956,6 +1352,9 @@ SetRequest(interp, session, request, response)
     
     if (response->errorStatus == TNM_SNMP_NOERROR) {
 	for (i = 0; i < inVarBindSize; i++) {
+	    if (inVarBindPtr[i].flags & NODE_INSTPROC) {
+		continue;
+	    }
 	    TnmOidFromString(&oid, inVarBindPtr[i].soid);
 	    inst = FindInstance(session, &oid);
 	    TnmOidFree(&oid);
@@ -997,6 +1396,9 @@ SetRequest(interp, session, request, response)
 	 */
       
         for (i = 0; i < inVarBindSize; i++) {
+	    if (inVarBindPtr[i].flags & NODE_INSTPROC) {
+		continue;
+	    }
 	    TnmOidFromString(&oid, inVarBindPtr[i].soid);
 	    inst = FindInstance(session, &oid);
 	    TnmOidFree(&oid);
@@ -1022,6 +1424,9 @@ SetRequest(interp, session, request, response)
 	 */
 
         for (i = varsToRollback; i >= 0; i--) {
+	    if (inVarBindPtr[i].flags & NODE_INSTPROC) {
+		continue;
+	    }
 	    TnmOidFromString(&oid, inVarBindPtr[i].soid);
 	    inst = FindInstance(session, &oid);
 	    TnmOidFree(&oid);
@@ -1044,6 +1449,7 @@ SetRequest(interp, session, request, response)
 	}
     }
 
+    Tcl_DecrRefCount(valuePtr);
     Tnm_SnmpFreeVBList(inVarBindSize, inVarBindPtr);
     return TCL_OK;
 }
@@ -1072,8 +1478,11 @@ TnmSnmpAgentRequest(interp, session, pdu)
     TnmSnmp *session;
     TnmSnmpPdu *pdu;
 {
-    int rc;
-    TnmSnmpPdu *reply;
+    int rc, cacheable;
+    TnmSnmpPdu reply;
+    CacheKey key;
+    CacheEntry *cachePtr;
+    Tcl_Obj *packetObj;
 
     switch (pdu->type) {
       case ASN1_SNMP_GET:
@@ -1092,26 +1501,56 @@ TnmSnmpAgentRequest(interp, session, pdu)
 
     }
 
+    /*
+     * Set requests are never answered from the cache. They remove
+     * the cached responses of the session instead since they may
+     * change the values returned by a retransmitted request.
+     */
+
+    CacheInit();
+    cacheable = (pdu->requestId != 0 && pdu->type != ASN1_SNMP_SET
+		 && tnmSnmpAgentCache > 0 && tnmSnmpAgentCacheTTL > 0);
+
     if (pdu->type == ASN1_SNMP_SET) {
-	CacheClear(session);
+	TnmSnmpAgentClearCache(session);
     }
 
-    reply = CacheHit(session, pdu);
-    if (reply != NULL) {
-	rc = TnmSnmpEncode(interp, session, reply, NULL, NULL);
-	return rc;
+    /*
+     * Never try to lookup request id 0 because there are some
+     * management applications that always use the request id 0.
+     */
+
+    if (cacheable) {
+	CacheKeyInit(&key, session, pdu);
+	cachePtr = CacheHit(&key);
+	if (cachePtr != NULL) {
+	    u_char *packet;
+	    int packetlen;
+	    packet = Tcl_GetByteArrayFromObj(cachePtr->packetObj, &packetlen);
+	    tnmSnmpStats.snmpOutGetResponses++;
+	    rc = TnmSnmpSend(interp, session, packet, packetlen,
+			     &pdu->addr, TNM_SNMP_ASYNC);
+	    if (rc == TCL_OK) {
+		Tcl_ResetResult(interp);
+	    }
+	    return rc;
+	}
     }
 
     TnmSnmpEvalBinding(interp, session, pdu, TNM_SNMP_BEGIN_EVENT);
 
-    reply = CacheGet(session, pdu);
+    memset((char *) &reply, 0, sizeof(reply));
+    Tcl_DStringInit(&reply.varbind);
+    reply.addr = pdu->addr;
+    reply.errorStatus = TNM_SNMP_NOERROR;
 
     if (pdu->type == ASN1_SNMP_SET) {
-	rc = SetRequest(interp, session, pdu, reply);
+	rc = SetRequest(interp, session, pdu, &reply);
     } else {
-	rc = GetRequest(interp, session, pdu, reply);
+	rc = GetRequest(interp, session, pdu, &reply);
     }
     if (rc != TCL_OK) {
+	Tcl_DStringFree(&reply.varbind);
 	return TCL_ERROR;
     }
 
@@ -1120,29 +1559,32 @@ TnmSnmpAgentRequest(interp, session, pdu)
      * request if we had an error.
      */
 
-    if (reply->errorStatus != TNM_SNMP_NOERROR) {
-	Tcl_DStringFree(&reply->varbind);
-	Tcl_DStringAppend(&reply->varbind,
-			  Tcl_DStringValue(&pdu->varbind),
-			  Tcl_DStringLength(&pdu->varbind));
+    if (reply.errorStatus != TNM_SNMP_NOERROR) {
+	Tcl_DStringFree(&reply.varbind);
+	Tcl_DStringAppend(&reply.varbind, Tcl_GetString(pdu->vbList), -1);
     }
  
-    reply->type = ASN1_SNMP_RESPONSE;
-    reply->requestId = pdu->requestId;
+    reply.type = ASN1_SNMP_RESPONSE;
+    reply.requestId = pdu->requestId;
 
-    TnmSnmpEvalBinding(interp, session, reply, TNM_SNMP_END_EVENT);
+    TnmSnmpEvalBinding(interp, session, &reply, TNM_SNMP_END_EVENT);
 
-    if (TnmSnmpEncode(interp, session, reply, NULL, NULL) != TCL_OK) {
+    packetObj = Tcl_NewObj();
+    Tcl_IncrRefCount(packetObj);
+    rc = TnmSnmpEncodeResponse(interp, session, &reply, packetObj);
+    if (rc != TCL_OK) {
 	Tcl_AddErrorInfo(interp, "\n    (snmp send reply)");
 	Tcl_BackgroundError(interp);
 	Tcl_ResetResult(interp);
-	reply->errorStatus = TNM_SNMP_GENERR;
-	Tcl_DStringFree(&reply->varbind);
-        Tcl_DStringAppend(&reply->varbind,
-			  Tcl_DStringValue(&pdu->varbind),
-			  Tcl_DStringLength(&pdu->varbind));
-	return TnmSnmpEncode(interp, session, reply, NULL, NULL);
-    } else {
-	return TCL_OK;
+	reply.errorStatus = TNM_SNMP_GENERR;
+	Tcl_DStringFree(&reply.varbind);
+        Tcl_DStringAppend(&reply.varbind, Tcl_GetString(pdu->vbList), -1);
+	rc = TnmSnmpEncodeResponse(interp, session, &reply, packetObj);
+    }
+    if (rc == TCL_OK && cacheable) {
+	CacheAdd(&key, packetObj);
     }
+    Tcl_DecrRefCount(packetObj);
+    Tcl_DStringFree(&reply.varbind);
+    return rc;
 }
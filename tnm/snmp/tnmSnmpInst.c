@@ -17,38 +17,79 @@
 #include "tnmMib.h"
 
 /*
- * The root of the tree containing all MIB instances.
+ * The root of the tree containing all MIB instances. The hash table
+ * maps the names of Tcl variables to the list of nodes bound to the
+ * variable so that nodes can be removed quickly when a variable is
+ * unset.
  */
 
 static TnmSnmpNode *instTree = NULL;
+static Tcl_HashTable varTable;
+
+/*
+ * The number of instance procedures registered in the tree. Lookups
+ * of instance procedures are skipped if there are none.
+ */
+
+static int numInstProcs = 0;
 
 /*
  * Forward declarations for procedures defined later in this file:
  */
 
 static void
-DumpTree                _ANSI_ARGS_((TnmSnmpNode *instPtr));
+DumpTree                _ANSI_ARGS_((TnmSnmpNode *instPtr, int level));
 
 static void
 FreeNode		_ANSI_ARGS_((TnmSnmpNode *inst));
 
+static TnmSnmpNode*
+FindChild		_ANSI_ARGS_((TnmSnmpNode *nodePtr, u_int subid,
+				     int *indexPtr));
+static TnmSnmpNode*
+InsertChild		_ANSI_ARGS_((TnmSnmpNode *nodePtr, int index,
+				     u_int subid, char *label, int offset));
+static void
+CountInstances		_ANSI_ARGS_((TnmSnmpNode *nodePtr, int delta));
+
+static void
+LinkVar			_ANSI_ARGS_((TnmSnmpNode *nodePtr));
+
+static void
+UnlinkVar		_ANSI_ARGS_((TnmSnmpNode *nodePtr));
+
 static TnmSnmpNode*
 AddNode			_ANSI_ARGS_((char *id, int offset, int syntax,
 				     int access, char *tclVarName));
 static void
-RemoveNode		_ANSI_ARGS_((TnmSnmpNode *root, char *varname));
+RemoveNode		_ANSI_ARGS_((char *varname));
+
+static void
+PruneNode		_ANSI_ARGS_((TnmSnmpNode *nodePtr));
 
 static TnmSnmpNode*
 FindNode		_ANSI_ARGS_((TnmSnmpNode *root, TnmOid *oidPtr));
 
 static TnmSnmpNode*
-FindNextNode		_ANSI_ARGS_((TnmSnmpNode *root, u_int *oid, int len));
+NextInstProc		_ANSI_ARGS_((TnmSnmpNode *nodePtr, TnmOid *oidPtr,
+				     TnmOid *nextPtr, Tcl_Obj *valuePtr));
+static TnmSnmpNode*
+FirstNode		_ANSI_ARGS_((TnmSnmpNode *nodePtr,
+				     TnmOid *nextPtr, Tcl_Obj *valuePtr));
+static TnmSnmpNode*
+FindNextNode		_ANSI_ARGS_((TnmSnmpNode *root, u_int *oid, int len,
+				     TnmOid *oidPtr, TnmOid *nextPtr,
+				     Tcl_Obj *valuePtr));
+static int
+CheckInstance		_ANSI_ARGS_((Tcl_Interp *interp, char *label,
+				     char **soidPtr, int *offsetPtr,
+				     int *syntaxPtr, int *accessPtr));
 
 static char*
 DeleteNodeProc		_ANSI_ARGS_((ClientData clientData, Tcl_Interp *interp,
 				     char *name1, char *name2, int flags));
 
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -67,23 +108,24 @@ DeleteNodeProc		_ANSI_ARGS_((ClientData clientData, Tcl_Interp *interp,
  */
 
 static void
-DumpTree(instPtr)
+DumpTree(instPtr, level)
     TnmSnmpNode *instPtr;
+    int level;
 {
+    int i;
+
     if (instPtr) {
-        fprintf(stderr, "** %s (%s)\n",
+        fprintf(stderr, "%*s** %s (%s) %d\n", level, "",
                 instPtr->label ? instPtr->label : "(none)",
                 TnmGetTableValue(tnmMibAccessTable,
-				 (unsigned) instPtr->access));
-        if (instPtr->childPtr) {
-            DumpTree(instPtr->childPtr);
-        }
-        if (instPtr->nextPtr) {
-            DumpTree(instPtr->nextPtr);
-        }
+				 (unsigned) instPtr->access),
+		instPtr->instances);
+	for (i = 0; i < instPtr->numChildren; i++) {
+	    DumpTree(instPtr->children[i], level + 1);
+	}
     }
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -112,6 +154,9 @@ FreeNode(instPtr)
     if (instPtr->tclVarName) {
 	ckfree(instPtr->tclVarName);
     }
+    if (instPtr->children) {
+	ckfree((char *) instPtr->children);
+    }
     while (instPtr->bindings) {
 	TnmSnmpBinding *bindPtr = instPtr->bindings;
 	instPtr->bindings = instPtr->bindings->nextPtr;
@@ -122,7 +167,207 @@ FreeNode(instPtr)
     }
     ckfree((char *) instPtr);
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FindChild --
+ *
+ *	This procedure searches the child with the given sub
+ *	identifier by a binary search in the sorted children.
+ *
+ * Results:
+ *	A pointer to the child or NULL if there is no such child.
+ *	The index of the child or the index where the child must
+ *	be inserted is left in indexPtr.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmSnmpNode*
+FindChild(nodePtr, subid, indexPtr)
+    TnmSnmpNode *nodePtr;
+    u_int subid;
+    int *indexPtr;
+{
+    int lo = 0, hi = nodePtr->numChildren, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (nodePtr->children[mid]->subid < subid) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+
+    *indexPtr = lo;
+    if (lo < nodePtr->numChildren && nodePtr->children[lo]->subid == subid) {
+	return nodePtr->children[lo];
+    }
+    return NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * InsertChild --
+ *
+ *	This procedure creates a new child node and inserts it at
+ *	the given index into the children of a node.
+ *
+ * Results:
+ *	A pointer to the new child node.
+ *
+ * Side effects:
+ *	The array of children may be enlarged.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmSnmpNode*
+InsertChild(nodePtr, index, subid, label, offset)
+    TnmSnmpNode *nodePtr;
+    int index;
+    u_int subid;
+    char *label;
+    int offset;
+{
+    TnmSnmpNode *n;
+
+    if (nodePtr->numChildren == nodePtr->sizeChildren) {
+	nodePtr->sizeChildren = nodePtr->sizeChildren
+	    ? 2 * nodePtr->sizeChildren : 4;
+	nodePtr->children = (TnmSnmpNode **) ckrealloc(
+	    (char *) nodePtr->children,
+	    (unsigned) nodePtr->sizeChildren * sizeof(TnmSnmpNode *));
+    }
+    memmove((char *) (nodePtr->children + index + 1),
+	    (char *) (nodePtr->children + index),
+	    (size_t) (nodePtr->numChildren - index) * sizeof(TnmSnmpNode *));
+
+    n = (TnmSnmpNode *) ckalloc(sizeof(TnmSnmpNode));
+    memset((char *) n, 0, sizeof(TnmSnmpNode));
+    n->label = ckstrdup(label);
+    n->subid = subid;
+    n->offset = offset;
+    n->parentPtr = nodePtr;
+
+    nodePtr->children[index] = n;
+    nodePtr->numChildren++;
+    return n;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CountInstances --
+ *
+ *	This procedure adjusts the number of instances in the subtree
+ *	of a node and all its parent nodes.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CountInstances(nodePtr, delta)
+    TnmSnmpNode *nodePtr;
+    int delta;
+{
+    for (; nodePtr; nodePtr = nodePtr->parentPtr) {
+	nodePtr->instances += delta;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LinkVar --
+ *
+ *	This procedure adds a node to the list of nodes bound to the
+ *	Tcl variable of the node.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The variable table is updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+LinkVar(nodePtr)
+    TnmSnmpNode *nodePtr;
+{
+    Tcl_HashEntry *entryPtr;
+    int isNew;
+
+    if (! nodePtr->tclVarName) {
+	return;
+    }
+
+    entryPtr = Tcl_CreateHashEntry(&varTable, nodePtr->tclVarName, &isNew);
+    nodePtr->varNextPtr = isNew
+	? NULL : (TnmSnmpNode *) Tcl_GetHashValue(entryPtr);
+    Tcl_SetHashValue(entryPtr, (ClientData) nodePtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UnlinkVar --
+ *
+ *	This procedure removes a node from the list of nodes bound
+ *	to the Tcl variable of the node.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The variable table is updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+UnlinkVar(nodePtr)
+    TnmSnmpNode *nodePtr;
+{
+    Tcl_HashEntry *entryPtr;
+    TnmSnmpNode **nodePtrPtr;
+
+    if (! nodePtr->tclVarName) {
+	return;
+    }
+
+    entryPtr = Tcl_FindHashEntry(&varTable, nodePtr->tclVarName);
+    if (! entryPtr) {
+	return;
+    }
+
+    nodePtrPtr = (TnmSnmpNode **) &Tcl_GetHashValue(entryPtr);
+    while (*nodePtrPtr && *nodePtrPtr != nodePtr) {
+	nodePtrPtr = &(*nodePtrPtr)->varNextPtr;
+    }
+    if (*nodePtrPtr) {
+	*nodePtrPtr = nodePtr->varNextPtr;
+    }
+    nodePtr->varNextPtr = NULL;
+    if (Tcl_GetHashValue(entryPtr) == NULL) {
+	Tcl_DeleteHashEntry(entryPtr);
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -148,8 +393,9 @@ AddNode(soid, offset, syntax, access, tclVarName)
     int access;
     char *tclVarName;
 {
-    Tnm_Oid *oid;
-    int i, oidlen;
+    Tnm_Oid *oid, oidBuf[TNM_OID_MAX_SIZE];
+    char buf[TNM_OID_STR_SIZE];
+    int i, index, oidlen;
     TnmSnmpNode *p, *q = NULL;
 
     if (instTree == NULL) {
@@ -157,10 +403,11 @@ AddNode(soid, offset, syntax, access, tclVarName)
 	memset((char *) instTree, 0, sizeof(TnmSnmpNode));
 	instTree->label = "1";
 	instTree->subid = 1;
+	Tcl_InitHashTable(&varTable, TCL_STRING_KEYS);
     }
 
-    oid = TnmStrToOid(soid, &oidlen);
-    if (oid[0] != 1 || oidlen < 1) {
+    oid = TnmStrToOid(soid, oidBuf, &oidlen);
+    if (! oid || oid[0] != 1 || oidlen < 1) {
 	return NULL;
     }
     if (oidlen == 1 && oid[0] == 1) {
@@ -168,71 +415,156 @@ AddNode(soid, offset, syntax, access, tclVarName)
     }
 
     for (p = instTree, i = 1; i < oidlen; p = q, i++) {
-	for (q = p->childPtr; q; q = q->nextPtr) {
-	    if (q->subid == oid[i]) break;
-	}
+	q = FindChild(p, oid[i], &index);
 	if (! q) {
 
 	    /*
 	     * Create new intermediate nodes.
 	     */
 
-	    TnmSnmpNode *n;
-	    char *s = TnmOidToStr(oid, i+1);
-	    
-	    n = (TnmSnmpNode *) ckalloc(sizeof(TnmSnmpNode));
-	    memset((char *) n, 0, sizeof(TnmSnmpNode));
-	    n->label = ckstrdup(s);
-	    n->subid = oid[i];
-	    n->offset = offset;
-
-	    if (! p->childPtr) {			/* first node  */
-		p->childPtr = n;
-
-	    } else if (p->childPtr->subid > oid[i]) {	/* insert head */
-		n->nextPtr = p->childPtr;
-		p->childPtr = n;
-
-	    } else {					/* somewhere else */
-		for (q = p->childPtr; q->nextPtr && q->nextPtr->subid < oid[i]; 
-		     q = q->nextPtr) ;
-		if (q->nextPtr && q->nextPtr->subid == oid[i]) {
-		    continue;
-		}
-		n->nextPtr = q->nextPtr;
-		q->nextPtr = n;
-	    }
-
-	    q = n;
+	    q = InsertChild(p, index, oid[i], TnmOidToStr(oid, i+1, buf), offset);
 	}
     }
 
     if (q) {
 	if (q->label) ckfree(q->label);
+	UnlinkVar(q);
 	if (q->tclVarName && q->tclVarName != tclVarName) {
 	    ckfree(q->tclVarName);
 	}
+	if (! q->syntax != ! syntax) {
+	    CountInstances(q, syntax ? 1 : -1);
+	}
 	
 	q->label  = soid;
 	q->offset = offset;
 	q->syntax = syntax;
 	q->access = access;
 	q->tclVarName = tclVarName;
+	q->counterPtr = NULL;
+	LinkVar(q);
     }
   
     return q;
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NextInstProc --
+ *
+ *	This procedure asks the instance procedure of a node for the
+ *	next instance following oidPtr in the subtree of the node. The
+ *	search starts at the node itself if oidPtr is NULL.
+ *
+ * Results:
+ *	The node or NULL if there is no next instance in the subtree.
+ *
+ * Side effects:
+ *	The oid and the value of the instance are left in nextPtr and
+ *	valuePtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmSnmpNode*
+NextInstProc(nodePtr, oidPtr, nextPtr, valuePtr)
+    TnmSnmpNode *nodePtr;
+    TnmOid *oidPtr;
+    TnmOid *nextPtr;
+    Tcl_Obj *valuePtr;
+{
+    TnmOid oid;
+    int status;
+
+    TnmOidInit(&oid);
+    if (oidPtr) {
+	TnmOidCopy(&oid, oidPtr);
+    } else {
+	TnmOidFromString(&oid, nodePtr->label);
+    }
+    status = (nodePtr->instProc)(nodePtr->clientData, TNM_SNMP_INST_NEXT,
+				 &oid, valuePtr);
+
+    /*
+     * Make sure that the procedure makes progress. Otherwise, a
+     * manager walking the MIB would loop forever.
+     */
+
+    if (status == TNM_SNMP_NOERROR && oidPtr
+	&& TnmOidCompare(&oid, oidPtr) <= 0) {
+	status = TNM_SNMP_GENERR;
+    }
+    if (status == TNM_SNMP_NOERROR) {
+	TnmOidCopy(nextPtr, &oid);
+    }
+    TnmOidFree(&oid);
+    return (status == TNM_SNMP_NOERROR) ? nodePtr : NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FirstNode --
+ *
+ *	This procedure locates the lexikographic first instance
+ *	node in the subtree of a node, including the node itself.
+ *	Subtrees without instances are skipped.
+ *
+ * Results:
+ *	A pointer to the node or NULL if there is no instance. The
+ *	oid and the value are left in nextPtr and valuePtr if the
+ *	instance is served by an instance procedure.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmSnmpNode*
+FirstNode(nodePtr, nextPtr, valuePtr)
+    TnmSnmpNode *nodePtr;
+    TnmOid *nextPtr;
+    Tcl_Obj *valuePtr;
+{
+    TnmSnmpNode *inst;
+    int i;
+
+    if (! nodePtr || nodePtr->instances == 0) {
+	return NULL;
+    }
+    if (nodePtr->instProc) {
+	return NextInstProc(nodePtr, NULL, nextPtr, valuePtr);
+    }
+    if (nodePtr->syntax) {
+	return nodePtr;
+    }
+    for (i = 0; i < nodePtr->numChildren; i++) {
+	inst = FirstNode(nodePtr->children[i], nextPtr, valuePtr);
+	if (inst) {
+	    return inst;
+	}
+    }
+    return NULL;
+}
+
 /*
  *----------------------------------------------------------------------
  *
  * FindNextNode --
  *
  *	This procedure locates the lexikographic next instance
- *	node in the instance tree.
+ *	node in the subtree of root. The oid contains the sub
+ *	identifiers following the oid of root. We descend along
+ *	the oid and search the first instance in the subtrees
+ *	to the right of the path while returning. The complete
+ *	oid is passed in oidPtr for instance procedures.
  *
  * Results:
- *	A pointer to the node or NULL if there is no next node.
+ *	A pointer to the node or NULL if there is no next node. The
+ *	oid and the value are left in nextPtr and valuePtr if the
+ *	instance is served by an instance procedure.
  *
  * Side effects:
  *	None.
@@ -241,70 +573,49 @@ AddNode(soid, offset, syntax, access, tclVarName)
  */
 
 static TnmSnmpNode*
-FindNextNode(root, oid, len)
+FindNextNode(root, oid, len, oidPtr, nextPtr, valuePtr)
     TnmSnmpNode *root;
     u_int *oid;
     int len;
+    TnmOid *oidPtr;
+    TnmOid *nextPtr;
+    Tcl_Obj *valuePtr;
 {
     TnmSnmpNode *p, *inst;
-    static int force = 0;
-
-    /*
-     * Reset the force flag if we start a new search from the root of
-     * the instance tree. The flag will be set whenever we decide that
-     * the next instance we find will be a good candidate.
-     */
+    int i;
 
-    if (root == instTree) {
-	force = 0;
+    if (! root || root->instances == 0) {
+	return NULL;
     }
 
-    /*
-     * Skip over all subidentifier that are lower than the
-     * subidentifier of interest.
-     */
-
-    p = root;
-    if (len) {
-	while (p && p->subid < oid[0]) p = p->nextPtr;
+    if (root->instProc) {
+	return NextInstProc(root, oidPtr, nextPtr, valuePtr);
     }
 
-    /*
-     * Loop over all neighbours at this tree level. Descend if possible.
-     */
-
-    while (p) {
-	if (p->childPtr) {
-	    if (len > 0 && p->subid == oid[0]) {
-		/* descend - positive match */
-		inst = FindNextNode(p->childPtr, oid + 1, len - 1);
-	    } else if (p->syntax) {
-		/* no match - use this node */
-		return p;
-	    } else {
-		/* descend - force next node */
-		force = 1;
-		inst = FindNextNode(p->childPtr, NULL, 0);
-	    }
-	    if (inst) return inst;
-	} else {
-	    if (len == 0 && p->syntax) {
-		/* found - node has larger oid */
-		return p;
-	    } else if (((len && p->subid != oid[0]) || force) && p->syntax) {
-		/* no match - forced to use this node */
-		return p;
-	    } else {
-		/* force next node */
-		force = 1;
+    if (len == 0) {
+	i = 0;
+    } else {
+	p = FindChild(root, oid[0], &i);
+	if (p) {
+	    inst = FindNextNode(p, oid + 1, len - 1,
+				oidPtr, nextPtr, valuePtr);
+	    if (inst) {
+		return inst;
 	    }
+	    i++;
+	}
+    }
+
+    for (; i < root->numChildren; i++) {
+	inst = FirstNode(root->children[i], nextPtr, valuePtr);
+	if (inst) {
+	    return inst;
 	}
-	p = p->nextPtr;
     }
 
     return NULL;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -328,27 +639,66 @@ FindNode(root, oidPtr)
     TnmOid *oidPtr;
 {
     TnmSnmpNode *p, *q = NULL;
-    int i;
+    int i, index;
     
-    if (TnmOidGet(oidPtr, 0) != 1) return NULL;
+    if (! root || TnmOidGet(oidPtr, 0) != 1) return NULL;
     for (p = root, i = 1; p && i < TnmOidGetLength(oidPtr); p = q, i++) {
-	for (q = p->childPtr; q; q = q->nextPtr) {
-	    if (q->subid == TnmOidGet(oidPtr, i)) break;
-	}
+	q = FindChild(p, TnmOidGet(oidPtr, i), &index);
 	if (!q) {
 	    return NULL; 
 	}
     }
     return q;
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PruneNode --
+ *
+ *	This procedure frees a node and its parents as long as they
+ *	neither are instances nor have bindings or children.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Nodes are removed from the tree.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PruneNode(nodePtr)
+    TnmSnmpNode *nodePtr;
+{
+    TnmSnmpNode *parentPtr;
+    int index;
+
+    while (nodePtr && nodePtr != instTree && ! nodePtr->syntax
+	   && ! nodePtr->instProc && ! nodePtr->bindings
+	   && nodePtr->numChildren == 0) {
+	parentPtr = nodePtr->parentPtr;
+	if (FindChild(parentPtr, nodePtr->subid, &index) == nodePtr) {
+	    parentPtr->numChildren--;
+	    memmove((char *) (parentPtr->children + index),
+		    (char *) (parentPtr->children + index + 1),
+		    (size_t) (parentPtr->numChildren - index)
+		    * sizeof(TnmSnmpNode *));
+	}
+	FreeNode(nodePtr);
+	nodePtr = parentPtr;
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
  * RemoveNode --
  *
- *	This procedure removes all nodes from the tree that are 
- *	associated with a given Tcl variable.
+ *	This procedure removes all instances from the tree that are 
+ *	associated with a given Tcl variable. Nodes which are still
+ *	needed for bindings or children are kept.
  *
  * Results:
  *	None.
@@ -360,33 +710,34 @@ FindNode(root, oidPtr)
  */
 
 static void
-RemoveNode(root, varName)
-    TnmSnmpNode *root;
+RemoveNode(varName)
     char *varName;
 {
+    Tcl_HashEntry *entryPtr;
     TnmSnmpNode *p, *q;
 
-    if (!root) return;
+    if (! instTree) return;
 
-    for (p = root; p; p = p->nextPtr) {
-	if (p->childPtr) {
-	    q = p->childPtr;
-	    RemoveNode(q, varName);
-	    if (q->tclVarName && (strcmp(q->tclVarName, varName) == 0)) {
-		p->childPtr = q->nextPtr;
-		FreeNode(q);
-	    }
-	}
-	if (p->nextPtr) {
-	    q = p->nextPtr;
-	    if (q->tclVarName && (strcmp(q->tclVarName, varName) == 0)) {
-		p->nextPtr = q->nextPtr;
-		FreeNode(q);
-	    }
+    entryPtr = Tcl_FindHashEntry(&varTable, varName);
+    if (! entryPtr) return;
+
+    p = (TnmSnmpNode *) Tcl_GetHashValue(entryPtr);
+    Tcl_DeleteHashEntry(entryPtr);
+
+    for (; p; p = q) {
+	q = p->varNextPtr;
+	p->varNextPtr = NULL;
+	ckfree(p->tclVarName);
+	p->tclVarName = NULL;
+	p->counterPtr = NULL;
+	if (p->syntax) {
+	    CountInstances(p, -1);
+	    p->syntax = 0;
 	}
+	PruneNode(p);
     }
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -394,8 +745,8 @@ RemoveNode(root, varName)
  *
  *	This procedure is a variable trace callback which is called
  *	by the Tcl interpreter whenever a MIB variable is removed.
- *	We have to run through the whole tree to discard these 
- *	variables.
+ *	The nodes bound to the variable are found in the variable
+ *	table.
  *
  * Results:
  *	Always NULL.
@@ -428,40 +779,43 @@ DeleteNodeProc(clientData, interp, name1, name2, flags)
 	strcat(varName,")");
     }
 
-    RemoveNode(instTree, varName);
+    RemoveNode(varName);
     ckfree(varName);
     return NULL;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * TnmSnmpCreateNode --
+ * CheckInstance --
  *
- *	This procedure creates a new node in the instance tree 
- *	and a Tcl array variable that will be used to access and 
- *	modify the instance from within Tcl.
+ *	This procedure checks whether label names an accessible
+ *	instance of a MIB object and computes the oid, the offset
+ *	of the instance identifier, the syntax and the access mode
+ *	of the instance.
  *
  * Results:
- *	A standard Tcl result.
+ *	A standard Tcl result. The oid left in soidPtr must be freed
+ *	by the caller if the result is TCL_OK.
  *
  * Side effects:
  *	None.
  *
  *----------------------------------------------------------------------
  */
- 
-int
-TnmSnmpCreateNode(interp, label, tclVarName, defval)
+
+static int
+CheckInstance(interp, label, soidPtr, offsetPtr, syntaxPtr, accessPtr)
     Tcl_Interp *interp;
     char *label;
-    char *tclVarName;
-    char *defval;
+    char **soidPtr;
+    int *offsetPtr;
+    int *syntaxPtr;
+    int *accessPtr;
 {
     char *soid = NULL;
     TnmMibNode *nodePtr = TnmMibFindNode(label, NULL, 0);
     int access, offset = 0, syntax = 0;
-    char *varName = NULL;
 
     if (!nodePtr || nodePtr->childPtr) {
 	Tcl_AppendResult(interp, "unknown object type \"", label, "\"", 
@@ -484,13 +838,14 @@ TnmSnmpCreateNode(interp, label, tclVarName, defval)
      */
 
     {
-	int oidLen;
-	Tnm_Oid *oid;
+	int oidLen = 0;
+	Tnm_Oid *oid, oidBuf[TNM_OID_MAX_SIZE];
 	TnmMibNode *basePtr = NULL;
-	char *freeme = NULL;
+	char *freeme = NULL, buf[TNM_OID_STR_SIZE];
 
-	for (oid = TnmStrToOid(soid, &oidLen); oidLen; oidLen--) {
-	    freeme = TnmOidToStr(oid, oidLen);
+	oid = TnmStrToOid(soid, oidBuf, &oidLen);
+	for (; oid && oidLen; oidLen--) {
+	    freeme = TnmOidToStr(oid, oidLen, buf);
 	    basePtr = TnmMibFindNode(freeme, NULL, 1);
 	    if (basePtr) break;
 	}
@@ -542,6 +897,51 @@ TnmSnmpCreateNode(interp, label, tclVarName, defval)
 	}
     }
 
+    *soidPtr = soid;
+    *offsetPtr = offset;
+    *syntaxPtr = syntax;
+    *accessPtr = access;
+    return TCL_OK;
+
+  errorExit:
+    if (soid) ckfree(soid);
+    return TCL_ERROR;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpCreateNode --
+ *
+ *	This procedure creates a new node in the instance tree 
+ *	and a Tcl array variable that will be used to access and 
+ *	modify the instance from within Tcl.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+ 
+int
+TnmSnmpCreateNode(interp, label, tclVarName, defval)
+    Tcl_Interp *interp;
+    char *label;
+    char *tclVarName;
+    char *defval;
+{
+    char *soid = NULL;
+    int access, offset, syntax;
+    char *varName = NULL;
+
+    if (CheckInstance(interp, label, &soid, &offset, &syntax, &access)
+	!= TCL_OK) {
+	return TCL_ERROR;
+    }
+
     /*
      * Now create the Tcl variable and the instance tree node.
      * Do not use tclVarName directly because it might be a string
@@ -569,6 +969,140 @@ TnmSnmpCreateNode(interp, label, tclVarName, defval)
     return TCL_ERROR;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpCreateCounter --
+ *
+ *	This procedure creates a new node in the instance tree whose
+ *	value is read from the unsigned int pointed to by counterPtr.
+ *	The instance is removed if counterPtr is NULL.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSnmpCreateCounter(interp, label, counterPtr)
+    Tcl_Interp *interp;
+    char *label;
+    u_int *counterPtr;
+{
+    char *soid = NULL;
+    int access, offset, syntax;
+    TnmSnmpNode *nodePtr;
+    TnmOid oid;
+
+    if (CheckInstance(interp, label, &soid, &offset, &syntax, &access)
+	!= TCL_OK) {
+	return TCL_ERROR;
+    }
+
+    TnmOidInit(&oid);
+    TnmOidFromString(&oid, soid);
+    nodePtr = FindNode(instTree, &oid);
+    TnmOidFree(&oid);
+
+    if (! counterPtr) {
+	ckfree(soid);
+	if (nodePtr && nodePtr->counterPtr) {
+	    nodePtr->counterPtr = NULL;
+	    if (! nodePtr->tclVarName) {
+		CountInstances(nodePtr, -1);
+		nodePtr->syntax = 0;
+		PruneNode(nodePtr);
+	    }
+	}
+	return TCL_OK;
+    }
+
+    nodePtr = AddNode(soid, offset, syntax, access, NULL);
+    if (! nodePtr) {
+	Tcl_AppendResult(interp, "illegal instance identifier \"",
+			 label, "\"", (char *) NULL);
+	ckfree(soid);
+	return TCL_ERROR;
+    }
+    nodePtr->counterPtr = counterPtr;
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpCreateInstProc --
+ *
+ *	This procedure registers an instance procedure which serves
+ *	all instances in the subtree of the MIB node given by label.
+ *	The procedure is removed if proc is NULL.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSnmpCreateInstProc(interp, label, proc, clientData)
+    Tcl_Interp *interp;
+    char *label;
+    TnmSnmpInstProc *proc;
+    ClientData clientData;
+{
+    char *soid = NULL;
+    TnmSnmpNode *nodePtr;
+    TnmOid oid;
+
+    if (TnmMibFindNode(label, NULL, 0)) {
+	soid = TnmMibGetOid(label);
+    }
+    if (! soid || ! TnmIsOid(soid)) {
+	Tcl_AppendResult(interp, "unknown object type \"", label, "\"", 
+			 (char *) NULL);
+	return TCL_ERROR;
+    }
+
+    TnmOidInit(&oid);
+    TnmOidFromString(&oid, soid);
+    nodePtr = FindNode(instTree, &oid);
+    TnmOidFree(&oid);
+
+    if (! nodePtr) {
+	if (! proc) {
+	    return TCL_OK;
+	}
+	nodePtr = AddNode(ckstrdup(soid), 0, 0, 0, NULL);
+	if (! nodePtr) {
+	    Tcl_AppendResult(interp, "illegal object type \"", label, "\"", 
+			     (char *) NULL);
+	    return TCL_ERROR;
+	}
+    }
+
+    if (proc && ! nodePtr->instProc) {
+	CountInstances(nodePtr, 1);
+	numInstProcs++;
+    }
+    if (! proc && nodePtr->instProc) {
+	CountInstances(nodePtr, -1);
+	numInstProcs--;
+    }
+    nodePtr->instProc = proc;
+    nodePtr->clientData = clientData;
+    if (! proc) {
+	PruneNode(nodePtr);
+    }
+    return TCL_OK;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -612,15 +1146,73 @@ TnmSnmpFindNode(session, oidPtr)
  */
 
 TnmSnmpNode*
-TnmSnmpFindNextNode(session, oidPtr)
+TnmSnmpFindNextNode(session, oidPtr, nextPtr, valuePtr)
     TnmSnmp *session;
     TnmOid *oidPtr;
+    TnmOid *nextPtr;
+    Tcl_Obj *valuePtr;
 {
+    u_int *oid = TnmOidGetElements(oidPtr);
+    int len = TnmOidGetLength(oidPtr);
+
 #if 0
-    DumpTree(instTree);
+    DumpTree(instTree, 0);
 #endif
-    return FindNextNode(instTree, TnmOidGetElements(oidPtr), 
-			TnmOidGetLength(oidPtr));
+
+    /*
+     * The root of the instance tree is the node 1. Every instance
+     * follows an oid which starts with 0 or which is empty.
+     */
+
+    if (len == 0 || oid[0] < 1) {
+	return FirstNode(instTree, nextPtr, valuePtr);
+    }
+    if (oid[0] > 1) {
+	return NULL;
+    }
+    return FindNextNode(instTree, oid + 1, len - 1,
+			oidPtr, nextPtr, valuePtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpFindInstProc --
+ *
+ *	This procedure locates the node of the instance procedure
+ *	which serves the instance given by oidPtr.
+ *
+ * Results:
+ *	A pointer to the node or NULL if the instance is not served
+ *	by an instance procedure.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+TnmSnmpNode*
+TnmSnmpFindInstProc(session, oidPtr)
+    TnmSnmp *session;
+    TnmOid *oidPtr;
+{
+    TnmSnmpNode *p;
+    int i, index;
+
+    if (numInstProcs == 0 || ! instTree || TnmOidGet(oidPtr, 0) != 1) {
+	return NULL;
+    }
+    for (p = instTree, i = 1; p; i++) {
+	if (p->instProc) {
+	    return p;
+	}
+	if (i >= TnmOidGetLength(oidPtr)) {
+	    break;
+	}
+	p = FindChild(p, TnmOidGet(oidPtr, i), &index);
+    }
+    return NULL;
 }
 
 /*
@@ -21,11 +21,117 @@
 extern int hexdump;		/* flag that controls hexdump */
 
 /*
- * Shared socket used for all asynchronous messages send out by this
- * manager or agent.
+ * Pool of shared sockets used for all asynchronous messages send out
+ * by this manager or agent. All messages to a peer are sent from the
+ * same socket of the pool so that the load of many peers is spread
+ * over multiple socket receive buffers. The interpreter is used to
+ * process incoming responses.
  */
 
-static TnmSnmpSocket *asyncSocket = NULL;
+static TnmSnmpSocket **asyncSockets = NULL;
+static int numAsyncSockets = 0;
+static Tcl_Interp *asyncInterp = NULL;
+
+int tnmSnmpSockets = TNM_SNMP_SOCKETS;
+int tnmSnmpRecvBuffer = 0;
+
+/*
+ * The number of worker threads that serve the pool of asynchronous
+ * sockets. Worker k serves the sockets whose index modulo the number
+ * of workers is k. A worker signs and sends the messages queued for
+ * its sockets and parses the received messages with TnmSnmpParse(),
+ * which includes the verification of SNMPv3 digests. The parsed
+ * messages are queued as RecvEvents to the thread that opened the
+ * pool, which converts them into Tcl objects and evaluates the
+ * callbacks since these use the interpreter and the MIB tree. The
+ * pool sockets have no file handlers while the workers are running.
+ */
+
+int tnmSnmpThreads = 0;
+
+/*
+ * The authentication key of a message, which is signed right before
+ * it is sent. The algorithm is TNM_SNMP_AUTH_NONE for messages which
+ * are not signed.
+ */
+
+typedef struct SignInfo {
+    int algorithm;		/* The authentication algorithm. */
+    int keyLength;		/* The length of the key. */
+    u_char key[TNM_SNMP_AUTH_KEYSIZE];	/* The localized key. */
+} SignInfo;
+
+/*
+ * Messages queued for transmission on the asynchronous socket. The
+ * packets are copied into a single buffer since the request owning
+ * a packet may be deleted before the queue is flushed.
+ */
+
+int tnmSnmpSendBatch = TNM_SNMP_SENDBATCH;
+
+typedef struct XmitMsg {
+    int sock;			/* The socket used to send the packet. */
+    int index;			/* The index of the socket in the pool. */
+    int offset;			/* The offset of the packet in the buffer. */
+    struct sockaddr_in to;	/* The destination address. */
+    SignInfo sign;		/* The key used to sign the packet. */
+} XmitMsg;
+
+typedef struct XmitQueue {
+    int length;			/* The number of queued messages. */
+    int size;			/* The number of allocated messages. */
+    XmitMsg *xmit;		/* The offsets and destinations. */
+    TnmSocketMsg *msgs;		/* The messages passed to the socket. */
+    u_char *buffer;		/* The buffer holding the packets. */
+    int used;			/* The number of bytes used in the buffer. */
+    int space;			/* The size of the buffer. */
+    int idle;			/* Set if the idle handler is registered. */
+} XmitQueue;
+
+static XmitQueue xmitQueue = { 0, 0, NULL, NULL, NULL, 0, 0, 0 };
+
+#ifdef TCL_THREADS
+/*
+ * The part of a flushed transmit queue which is handed to a worker.
+ * The packets are copied behind the structure.
+ */
+
+typedef struct XmitJob {
+    int length;			/* The number of messages. */
+    TnmSocketMsg *msgs;		/* The messages passed to the socket. */
+    XmitMsg *xmit;		/* The offsets, destinations and keys. */
+    u_char *buffer;		/* The buffer holding the packets. */
+    struct XmitJob *nextPtr;	/* The next job for the worker. */
+} XmitJob;
+
+/*
+ * The sockets of a worker are copied when the workers are started
+ * so that the workers never look at the pool, which is owned by the
+ * thread that opened it. A worker is woken up by a datagram sent to
+ * its loopback wakeup socket when jobs have been queued for it. The
+ * job list is protected by the workerMutex.
+ */
+
+typedef struct Worker {
+    Tcl_ThreadId id;		/* The thread id of the worker. */
+    int numSockets;		/* The number of sockets served. */
+    TnmSnmpSocket **sockets;	/* The sockets served by the worker. */
+    int *socks;			/* The file descriptors of the sockets. */
+    int wakeup;			/* The wakeup socket. */
+    struct sockaddr_in wakeupAddr; /* The address of the wakeup socket. */
+    XmitJob *firstJob;		/* The jobs queued for the worker. */
+    XmitJob *lastJob;
+} Worker;
+
+static Worker *workers = NULL;
+static int numWorkers = 0;
+static int numThreads = 0;
+static volatile int stopWorkers = 0;
+static Tcl_ThreadId asyncThread;
+TCL_DECLARE_MUTEX(workerMutex)
+
+#define TNM_SNMP_WORKER_WAIT	100	/* ms between checks of stopWorkers */
+#endif
 
 /*
  * Shared socket used for all synchronous manager initiated 
@@ -40,6 +146,33 @@ static TnmSnmpSocket *syncSocket = NULL;
 
 TnmSnmpSocket *tnmSnmpSocketList = NULL;
 
+/*
+ * The number of messages read from an asynchronous socket whenever
+ * it becomes readable. The buffers used to receive a batch are
+ * allocated on demand and one batch is kept for reuse in freeBatch.
+ */
+
+int tnmSnmpRecvBatch = TNM_SNMP_RECVBATCH;
+
+typedef struct RecvBatch {
+    int size;			/* The number of messages in the batch. */
+    TnmSocketMsg *msgs;		/* The messages received in one call. */
+    struct sockaddr_in *from;	/* The addresses of the senders. */
+    u_char *packets;		/* The buffers for the messages. */
+} RecvBatch;
+
+static RecvBatch *freeBatch = NULL;
+
+#ifdef TCL_THREADS
+typedef struct RecvEvent {
+    Tcl_Event header;		/* The Tcl event header. */
+    TnmSnmpSocket *sockPtr;	/* The socket the messages were read from. */
+    unsigned int drops;		/* The drop counter reported by the socket. */
+    RecvBatch batch;		/* The received messages. */
+    TnmSnmpMsg **parsed;	/* The messages parsed by the worker. */
+} RecvEvent;
+#endif
+
 /*
  * A global variable for performance measurements.
  */
@@ -59,9 +192,61 @@ static void
 AgentProc		_ANSI_ARGS_((ClientData clientData, int mask));
 
 static int
-AgentRecv		_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
-				     u_char *packet, int *packetlen,
-				     struct sockaddr_in *from));
+ShardIndex		_ANSI_ARGS_((struct sockaddr_in *to));
+
+static int
+ResizePool		_ANSI_ARGS_((Tcl_Interp *interp, int size));
+
+static void
+SetRecvBuffer		_ANSI_ARGS_((TnmSnmpSocket *sockPtr));
+
+static void
+GetSignInfo		_ANSI_ARGS_((TnmSnmp *session, SignInfo *signPtr));
+
+static void
+SignPacket		_ANSI_ARGS_((SignInfo *signPtr,
+				     u_char *packet, int packetlen));
+
+static void
+XmitAppend		_ANSI_ARGS_((int sock, int index,
+				     u_char *packet, int packetlen,
+				     struct sockaddr_in *to, SignInfo *signPtr));
+static void
+XmitProc		_ANSI_ARGS_((ClientData clientData));
+
+static int
+XmitSend		_ANSI_ARGS_((XmitMsg *xmit, TnmSocketMsg *msgs,
+				     u_char *buffer, int length, int dump));
+
+static RecvBatch*
+AllocBatch		_ANSI_ARGS_((void));
+
+static void
+FreeBatch		_ANSI_ARGS_((RecvBatch *batch));
+
+static int
+RecvBatchProc		_ANSI_ARGS_((Tcl_Interp *interp,
+				     TnmSnmpSocket *sockPtr,
+				     RecvBatch *batch));
+static void
+DecodeBatch		_ANSI_ARGS_((Tcl_Interp *interp, RecvBatch *batch,
+				     TnmSnmpMsg **parsed, int n, char *where));
+static void
+StartWorkers		_ANSI_ARGS_((void));
+
+static void
+StopWorkers		_ANSI_ARGS_((void));
+
+#ifdef TCL_THREADS
+static void
+XmitHandOff		_ANSI_ARGS_((XmitQueue *q));
+
+static Tcl_ThreadCreateType
+WorkerProc		_ANSI_ARGS_((ClientData clientData));
+
+static int
+RecvEventProc		_ANSI_ARGS_((Tcl_Event *evPtr, int flags));
+#endif
 
 
 /*
@@ -138,6 +323,19 @@ TnmSnmpOpen(interp, addr)
     }
 #endif
 
+    /*
+     * Ask the kernel to report the number of datagrams dropped
+     * because the receive buffer was full. This is not an error
+     * if the system does not support it.
+     */
+
+#ifdef SO_RXQ_OVFL
+    {
+        int on = 1;
+	setsockopt(socket, SOL_SOCKET, SO_RXQ_OVFL, (char *) &on, sizeof(on));
+    }
+#endif
+
     sockPtr = (TnmSnmpSocket *) ckalloc(sizeof(TnmSnmpSocket));
     memset((char *) sockPtr, 0, sizeof(TnmSnmpSocket));
     sockPtr->sock = socket;
@@ -269,8 +467,8 @@ TnmSnmpWait(ms, flags)
     int width;
     TnmSnmpSocket *snmpSocket = NULL;
 
-    if (flags & TNM_SNMP_ASYNC) {
-	snmpSocket = asyncSocket;
+    if (flags & TNM_SNMP_ASYNC && numAsyncSockets) {
+	snmpSocket = asyncSockets[0];
     }
     if (flags & TNM_SNMP_SYNC) {
 	snmpSocket = syncSocket;
@@ -371,13 +569,14 @@ TnmSnmpManagerOpen(interp)
 	    return TCL_ERROR;
 	}
     }
-    if (! asyncSocket) {
-	asyncSocket = TnmSnmpOpen(interp, &addr);
-	if (! asyncSocket) {
+    if (! asyncInterp) {
+	asyncInterp = interp;
+	if (ResizePool(interp, tnmSnmpSockets) != TCL_OK) {
+	    ResizePool(NULL, 0);
+	    asyncInterp = NULL;
 	    return TCL_ERROR;
 	}
-	TnmCreateSocketHandler(asyncSocket->sock, TCL_READABLE, 
-			       ResponseProc, (ClientData) interp);
+	StartWorkers();
     }
     return TCL_OK;
 }
@@ -401,11 +600,247 @@ TnmSnmpManagerOpen(interp)
 void
 TnmSnmpManagerClose()
 {
-    TnmSnmpClose(asyncSocket);
-    asyncSocket = NULL;
+    TnmSnmpFlush();
+    StopWorkers();
+    ResizePool(NULL, 0);
+    asyncInterp = NULL;
     TnmSnmpClose(syncSocket);
     syncSocket = NULL;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpSetSockets --
+ *
+ *	This procedure applies the values of tnmSnmpSockets,
+ *	tnmSnmpRecvBuffer and tnmSnmpThreads to the pool of
+ *	asynchronous sockets. The pool is only changed if the
+ *	manager sockets are open.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	Sockets may be opened or closed. Requests in flight on a
+ *	closed socket are retransmitted on the remaining sockets.
+ *	The worker threads are restarted.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSnmpSetSockets(interp)
+    Tcl_Interp *interp;
+{
+    int i, code;
+
+    if (! asyncInterp) {
+	return TCL_OK;
+    }
+
+    StopWorkers();
+    for (i = 0; i < numAsyncSockets; i++) {
+	SetRecvBuffer(asyncSockets[i]);
+    }
+    code = ResizePool(interp, tnmSnmpSockets);
+    StartWorkers();
+    return code;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpGetSockets --
+ *
+ *	This procedure returns a description of the asynchronous
+ *	sockets. Every element of the list contains the local port
+ *	number, the size of the receive buffer and the number of
+ *	datagrams dropped because the receive buffer was full.
+ *
+ * Results:
+ *	A pointer to a new Tcl list object.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_Obj*
+TnmSnmpGetSockets(pattern)
+    char *pattern;
+{
+    Tcl_Obj *listPtr, *elemPtr;
+    struct sockaddr_in name;
+    socklen_t namelen, optlen;
+    int i, size;
+    char buf[20];
+
+    listPtr = Tcl_NewListObj(0, NULL);
+    for (i = 0; i < numAsyncSockets; i++) {
+	namelen = sizeof(name);
+	if (getsockname(asyncSockets[i]->sock,
+			(struct sockaddr *) &name, &namelen) != 0) {
+	    continue;
+	}
+	sprintf(buf, "%u", ntohs(name.sin_port));
+	if (pattern && ! Tcl_StringMatch(buf, pattern)) {
+	    continue;
+	}
+	size = 0;
+	optlen = sizeof(size);
+	getsockopt(asyncSockets[i]->sock, SOL_SOCKET, SO_RCVBUF,
+		   (char *) &size, &optlen);
+	elemPtr = Tcl_NewListObj(0, NULL);
+	Tcl_ListObjAppendElement(NULL, elemPtr, Tcl_NewStringObj(buf, -1));
+	Tcl_ListObjAppendElement(NULL, elemPtr, Tcl_NewIntObj(size));
+	Tcl_ListObjAppendElement(NULL, elemPtr,
+		 Tcl_NewWideIntObj((Tcl_WideInt) asyncSockets[i]->drops));
+	Tcl_ListObjAppendElement(NULL, listPtr, elemPtr);
+    }
+    return listPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ResizePool --
+ *
+ *	This procedure opens or closes asynchronous sockets until
+ *	the pool contains size sockets. Queued messages are flushed
+ *	before the pool is changed since the mapping of peers to
+ *	sockets changes.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	Sockets are opened or closed and socket handlers are
+ *	created or deleted.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ResizePool(interp, size)
+    Tcl_Interp *interp;
+    int size;
+{
+    struct sockaddr_in addr;
+    TnmSnmpSocket *sockPtr;
+
+    if (size == numAsyncSockets) {
+	return TCL_OK;
+    }
+
+    TnmSnmpFlush();
+
+    while (numAsyncSockets > size) {
+	TnmSnmpClose(asyncSockets[--numAsyncSockets]);
+    }
+
+    if (size == 0) {
+	if (asyncSockets) {
+	    ckfree((char *) asyncSockets);
+	    asyncSockets = NULL;
+	}
+	return TCL_OK;
+    }
+
+    if (asyncSockets) {
+	asyncSockets = (TnmSnmpSocket **) ckrealloc((char *) asyncSockets,
+				    size * sizeof(TnmSnmpSocket *));
+    } else {
+	asyncSockets = (TnmSnmpSocket **) ckalloc(size
+				    * sizeof(TnmSnmpSocket *));
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    while (numAsyncSockets < size) {
+	sockPtr = TnmSnmpOpen(interp, &addr);
+	if (! sockPtr) {
+	    return TCL_ERROR;
+	}
+	SetRecvBuffer(sockPtr);
+	TnmCreateSocketHandler(sockPtr->sock, TCL_READABLE, 
+			       ResponseProc, (ClientData) sockPtr);
+	asyncSockets[numAsyncSockets++] = sockPtr;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetRecvBuffer --
+ *
+ *	This procedure sets the size of the receive buffer of an
+ *	asynchronous socket to tnmSnmpRecvBuffer bytes. The system
+ *	default is kept if tnmSnmpRecvBuffer is 0.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The receive buffer size of the socket is changed. Systems
+ *	may silently limit the size.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SetRecvBuffer(sockPtr)
+    TnmSnmpSocket *sockPtr;
+{
+#ifdef SO_RCVBUF
+    int size = tnmSnmpRecvBuffer;
+
+    if (size > 0) {
+	setsockopt(sockPtr->sock, SOL_SOCKET, SO_RCVBUF,
+		   (char *) &size, sizeof(size));
+    }
+#endif
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ShardIndex --
+ *
+ *	This procedure selects the asynchronous socket used to talk
+ *	to a peer. The socket is selected by hashing the address and
+ *	port of the peer so that all requests to a peer and their
+ *	retransmissions use the same socket.
+ *
+ * Results:
+ *	The index of the socket in the pool. The pool must not be
+ *	empty.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ShardIndex(to)
+    struct sockaddr_in *to;
+{
+    unsigned int hash;
+
+    if (numAsyncSockets == 1 || ! to) {
+	return 0;
+    }
+
+    hash = (unsigned int) ntohl(to->sin_addr.s_addr) * 31
+	+ ntohs(to->sin_port);
+    hash *= 2654435761U;
+    return (int) ((hash >> 16) % numAsyncSockets);
+}
 
 /*
  *----------------------------------------------------------------------
@@ -547,6 +982,8 @@ TnmSnmpListenerClose(session)
  * TnmSnmpSend --
  *
  *	This procedure sends a packet to the destination address.
+ *	Authenticated SNMPv3 messages are signed with the key of
+ *	the session right before they are sent.
  *
  * Results:
  *	A standard Tcl result.
@@ -566,7 +1003,8 @@ TnmSnmpSend(interp, session, packet, packetlen, to, flags)
     struct sockaddr_in *to;
     int flags;
 {
-    int code, sock;
+    int code, sock, index = 0, queue = 0;
+    SignInfo sign;
 
     if (session->domain == TNM_SNMP_TCP_DOMAIN) {
 	/* 1 get suitable tcp socket */
@@ -579,13 +1017,36 @@ TnmSnmpSend(interp, session, packet, packetlen, to, flags)
     }
 
     sock = tnmSnmpSocketList ? tnmSnmpSocketList->sock : -1;
-    if (flags & TNM_SNMP_ASYNC && asyncSocket) {
-	sock = asyncSocket->sock;
+    if (flags & TNM_SNMP_ASYNC && numAsyncSockets) {
+	index = ShardIndex(to);
+	sock = asyncSockets[index]->sock;
+	queue = 1;
     }
     if (flags & TNM_SNMP_SYNC && syncSocket) {
 	sock = syncSocket->sock;
+	queue = 0;
+    }
+
+    GetSignInfo(session, &sign);
+
+    /*
+     * Queue the message if the caller allows us to do so. We do
+     * not queue in benchmark mode since the caller expects to find
+     * the time stamp of this message in tnmSnmpBenchMark. Messages
+     * still queued are sent before a synchronous request goes out.
+     */
+
+#ifndef TNM_SNMP_BENCH
+    if (flags & TNM_SNMP_QUEUED && tnmSnmpSendBatch > 1 && queue) {
+	XmitAppend(sock, index, packet, packetlen, to, &sign);
+	return TCL_OK;
+    }
+#endif
+    if (flags & TNM_SNMP_SYNC) {
+	TnmSnmpFlush();
     }
 
+    SignPacket(&sign, packet, packetlen);
     code = TnmSocketSendTo(sock, (char *) packet, (size_t) packetlen, 0, 
 			   (struct sockaddr *) to, sizeof(*to));
 
@@ -604,7 +1065,7 @@ TnmSnmpSend(interp, session, packet, packetlen, to, flags)
 
     if (hexdump) {
 	struct sockaddr_in name, *from = NULL;
-	int namelen = sizeof(name);
+	socklen_t namelen = sizeof(name);
 
 	if (getsockname(sock, (struct sockaddr *) &name, &namelen) == 0) {
 	    from = &name;
@@ -615,19 +1076,19 @@ TnmSnmpSend(interp, session, packet, packetlen, to, flags)
     
     return TCL_OK;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * TnmSnmpRecv --
+ * GetSignInfo --
  *
- *	This procedure reads incoming responses from the 
- *	manager socket.
+ *	This procedure copies the algorithm and the localized key
+ *	used to sign the messages of a session. The key is copied
+ *	since queued messages may be signed by a worker thread after
+ *	the session has been changed or deleted.
  *
  * Results:
- *	A standard Tcl result. The data and the length of the
- *	packet is stored in packet and packetlen. The address of
- *	the sender is stored in from.
+ *	None.
  *
  * Side effects:
  *	None.
@@ -635,89 +1096,323 @@ TnmSnmpSend(interp, session, packet, packetlen, to, flags)
  *----------------------------------------------------------------------
  */
 
-int
-TnmSnmpRecv(interp, packet, packetlen, from, flags)
-    Tcl_Interp *interp;
-    u_char *packet;
-    int	*packetlen;
-    struct sockaddr_in *from;
-    int flags;
+static void
+GetSignInfo(session, signPtr)
+    TnmSnmp *session;
+    SignInfo *signPtr;
 {
-    int	sock, fromlen = sizeof(*from);
-
-    if (! tnmSnmpSocketList) {
-	Tcl_SetResult(interp, "sendto failed: no open socket", TCL_STATIC);
-	return TCL_ERROR;
-    }
-
-    sock = tnmSnmpSocketList ? tnmSnmpSocketList->sock : -1;
-    if (flags & TNM_SNMP_ASYNC && asyncSocket) {
-	sock = asyncSocket->sock;
-    }
-    if (flags & TNM_SNMP_SYNC && syncSocket) {
-	sock = syncSocket->sock;
-    }
-
-    *packetlen = TnmSocketRecvFrom(sock, (char *) packet, (size_t) *packetlen, 0,
-				   (struct sockaddr *) from, &fromlen);
-
-    if (*packetlen == TNM_SOCKET_ERROR) {
-	Tcl_AppendResult(interp, "recvfrom failed: ",
-			 Tcl_PosixError(interp), (char *) NULL);
-	return TCL_ERROR;
-    }
-
-#ifdef TNM_SNMP_BENCH
-    Tcl_GetTime(&tnmSnmpBenchMark.recvTime);
-    tnmSnmpBenchMark.recvSize = *packetlen;
-#endif
-
-    if (hexdump) {
-	struct sockaddr_in name, *to = NULL;
-	int namelen = sizeof(name);
-
-	if (getsockname(sock, (struct sockaddr *) &name, &namelen) == 0) {
-	    to = &name;
+    signPtr->algorithm = TNM_SNMP_AUTH_NONE;
+    signPtr->keyLength = 0;
+
+#ifdef TNM_SNMPv3
+    if (session->version == TNM_SNMPv3
+	&& (session->securityLevel & TNM_SNMP_AUTH_MASK)
+	&& session->usmAuthKey) {
+	int algorithm = session->securityLevel & TNM_SNMP_AUTH_MASK;
+	int length;
+	char *key = TnmGetOctetStringFromObj(NULL, session->usmAuthKey,
+					     &length);
+	if (key && length == ((algorithm == TNM_SNMP_AUTH_MD5)
+			      ? TNM_MD5_SIZE : TNM_SHA_SIZE)) {
+	    signPtr->algorithm = algorithm;
+	    signPtr->keyLength = length;
+	    memcpy(signPtr->key, key, (size_t) length);
 	}
-
-	TnmSnmpDumpPacket(packet, *packetlen, from, to);
     }
-
-    return TCL_OK;
+#endif
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * AgentRecv --
+ * SignPacket --
  *
- *	This procedure reads from the socket to process incoming
- *	SNMP requests.
+ *	This procedure writes the digest of an authenticated SNMPv3
+ *	message into the message. It may be called from any thread.
  *
  * Results:
- *	A standard Tcl result.
+ *	None.
  *
  * Side effects:
- *	None.
+ *	The authentication parameters of the packet are modified.
  *
  *----------------------------------------------------------------------
  */
 
-static int
-AgentRecv(interp, session, packet, packetlen, from)
-    Tcl_Interp	*interp;
-    TnmSnmp *session;
+static void
+SignPacket(signPtr, packet, packetlen)
+    SignInfo *signPtr;
+    u_char *packet;
+    int packetlen;
+{
+#ifdef TNM_SNMPv3
+    if (signPtr->algorithm != TNM_SNMP_AUTH_NONE) {
+	TnmSnmpAuthOutMsg(signPtr->algorithm, signPtr->key,
+			  signPtr->keyLength, packet, packetlen);
+    }
+#endif
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * XmitAppend --
+ *
+ *	This procedure appends a message to the transmit queue. The
+ *	queue is flushed if it holds tnmSnmpSendBatch messages.
+ *	Otherwise, we make sure that it is flushed when the event
+ *	loop becomes idle.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The packet is copied and an idle handler may be registered.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+XmitAppend(sock, index, packet, packetlen, to, signPtr)
+    int sock;
+    int index;
     u_char *packet;
-    int *packetlen;
+    int packetlen;
+    struct sockaddr_in *to;
+    SignInfo *signPtr;
+{
+    XmitQueue *q = &xmitQueue;
+
+    if (q->length == q->size) {
+	q->size = q->size ? 2 * q->size : TNM_SNMP_SENDBATCH;
+	if (q->xmit) {
+	    q->xmit = (XmitMsg *) ckrealloc((char *) q->xmit,
+					    q->size * sizeof(XmitMsg));
+	    q->msgs = (TnmSocketMsg *) ckrealloc((char *) q->msgs,
+					    q->size * sizeof(TnmSocketMsg));
+	} else {
+	    q->xmit = (XmitMsg *) ckalloc(q->size * sizeof(XmitMsg));
+	    q->msgs = (TnmSocketMsg *) ckalloc(q->size * sizeof(TnmSocketMsg));
+	}
+    }
+
+    if (q->used + packetlen > q->space) {
+	while (q->used + packetlen > q->space) {
+	    q->space = q->space ? 2 * q->space : TNM_SNMP_MAXSIZE;
+	}
+	if (q->buffer) {
+	    q->buffer = (u_char *) ckrealloc((char *) q->buffer, q->space);
+	} else {
+	    q->buffer = (u_char *) ckalloc(q->space);
+	}
+    }
+
+    memcpy((char *) q->buffer + q->used, (char *) packet, packetlen);
+    q->xmit[q->length].sock = sock;
+    q->xmit[q->length].index = index;
+    q->xmit[q->length].offset = q->used;
+    q->xmit[q->length].to = *to;
+    q->xmit[q->length].sign = *signPtr;
+    q->msgs[q->length].len = packetlen;
+    q->used += packetlen;
+    q->length++;
+
+    if (q->length >= tnmSnmpSendBatch) {
+	TnmSnmpFlush();
+    } else if (! q->idle) {
+	Tcl_DoWhenIdle(XmitProc, (ClientData) NULL);
+	q->idle = 1;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * XmitProc --
+ *
+ *	This procedure is called when the event loop becomes idle
+ *	to transmit the queued messages.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Messages are sent.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+XmitProc(clientData)
+    ClientData clientData;
+{
+    xmitQueue.idle = 0;
+    TnmSnmpFlush();
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * XmitSend --
+ *
+ *	This procedure signs and transmits queued messages with as
+ *	few system calls as possible. Consecutive messages queued
+ *	for the same socket are passed to the socket together.
+ *	Messages which can not be sent are dropped, just like a
+ *	failed sendto() of a message which is not queued. The
+ *	retransmission timer takes care of them. It may be called
+ *	from any thread if dump is 0.
+ *
+ * Results:
+ *	The number of messages sent.
+ *
+ * Side effects:
+ *	Messages are sent and dumped if dump is set.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+XmitSend(xmit, msgs, buffer, length, dump)
+    XmitMsg *xmit;
+    TnmSocketMsg *msgs;
+    u_char *buffer;
+    int length;
+    int dump;
+{
+    int i, j, m, n, sock, sent = 0;
+
+    for (i = 0; i < length; i++) {
+	msgs[i].buf = (char *) buffer + xmit[i].offset;
+	msgs[i].addr = (struct sockaddr *) &xmit[i].to;
+	msgs[i].addrlen = sizeof(struct sockaddr_in);
+	SignPacket(&xmit[i].sign, (u_char *) msgs[i].buf, (int) msgs[i].len);
+    }
+
+    for (i = 0; i < length; i += n) {
+	sock = xmit[i].sock;
+	for (m = i + 1; m < length && xmit[m].sock == sock; m++) ;
+	n = TnmSocketSendMulti(sock, msgs + i, m - i, 0);
+	if (n == TNM_SOCKET_ERROR) {
+	    n = 1;
+	    continue;
+	}
+
+	sent += n;
+
+	if (dump) {
+	    struct sockaddr_in name, *from = NULL;
+	    socklen_t namelen = sizeof(name);
+
+	    if (getsockname(sock, (struct sockaddr *) &name, &namelen) == 0) {
+		from = &name;
+	    }
+
+	    for (j = i; j < i + n; j++) {
+		TnmSnmpDumpPacket((u_char *) msgs[j].buf,
+				  (int) msgs[j].len, from, &xmit[j].to);
+	    }
+	}
+    }
+
+    return sent;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpFlush --
+ *
+ *	This procedure transmits all queued messages. The messages
+ *	are handed to the worker threads which serve the sockets of
+ *	the messages if workers are running and sent by XmitSend()
+ *	otherwise. Messages handed to a worker are counted as sent.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Messages are sent and the transmit queue is emptied.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmSnmpFlush()
+{
+    XmitQueue *q = &xmitQueue;
+
+    if (q->idle) {
+	Tcl_CancelIdleCall(XmitProc, (ClientData) NULL);
+	q->idle = 0;
+    }
+
+    if (q->length == 0) {
+	return;
+    }
+
+    if (! numAsyncSockets) {
+	q->length = q->used = 0;
+	return;
+    }
+
+#ifdef TCL_THREADS
+    if (numWorkers && ! hexdump) {
+	XmitHandOff(q);
+	tnmSnmpStats.snmpOutPkts += q->length;
+	q->length = q->used = 0;
+	return;
+    }
+#endif
+
+    tnmSnmpStats.snmpOutPkts += XmitSend(q->xmit, q->msgs, q->buffer,
+					 q->length, hexdump);
+    q->length = q->used = 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpRecv --
+ *
+ *	This procedure reads incoming responses from the 
+ *	manager socket.
+ *
+ * Results:
+ *	A standard Tcl result. The data and the length of the
+ *	packet is stored in packet and packetlen. The address of
+ *	the sender is stored in from.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSnmpRecv(interp, packet, packetlen, from, flags)
+    Tcl_Interp *interp;
+    u_char *packet;
+    int	*packetlen;
     struct sockaddr_in *from;
+    int flags;
 {
-    int	sock = session->socket->sock, fromlen = sizeof(*from);
+    int	sock;
+    socklen_t fromlen = sizeof(*from);
 
-    if (! session->socket) {
-	Tcl_SetResult(interp, "recvfrom failed: no agent socket", TCL_STATIC);
+    if (! tnmSnmpSocketList) {
+	Tcl_SetResult(interp, "sendto failed: no open socket", TCL_STATIC);
 	return TCL_ERROR;
     }
 
+    sock = tnmSnmpSocketList ? tnmSnmpSocketList->sock : -1;
+    if (flags & TNM_SNMP_ASYNC && numAsyncSockets) {
+	sock = asyncSockets[0]->sock;
+    }
+    if (flags & TNM_SNMP_SYNC && syncSocket) {
+	sock = syncSocket->sock;
+    }
+
     *packetlen = TnmSocketRecvFrom(sock, (char *) packet, (size_t) *packetlen, 0,
 				   (struct sockaddr *) from, &fromlen);
 
@@ -727,9 +1422,14 @@ AgentRecv(interp, session, packet, packetlen, from)
 	return TCL_ERROR;
     }
 
+#ifdef TNM_SNMP_BENCH
+    Tcl_GetTime(&tnmSnmpBenchMark.recvTime);
+    tnmSnmpBenchMark.recvSize = *packetlen;
+#endif
+
     if (hexdump) {
 	struct sockaddr_in name, *to = NULL;
-	int namelen = sizeof(name);
+	socklen_t namelen = sizeof(name);
 
 	if (getsockname(sock, (struct sockaddr *) &name, &namelen) == 0) {
 	    to = &name;
@@ -741,12 +1441,214 @@ AgentRecv(interp, session, packet, packetlen, from)
     return TCL_OK;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * AllocBatch --
+ *
+ *	This procedure returns a batch of receive buffers. We reuse
+ *	the cached batch if it is available and has the right size.
+ *	A new batch is allocated otherwise, e.g. if a callback
+ *	processed while decoding a batch re-enters the event loop.
+ *
+ * Results:
+ *	A pointer to the batch.
+ *
+ * Side effects:
+ *	Memory is allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static RecvBatch*
+AllocBatch()
+{
+    RecvBatch *batch = freeBatch;
+    int size = tnmSnmpRecvBatch;
+
+    freeBatch = NULL;
+    if (batch && batch->size == size) {
+	return batch;
+    }
+    if (batch) {
+	ckfree((char *) batch);
+    }
+
+    batch = (RecvBatch *) ckalloc(sizeof(RecvBatch)
+				  + size * sizeof(TnmSocketMsg)
+				  + size * sizeof(struct sockaddr_in)
+				  + size * TNM_SNMP_MAXSIZE);
+    batch->size = size;
+    batch->msgs = (TnmSocketMsg *) (batch + 1);
+    batch->from = (struct sockaddr_in *) (batch->msgs + size);
+    batch->packets = (u_char *) (batch->from + size);
+    return batch;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeBatch --
+ *
+ *	This procedure releases a batch of receive buffers. The
+ *	batch is kept for reuse unless we already have one cached
+ *	or the batch size has been changed in the meantime.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory may be freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeBatch(batch)
+    RecvBatch *batch;
+{
+    if (! freeBatch && batch->size == tnmSnmpRecvBatch) {
+	freeBatch = batch;
+    } else {
+	ckfree((char *) batch);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RecvBatchProc --
+ *
+ *	This procedure reads all pending messages from an asynchronous
+ *	socket, up to the size of the batch. The drop counter of the
+ *	socket is updated if the system reports dropped datagrams.
+ *
+ * Results:
+ *	The number of messages received or TNM_SOCKET_ERROR if no
+ *	message could be read. An error message is left in the
+ *	interpreter in the latter case.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+RecvBatchProc(interp, sockPtr, batch)
+    Tcl_Interp *interp;
+    TnmSnmpSocket *sockPtr;
+    RecvBatch *batch;
+{
+    int i, n, sock = sockPtr->sock;
+
+    for (i = 0; i < batch->size; i++) {
+	batch->msgs[i].buf = (char *) batch->packets + i * TNM_SNMP_MAXSIZE;
+	batch->msgs[i].len = TNM_SNMP_MAXSIZE;
+	batch->msgs[i].addr = (struct sockaddr *) &batch->from[i];
+	batch->msgs[i].addrlen = sizeof(struct sockaddr_in);
+    }
+
+    n = TnmSocketRecvMulti(sock, batch->msgs, batch->size, 0);
+    if (n == TNM_SOCKET_ERROR) {
+	Tcl_AppendResult(interp, "recvfrom failed: ",
+			 Tcl_PosixError(interp), (char *) NULL);
+	return TNM_SOCKET_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+	if (batch->msgs[i].drops > sockPtr->drops) {
+	    sockPtr->drops = batch->msgs[i].drops;
+	}
+    }
+
+#ifdef TNM_SNMP_BENCH
+    Tcl_GetTime(&tnmSnmpBenchMark.recvTime);
+#endif
+
+    if (hexdump) {
+	struct sockaddr_in name, *to = NULL;
+	socklen_t namelen = sizeof(name);
+
+	if (getsockname(sock, (struct sockaddr *) &name, &namelen) == 0) {
+	    to = &name;
+	}
+
+	for (i = 0; i < n; i++) {
+	    TnmSnmpDumpPacket((u_char *) batch->msgs[i].buf,
+			      (int) batch->msgs[i].len, &batch->from[i], to);
+	}
+    }
+
+    return n;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DecodeBatch --
+ *
+ *	This procedure decodes and processes the messages of a batch
+ *	back to back. The messages have already been parsed by a
+ *	worker thread if parsed is not NULL. Errors are reported as
+ *	background errors.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Callbacks bound to the received messages are evaluated. The
+ *	parsed messages which have been processed are released and
+ *	their slots in parsed are cleared.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+DecodeBatch(interp, batch, parsed, n, where)
+    Tcl_Interp *interp;
+    RecvBatch *batch;
+    TnmSnmpMsg **parsed;
+    int n;
+    char *where;
+{
+    int i, code;
+    TnmSnmpMsg *msg;
+
+    Tcl_Preserve((ClientData) interp);
+    for (i = 0; i < n && ! Tcl_InterpDeleted(interp); i++) {
+	Tcl_ResetResult(interp);
+#ifdef TNM_SNMP_BENCH
+	tnmSnmpBenchMark.recvSize = (int) batch->msgs[i].len;
+#endif
+	if (parsed) {
+	    msg = parsed[i];
+	    parsed[i] = NULL;
+	} else {
+	    msg = TnmSnmpParse((u_char *) batch->msgs[i].buf,
+			       (int) batch->msgs[i].len);
+	}
+	code = TnmSnmpDecodeMsg(interp, msg, &batch->from[i],
+				NULL, NULL, NULL, NULL);
+	TnmSnmpFreeMsg(msg);
+	if (code == TCL_ERROR) {
+	    Tcl_AddErrorInfo(interp, where);
+	    Tcl_BackgroundError(interp);
+	}
+	if (code == TCL_CONTINUE && hexdump) {
+	    TnmWriteMessage(interp->result);
+	    TnmWriteMessage("\n");
+	}
+    }
+    Tcl_Release((ClientData) interp);
+}
+
 /*
  *----------------------------------------------------------------------
  *
  * TnmSnmpTimeoutProc --
  *
- *	This procedure is called from the event dispatcher whenever
+ *	This procedure is called from the timing wheel whenever
  *	a timeout occurs so that we can retransmit packets.
  *
  * Results:
@@ -769,7 +1671,7 @@ TnmSnmpTimeoutProc(clientData)
     if (request->sends < (1 + session->retries)) {
 	
 	/* 
-	 * Reinstall TimerHandler for this request and retransmit
+	 * Reschedule the timer for this request and retransmit
 	 * this request (keeping the original oid).
 	 */
 	
@@ -779,8 +1681,12 @@ TnmSnmpTimeoutProc(clientData)
 	}
 #endif
 	TnmSnmpDelay(session);
+	if (request->sends == 0) {
+	    Tcl_GetTime(&request->sendTime);
+	}
 	TnmSnmpSend(interp, session, request->packet, request->packetlen, 
-		    &session->maddr, TNM_SNMP_ASYNC);
+		    &session->maddr, (session->delay > 0) ? TNM_SNMP_ASYNC
+		    : TNM_SNMP_ASYNC | TNM_SNMP_QUEUED);
 #ifdef TNM_SNMP_BENCH
 	if (request->stats.sendSize == 0) {
 	    request->stats.sendSize = tnmSnmpBenchMark.sendSize;
@@ -788,9 +1694,8 @@ TnmSnmpTimeoutProc(clientData)
 	}
 #endif
         request->sends++;
-	request->timer = Tcl_CreateTimerHandler(
-			(session->timeout * 1000) / (session->retries + 1),
-			TnmSnmpTimeoutProc, (ClientData) request);
+	TnmSnmpStartTimer(request,
+			  (session->timeout * 1000) / (session->retries + 1));
 
     } else {
 
@@ -809,6 +1714,9 @@ TnmSnmpTimeoutProc(clientData)
 	pdu->errorStatus = TNM_SNMP_NORESPONSE;
 	Tcl_DStringInit(&pdu->varbind);
 
+	TnmSnmpAdaptRepetitions(session, request->bulk, pdu->errorStatus,
+				NULL, 0, NULL);
+
 	Tcl_Preserve((ClientData) request);
 	Tcl_Preserve((ClientData) session);
 	TnmSnmpDeleteRequest(request);
@@ -843,27 +1751,23 @@ ResponseProc(clientData, mask)
     ClientData	clientData;
     int mask;
 {
-    Tcl_Interp *interp = (Tcl_Interp *) clientData;
-    u_char packet[TNM_SNMP_MAXSIZE];
-    int code, packetlen = TNM_SNMP_MAXSIZE;
-    struct sockaddr_in from;
+    TnmSnmpSocket *sockPtr = (TnmSnmpSocket *) clientData;
+    Tcl_Interp *interp = asyncInterp;
+    RecvBatch *batch;
+    int n;
 
-    Tcl_ResetResult(interp);
-    code = TnmSnmpRecv(interp, packet, &packetlen, &from, TNM_SNMP_ASYNC);
-    if (code != TCL_OK) return;
+    if (! interp) return;
 
-    code = TnmSnmpDecode(interp, packet, packetlen, &from, 
-			 NULL, NULL, NULL, NULL);
-    if (code == TCL_ERROR) {
-	Tcl_AddErrorInfo(interp, "\n    (snmp response event)");
-	Tcl_BackgroundError(interp);
-    }
-    if (code == TCL_CONTINUE && hexdump) {
-	TnmWriteMessage(interp->result);
-	TnmWriteMessage("\n");
+    Tcl_ResetResult(interp);
+    batch = AllocBatch();
+    n = RecvBatchProc(interp, sockPtr, batch);
+    if (n != TNM_SOCKET_ERROR) {
+	DecodeBatch(interp, batch, NULL, n, "\n    (snmp response event)");
     }
+    FreeBatch(batch);
+    TnmSnmpFlush();
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -888,24 +1792,498 @@ AgentProc(clientData, mask)
 {
     TnmSnmp *session = (TnmSnmp *) clientData;
     Tcl_Interp *interp = session->interp;
-    u_char packet[TNM_SNMP_MAXSIZE];
-    int code, packetlen = TNM_SNMP_MAXSIZE;
-    struct sockaddr_in from;
+    RecvBatch *batch;
+    int n;
 
-    if (! interp) return;
+    if (! interp || ! session->socket) return;
 
     Tcl_ResetResult(interp);
-    code = AgentRecv(interp, session, packet, &packetlen, &from);
-    if (code != TCL_OK) return;
-    
-    code = TnmSnmpDecode(interp, packet, packetlen, &from, 
-			 NULL, NULL, NULL, NULL);
-    if (code == TCL_ERROR) {
-	Tcl_AddErrorInfo(interp, "\n    (snmp agent event)");
-	Tcl_BackgroundError(interp);
+    batch = AllocBatch();
+    n = RecvBatchProc(interp, session->socket, batch);
+    if (n != TNM_SOCKET_ERROR) {
+	DecodeBatch(interp, batch, NULL, n, "\n    (snmp agent event)");
+    }
+    FreeBatch(batch);
+    TnmSnmpFlush();
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StartWorkers --
+ *
+ *	This procedure starts tnmSnmpThreads worker threads which
+ *	serve the pool of asynchronous sockets. No more workers than
+ *	sockets are started. Every worker gets a copy of its part of
+ *	the pool and a wakeup socket. The file handlers of the pool
+ *	sockets are removed while the workers are running. No workers
+ *	are started if a socket can not be used with select().
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Threads and wakeup sockets are created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+StartWorkers()
+{
+#ifdef TCL_THREADS
+    int i, k, n = tnmSnmpThreads;
+    Worker *workerPtr;
+    socklen_t namelen;
+
+    if (numWorkers || n == 0 || numAsyncSockets == 0) {
+	return;
+    }
+    if (n > numAsyncSockets) {
+	n = numAsyncSockets;
+    }
+    for (i = 0; i < numAsyncSockets; i++) {
+	if (asyncSockets[i]->sock >= FD_SETSIZE) {
+	    return;
+	}
+    }
+
+    workers = (Worker *) ckalloc(n * sizeof(Worker));
+    memset((char *) workers, 0, n * sizeof(Worker));
+    for (k = 0; k < n; k++) {
+	workerPtr = &workers[k];
+	workerPtr->sockets = (TnmSnmpSocket **) ckalloc(
+	    (numAsyncSockets / n + 1) * sizeof(TnmSnmpSocket *));
+	workerPtr->socks = (int *) ckalloc(
+	    (numAsyncSockets / n + 1) * sizeof(int));
+	for (i = k; i < numAsyncSockets; i += n) {
+	    workerPtr->sockets[workerPtr->numSockets] = asyncSockets[i];
+	    workerPtr->socks[workerPtr->numSockets] = asyncSockets[i]->sock;
+	    workerPtr->numSockets++;
+	}
+
+	workerPtr->wakeupAddr.sin_family = AF_INET;
+	workerPtr->wakeupAddr.sin_port = 0;
+	workerPtr->wakeupAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	namelen = sizeof(workerPtr->wakeupAddr);
+	workerPtr->wakeup = TnmSocket(AF_INET, SOCK_DGRAM, 0);
+	if (workerPtr->wakeup == TNM_SOCKET_ERROR
+	    || TnmSocketBind(workerPtr->wakeup,
+			     (struct sockaddr *) &workerPtr->wakeupAddr,
+			     sizeof(workerPtr->wakeupAddr)) == TNM_SOCKET_ERROR
+	    || getsockname(workerPtr->wakeup,
+			   (struct sockaddr *) &workerPtr->wakeupAddr,
+			   &namelen) != 0
+	    || workerPtr->wakeup >= FD_SETSIZE) {
+	    break;
+	}
+    }
+
+    /*
+     * Keep the socket handlers if a wakeup socket could not be
+     * created. Everything done so far is cleaned up by StopWorkers().
+     */
+
+    numWorkers = (k < n) ? k + 1 : n;
+    if (k < n) {
+	StopWorkers();
+	return;
+    }
+
+    for (i = 0; i < numAsyncSockets; i++) {
+	TnmDeleteSocketHandler(asyncSockets[i]->sock);
+    }
+
+    asyncThread = Tcl_GetCurrentThread();
+    stopWorkers = 0;
+    for (k = 0; k < n; k++) {
+	if (Tcl_CreateThread(&workers[k].id, WorkerProc,
+			     (ClientData) &workers[k],
+			     TCL_THREAD_STACK_DEFAULT,
+			     TCL_THREAD_JOINABLE) != TCL_OK) {
+	    break;
+	}
+	numThreads++;
+    }
+
+    /*
+     * Fall back to socket handlers if a thread could not be started.
+     * The sockets of the missing worker would not be served otherwise.
+     */
+
+    if (numThreads < n) {
+	StopWorkers();
+    }
+#endif
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StopWorkers --
+ *
+ *	This procedure stops all worker threads and waits until
+ *	they have terminated. Jobs which have not been processed by
+ *	a worker are sent by the calling thread. The file handlers
+ *	of the pool sockets are restored afterwards.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Threads are terminated and wakeup sockets are closed.
+ *	Received messages that are still queued as events are
+ *	processed later.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+StopWorkers()
+{
+#ifdef TCL_THREADS
+    int i, k, result, restore = (numThreads > 0);
+    XmitJob *jobPtr, *nextPtr;
+    Worker *workerPtr;
+
+    if (! workers) {
+	return;
+    }
+
+    stopWorkers = 1;
+    for (k = 0; k < numThreads; k++) {
+	Tcl_JoinThread(workers[k].id, &result);
+    }
+
+    for (k = 0; k < numWorkers; k++) {
+	workerPtr = &workers[k];
+	for (jobPtr = workerPtr->firstJob; jobPtr; jobPtr = nextPtr) {
+	    nextPtr = jobPtr->nextPtr;
+	    XmitSend(jobPtr->xmit, jobPtr->msgs, jobPtr->buffer,
+		     jobPtr->length, 0);
+	    ckfree((char *) jobPtr);
+	}
+	if (workerPtr->wakeup != TNM_SOCKET_ERROR) {
+	    TnmSocketClose(workerPtr->wakeup);
+	}
+	ckfree((char *) workerPtr->sockets);
+	ckfree((char *) workerPtr->socks);
+    }
+    ckfree((char *) workers);
+    workers = NULL;
+    numWorkers = 0;
+    numThreads = 0;
+    stopWorkers = 0;
+
+    if (restore) {
+	for (i = 0; i < numAsyncSockets; i++) {
+	    TnmCreateSocketHandler(asyncSockets[i]->sock, TCL_READABLE,
+				   ResponseProc, (ClientData) asyncSockets[i]);
+	}
+    }
+#endif
+}
+
+#ifdef TCL_THREADS
+/*
+ *----------------------------------------------------------------------
+ *
+ * XmitHandOff --
+ *
+ *	This procedure splits the transmit queue into one job for
+ *	every worker that serves a socket used by the queued messages.
+ *	The jobs are appended to the job lists of the workers, which
+ *	are woken up by a datagram sent to their wakeup socket.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The packets are copied into the jobs.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+XmitHandOff(q)
+    XmitQueue *q;
+{
+    int i, k, n, len;
+    XmitJob *jobPtr;
+    Worker *workerPtr;
+    u_char *p;
+
+    for (k = 0; k < numWorkers; k++) {
+	workerPtr = &workers[k];
+	for (i = 0, n = 0, len = 0; i < q->length; i++) {
+	    if (q->xmit[i].index % numWorkers == k) {
+		n++;
+		len += (int) q->msgs[i].len;
+	    }
+	}
+	if (n == 0) {
+	    continue;
+	}
+
+	jobPtr = (XmitJob *) ckalloc(sizeof(XmitJob)
+				     + n * sizeof(TnmSocketMsg)
+				     + n * sizeof(XmitMsg) + len);
+	jobPtr->length = n;
+	jobPtr->msgs = (TnmSocketMsg *) (jobPtr + 1);
+	jobPtr->xmit = (XmitMsg *) (jobPtr->msgs + n);
+	jobPtr->buffer = (u_char *) (jobPtr->xmit + n);
+	jobPtr->nextPtr = NULL;
+	for (i = 0, n = 0, p = jobPtr->buffer; i < q->length; i++) {
+	    if (q->xmit[i].index % numWorkers != k) {
+		continue;
+	    }
+	    memcpy(p, q->buffer + q->xmit[i].offset, q->msgs[i].len);
+	    jobPtr->xmit[n] = q->xmit[i];
+	    jobPtr->xmit[n].offset = p - jobPtr->buffer;
+	    jobPtr->msgs[n].len = q->msgs[i].len;
+	    p += q->msgs[i].len;
+	    n++;
+	}
+
+	Tcl_MutexLock(&workerMutex);
+	if (workerPtr->lastJob) {
+	    workerPtr->lastJob->nextPtr = jobPtr;
+	} else {
+	    workerPtr->firstJob = jobPtr;
+	}
+	workerPtr->lastJob = jobPtr;
+	Tcl_MutexUnlock(&workerMutex);
+
+	TnmSocketSendTo(workerPtr->wakeup, "", 1, 0,
+			(struct sockaddr *) &workerPtr->wakeupAddr,
+			sizeof(workerPtr->wakeupAddr));
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WorkerProc --
+ *
+ *	This procedure is the main loop of a worker thread. It waits
+ *	until one of its sockets becomes readable or until it is
+ *	woken up. Jobs queued for the worker are signed and sent.
+ *	Batches of received messages are copied, parsed and queued
+ *	to the thread that owns the pool. The worker only uses its
+ *	copy of the pool, which is not changed while it is running.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Messages are sent and events are queued to the thread that
+ *	owns the pool.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_ThreadCreateType
+WorkerProc(clientData)
+    ClientData clientData;
+{
+    Worker *workerPtr = (Worker *) clientData;
+    int size = tnmSnmpRecvBatch;
+    TnmSocketMsg *msgs, wakeMsgs[TNM_SNMP_RECVBATCH];
+    struct sockaddr_in *from, wakeFrom[TNM_SNMP_RECVBATCH];
+    char wakeBuf[TNM_SNMP_RECVBATCH];
+    u_char *packets, *p;
+    struct timeval wait;
+    fd_set readfds;
+    int i, j, n, len, sock, width;
+    RecvEvent *evPtr;
+    XmitJob *jobPtr, *nextPtr;
+    unsigned int drops;
+
+    msgs = (TnmSocketMsg *) ckalloc(size * (sizeof(TnmSocketMsg)
+			    + sizeof(struct sockaddr_in) + TNM_SNMP_MAXSIZE));
+    from = (struct sockaddr_in *) (msgs + size);
+    packets = (u_char *) (from + size);
+
+    while (! stopWorkers) {
+	FD_ZERO(&readfds);
+	FD_SET(workerPtr->wakeup, &readfds);
+	width = workerPtr->wakeup + 1;
+	for (i = 0; i < workerPtr->numSockets; i++) {
+	    sock = workerPtr->socks[i];
+	    FD_SET(sock, &readfds);
+	    if (sock >= width) {
+		width = sock + 1;
+	    }
+	}
+	wait.tv_sec = 0;
+	wait.tv_usec = TNM_SNMP_WORKER_WAIT * 1000;
+	if (select(width, &readfds, NULL, NULL, &wait) <= 0) {
+	    continue;
+	}
+
+	/*
+	 * Drain the wakeup socket before we take the jobs so that
+	 * a wakeup for jobs queued meanwhile is not lost.
+	 */
+
+	if (FD_ISSET(workerPtr->wakeup, &readfds)) {
+	    do {
+		for (j = 0; j < TNM_SNMP_RECVBATCH; j++) {
+		    wakeMsgs[j].buf = wakeBuf + j;
+		    wakeMsgs[j].len = 1;
+		    wakeMsgs[j].addr = (struct sockaddr *) &wakeFrom[j];
+		    wakeMsgs[j].addrlen = sizeof(struct sockaddr_in);
+		}
+		n = TnmSocketRecvMulti(workerPtr->wakeup, wakeMsgs,
+				       TNM_SNMP_RECVBATCH, 0);
+	    } while (n == TNM_SNMP_RECVBATCH);
+
+	    Tcl_MutexLock(&workerMutex);
+	    jobPtr = workerPtr->firstJob;
+	    workerPtr->firstJob = workerPtr->lastJob = NULL;
+	    Tcl_MutexUnlock(&workerMutex);
+
+	    for (; jobPtr; jobPtr = nextPtr) {
+		nextPtr = jobPtr->nextPtr;
+		XmitSend(jobPtr->xmit, jobPtr->msgs, jobPtr->buffer,
+			 jobPtr->length, 0);
+		ckfree((char *) jobPtr);
+	    }
+	}
+
+	for (i = 0; i < workerPtr->numSockets; i++) {
+	    sock = workerPtr->socks[i];
+	    if (! FD_ISSET(sock, &readfds)) {
+		continue;
+	    }
+	    for (j = 0; j < size; j++) {
+		msgs[j].buf = (char *) packets + j * TNM_SNMP_MAXSIZE;
+		msgs[j].len = TNM_SNMP_MAXSIZE;
+		msgs[j].addr = (struct sockaddr *) &from[j];
+		msgs[j].addrlen = sizeof(struct sockaddr_in);
+	    }
+	    n = TnmSocketRecvMulti(sock, msgs, size, 0);
+	    if (n == TNM_SOCKET_ERROR || n == 0) {
+		continue;
+	    }
+
+	    len = 0, drops = 0;
+	    for (j = 0; j < n; j++) {
+		len += (int) msgs[j].len;
+		if (msgs[j].drops > drops) {
+		    drops = msgs[j].drops;
+		}
+	    }
+
+	    evPtr = (RecvEvent *) ckalloc(sizeof(RecvEvent)
+				  + n * sizeof(TnmSocketMsg)
+				  + n * sizeof(TnmSnmpMsg *)
+				  + n * sizeof(struct sockaddr_in) + len);
+	    evPtr->header.proc = RecvEventProc;
+	    evPtr->sockPtr = workerPtr->sockets[i];
+	    evPtr->drops = drops;
+	    evPtr->batch.size = n;
+	    evPtr->batch.msgs = (TnmSocketMsg *) (evPtr + 1);
+	    evPtr->parsed = (TnmSnmpMsg **) (evPtr->batch.msgs + n);
+	    evPtr->batch.from = (struct sockaddr_in *) (evPtr->parsed + n);
+	    evPtr->batch.packets = (u_char *) (evPtr->batch.from + n);
+	    for (j = 0, p = evPtr->batch.packets; j < n; j++) {
+		memcpy(p, msgs[j].buf, msgs[j].len);
+		evPtr->batch.msgs[j] = msgs[j];
+		evPtr->batch.msgs[j].buf = (char *) p;
+		evPtr->batch.from[j] = from[j];
+		evPtr->batch.msgs[j].addr =
+		    (struct sockaddr *) &evPtr->batch.from[j];
+		evPtr->parsed[j] = TnmSnmpParse(p, (int) msgs[j].len);
+		p += msgs[j].len;
+	    }
+	    Tcl_ThreadQueueEvent(asyncThread, (Tcl_Event *) evPtr,
+				 TCL_QUEUE_TAIL);
+	    Tcl_ThreadAlert(asyncThread);
+	}
+    }
+
+    ckfree((char *) msgs);
+    Tcl_ExitThread(TCL_OK);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RecvEventProc --
+ *
+ *	This procedure is called from the event dispatcher to process
+ *	a batch of messages received and parsed by a worker thread.
+ *	The batch is dropped if the manager sockets have been closed
+ *	meanwhile.
+ *
+ * Results:
+ *	1 if the event has been processed and 0 if it must be
+ *	deferred since file events are not serviced.
+ *
+ * Side effects:
+ *	Callbacks bound to the received messages are evaluated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+RecvEventProc(evPtr, flags)
+    Tcl_Event *evPtr;
+    int flags;
+{
+    RecvEvent *recvPtr = (RecvEvent *) evPtr;
+    Tcl_Interp *interp = asyncInterp;
+    struct sockaddr_in name, *to = NULL;
+    socklen_t namelen = sizeof(name);
+    int i;
+
+    if (! (flags & TCL_FILE_EVENTS)) {
+	return 0;
     }
-    if (code == TCL_CONTINUE && hexdump) {
-	TnmWriteMessage(interp->result);
-	TnmWriteMessage("\n");
+
+    if (interp) {
+	for (i = 0; i < numAsyncSockets; i++) {
+	    if (asyncSockets[i] == recvPtr->sockPtr) {
+		if (recvPtr->drops > recvPtr->sockPtr->drops) {
+		    recvPtr->sockPtr->drops = recvPtr->drops;
+		}
+		if (getsockname(recvPtr->sockPtr->sock,
+				(struct sockaddr *) &name, &namelen) == 0) {
+		    to = &name;
+		}
+		break;
+	    }
+	}
+
+#ifdef TNM_SNMP_BENCH
+	Tcl_GetTime(&tnmSnmpBenchMark.recvTime);
+#endif
+
+	if (hexdump) {
+	    for (i = 0; i < recvPtr->batch.size; i++) {
+		TnmSnmpDumpPacket((u_char *) recvPtr->batch.msgs[i].buf,
+				  (int) recvPtr->batch.msgs[i].len,
+				  &recvPtr->batch.from[i], to);
+	    }
+	}
+
+	DecodeBatch(interp, &recvPtr->batch, recvPtr->parsed,
+		    recvPtr->batch.size, "\n    (snmp response event)");
+	TnmSnmpFlush();
     }
+
+    /*
+     * Release the messages which have not been processed because
+     * the interpreter is gone.
+     */
+
+    for (i = 0; i < recvPtr->batch.size; i++) {
+	if (recvPtr->parsed[i]) {
+	    TnmSnmpFreeMsg(recvPtr->parsed[i]);
+	}
+    }
+    return 1;
 }
+#endif
@@ -24,11 +24,35 @@
 extern int hexdump;
 
 /*
- * A structure to keep the important parts of the message header 
- * while processing incoming SNMP messages.
+ * A structure to keep the important parts of a received message.
+ * TnmSnmpParse() fills it without using Tcl objects, the MIB tree
+ * or the SNMP statistics so that messages can be parsed in any
+ * thread. The statistics are counted and the varbinds are converted
+ * into Tcl objects by TnmSnmpDecodeMsg() in the thread which owns
+ * the sessions. All pointers point into the packet, which must not
+ * be freed while the message is in use.
  */
 
-typedef struct Message {
+typedef struct VarBind {
+    int name;			/* The offset of the name in oids. */
+    int nameLength;		/* The number of sub-identifiers. */
+    u_char tag;			/* The ASN.1 tag of the value. */
+    int intValue;		/* Integer values or the offset of an
+				 * object identifier value in oids. */
+    int length;			/* The length of octet strings and
+				 * object identifier values. */
+    TnmUnsigned64 u64Value;	/* Counter64 values. */
+    char *octets;		/* Octet string values. */
+} VarBind;
+
+struct TnmSnmpMsg {
+    u_char *packet;		/* The packet containing the message. */
+    int packetlen;		/* The length of the packet. */
+    int code;			/* TCL_ERROR if the message is invalid. */
+    char *error;		/* The error message if it is invalid. */
+    TnmBer ber;			/* The BER decoder state. */
+    int badVersions;		/* Statistics counted by TnmSnmpDecodeMsg. */
+    int parseErrs;
     int version;
     int comLen;
     u_char *com;
@@ -53,7 +77,33 @@ typedef struct Message {
     int engineIDLength;
     int engineBoots;
     int engineTime;
-} Message;
+    int authentic;		/* Set if the digest has been verified. */
+    int authAlgorithm;		/* The algorithm and the key which */
+    u_char authKey[TNM_SNMP_AUTH_KEYSIZE]; /* produced the digest. */
+    int authKeyLength;
+    int type;			/* The fields of the PDU. */
+    int requestId;
+    int errorStatus;
+    int errorIndex;
+    char *context;
+    int contextLength;
+    char *contextEngineID;
+    int contextEngineIDLength;
+    int enterprise;		/* The fields of SNMPv1 traps. */
+    int enterpriseLength;
+    int generic;
+    int specific;
+    int timeStamp;
+    int hasVbList;		/* Set if the PDU has a varbind list. */
+    int vbc;			/* The number of varbinds. */
+    int vbSize;			/* The number of allocated varbinds. */
+    VarBind *vbs;		/* The varbinds. */
+    int oidc;			/* The number of used sub-identifiers. */
+    int oidSize;		/* The number of allocated sub-identifiers. */
+    Tnm_Oid *oids;		/* The object identifiers. */
+};
+
+typedef struct TnmSnmpMsg Message;
 
 /*
  * Forward declarations for procedures defined later in this file:
@@ -66,18 +116,16 @@ Authentic		_ANSI_ARGS_((TnmSnmp *session,
 				     u_int **snmpStatPtr));
 
 static int
-DecodeMessage		_ANSI_ARGS_((Tcl_Interp	*interp, 
-				     Message *msg, TnmSnmpPdu *pdu,
-				     TnmBer *ber));
+DecodeMessage		_ANSI_ARGS_((Message *msg, TnmBer *ber));
+
 static TnmBer*
-DecodeHeader		_ANSI_ARGS_((Message *msg, TnmSnmpPdu *pdu,
-				     TnmBer *ber));
+DecodeHeader		_ANSI_ARGS_((Message *msg, TnmBer *ber));
+
 static TnmBer*
-DecodeScopedPDU		_ANSI_ARGS_((TnmBer *ber, TnmSnmpPdu *pdu));
+DecodeScopedPDU		_ANSI_ARGS_((TnmBer *ber, Message *msg));
 
 static TnmBer*
-DecodeUsmSecParams	_ANSI_ARGS_((Message *msg, TnmSnmpPdu *pdu,
-				     TnmBer *ber));
+DecodeUsmSecParams	_ANSI_ARGS_((Message *msg, TnmBer *ber));
 
 #ifdef TNM_SNMPv2U
 static int
@@ -91,7 +139,25 @@ SendUsecReport		_ANSI_ARGS_((Tcl_Interp *interp,
 #endif
 
 static TnmBer*
-DecodePDU		_ANSI_ARGS_((TnmBer *ber, TnmSnmpPdu *pdu));
+DecodePDU		_ANSI_ARGS_((TnmBer *ber, Message *msg));
+
+static int
+AddOid			_ANSI_ARGS_((Message *msg, Tnm_Oid *oid, int oidlen));
+
+static VarBind*
+AddVarBind		_ANSI_ARGS_((Message *msg));
+
+static Tcl_Obj*
+NewVarBindList		_ANSI_ARGS_((Message *msg));
+
+static void
+PduFree			_ANSI_ARGS_((TnmSnmpPdu *pdu));
+
+static Tcl_Obj*
+NewOidObj		_ANSI_ARGS_((Tnm_Oid *oid, int oidlen));
+
+static Tcl_Obj*
+FormatValue		_ANSI_ARGS_((TnmMibNode *nodePtr, Tcl_Obj *objPtr));
 
 
 /*
@@ -122,29 +188,180 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
     int *reqid;
     int *status;
     int *index;
+{
+    TnmSnmpMsg *msg;
+    int code;
+
+    msg = TnmSnmpParse(packet, packetlen);
+    code = TnmSnmpDecodeMsg(interp, msg, from, session, reqid, status, index);
+    TnmSnmpFreeMsg(msg);
+    return code;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpParse --
+ *
+ *	This procedure parses a complete SNMP packet and verifies the
+ *	digest of authenticated SNMPv3 messages. It does not use Tcl
+ *	objects, the MIB tree or any global state and may therefore
+ *	be called from any thread.
+ *
+ * Results:
+ *	A pointer to the parsed message which must be passed to
+ *	TnmSnmpDecodeMsg() and released with TnmSnmpFreeMsg(). The
+ *	message refers to the packet, which must be kept until the
+ *	message is released. Errors are reported by TnmSnmpDecodeMsg().
+ *
+ * Side effects:
+ *	Memory is allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+TnmSnmpMsg*
+TnmSnmpParse(packet, packetlen)
+    u_char *packet;
+    int packetlen;
+{
+    Message *msg;
+
+    msg = (Message *) ckalloc(sizeof(Message));
+    memset((char *) msg, 0, sizeof(Message));
+    msg->packet = packet;
+    msg->packetlen = packetlen;
+
+    TnmBerInit(&msg->ber, packet, packetlen);
+    msg->code = DecodeMessage(msg, &msg->ber);
+
+#ifdef TNM_SNMPv3
+    if (msg->code == TCL_OK && msg->version == TNM_SNMPv3
+	&& (*msg->msgFlags & TNM_SNMP_FLAG_AUTH)
+	&& msg->authDigestLen == TNM_SNMP_AUTH_PARAMS) {
+	msg->authentic = TnmSnmpAuthInMsg(msg->user, msg->userLength,
+					  msg->engineID, msg->engineIDLength,
+					  packet, packetlen, msg->authDigest,
+					  &msg->authAlgorithm, msg->authKey,
+					  &msg->authKeyLength);
+    }
+#endif
+
+    return msg;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpFreeMsg --
+ *
+ *	This procedure releases a message parsed by TnmSnmpParse().
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmSnmpFreeMsg(msg)
+    TnmSnmpMsg *msg;
+{
+    if (msg->vbs) {
+	ckfree((char *) msg->vbs);
+    }
+    if (msg->oids) {
+	ckfree((char *) msg->oids);
+    }
+    memset(msg->authKey, 0, sizeof(msg->authKey));
+    ckfree((char *) msg);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpDecodeMsg --
+ *
+ *	This procedure counts a message parsed by TnmSnmpParse() in
+ *	the SNMP statistics, converts the varbinds into Tcl objects
+ *	and does all required actions (mostly executing callbacks or
+ *	doing gets/sets in the agent module). It must be called by
+ *	the thread which owns the sessions.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSnmpDecodeMsg(interp, msg, from, session, reqid, status, index)
+    Tcl_Interp *interp;
+    TnmSnmpMsg *msg;
+    struct sockaddr_in *from;
+    TnmSnmp *session;
+    int *reqid;
+    int *status;
+    int *index;
 {
     TnmSnmpPdu _pdu, *pdu = &_pdu;
-    Message _msg, *msg = &_msg;
     TnmSnmpRequest *request = NULL;
-    int code, delivered = 0;
-    TnmBer *ber;
+    u_char *packet = msg->packet;
+    int packetlen = msg->packetlen;
+    int delivered = 0;
 
     if (reqid) {
 	*reqid = 0;
     }
-    memset((char *) msg, 0, sizeof(Message));
-    Tcl_DStringInit(&pdu->varbind);
-    pdu->addr = *from;
 
     tnmSnmpStats.snmpInPkts++;
-    ber = TnmBerCreate(packet, packetlen);
-    code = DecodeMessage(interp, msg, pdu, ber);
-    TnmBerDelete(ber);
-    if (code == TCL_ERROR) {
-	Tcl_DStringFree(&pdu->varbind);
+    tnmSnmpStats.snmpInBadVersions += msg->badVersions;
+    tnmSnmpStats.snmpInASNParseErrs += msg->parseErrs;
+    switch (msg->errorStatus) {
+      case TNM_SNMP_TOOBIG:
+	  tnmSnmpStats.snmpInTooBigs++;
+	  break;
+      case TNM_SNMP_NOSUCHNAME:
+	  tnmSnmpStats.snmpInNoSuchNames++;
+	  break;
+      case TNM_SNMP_BADVALUE:
+	  tnmSnmpStats.snmpInBadValues++;
+	  break;
+      case TNM_SNMP_READONLY:
+	  tnmSnmpStats.snmpInReadOnlys++;
+	  break;
+      case TNM_SNMP_GENERR:
+	  tnmSnmpStats.snmpInGenErrs++;
+	  break;
+    }
+
+    if (msg->code == TCL_ERROR) {
+	Tcl_SetResult(interp, msg->error, TCL_VOLATILE);
 	return TCL_ERROR;
     }
 
+    memset((char *) pdu, 0, sizeof(TnmSnmpPdu));
+    Tcl_DStringInit(&pdu->varbind);
+    pdu->addr = *from;
+    pdu->type = msg->type;
+    pdu->requestId = msg->requestId;
+    pdu->errorStatus = msg->errorStatus;
+    pdu->errorIndex = msg->errorIndex;
+#ifdef TNM_SNMPv3
+    pdu->context = msg->context;
+    pdu->contextLength = msg->contextLength;
+    pdu->engineID = msg->contextEngineID;
+    pdu->engineIDLength = msg->contextEngineIDLength;
+#endif
+    pdu->vbList = NewVarBindList(msg);
+    Tcl_IncrRefCount(pdu->vbList);
+
     /*
      * Show the contents of the PDU - mostly for debugging.
      */
@@ -153,12 +370,14 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 
     if (msg->version == TNM_SNMPv3 && pdu->type == ASN1_SNMP_REPORT) {
 	TnmSnmp *s = session;
+	char *engineID;
+	int length;
 	request = TnmSnmpFindRequest(pdu->requestId);
 	if (request) {
 	    s = request->session;
 	}
 	if (! s) {
-	    Tcl_DStringFree(&pdu->varbind);
+	    PduFree(pdu);
 	    return TCL_CONTINUE;
 	}
 
@@ -171,11 +390,22 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 
 	TnmSnmpEvalBinding(interp, s, pdu, TNM_SNMP_RECV_EVENT);
 
-	TnmSetOctetStringObj(s->engineID, msg->engineID, msg->engineIDLength);
+	/*
+	 * Localize the keys again if the engineID has changed. This
+	 * is cheap since the master keys are cached.
+	 */
+
+	engineID = TnmGetOctetStringFromObj(NULL, s->engineID, &length);
+	if (length != msg->engineIDLength
+	    || memcmp(engineID, msg->engineID, (size_t) length) != 0) {
+	    TnmSetOctetStringObj(s->engineID,
+				 msg->engineID, msg->engineIDLength);
+	    TnmSnmpComputeKeys(s);
+	}
 	s->engineBoots = msg->engineBoots;
 	s->engineTime = msg->engineTime;
 	
-	Tcl_DStringFree(&pdu->varbind);
+	PduFree(pdu);
 	return TCL_BREAK;
     }
 
@@ -209,7 +439,7 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 	    s = request->session;
 	}
 	if (! s) {
-	    Tcl_DStringFree(&pdu->varbind);
+	    PduFree(pdu);
 	    return TCL_CONTINUE;
 	}
 
@@ -264,7 +494,7 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 			    &s->maddr, TNM_SNMP_ASYNC);
 	    }
 	}
-	Tcl_DStringFree(&pdu->varbind);
+	PduFree(pdu);
 	return TCL_BREAK;
     }
 #endif
@@ -289,7 +519,7 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 
 	if (! request) {
 	    if (! session) {
-		Tcl_DStringFree(&pdu->varbind);
+		PduFree(pdu);
 		return TCL_CONTINUE;
 	    }
 	    
@@ -299,7 +529,7 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 
 	    if (! Authentic(session, msg, pdu, packet, packetlen, NULL)) {
 		Tcl_SetResult(interp, "authentication failure", TCL_STATIC);
-		Tcl_DStringFree(&pdu->varbind);
+		PduFree(pdu);
 		return TCL_CONTINUE;
 	    }
 
@@ -314,15 +544,15 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 				 (char *) NULL);
 		sprintf(buf, " %d ", pdu->errorIndex - 1);
 		Tcl_AppendResult(interp, buf, 
-				  Tcl_DStringValue(&pdu->varbind),
+				  Tcl_GetString(pdu->vbList),
 				  (char *) NULL);
-		Tcl_DStringFree(&pdu->varbind);
+		PduFree(pdu);
 		if (status) *status = pdu->errorStatus;
 		if (index) *index = pdu->errorIndex;
 		return TCL_ERROR;
 	    }
-	    Tcl_ResetResult(interp);
-	    Tcl_DStringResult(interp, &pdu->varbind);
+	    Tcl_SetObjResult(interp, pdu->vbList);
+	    PduFree(pdu);
 	    return TCL_OK;
 
 	} else {
@@ -331,7 +561,7 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 
 	    if (! Authentic(session, msg, pdu, packet, packetlen, NULL)) {
 		Tcl_SetResult(interp, "authentication failure", TCL_STATIC);
-		Tcl_DStringFree(&pdu->varbind);
+		PduFree(pdu);
 		return TCL_CONTINUE;
 	    }
 
@@ -343,6 +573,17 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 
 	    TnmSnmpEvalBinding(interp, session, pdu, TNM_SNMP_RECV_EVENT);
 
+	    /*
+	     * Learn from the response how many varbinds the agent
+	     * is willing to return in a getbulk response. The round
+	     * trip time is only meaningful if there was no retry.
+	     */
+
+	    TnmSnmpAdaptRepetitions(session, request->bulk, pdu->errorStatus,
+				    pdu->vbList, packetlen,
+				    (request->sends == 1)
+				    ? &request->sendTime : NULL);
+
 	    /* 
 	     * Evaluate the callback procedure after we have deleted
 	     * the request structure. This strange order makes sure
@@ -363,7 +604,7 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 	     * Free response message structure.
 	     */
 	    
-	    Tcl_DStringFree(&pdu->varbind);
+	    PduFree(pdu);
 	    return TCL_OK;
 	}
     }
@@ -417,7 +658,7 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 		pdu->type = ASN1_SNMP_RESPONSE;
 		if (TnmSnmpEncode(interp, session, pdu, NULL, NULL)
 		    != TCL_OK) {
-		    Tcl_DStringFree(&pdu->varbind);
+		    PduFree(pdu);
 		    return TCL_ERROR;
 		}
             }
@@ -433,7 +674,7 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 		if (Authentic(session, msg, pdu, packet, packetlen, &statPtr)) {
 		    TnmSnmpEvalBinding(interp, session, pdu, TNM_SNMP_RECV_EVENT);
 		    if (TnmSnmpAgentRequest(interp, session, pdu) != TCL_OK) {
-			Tcl_DStringFree(&pdu->varbind);
+			PduFree(pdu);
 			return TCL_ERROR;
 		    }
 		    delivered++;
@@ -455,7 +696,7 @@ TnmSnmpDecode(interp, packet, packetlen, from, session, reqid, status, index)
 	tnmSnmpStats.snmpInBadCommunityNames++;
     }
 
-    Tcl_DStringFree(&pdu->varbind);
+    PduFree(pdu);
     return TCL_CONTINUE;
 }
 
@@ -640,15 +881,36 @@ Authentic(session, msg, pdu, packet, packetlen, snmpStatPtr)
 	break;
 #endif
     case TNM_SNMPv3:
-	if (! (*msg->msgFlags & TNM_SNMP_FLAG_AUTH) 
-	    && ! (*msg->msgFlags & TNM_SNMP_FLAG_PRIV)) {
-	    char *user;
-	    int userLength;
+	{
+	    char *user, *key;
+	    int userLength, keyLength;
 	    user = Tcl_GetStringFromObj(session->user, &userLength);
+	    if (userLength != msg->userLength
+		|| memcmp(user, msg->user, (size_t) userLength) != 0) {
+		break;
+	    }
 
-	    authentic = (userLength == msg->userLength)
-		&& (memcmp(user, msg->user, (size_t) userLength) == 0);
-	    break;
+	    if (! (*msg->msgFlags & TNM_SNMP_FLAG_AUTH) 
+		&& ! (*msg->msgFlags & TNM_SNMP_FLAG_PRIV)) {
+		authentic = 1;
+		break;
+	    }
+
+	    /*
+	     * The digest has been verified by TnmSnmpParse(). Accept the
+	     * message if the session uses the key which produced the
+	     * digest. Encrypted messages are not supported.
+	     */
+
+	    if ((*msg->msgFlags & TNM_SNMP_FLAG_PRIV) || ! msg->authentic
+		|| ! session->usmAuthKey || msg->authAlgorithm
+		!= (session->securityLevel & TNM_SNMP_AUTH_MASK)) {
+		break;
+	    }
+	    key = TnmGetOctetStringFromObj(NULL, session->usmAuthKey,
+					   &keyLength);
+	    authentic = key && (keyLength == msg->authKeyLength)
+		&& (memcmp(key, msg->authKey, (size_t) keyLength) == 0);
 	}
 	break;
     }
@@ -674,10 +936,8 @@ Authentic(session, msg, pdu, packet, packetlen, snmpStatPtr)
  */
 
 static int
-DecodeMessage(interp, msg, pdu, ber)
-    Tcl_Interp *interp;
+DecodeMessage(msg, ber)
     Message *msg;
-    TnmSnmpPdu *pdu;
     TnmBer *ber;
 {
     int version, msgSeqLength;
@@ -721,7 +981,7 @@ DecodeMessage(interp, msg, pdu, ber)
 	break;
     default:
 	TnmBerSetError(ber, "unknown version in SNMP message");
-	tnmSnmpStats.snmpInBadVersions++;
+	msg->badVersions++;
 	goto asn1Error;
     }
     
@@ -740,39 +1000,35 @@ DecodeMessage(interp, msg, pdu, ber)
 	}
 #endif
 
-	if (! DecodePDU(ber, pdu)) {
+	if (! DecodePDU(ber, msg)) {
 	    goto asn1Error;
 	}
 
-#ifdef TNM_SNMPv3
 	/*
 	 * We probably have to make some mappings here according to
 	 * the coexistance specification currently being defined. (XXXX)
 	 */
-	pdu->context = msg->com;
-	pdu->contextLength = msg->comLen;
-#endif
+	msg->context = (char *) msg->com;
+	msg->contextLength = msg->comLen;
     }
 
     if (version == 3) {
 	u_char *usmParam;
-	TnmBer *usmBer;
+	TnmBer usmBer;
 	int usmParamLength;
 
-	if (! DecodeHeader(msg, pdu, ber)) {
+	if (! DecodeHeader(msg, ber)) {
 	    goto asn1Error;
 	}
 	if (! TnmBerDecOctetString(ber, ASN1_OCTET_STRING, 
 				   (char **) &usmParam, &usmParamLength)) {
 	    goto asn1Error;
 	}
-	usmBer = TnmBerCreate(usmParam, usmParamLength);
-	if (! DecodeUsmSecParams(msg, pdu, usmBer)) {
-	    TnmBerDelete(usmBer);
+	TnmBerInit(&usmBer, usmParam, usmParamLength);
+	if (! DecodeUsmSecParams(msg, &usmBer)) {
 	    goto asn1Error;
 	}
-	TnmBerDelete(usmBer);
-	if (! DecodeScopedPDU(ber, pdu)) {
+	if (! DecodeScopedPDU(ber, msg)) {
 	    goto asn1Error;
 	}
     }
@@ -788,15 +1044,13 @@ DecodeMessage(interp, msg, pdu, ber)
     return TCL_OK;
 
   asn1Error:
-    Tcl_SetResult(interp, ber ? TnmBerGetError(ber) : "parse error",
-		  TCL_VOLATILE);
-    tnmSnmpStats.snmpInASNParseErrs++;
+    msg->error = TnmBerGetError(ber);
+    msg->parseErrs++;
     return TCL_ERROR;
 
  lengthError:
-    Tcl_SetResult(interp, "message length does not match packet size", 
-		  TCL_STATIC);
-    tnmSnmpStats.snmpInASNParseErrs++;
+    msg->error = "message length does not match packet size";
+    msg->parseErrs++;
     return TCL_ERROR;
 }
 
@@ -825,9 +1079,8 @@ DecodeMessage(interp, msg, pdu, ber)
  */
 
 static TnmBer*
-DecodeHeader(msg, pdu, ber)
+DecodeHeader(msg, ber)
     Message *msg;
-    TnmSnmpPdu *pdu;
     TnmBer *ber;
 {
     u_char *seqToken;
@@ -896,9 +1149,8 @@ DecodeHeader(msg, pdu, ber)
  */
 
 static TnmBer*
-DecodeUsmSecParams(msg, pdu, ber)
+DecodeUsmSecParams(msg, ber)
     Message *msg;
-    TnmSnmpPdu *pdu;
     TnmBer *ber;
 {
     u_char *seqToken;
@@ -922,7 +1174,9 @@ DecodeUsmSecParams(msg, pdu, ber)
 			       &msg->user, &msg->userLength)) {
 	return NULL;
     }
-    if (! TnmBerDecOctetString(ber, ASN1_OCTET_STRING, NULL, NULL)) {
+    if (! TnmBerDecOctetString(ber, ASN1_OCTET_STRING,
+			       (char **) &msg->authDigest,
+			       &msg->authDigestLen)) {
 	return NULL;
     }
     if (! TnmBerDecOctetString(ber, ASN1_OCTET_STRING, NULL, NULL)) {
@@ -956,9 +1210,9 @@ DecodeUsmSecParams(msg, pdu, ber)
  */
 
 static TnmBer*
-DecodeScopedPDU(ber, pdu)
+DecodeScopedPDU(ber, msg)
     TnmBer *ber;
-    TnmSnmpPdu *pdu;
+    Message *msg;
 {
     u_char *seqToken;
     int seqLength;
@@ -967,15 +1221,15 @@ DecodeScopedPDU(ber, pdu)
 	return NULL;
     }
 
-    if (! TnmBerDecOctetString(ber, ASN1_OCTET_STRING,
-			       &pdu->engineID, &pdu->engineIDLength)) {
+    if (! TnmBerDecOctetString(ber, ASN1_OCTET_STRING, &msg->contextEngineID,
+			       &msg->contextEngineIDLength)) {
 	return NULL;
     }
     if (! TnmBerDecOctetString(ber, ASN1_OCTET_STRING,
-			       &pdu->context, &pdu->contextLength)) {
+			       &msg->context, &msg->contextLength)) {
 	return NULL;
     }
-    if (! DecodePDU(ber, pdu)) {
+    if (! DecodePDU(ber, msg)) {
 	return NULL;
     }
     
@@ -1127,6 +1381,7 @@ SendUsecReport(interp, session, to, reqid, statPtr)
     pdu->errorStatus = TNM_SNMP_NOERROR;
     pdu->errorIndex = 0;    
     pdu->trapOID = NULL;
+    pdu->vbList = NULL;
     Tcl_DStringInit(&pdu->varbind);
     
     if (statPtr > &tnmSnmpStats.usecStatsUnsupportedQoS) {
@@ -1163,11 +1418,12 @@ SendUsecReport(interp, session, to, reqid, statPtr)
  * DecodePDU --
  *
  *	This procedure takes a serialized packet and decodes the PDU. 
- *	The result is written to the pdu structure and varbind list 
- *	is converted to a TCL list contained in pdu->varbind.
+ *	The result is written to the message structure. The names and
+ *	values of the varbinds are collected in msg->vbs and converted
+ *	into Tcl objects later by NewVarBindList().
  *
  * Results:
- *	A standard Tcl result.
+ *	A pointer to the packet or NULL if there was an error.
  *
  * Side effects:
  *	None.
@@ -1176,22 +1432,15 @@ SendUsecReport(interp, session, to, reqid, statPtr)
  */
 
 static TnmBer*
-DecodePDU(ber, pdu)
+DecodePDU(ber, msg)
     TnmBer *ber;
-    TnmSnmpPdu *pdu;
+    Message *msg;
 {
-    int oidlen = 0;
-    
     Tnm_Oid oid[TNM_OID_MAX_SIZE];
-    int int_val;
-    char buf[20];
-    char *exception, *freeme;
-    static char *vboid;
-    static int vboidLen = 0;
-    char *snmpTrapEnterprise = NULL;
-    u_char byte;
-
-    u_char tag;
+    int oidlen = 0, int_val;
+    char *freeme;
+    VarBind *vbPtr;
+    u_char byte, tag;
 
     u_char *pduSeqToken, *vbSeqToken, *vblSeqToken;
     int pduSeqLength, vbSeqLength, vblSeqLength;
@@ -1200,8 +1449,6 @@ DecodePDU(ber, pdu)
 	return NULL;
     }
 
-    Tcl_DStringInit(&pdu->varbind);
-
     /*
      * Decode the PDU sequence and check whether the PDU type is
      * acceptable for us.
@@ -1209,12 +1456,12 @@ DecodePDU(ber, pdu)
 
     TnmBerDecPeek(ber, (u_char *) &byte);
     if (! TnmBerDecSequenceStart(ber, byte, &pduSeqToken, &pduSeqLength)) {
-	tnmSnmpStats.snmpInASNParseErrs++;
+	msg->parseErrs++;
 	goto asn1Error;
     }
-    pdu->type = byte;
+    msg->type = byte;
 
-    if (TnmGetTableValue(tnmSnmpPDUTable, (unsigned) pdu->type) == NULL) {
+    if (TnmGetTableValue(tnmSnmpPDUTable, (unsigned) msg->type) == NULL) {
 	TnmBerSetError(ber, "unknown PDU tag in SNMP message");
 	goto asn1Error;
     }
@@ -1224,16 +1471,7 @@ DecodePDU(ber, pdu)
      * different format and require therefore some extra code.
      */
 
-    if (pdu->type == ASN1_SNMP_TRAP1) {
-
-	int generic, specific;
-	char *toid = NULL;
-
-	pdu->requestId = 0;
-	pdu->errorStatus = 0;
-	pdu->errorIndex = 0;
-
-	if (! TnmBerDecOID(ber, oid, &oidlen)) goto asn1Error;
+    if (msg->type == ASN1_SNMP_TRAP1) {
 
 	/*
 	 * Save the enterprise object identifier so we can add it
@@ -1241,25 +1479,18 @@ DecodePDU(ber, pdu)
 	 * snmpTrapEnterprise for details.
 	 */
 
-	{
-	    char *tmp;
-	    snmpTrapEnterprise = TnmOidToStr(oid, oidlen);
-	    tmp = TnmMibGetName(snmpTrapEnterprise, 0);
-	    if (tmp) {
-		snmpTrapEnterprise = ckstrdup(tmp);
-	    } else {
-		snmpTrapEnterprise = ckstrdup(snmpTrapEnterprise);
-	    }
-	}
+	if (! TnmBerDecOID(ber, oid, &oidlen)) goto asn1Error;
+	msg->enterprise = AddOid(msg, oid, oidlen);
+	msg->enterpriseLength = oidlen;
 
 	if (! TnmBerDecOctetString(ber, ASN1_IPADDRESS, 
 				   (char **) &freeme, &int_val)) {
 	    goto asn1Error;
 	}
-	if (! TnmBerDecInt(ber, ASN1_INTEGER, &generic)) {
+	if (! TnmBerDecInt(ber, ASN1_INTEGER, &msg->generic)) {
 	    goto asn1Error;
 	}
-	if (! TnmBerDecInt(ber, ASN1_INTEGER, &specific)) {
+	if (! TnmBerDecInt(ber, ASN1_INTEGER, &msg->specific)) {
 	    goto asn1Error;
 	}
 
@@ -1281,90 +1512,25 @@ DecodePDU(ber, pdu)
 	 * Ignore errors here to accept bogus trap messages.
 	 */
 
-	if (! TnmBerDecInt(ber, ASN1_TIMETICKS, &int_val)) {
+	if (! TnmBerDecInt(ber, ASN1_TIMETICKS, &msg->timeStamp)) {
 	    goto asn1Error;
 	}
-	{   sprintf(buf, "%u", int_val);
-	    Tcl_DStringStartSublist(&pdu->varbind);
-	    Tcl_DStringAppendElement(&pdu->varbind, "1.3.6.1.2.1.1.3.0");
-	    Tcl_DStringAppendElement(&pdu->varbind, "TimeTicks");
-	    Tcl_DStringAppendElement(&pdu->varbind, buf);
-	    Tcl_DStringEndSublist(&pdu->varbind);
-	}
-
-	switch (generic) {
-	  case 0:				/* coldStart*/
-	    toid = "1.3.6.1.6.3.1.1.5.1";
-	    break;
-	  case 1:				/* warmStart */
-	    toid = "1.3.6.1.6.3.1.1.5.2";
-	    break;
-	  case 2:				/* linkDown */
-	    toid = "1.3.6.1.6.3.1.1.5.3";
-	    break;
-	  case 3:				/* linkUp */
-	    toid = "1.3.6.1.6.3.1.1.5.4";
-	    break;
-	  case 4:				/* authenticationFailure */
-	    toid = "1.3.6.1.6.3.1.1.5.5";
-	    break;
-	  case 5:				/* egpNeighborLoss */
-	    toid = "1.3.6.1.6.3.1.1.5.6";
-	    break;
-	  default:
-	    oid[oidlen++] = 0;
-	    oid[oidlen++] = specific;		/* enterpriseSpecific */
-	    toid = ckstrdup(TnmOidToStr(oid, oidlen));
-	    break;
-	}
-
-	Tcl_DStringStartSublist(&pdu->varbind);
-	Tcl_DStringAppendElement(&pdu->varbind, "1.3.6.1.6.3.1.1.4.1.0");
-	Tcl_DStringAppendElement(&pdu->varbind, "OBJECT IDENTIFIER");
-	{
-#if 1
-	    Tcl_Obj *tmp = TnmMibFormat("1.3.6.1.6.3.1.1.4.1.0", 0, toid);
-	    if (tmp) {
-		Tcl_DStringAppendElement(&pdu->varbind, Tcl_GetString(tmp));
-		Tcl_DecrRefCount(tmp);
-	    } else {
-		Tcl_DStringAppendElement(&pdu->varbind, toid);
-	    }
-#else
-	    char *tmp = TnmMibGetName(toid, 0);
-	    if (tmp) {
-		Tcl_DStringAppendElement(&pdu->varbind, tmp);
-	    } else {
-		Tcl_DStringAppendElement(&pdu->varbind, toid);
-	    }
-#endif
-	}
-
-	if (((generic < 0) || (generic > 5)) && toid) {
-	    ckfree(toid);
-	    toid = NULL;
-	}
-	Tcl_DStringEndSublist(&pdu->varbind);
-
-	if (ber == NULL) {
-	    goto trapError;
-	}
 
     } else {
 
 	/*
 	 * Decode the request-id, the error-status, and the error-index
-	 * fields. Update our SNMP statistics if we got an error-status
-	 * which is counted in the SNMP MIB.
+	 * fields. The error-status is counted in the SNMP MIB by
+	 * TnmSnmpDecodeMsg().
 	 */
 	
-	if (! TnmBerDecInt(ber, ASN1_INTEGER, &pdu->requestId)) {
+	if (! TnmBerDecInt(ber, ASN1_INTEGER, &msg->requestId)) {
 	    goto asn1Error;
 	}
-	if (! TnmBerDecInt(ber, ASN1_INTEGER, &pdu->errorStatus)) {
+	if (! TnmBerDecInt(ber, ASN1_INTEGER, &msg->errorStatus)) {
 	    goto asn1Error;
 	}
-	if (! TnmBerDecInt(ber, ASN1_INTEGER, &pdu->errorIndex)) {
+	if (! TnmBerDecInt(ber, ASN1_INTEGER, &msg->errorIndex)) {
 	    goto asn1Error;
 	}
 
@@ -1373,29 +1539,11 @@ DecodePDU(ber, pdu)
 	 * unknown error status values.
 	 */
 
-	if (pdu->errorStatus < TNM_SNMP_NOERROR
-	    || pdu->errorStatus > TNM_SNMP_INCONSISTENTNAME) {
+	if (msg->errorStatus < TNM_SNMP_NOERROR
+	    || msg->errorStatus > TNM_SNMP_INCONSISTENTNAME) {
 	    TnmBerSetError(ber, "unknown error status in SNMP PDU");
 	    goto asn1Error;
 	}
-	
-	switch (pdu->errorStatus) {
-	  case TNM_SNMP_TOOBIG:
-	      tnmSnmpStats.snmpInTooBigs++;
-	      break;
-	  case TNM_SNMP_NOSUCHNAME:
-	      tnmSnmpStats.snmpInNoSuchNames++;
-	      break;
-	  case TNM_SNMP_BADVALUE:
-	      tnmSnmpStats.snmpInBadValues++;
-	      break;
-	  case TNM_SNMP_READONLY:
-	      tnmSnmpStats.snmpInReadOnlys++;
-	      break;
-	  case TNM_SNMP_GENERR:
-	      tnmSnmpStats.snmpInGenErrs++;
-	      break;
-	}
     }
     
     /*
@@ -1406,11 +1554,12 @@ DecodePDU(ber, pdu)
 
     if (! TnmBerDecSequenceStart(ber, ASN1_SEQUENCE,
 				 &vblSeqToken, &vblSeqLength)) {
-	if (pdu->type == ASN1_SNMP_TRAP1) {
-	    goto trapError;
+	if (msg->type == ASN1_SNMP_TRAP1) {
+	    return ber;
 	}
 	goto asn1Error;
     }
+    msg->hasVbList = 1;
 
     /*
      * vbLen contains the total length of the encoded varbind list. We
@@ -1431,8 +1580,6 @@ DecodePDU(ber, pdu)
 	    goto asn1Error;
 	}
 	
-	Tcl_DStringStartSublist(&pdu->varbind);
-	
 	/*
 	 * Decode the OBJECT-IDENTIFIER of the varbind.
 	 */
@@ -1441,48 +1588,25 @@ DecodePDU(ber, pdu)
 	    goto asn1Error;
 	}
 
-	{
-	    char *soid = TnmOidToStr(oid, oidlen);
-	    int len = strlen(soid);
-	    if (vboidLen < len + 1)  {
-		if (vboid) ckfree(vboid);
-		vboidLen = len + 1;
-		vboid = ckstrdup(soid);
-	    } else {
-		strcpy(vboid, soid);
-	    }
-	    Tcl_DStringAppendElement(&pdu->varbind, vboid);
-	}
+	vbPtr = AddVarBind(msg);
+	vbPtr->name = AddOid(msg, oid, oidlen);
+	vbPtr->nameLength = oidlen;
 
 	/*
-	 * Handle exceptions that are coded in the SNMP varbind. We
-	 * try to create a type conforming null value if possible.
+	 * Handle exceptions that are coded in the SNMP varbind. The
+	 * type conforming null value is created by NewVarBindList().
 	 */
 
 	if (! TnmBerDecPeek(ber, &tag)) {
 	    goto asn1Error;
 	}
+	vbPtr->tag = tag;
 
-	exception = TnmGetTableValue(tnmSnmpExceptionTable, tag);
-	if (exception) {
-	    Tcl_DStringAppendElement(&pdu->varbind, exception);
-	    Tcl_DStringAppendElement(&pdu->varbind, 
-				     TnmMibGetBaseSyntax(vboid)
-				     == ASN1_OCTET_STRING ? "" : "0");
+	if (TnmGetTableValue(tnmSnmpExceptionTable, tag)) {
 	    TnmBerDecNull(ber, tag);
 	    goto nextVarBind;
 	}
 
-	/*
-	 * Decode the ASN.1 type.
-	 */
-
-	{
-	    char *syntax = TnmGetTableValue(tnmSnmpTypeTable, tag);
-	    Tcl_DStringAppendElement(&pdu->varbind, syntax
-				     ? syntax : "Opaque");
-	}
-
 	/*
 	 * Decode the value of the object.
 	 */
@@ -1491,150 +1615,56 @@ DecodePDU(ber, pdu)
 	case ASN1_COUNTER32:
 	case ASN1_GAUGE32:
 	case ASN1_TIMETICKS:
-	    if (! TnmBerDecInt(ber, tag, &int_val)) {
-		goto asn1Error;
-	    }
-	    sprintf(buf, "%u", int_val);
-            Tcl_DStringAppendElement(&pdu->varbind, buf);
-            break;
 	case ASN1_INTEGER:
-	    if (! TnmBerDecInt(ber, tag, &int_val)) {
+	    if (! TnmBerDecInt(ber, tag, &vbPtr->intValue)) {
 		goto asn1Error;
 	    }
-	    {   Tcl_Obj *tmp;
-		sprintf(buf, "%d", int_val);
-		tmp = TnmMibFormat(vboid, 0, buf);
-		if (tmp) {
-		    Tcl_DStringAppendElement(&pdu->varbind,
-					     Tcl_GetString(tmp));
-		    Tcl_DecrRefCount(tmp);
-		} else {
-		    Tcl_DStringAppendElement(&pdu->varbind, buf);
-		}
-	    }
             break;
 	case ASN1_COUNTER64:
-	    {
-		TnmUnsigned64 u;
-		Tcl_Obj *objPtr;
-		if (! TnmBerDecUnsigned64(ber, &u)) {
-		    goto asn1Error;
-		}
-		objPtr = TnmNewUnsigned64Obj(u);
-		Tcl_DStringAppendElement(&pdu->varbind, 
-					 Tcl_GetStringFromObj(objPtr, NULL));
-		Tcl_DecrRefCount(objPtr);
+	    if (! TnmBerDecUnsigned64(ber, &vbPtr->u64Value)) {
+		goto asn1Error;
 	    }
 	    break;
 	case ASN1_NULL:
 	    if (! TnmBerDecNull(ber, ASN1_NULL)) {
 		goto asn1Error;
 	    }
-	    Tcl_DStringAppendElement(&pdu->varbind, "");
             break;
 	case ASN1_OBJECT_IDENTIFIER:
 	    if (! TnmBerDecOID(ber, oid, &oidlen)) {
 		goto asn1Error;
 	    }
-#if 1
-	    {   char *soid = TnmOidToStr(oid, oidlen);
-		Tcl_Obj *tmp = TnmMibFormat(vboid, 0, soid);
-		if (tmp) {
-		    Tcl_DStringAppendElement(&pdu->varbind,
-					     Tcl_GetString(tmp));
-		    Tcl_DecrRefCount(tmp);
-		} else {
-		    Tcl_DStringAppendElement(&pdu->varbind, soid);
-		}
-	    }
-#else
-	    Tcl_DStringAppendElement(&pdu->varbind, TnmOidToStr(oid, oidlen));
-#endif
+	    vbPtr->intValue = AddOid(msg, oid, oidlen);
+	    vbPtr->length = oidlen;
             break;
 	case ASN1_IPADDRESS:
 	    if (! TnmBerDecOctetString(ber, ASN1_IPADDRESS, 
-				       (char **) &freeme, &int_val)) {
-		 goto asn1Error;
-	    }
-	    if (int_val != 4) goto asn1Error;
-            Tcl_DStringAppend(&pdu->varbind, " ", 1);
-	    {
-		struct sockaddr_in addr;
-		memcpy(&addr.sin_addr, freeme, 4);
-		Tcl_DStringAppendElement(&pdu->varbind, 
-					 inet_ntoa(addr.sin_addr));
+				       &vbPtr->octets, &vbPtr->length)) {
+		goto asn1Error;
 	    }
+	    if (vbPtr->length != 4) goto asn1Error;
             break;
 	case ASN1_OPAQUE:
 	case ASN1_OCTET_STRING:
             if (! TnmBerDecOctetString(ber, tag, 
-				       (char **) &freeme, &int_val)) {
+				       &vbPtr->octets, &vbPtr->length)) {
 		goto asn1Error;
 	    }
-	    {
-		static char *hex = NULL;
-		static size_t hexLen = 0;
-		if (hexLen < int_val * 5 + 1) {
-		    if (hex) ckfree(hex);
-		    hexLen = int_val * 5 + 1;
-		    hex = ckalloc(hexLen);
-		}
-		TnmHexEnc(freeme, int_val, hex);
-		if (tag == ASN1_OCTET_STRING) {
-		    Tcl_Obj *tmp;
-		    tmp = TnmMibFormat(vboid, 0, hex);
-		    if (tmp) {
-			Tcl_DStringAppendElement(&pdu->varbind,
-						 Tcl_GetString(tmp));
-			Tcl_DecrRefCount(tmp);
-		    } else {
-			Tcl_DStringAppendElement(&pdu->varbind, hex);
-		    }
-		} else {
-		    Tcl_DStringAppendElement(&pdu->varbind, hex);
-		}
-	    }
             break;
 	default:
-	    if (! TnmBerDecAny(ber, (char **) &freeme, &int_val)) {
-		    goto asn1Error;
-	    }
-	    {
-		static char *hex = NULL;
-		static size_t hexLen = 0;
-		if (hexLen < int_val * 5 + 1) {
-		    if (hex) ckfree(hex);
-		    hexLen = int_val * 5 + 1;
-		    hex = ckalloc(hexLen);
-		}
-		TnmHexEnc(freeme, int_val, hex);
-		Tcl_DStringAppendElement(&pdu->varbind, hex);
+	    if (! TnmBerDecAny(ber, &vbPtr->octets, &vbPtr->length)) {
+		goto asn1Error;
 	    }
 	    break;
 	}
 	
       nextVarBind:
 
-	Tcl_DStringEndSublist(&pdu->varbind);
 	if (! TnmBerDecSequenceEnd(ber, vbSeqToken, vbSeqLength)) {
 	    goto asn1Error;
 	}
     }
 
-    /*
-     * Add the enterprise object identifier to the varbind list.
-     * See the definition of snmpTrapEnterprise of details.
-     */
-
-    if (pdu->type == ASN1_SNMP_TRAP1 && snmpTrapEnterprise) {
-	Tcl_DStringStartSublist(&pdu->varbind);
-	Tcl_DStringAppendElement(&pdu->varbind, "1.3.6.1.6.3.1.1.4.3.0");
-        Tcl_DStringAppendElement(&pdu->varbind, "OBJECT IDENTIFIER");
-	Tcl_DStringAppendElement(&pdu->varbind, snmpTrapEnterprise);
-	Tcl_DStringEndSublist(&pdu->varbind);
-	ckfree(snmpTrapEnterprise);
-    }
-
     if (! TnmBerDecSequenceEnd(ber, vblSeqToken, vblSeqLength)) {
 	goto asn1Error;
     }
@@ -1643,13 +1673,368 @@ DecodePDU(ber, pdu)
     }
 
     return ber;
-    
+
   asn1Error:
-    tnmSnmpStats.snmpInASNParseErrs++;
+    msg->parseErrs++;
     return NULL;
+}
 
-  trapError:
-    return ber;
+/*
+ *----------------------------------------------------------------------
+ *
+ * AddOid --
+ *
+ *	This procedure appends an object identifier to the array of
+ *	sub-identifiers of a message.
+ *
+ * Results:
+ *	The offset of the object identifier in msg->oids.
+ *
+ * Side effects:
+ *	Memory may be allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+AddOid(msg, oid, oidlen)
+    Message *msg;
+    Tnm_Oid *oid;
+    int oidlen;
+{
+    int offset = msg->oidc;
+
+    if (msg->oidc + oidlen > msg->oidSize) {
+	while (msg->oidc + oidlen > msg->oidSize) {
+	    msg->oidSize = msg->oidSize ? 2 * msg->oidSize : TNM_OID_MAX_SIZE;
+	}
+	msg->oids = (Tnm_Oid *) (msg->oids
+		? ckrealloc((char *) msg->oids, msg->oidSize * sizeof(Tnm_Oid))
+		: ckalloc(msg->oidSize * sizeof(Tnm_Oid)));
+    }
+    memcpy((char *) (msg->oids + offset), (char *) oid,
+	   oidlen * sizeof(Tnm_Oid));
+    msg->oidc += oidlen;
+    return offset;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AddVarBind --
+ *
+ *	This procedure appends an empty varbind to a message.
+ *
+ * Results:
+ *	A pointer to the new varbind, which is valid until the
+ *	next varbind is added.
+ *
+ * Side effects:
+ *	Memory may be allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static VarBind*
+AddVarBind(msg)
+    Message *msg;
+{
+    VarBind *vbPtr;
+
+    if (msg->vbc == msg->vbSize) {
+	msg->vbSize = msg->vbSize ? 2 * msg->vbSize : 16;
+	msg->vbs = (VarBind *) (msg->vbs
+		? ckrealloc((char *) msg->vbs, msg->vbSize * sizeof(VarBind))
+		: ckalloc(msg->vbSize * sizeof(VarBind)));
+    }
+    vbPtr = msg->vbs + msg->vbc++;
+    memset((char *) vbPtr, 0, sizeof(VarBind));
+    return vbPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NewVarBindList --
+ *
+ *	This procedure converts the varbinds of a parsed message into
+ *	a Tcl list of {oid syntax value} lists. Values of type INTEGER,
+ *	OBJECT IDENTIFIER and OCTET STRING are formatted according to
+ *	the MIB definition of the varbind. The object identifiers and
+ *	values keep their internal representation so that no string
+ *	is generated unless a script asks for one. The varbinds of
+ *	SNMPv1 traps are mapped as defined in RFC 1908.
+ *
+ * Results:
+ *	The new list object with ref count 0.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_Obj*
+NewVarBindList(msg)
+    Message *msg;
+{
+    Tcl_Obj *listPtr, *vbv[3];
+    TnmMibNode *nodePtr;
+    VarBind *vbPtr;
+    char *exception, *syntax, *toid = NULL, *enterprise = NULL;
+    char buf[TNM_OID_STR_SIZE];
+    int i;
+
+    listPtr = Tcl_NewListObj(0, NULL);
+
+    if (msg->type == ASN1_SNMP_TRAP1) {
+	Tnm_Oid oid[TNM_OID_MAX_SIZE];
+	int oidlen = msg->enterpriseLength;
+
+	memcpy((char *) oid, (char *) (msg->oids + msg->enterprise),
+	       oidlen * sizeof(Tnm_Oid));
+	enterprise = TnmOidToStr(oid, oidlen, buf);
+	toid = TnmMibGetName(enterprise, 0);
+	enterprise = ckstrdup(toid ? toid : enterprise);
+
+	vbv[0] = Tcl_NewStringObj("1.3.6.1.2.1.1.3.0", -1);
+	vbv[1] = Tcl_NewStringObj("TimeTicks", -1);
+	vbv[2] = TnmNewUnsigned32Obj((TnmUnsigned32) (u_int) msg->timeStamp);
+	Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewListObj(3, vbv));
+
+	switch (msg->generic) {
+	  case 0:				/* coldStart*/
+	    toid = "1.3.6.1.6.3.1.1.5.1";
+	    break;
+	  case 1:				/* warmStart */
+	    toid = "1.3.6.1.6.3.1.1.5.2";
+	    break;
+	  case 2:				/* linkDown */
+	    toid = "1.3.6.1.6.3.1.1.5.3";
+	    break;
+	  case 3:				/* linkUp */
+	    toid = "1.3.6.1.6.3.1.1.5.4";
+	    break;
+	  case 4:				/* authenticationFailure */
+	    toid = "1.3.6.1.6.3.1.1.5.5";
+	    break;
+	  case 5:				/* egpNeighborLoss */
+	    toid = "1.3.6.1.6.3.1.1.5.6";
+	    break;
+	  default:
+	    if (oidlen + 2 <= TNM_OID_MAX_SIZE) {
+		oid[oidlen++] = 0;
+		oid[oidlen++] = msg->specific;	/* enterpriseSpecific */
+	    }
+	    toid = TnmOidToStr(oid, oidlen, buf);
+	    break;
+	}
+
+	vbv[0] = Tcl_NewStringObj("1.3.6.1.6.3.1.1.4.1.0", -1);
+	vbv[1] = Tcl_NewStringObj("OBJECT IDENTIFIER", -1);
+	vbv[2] = TnmMibFormat("1.3.6.1.6.3.1.1.4.1.0", 0, toid);
+	if (! vbv[2]) {
+	    vbv[2] = Tcl_NewStringObj(toid, -1);
+	}
+	Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewListObj(3, vbv));
+    }
+
+    for (i = 0, vbPtr = msg->vbs; i < msg->vbc; i++, vbPtr++) {
+
+	vbv[0] = NewOidObj(msg->oids + vbPtr->name, vbPtr->nameLength);
+	nodePtr = NULL;
+
+	/*
+	 * Values of type INTEGER, OBJECT IDENTIFIER and OCTET STRING
+	 * and exceptions need the MIB node of the varbind. We try to
+	 * create a type conforming null value for exceptions.
+	 */
+
+	exception = TnmGetTableValue(tnmSnmpExceptionTable, vbPtr->tag);
+	if (exception || vbPtr->tag == ASN1_INTEGER
+	    || vbPtr->tag == ASN1_OBJECT_IDENTIFIER
+	    || vbPtr->tag == ASN1_OCTET_STRING) {
+	    nodePtr = TnmMibNodeFromOid(TnmGetOidFromObj(NULL, vbv[0]), NULL);
+	}
+
+	if (exception) {
+	    int type = ASN1_OTHER;
+	    if (nodePtr) {
+		type = (nodePtr->typePtr && nodePtr->typePtr->name)
+		    ? nodePtr->typePtr->syntax : nodePtr->syntax;
+	    }
+	    vbv[1] = Tcl_NewStringObj(exception, -1);
+	    vbv[2] = (type == ASN1_OCTET_STRING)
+		? Tcl_NewObj() : Tcl_NewIntObj(0);
+	    Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewListObj(3, vbv));
+	    continue;
+	}
+
+	syntax = TnmGetTableValue(tnmSnmpTypeTable, vbPtr->tag);
+	vbv[1] = Tcl_NewStringObj(syntax ? syntax : "Opaque", -1);
+
+	switch (vbPtr->tag) {
+	case ASN1_COUNTER32:
+	case ASN1_GAUGE32:
+	case ASN1_TIMETICKS:
+	    vbv[2] = TnmNewUnsigned32Obj((TnmUnsigned32) (u_int)
+					 vbPtr->intValue);
+            break;
+	case ASN1_INTEGER:
+	    vbv[2] = FormatValue(nodePtr, Tcl_NewIntObj(vbPtr->intValue));
+            break;
+	case ASN1_COUNTER64:
+	    vbv[2] = TnmNewUnsigned64Obj(vbPtr->u64Value);
+	    break;
+	case ASN1_NULL:
+	    vbv[2] = Tcl_NewObj();
+            break;
+	case ASN1_OBJECT_IDENTIFIER:
+	    vbv[2] = FormatValue(nodePtr, NewOidObj(msg->oids
+				 + vbPtr->intValue, vbPtr->length));
+            break;
+	case ASN1_IPADDRESS:
+	    {
+		struct in_addr ipaddr;
+		memcpy(&ipaddr, vbPtr->octets, 4);
+		vbv[2] = TnmNewIpAddressObj(&ipaddr);
+	    }
+            break;
+	case ASN1_OCTET_STRING:
+	    vbv[2] = FormatValue(nodePtr, TnmNewOctetStringObj(vbPtr->octets,
+							      vbPtr->length));
+	    break;
+	default:
+	    vbv[2] = TnmNewOctetStringObj(vbPtr->octets, vbPtr->length);
+	    break;
+	}
+
+	Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewListObj(3, vbv));
+    }
+
+    /*
+     * Add the enterprise object identifier to the varbind list.
+     * See the definition of snmpTrapEnterprise of details.
+     */
+
+    if (enterprise && msg->hasVbList) {
+	vbv[0] = Tcl_NewStringObj("1.3.6.1.6.3.1.1.4.3.0", -1);
+	vbv[1] = Tcl_NewStringObj("OBJECT IDENTIFIER", -1);
+	vbv[2] = Tcl_NewStringObj(enterprise, -1);
+	Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewListObj(3, vbv));
+    }
+    if (enterprise) {
+	ckfree(enterprise);
+    }
+
+    return listPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NewOidObj --
+ *
+ *	This procedure creates a new object identifier object for the
+ *	decoded sub-identifiers without going through the string
+ *	representation.
+ *
+ * Results:
+ *	The new object with ref count 0 and an invalid string
+ *	representation.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_Obj*
+NewOidObj(oid, oidlen)
+    Tnm_Oid *oid;
+    int oidlen;
+{
+    Tcl_Obj *objPtr = Tcl_NewObj();
+    TnmOid *oidPtr = (TnmOid *) Tcl_Alloc(sizeof(TnmOid));
+
+    TnmOidInit(oidPtr);
+    TnmOidSetLength(oidPtr, oidlen);
+    memcpy((char *) TnmOidGetElements(oidPtr), (char *) oid,
+	   oidlen * sizeof(Tnm_Oid));
+    TnmSetOidObj(objPtr, oidPtr);
+    return objPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FormatValue --
+ *
+ *	This procedure converts a decoded value into the format
+ *	defined by the textual convention or enumeration of the MIB
+ *	node. This is TnmMibFormat() for callers that already know
+ *	the MIB node.
+ *
+ * Results:
+ *	The formatted value or objPtr if no conversion applies. The
+ *	object objPtr is freed if a new object is returned.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_Obj*
+FormatValue(nodePtr, objPtr)
+    TnmMibNode *nodePtr;
+    Tcl_Obj *objPtr;
+{
+    Tcl_Obj *fmtPtr;
+
+    if (! nodePtr) {
+	return objPtr;
+    }
+
+    if ((nodePtr->macro != TNM_MIB_OBJECTTYPE) &&
+	!(nodePtr->macro == TNM_MIB_VALUE_ASSIGNEMENT && !nodePtr->childPtr)) {
+	return objPtr;
+    }
+
+    fmtPtr = TnmMibFormatValue(nodePtr->typePtr, (int) nodePtr->syntax,
+			       objPtr);
+    if (! fmtPtr) {
+	return objPtr;
+    }
+    Tcl_DecrRefCount(objPtr);
+    return fmtPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PduFree --
+ *
+ *	This procedure frees the varbind list of a decoded PDU.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PduFree(pdu)
+    TnmSnmpPdu *pdu;
+{
+    if (pdu->vbList) {
+	Tcl_DecrRefCount(pdu->vbList);
+	pdu->vbList = NULL;
+    }
+    Tcl_DStringFree(&pdu->varbind);
 }
 
 /*
@@ -23,11 +23,25 @@
 
 extern int	hexdump;
 
+/*
+ * The maximum length of encoded USM security parameters. This is
+ * plenty for an engineID and a user name of at most 32 bytes and
+ * the authentication and privacy parameters.
+ */
+
+#define USM_PARAM_MAX_LENGTH 256
+
 /*
  * Forward declarations for procedures defined later in this file:
  */
 
 static int
+Encode			_ANSI_ARGS_((Tcl_Interp *interp,
+				     TnmSnmp *session, TnmSnmpPdu *pdu,
+				     TnmSnmpRequestProc *proc,
+				     ClientData clientData,
+				     Tcl_Obj *packetObj));
+static int
 EncodeMessage		_ANSI_ARGS_((Tcl_Interp *interp,
 				     TnmSnmp *sess, TnmSnmpPdu *pdu,
 				     TnmBer *ber));
@@ -39,7 +53,7 @@ EncodeScopedPDU		_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
 				     TnmSnmpPdu *pdu, TnmBer *ber));
 static u_char*
 EncodeUsmSecParams	_ANSI_ARGS_((TnmSnmp *session, TnmSnmpPdu *pdu,
-				     int *lengthPtr));
+				     u_char *buffer, int *lengthPtr));
 #ifdef TNM_SNMPv2U
 static int
 EncodeUsecParameter	_ANSI_ARGS_((TnmSnmp *session, TnmSnmpPdu *pdu, 
@@ -77,11 +91,68 @@ TnmSnmpEncode(interp, session, pdu, proc, clientData)
     TnmSnmpRequestProc *proc;
     ClientData clientData;
 {
-    int	retry = 0, packetlen = 0, code = 0;
-    u_char packet[TNM_SNMP_MAXSIZE];
-    TnmBer *ber;
+    return Encode(interp, session, pdu, proc, clientData, NULL);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpEncodeResponse --
+ *
+ *	This procedure encodes and sends a response like TnmSnmpEncode.
+ *	The message as it was sent is stored in the byte array object
+ *	packetObj so that it can be sent again without encoding.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	The byte array of packetObj is modified.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSnmpEncodeResponse(interp, session, pdu, packetObj)
+    Tcl_Interp *interp;
+    TnmSnmp *session;
+    TnmSnmpPdu *pdu;
+    Tcl_Obj *packetObj;
+{
+    return Encode(interp, session, pdu, NULL, NULL, packetObj);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Encode --
+ *
+ *	This procedure implements TnmSnmpEncode. The encoded message
+ *	of a trap, report or response is stored in packetObj unless
+ *	packetObj is NULL.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    memset((char *) packet, 0, sizeof(packet));
+static int
+Encode(interp, session, pdu, proc, clientData, packetObj)
+    Tcl_Interp *interp;
+    TnmSnmp *session;
+    TnmSnmpPdu *pdu;
+    TnmSnmpRequestProc *proc;
+    ClientData clientData;
+    Tcl_Obj *packetObj;
+{
+    int	retry = 0, packetlen = 0, code = 0, bulk = 0;
+    u_char packet[TNM_SNMP_MAXSIZE];
+    TnmBer _ber, *ber = &_ber;
+    Tcl_Time sendTime;
 
     /*
      * Some special care must be taken to conform to SNMPv1 sessions:
@@ -127,20 +198,39 @@ TnmSnmpEncode(interp, session, pdu, proc, clientData)
 	}
     }
 
+    /*
+     * Compute the number of varbinds we ask for with a getbulk
+     * request so that we can adapt the max-repetitions value to
+     * the size of the response.
+     */
+
+    if (pdu->type == ASN1_SNMP_GETBULK) {
+	int vbc, nonRep;
+	Tcl_Obj *listPtr = pdu->vbList;
+	if (! listPtr) {
+	    listPtr = Tcl_NewStringObj(Tcl_DStringValue(&pdu->varbind),
+				       Tcl_DStringLength(&pdu->varbind));
+	}
+	Tcl_IncrRefCount(listPtr);
+	if (Tcl_ListObjLength(NULL, listPtr, &vbc) == TCL_OK) {
+	    nonRep = (pdu->errorStatus < vbc) ? pdu->errorStatus : vbc;
+	    bulk = nonRep + (vbc - nonRep) * pdu->errorIndex;
+	}
+	Tcl_DecrRefCount(listPtr);
+    }
+
     /*
      * Encode message into ASN1 BER transfer syntax. Authentication or
      * encryption is done within the following procedures if it is an
      * authentic or private message.
      */
 
-    ber = TnmBerCreate(packet, sizeof(packet));
+    TnmBerInit(ber, packet, sizeof(packet));
     code = EncodeMessage(interp, session, pdu, ber);
     if (code != TCL_OK) {
-	TnmBerDelete(ber);
 	return TCL_ERROR;
     }
     packetlen = TnmBerSize(ber);
-    TnmBerDelete(ber);
 
     switch (pdu->type) {
       case ASN1_SNMP_GET:
@@ -179,6 +269,9 @@ TnmSnmpEncode(interp, session, pdu, proc, clientData)
 	    TnmSnmpUsecAuth(session, packet, packetlen);
 	}
 #endif
+	if (packetObj) {
+	    Tcl_SetByteArrayObj(packetObj, packet, packetlen);
+	}
 	code = TnmSnmpSend(interp, session, packet, packetlen,
 			   &pdu->addr, TNM_SNMP_ASYNC);
 	if (code != TCL_OK) {
@@ -196,8 +289,9 @@ TnmSnmpEncode(interp, session, pdu, proc, clientData)
 	TnmSnmpRequest *rPtr;
 	rPtr = TnmSnmpCreateRequest(pdu->requestId, packet, packetlen,
 				    proc, clientData, interp);
+	rPtr->bulk = bulk;
 	TnmSnmpQueueRequest(session, rPtr);
-	sprintf(interp->result, "%d", (int) pdu->requestId);
+	Tcl_SetObjResult(interp, Tcl_NewIntObj((int) pdu->requestId));
 	return TCL_OK;
     }
     
@@ -206,7 +300,7 @@ TnmSnmpEncode(interp, session, pdu, proc, clientData)
      */
     
     for (retry = 0; retry <= session->retries; retry++) {
-	int id, status, index;
+	int id, status = TNM_SNMP_NOERROR, index = 0;
 #ifdef TNM_SNMP_BENCH
 	TnmSnmpMark stats;
 	memset((char *) &stats, 0, sizeof(stats));
@@ -219,6 +313,9 @@ TnmSnmpEncode(interp, session, pdu, proc, clientData)
 	}
 #endif
 	TnmSnmpDelay(session);
+	if (retry == 0) {
+	    Tcl_GetTime(&sendTime);
+	}
 	code = TnmSnmpSend(interp, session, packet, packetlen, 
 			   &pdu->addr, TNM_SNMP_SYNC);
 	if (code != TCL_OK) {
@@ -258,6 +355,10 @@ TnmSnmpEncode(interp, session, pdu, proc, clientData)
 		    stats.recvTime = tnmSnmpBenchMark.recvTime;
 		    session->stats = stats;
 #endif
+		    TnmSnmpAdaptRepetitions(session, bulk, TNM_SNMP_NOERROR,
+					    Tcl_GetObjResult(interp),
+					    packetlen,
+					    (retry == 0) ? &sendTime : NULL);
 		    return TCL_OK;
 		}
 		rc = TCL_CONTINUE;
@@ -272,11 +373,14 @@ TnmSnmpEncode(interp, session, pdu, proc, clientData)
 	    if (rc == TCL_ERROR) {
 		pdu->errorStatus = status;
 		pdu->errorIndex = index;
+		TnmSnmpAdaptRepetitions(session, bulk, status, NULL, 0, NULL);
 		return TCL_ERROR;
 	    }
 	}
     }
     
+    TnmSnmpAdaptRepetitions(session, bulk, TNM_SNMP_NORESPONSE,
+			    NULL, 0, NULL);
     Tcl_SetResult(interp, "noResponse 0 {}", TCL_STATIC);
     return TCL_ERROR;
 }
@@ -359,10 +463,12 @@ EncodeMessage(interp, session, pdu, ber)
     }
 
     if (version == 3) {
-	int secParamLength;
+	u_char usmBuffer[USM_PARAM_MAX_LENGTH];
+	int secParamLength = sizeof(usmBuffer);
 	char *secParam;
 	ber = EncodeHeader(interp, session, pdu, ber);
-	secParam = EncodeUsmSecParams(session, pdu, &secParamLength);
+	secParam = EncodeUsmSecParams(session, pdu, usmBuffer,
+				      &secParamLength);
 	if (! secParam) {
 	    Tcl_SetResult(interp, TnmBerGetError(NULL), TCL_STATIC);
 	    return TCL_ERROR;
@@ -440,7 +546,7 @@ EncodeHeader(interp, session, pdu, ber)
     ber = TnmBerEncSequenceStart(ber, ASN1_SEQUENCE, &seqToken);
 
     ber = TnmBerEncInt(ber, ASN1_INTEGER, pdu->requestId);
-    ber = TnmBerEncInt(ber, ASN1_INTEGER, TNM_SNMP_MAXSIZE);
+    ber = TnmBerEncInt(ber, ASN1_INTEGER, session->maxSize);
     ber = TnmBerEncOctetString(ber, ASN1_OCTET_STRING, &flags, 1);
     ber = TnmBerEncInt(ber, ASN1_INTEGER, TNM_SNMP_USM_SEC_MODEL);
 
@@ -466,8 +572,10 @@ EncodeHeader(interp, session, pdu, ber)
  *	  }
  *
  * Results:
- *	A pointer to the beginning to the encoded security parameters.
- *	The length is returned in the lengthPtr parameter.
+ *	A pointer to the beginning to the encoded security parameters
+ *	in the buffer provided by the caller. The size of the buffer
+ *	is passed in and the length of the encoded parameters is
+ *	returned in the lengthPtr parameter.
  *
  * Side effects:
  *	None.
@@ -476,22 +584,22 @@ EncodeHeader(interp, session, pdu, ber)
  */
 
 static u_char*
-EncodeUsmSecParams(session, pdu, lengthPtr)
+EncodeUsmSecParams(session, pdu, buffer, lengthPtr)
     TnmSnmp *session;
     TnmSnmpPdu *pdu;
+    u_char *buffer;
     int *lengthPtr;
 {
     u_char *seqToken;
     char *user, *engineID;
     int userLength, engineIDLength;
-    static u_char buffer[TNM_SNMP_MAXSIZE];
-    TnmBer *ber;
+    TnmBer _ber, *ber = &_ber;
 
     /*
      * Start building the UsmSecurityParameters field.
      */
 
-    ber = TnmBerCreate(buffer, sizeof(buffer));
+    TnmBerInit(ber, buffer, *lengthPtr);
     ber = TnmBerEncSequenceStart(ber, ASN1_SEQUENCE, &seqToken);
 
     engineID = TnmGetOctetStringFromObj(NULL, session->engineID,
@@ -524,12 +632,10 @@ EncodeUsmSecParams(session, pdu, lengthPtr)
 
     if (! ber) {
 	*lengthPtr = 0;
-	/* TnmBerDelete(ber); xxx */
 	return NULL;
     }
 
     *lengthPtr = (ber->current - ber->start);
-    TnmBerDelete(ber);
     return buffer;
 }
 
@@ -831,9 +937,9 @@ EncodePDU(interp, session, pdu, ber)
     u_char *pduSeqToken, *vbSeqToken, *vblSeqToken;
     
     int i, vblc, vbc;
-    char **vblv, **vbv;
+    Tcl_Obj *listPtr, **vblv, **vbv;
 
-    Tnm_Oid *oid;
+    Tnm_Oid *oid, oidBuf[TNM_OID_MAX_SIZE];
     int oidlen;
 
     ber = TnmBerEncSequenceStart(ber, (u_char) pdu->type, &pduSeqToken);
@@ -852,7 +958,7 @@ EncodePDU(interp, session, pdu, ber)
 	 * for the standard traps to be backward compatible.
 	 */
 
-	oid = TnmStrToOid(pdu->trapOID, &oidlen);
+	oid = TnmStrToOid(pdu->trapOID, oidBuf, &oidlen);
 	if (! oid || oidlen < 4) {
 	    Tcl_SetResult(interp, "illegal notification object identifier",
 			  TCL_STATIC);
@@ -922,12 +1028,18 @@ EncodePDU(interp, session, pdu, ber)
     ber = TnmBerEncSequenceStart(ber, ASN1_SEQUENCE, &vblSeqToken);
     
     /*
-     * split the varbind list and loop over all elements
+     * split the varbind list and loop over all elements - use the
+     * list object of a received PDU if we have one
      */
-    
-    if (Tcl_SplitList(interp, Tcl_DStringValue(&pdu->varbind), &vblc, &vblv)
-	!= TCL_OK) {
-	return NULL;
+
+    listPtr = pdu->vbList;
+    if (! listPtr) {
+	listPtr = Tcl_NewStringObj(Tcl_DStringValue(&pdu->varbind),
+				   Tcl_DStringLength(&pdu->varbind));
+    }
+    Tcl_IncrRefCount(listPtr);
+    if (Tcl_ListObjGetElements(interp, listPtr, &vblc, &vblv) != TCL_OK) {
+	goto error;
     }
 
     if (pdu->type == ASN1_SNMP_TRAP2 || pdu->type == ASN1_SNMP_INFORM) {
@@ -938,15 +1050,15 @@ EncodePDU(interp, session, pdu, ber)
 	 */
 
 	ber = TnmBerEncSequenceStart(ber, ASN1_SEQUENCE, &vbSeqToken);
-	oid = TnmStrToOid("1.3.6.1.2.1.1.3.0", &oidlen);
+	oid = TnmStrToOid("1.3.6.1.2.1.1.3.0", oidBuf, &oidlen);
 	ber = TnmBerEncOID(ber, oid, oidlen);
 	ber = TnmBerEncInt(ber, ASN1_TIMETICKS, TnmSnmpSysUpTime());
 	ber = TnmBerEncSequenceEnd(ber, vbSeqToken);
 
 	ber = TnmBerEncSequenceStart(ber, ASN1_SEQUENCE, &vbSeqToken);
-	oid = TnmStrToOid("1.3.6.1.6.3.1.1.4.1.0", &oidlen);
+	oid = TnmStrToOid("1.3.6.1.6.3.1.1.4.1.0", oidBuf, &oidlen);
 	ber = TnmBerEncOID(ber, oid, oidlen);
-	oid = TnmStrToOid(pdu->trapOID, &oidlen);
+	oid = TnmStrToOid(pdu->trapOID, oidBuf, &oidlen);
 	ber = TnmBerEncOID(ber, oid, oidlen);
 	ber = TnmBerEncSequenceEnd(ber, vbSeqToken);
     }
@@ -960,15 +1072,13 @@ EncodePDU(interp, session, pdu, ber)
 	 * split a single varbind into its components
 	 */
 	
-	if (Tcl_SplitList(interp, vblv[i], &vbc, &vbv) != TCL_OK) {
-	    ckfree((char *) vblv);
-	    return NULL;
+	if (Tcl_ListObjGetElements(interp, vblv[i], &vbc, &vbv) != TCL_OK) {
+	    goto error;
 	}
 
 	if (vbc == 0) {
 	    Tcl_SetResult(interp, "missing OBJECT IDENTIFIER", TCL_STATIC);
-	    ckfree((char *) vblv);
-            return NULL;
+	    goto error;
 	}
 	
 	/*
@@ -979,22 +1089,27 @@ EncodePDU(interp, session, pdu, ber)
 
 	/*
 	 * encode the object identifier, perhaps consulting the MIB
+	 * unless we already have the sub-identifiers
 	 */
 
-	oid = TnmStrToOid(vbv[0], &oidlen);
-	if (! oid) {
-	    char *tmp = TnmMibGetOid(vbv[0]);
-	    if (tmp) {
-		oid = TnmStrToOid(tmp, &oidlen);
+	if (vbv[0]->typePtr == &tnmOidType) {
+	    TnmOid *oidPtr = TnmGetOidFromObj(interp, vbv[0]);
+	    oid = TnmOidGetElements(oidPtr);
+	    oidlen = TnmOidGetLength(oidPtr);
+	} else {
+	    oid = TnmStrToOid(Tcl_GetString(vbv[0]), oidBuf, &oidlen);
+	    if (! oid) {
+		char *tmp = TnmMibGetOid(Tcl_GetString(vbv[0]));
+		if (tmp) {
+		    oid = TnmStrToOid(tmp, oidBuf, &oidlen);
+		}
 	    }
 	}
 	if (! oid) {
 	    Tcl_ResetResult(interp);
 	    Tcl_AppendResult(interp, "invalid object identifier \"",
-			     vbv[0], "\"", (char *) NULL);
-	    ckfree((char *) vbv);
-	    ckfree((char *) vblv);
-	    return NULL;
+			     Tcl_GetString(vbv[0]), "\"", (char *) NULL);
+	    goto error;
 	}
 
 	ber = TnmBerEncOID(ber, oid, oidlen);
@@ -1012,11 +1127,11 @@ EncodePDU(interp, session, pdu, ber)
 	    asn1_type = ASN1_NULL;
 	    break;
 	  case 2:
-	    value = vbv[1];
-	    asn1_type = TnmMibGetBaseSyntax(vbv[0]);
+	    value = Tcl_GetString(vbv[1]);
+	    asn1_type = TnmMibGetBaseSyntax(Tcl_GetString(vbv[0]));
 	    break;
 	  default:
-	    value = vbv[2];
+	    value = Tcl_GetString(vbv[2]);
 
 	    /*
 	     * Check if there is an exception in the asn1 type field.
@@ -1026,15 +1141,18 @@ EncodePDU(interp, session, pdu, ber)
 	     */
 
 	    if (pdu->type == ASN1_SNMP_RESPONSE) {
-		asn1_type = TnmGetTableKey(tnmSnmpExceptionTable, vbv[1]);
+		asn1_type = TnmGetTableKey(tnmSnmpExceptionTable,
+					   Tcl_GetString(vbv[1]));
 	        if (asn1_type < 0) {
-		    asn1_type = TnmGetTableKey(tnmSnmpTypeTable, vbv[1]);
+		    asn1_type = TnmGetTableKey(tnmSnmpTypeTable,
+					       Tcl_GetString(vbv[1]));
 		    if (asn1_type < 0) {
 			asn1_type = ASN1_OTHER;
 		    }
 		}
 	    } else {
-		asn1_type = TnmGetTableKey(tnmSnmpTypeTable, vbv[1]);
+		asn1_type = TnmGetTableKey(tnmSnmpTypeTable,
+					   Tcl_GetString(vbv[1]));
 		if (asn1_type < 0) {
 		    asn1_type = ASN1_OTHER;
 		}
@@ -1042,7 +1160,7 @@ EncodePDU(interp, session, pdu, ber)
 
 	    if (asn1_type == ASN1_OTHER) {
 		TnmMibType *typePtr;
-		typePtr = TnmMibFindType(vbv[1]);
+		typePtr = TnmMibFindType(Tcl_GetString(vbv[1]));
 		if (typePtr) {
 		    asn1_type = typePtr->syntax;
 		}
@@ -1052,11 +1170,9 @@ EncodePDU(interp, session, pdu, ber)
 
 	if (asn1_type == ASN1_OTHER) {
 	    Tcl_ResetResult(interp);
-	    Tcl_AppendResult(interp, "unknown type \"", vbv[1], "\"",
-			     (char *) NULL);
-	    ckfree((char *) vbv);
-	    ckfree((char *) vblv);
-	    return NULL;
+	    Tcl_AppendResult(interp, "unknown type \"",
+			     Tcl_GetString(vbv[1]), "\"", (char *) NULL);
+	    goto error;
 	}
 
 	/*
@@ -1075,12 +1191,12 @@ EncodePDU(interp, session, pdu, ber)
 		int int_val, rc;
 		rc = Tcl_GetInt(interp, value, &int_val);
 		if (rc != TCL_OK) {
-		    char *tmp = TnmMibScan(vbv[0], 0, value);
+		    char *tmp = TnmMibScan(Tcl_GetString(vbv[0]), 0, value);
 		    if (tmp && *tmp) {
 			Tcl_ResetResult(interp);
 			rc = Tcl_GetInt(interp, tmp, &int_val);
 		    }
-		    if (rc != TCL_OK) return NULL;
+		    if (rc != TCL_OK) goto error;
 		}
 		ber = TnmBerEncInt(ber, (u_char) asn1_type, int_val);
 		break;
@@ -1091,24 +1207,24 @@ EncodePDU(interp, session, pdu, ber)
 		    Tcl_SetResult(interp,
 				  "Counter64 not allowed on an SNMPv1 session",
 				  TCL_STATIC);
-		    return NULL;
+		    goto error;
 		}
 		if (sizeof(int) >= 8) {
 		    rc = Tcl_GetInt(interp, value, &int_val);
 		    if (rc != TCL_OK) {
-			return NULL;
+			goto error;
 		    }
 		    ber = TnmBerEncInt(ber, ASN1_COUNTER64, int_val);
 		} else {
 		    double d;
 		    rc = Tcl_GetDouble(interp, value, &d);
 		    if (rc != TCL_OK) {
-			return NULL;
+			goto error;
 		    }
 		    if (d < 0) {
 			Tcl_SetResult(interp, "negativ counter value",
 				      TCL_STATIC);
-			return NULL;
+			goto error;
 		    }
 		    ber = TnmBerEncUnsigned64(ber, d);
 		}
@@ -1120,7 +1236,7 @@ EncodePDU(interp, session, pdu, ber)
 		if ((addr == -1 && strcmp(value, "255.255.255.255") != 0)
 		    || (cnt != 4)) {
 		    Tcl_SetResult(interp, "invalid IP address", TCL_STATIC);
-		    return NULL;
+		    goto error;
 		}
 		ber = TnmBerEncOctetString(ber, ASN1_IPADDRESS,
 					   (char *) &addr, 4);
@@ -1136,7 +1252,7 @@ EncodePDU(interp, session, pdu, ber)
 		    ber = TnmBerEncOctetString(ber, ASN1_OCTET_STRING, NULL, 0);
 		    break;
 		}
-		scan = TnmMibScan(vbv[0], 0, value);
+		scan = TnmMibScan(Tcl_GetString(vbv[0]), 0, value);
 		if (scan) hex = scan;
 		if (*hex) {
 		    len = strlen(hex);
@@ -1148,7 +1264,7 @@ EncodePDU(interp, session, pdu, ber)
 		    if (TnmHexDec(hex, bin, &len) < 0) {
 			Tcl_SetResult(interp, "illegal OCTET STRING value",
 				      TCL_STATIC);
-			return NULL;
+			goto error;
 		    }
 		} else {
 		    len = 0;
@@ -1171,7 +1287,7 @@ EncodePDU(interp, session, pdu, ber)
 		    if (TnmHexDec(hex, bin, &len) < 0) {
 			Tcl_SetResult(interp, "illegal Opaque value",
 				      TCL_STATIC);
-			return NULL;
+			goto error;
 		    }
 		} else {
 		    len = 0;
@@ -1180,18 +1296,18 @@ EncodePDU(interp, session, pdu, ber)
 		break;
 	    }
 	    case ASN1_OBJECT_IDENTIFIER:
-		oid = TnmStrToOid(value, &oidlen);
+		oid = TnmStrToOid(value, oidBuf, &oidlen);
 		if (! oid) {
 		    char *tmp = TnmMibGetOid(value);
 		    if (tmp) {
-			oid = TnmStrToOid(tmp, &oidlen);
+			oid = TnmStrToOid(tmp, oidBuf, &oidlen);
 		    }
 		}
 		if (! oid) {
 		    Tcl_AppendResult(interp, 
 				     "illegal object identifier \"",
 				     value, "\"", (char *) NULL);
-		    return NULL;
+		    goto error;
 		}
 		ber = TnmBerEncOID(ber, oid, oidlen);
 		break;
@@ -1204,18 +1320,20 @@ EncodePDU(interp, session, pdu, ber)
 	    default:
 		sprintf(interp->result, "unknown asn1 type 0x%.2x",
 			asn1_type);
-		return NULL;
+		goto error;
 	    }
 	}
 	
 	ber = TnmBerEncSequenceEnd(ber, vbSeqToken);
-
-	ckfree((char *) vbv);
     }
 
-    ckfree((char *) vblv);
+    Tcl_DecrRefCount(listPtr);
 
     ber = TnmBerEncSequenceEnd(ber, vblSeqToken);
     ber = TnmBerEncSequenceEnd(ber, pduSeqToken);
     return ber;
+
+  error:
+    Tcl_DecrRefCount(listPtr);
+    return NULL;
 }
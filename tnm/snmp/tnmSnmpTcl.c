@@ -40,6 +40,48 @@ typedef struct SnmpControl {
     Tcl_HashTable aliasTable;	/* The hash table with SNMP aliases. */
 } SnmpControl;
 
+/*
+ * The following structures are used to retrieve conceptual tables.
+ * Every column of a table is split into segments which cover a range
+ * of instance identifiers. Every segment has at most one getbulk (or
+ * getnext) request in flight so that the number of requests in
+ * flight is only limited by the window of the session. The rows are
+ * collected in a hash table and sorted once all segments are done.
+ * The segments split the range of the first index subidentifier
+ * which is probed with a single getnext request before the segments
+ * are created.
+ */
+
+#define TABLE_SEGMENTS	16	/* Max. number of segments per column. */
+#define TABLE_PROBES	33	/* Probes at 0 and at 2^0 ... 2^31. */
+
+typedef struct TableSegment {
+    int column;			/* The index of the column we retrieve. */
+    TnmOid colOid;		/* The object identifier of the column. */
+    TnmOid nextOid;		/* The start of the next request. */
+    TnmOid lastOid;		/* Last instance of the segment or empty. */
+    int maxReps;		/* Max. repetitions of the last request. */
+    struct TableState *statePtr;/* The table we belong to. */
+} TableSegment;
+
+typedef struct TableState {
+    Tcl_Interp *interp;		/* The interpreter for error messages. */
+    int numColumns;		/* The number of columns we retrieve. */
+    int active;			/* The number of requests in flight. */
+    int code;			/* The result of the table retrieval. */
+    Tcl_Obj *errorObj;		/* The error message if code is TCL_ERROR. */
+    Tcl_HashTable rowTable;	/* The rows indexed by instance identifier. */
+    TnmOid probeOid;		/* The column used to probe the indexes. */
+    u_int firstIndex;		/* The smallest first index subidentifier. */
+    u_int lastIndex;		/* Upper bound of the first subidentifier. */
+} TableState;
+
+typedef struct TableRow {
+    TnmOid instOid;		/* The instance identifier of the row. */
+    Tcl_Obj *values[1];		/* The values, one per column. The actual
+				 * size depends on the number of columns. */
+} TableRow;
+
 /*
  * Forward declarations for procedures defined later in this file:
  */
@@ -62,6 +104,12 @@ GetOption	_ANSI_ARGS_((Tcl_Interp *interp, ClientData object,
 static int
 SetOption	_ANSI_ARGS_((Tcl_Interp *interp, ClientData object, 
 			     int option, Tcl_Obj *objPtr));
+static Tcl_Obj*
+GetSnmpOption	_ANSI_ARGS_((Tcl_Interp *interp, ClientData object, 
+			     int option));
+static int
+SetSnmpOption	_ANSI_ARGS_((Tcl_Interp *interp, ClientData object, 
+			     int option, Tcl_Obj *objPtr));
 static int
 BindEvent	_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
 			     Tcl_Obj *eventPtr, Tcl_Obj *script));
@@ -111,18 +159,32 @@ Delta		_ANSI_ARGS_((Tcl_Interp *interp, Tcl_Obj *vbl1,
 static int
 Extract		_ANSI_ARGS_((Tcl_Interp *interp, int what, Tcl_Obj *objPtr,
 			     Tcl_Obj *indexObjPtr));
+static int
+ExpandTable	_ANSI_ARGS_((Tcl_Interp *interp, Tcl_Obj *tableObj,
+			     TnmMibNode ***columnsPtr));
+static void
+TableProbe	_ANSI_ARGS_((TnmSnmp *session, TableState *statePtr));
+static void
+TableProbeProc	_ANSI_ARGS_((TnmSnmp *session, TnmSnmpPdu *pdu, 
+			     ClientData clientData));
+static int
+TableWait	_ANSI_ARGS_((TnmSnmp *session, TableState *statePtr));
+static void
+TableRequest	_ANSI_ARGS_((TnmSnmp *session, TableSegment *segPtr));
+static void
+TableProc	_ANSI_ARGS_((TnmSnmp *session, TnmSnmpPdu *pdu, 
+			     ClientData clientData));
+static int
+TableCompare	_ANSI_ARGS_((CONST VOID *a, CONST VOID *b));
+static int
+Table		_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
+			     Tcl_Obj *tableObj, Tcl_Obj *arrayName));
 
 #if 0
 static int
-ExpandTable	_ANSI_ARGS_((Tcl_Interp *interp, 
-			     char *tList, Tcl_DString *dst));
-static int
 ExpandScalars	_ANSI_ARGS_((Tcl_Interp *interp, 
 			     char *sList, Tcl_DString *dst));
 static int
-Table		_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
-			     char *table, char *arrayName));
-static int
 Scalars		_ANSI_ARGS_((Tcl_Interp *interp, TnmSnmp *session,
 			     char *group, char *arrayName));
 static void
@@ -144,6 +206,7 @@ enum options {
     optPassword,
 #endif
     optTransport, optTimeout, optRetries, optWindow, optDelay,
+    optMaxSize, optMaxRepetitions,
 #ifdef TNM_SNMP_BENCH
     optRtt, optSendSize, optRecvSize
 #endif
@@ -171,6 +234,8 @@ static TnmTable generatorOptionTable[] = {
     { optRetries,	"-retries" },
     { optWindow,	"-window" },
     { optDelay,		"-delay" },
+    { optMaxSize,	"-maxsize" },
+    { optMaxRepetitions, "-maxrepetitions" },
     { optTags,		"-tags" },
 #ifdef TNM_SNMP_BENCH
     { optRtt,		"-rtt" },
@@ -297,6 +362,37 @@ static TnmConfig listenerConfig = {
     GetOption
 };
 
+/*
+ * The options used to configure the SNMP engine itself. They are
+ * shared by all sessions and processed by the snmp configure and
+ * snmp cget commands.
+ */
+
+enum snmpOptions {
+    snmpOptTick, snmpOptRecvBatch, snmpOptSendBatch, snmpOptSockets,
+    snmpOptRecvBuffer, snmpOptThreads, snmpOptKeyCache,
+    snmpOptAgentCache, snmpOptAgentCacheTTL
+};
+
+static TnmTable snmpOptionTable[] = {
+    { snmpOptTick,	"-tick" },
+    { snmpOptRecvBatch,	"-recvbatch" },
+    { snmpOptSendBatch,	"-sendbatch" },
+    { snmpOptSockets,	"-sockets" },
+    { snmpOptRecvBuffer, "-recvbuffer" },
+    { snmpOptThreads,	"-threads" },
+    { snmpOptKeyCache,	"-keycache" },
+    { snmpOptAgentCache, "-agentcache" },
+    { snmpOptAgentCacheTTL, "-agentcachettl" },
+    { 0, NULL }
+};
+
+static TnmConfig snmpConfig = {
+    snmpOptionTable,
+    SetSnmpOption,
+    GetSnmpOption
+};
+
 static TnmTable listenerEventTable[] = {
     { TNM_SNMP_SEND_EVENT,	"send" },
     { TNM_SNMP_RECV_EVENT,	"recv" },
@@ -432,6 +528,7 @@ PduInit(pduPtr, session, type)
     pduPtr->errorStatus = TNM_SNMP_NOERROR;
     pduPtr->errorIndex = 0;    
     pduPtr->trapOID = NULL;
+    pduPtr->vbList = NULL;
     Tcl_DStringInit(&pduPtr->varbind);
 
 #ifdef TNM_SNMP_BENCH
@@ -460,6 +557,10 @@ PduFree(pduPtr)
     TnmSnmpPdu *pduPtr;
 {
     if (pduPtr->trapOID) ckfree(pduPtr->trapOID);
+    if (pduPtr->vbList) {
+	Tcl_DecrRefCount(pduPtr->vbList);
+	pduPtr->vbList = NULL;
+    }
     Tcl_DStringFree(&pduPtr->varbind);
 }
 
@@ -565,6 +666,10 @@ GetOption(interp, object, option)
     case optDelay:
 	if (session->domain != TNM_SNMP_UDP_DOMAIN) return NULL;
 	return Tcl_NewIntObj(session->delay);
+    case optMaxSize:
+	return Tcl_NewIntObj(session->maxSize);
+    case optMaxRepetitions:
+	return Tcl_NewIntObj(session->maxReps);
     case optTags:
 	return session->tagList;
     case optEnterprise:
@@ -844,6 +949,21 @@ SetOption(interp, object, option, objPtr)
 	}
 	session->delay = num;
 	return TCL_OK;
+    case optMaxSize:
+	if (TnmGetIntRangeFromObj(interp, objPtr, 484, TNM_SNMP_MAXSIZE, 
+				  &num) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	session->maxSize = num;
+	return TCL_OK;
+    case optMaxRepetitions:
+	if (TnmGetPositiveFromObj(interp, objPtr, &num) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	session->maxReps = num;
+	session->maxRepsLimit = 0;
+	session->maxRepsGood = 0;
+	return TCL_OK;
     case optTags:
 	if (session->tagList) {
 	    Tcl_DecrRefCount(session->tagList);
@@ -864,6 +984,148 @@ SetOption(interp, object, option, objPtr)
 
     return TCL_OK;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetSnmpOption --
+ *
+ *	This procedure retrieves the value of an option of the SNMP
+ *	engine.
+ *
+ * Results:
+ *	A pointer to the value formatted as a string.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_Obj*
+GetSnmpOption(interp, object, option)
+    Tcl_Interp *interp;
+    ClientData object;
+    int option;
+{
+    switch ((enum snmpOptions) option) {
+    case snmpOptTick:
+	return Tcl_NewIntObj(TnmSnmpGetTick());
+    case snmpOptRecvBatch:
+	return Tcl_NewIntObj(tnmSnmpRecvBatch);
+    case snmpOptSendBatch:
+	return Tcl_NewIntObj(tnmSnmpSendBatch);
+    case snmpOptSockets:
+	return Tcl_NewIntObj(tnmSnmpSockets);
+    case snmpOptRecvBuffer:
+	return Tcl_NewIntObj(tnmSnmpRecvBuffer);
+    case snmpOptThreads:
+	return Tcl_NewIntObj(tnmSnmpThreads);
+    case snmpOptKeyCache:
+	return Tcl_NewIntObj(tnmSnmpKeyCache);
+    case snmpOptAgentCache:
+	return Tcl_NewIntObj(tnmSnmpAgentCache);
+    case snmpOptAgentCacheTTL:
+	return Tcl_NewIntObj(tnmSnmpAgentCacheTTL);
+    }
+    return NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetSnmpOption --
+ *
+ *	This procedure modifies a single option of the SNMP engine.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SetSnmpOption(interp, object, option, objPtr)
+    Tcl_Interp *interp;
+    ClientData object;
+    int option;
+    Tcl_Obj *objPtr;
+{
+    int num;
+
+    switch ((enum snmpOptions) option) {
+    case snmpOptTick:
+	if (TnmGetPositiveFromObj(interp, objPtr, &num) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	TnmSnmpSetTick(num);
+	return TCL_OK;
+    case snmpOptRecvBatch:
+	if (TnmGetPositiveFromObj(interp, objPtr, &num) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	tnmSnmpRecvBatch = num;
+	return TCL_OK;
+    case snmpOptSendBatch:
+	if (TnmGetPositiveFromObj(interp, objPtr, &num) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	tnmSnmpSendBatch = num;
+	TnmSnmpFlush();
+	return TCL_OK;
+    case snmpOptSockets:
+	if (TnmGetPositiveFromObj(interp, objPtr, &num) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	tnmSnmpSockets = num;
+	return TnmSnmpSetSockets(interp);
+    case snmpOptRecvBuffer:
+	if (TnmGetUnsignedFromObj(interp, objPtr, &num) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	tnmSnmpRecvBuffer = num;
+	return TnmSnmpSetSockets(interp);
+    case snmpOptThreads:
+	if (TnmGetUnsignedFromObj(interp, objPtr, &num) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+#ifndef TCL_THREADS
+	if (num > 0) {
+	    Tcl_SetResult(interp, "threads not supported by this build",
+			  TCL_STATIC);
+	    return TCL_ERROR;
+	}
+#endif
+	tnmSnmpThreads = num;
+	return TnmSnmpSetSockets(interp);
+    case snmpOptKeyCache:
+	if (TnmGetUnsignedFromObj(interp, objPtr, &num) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	tnmSnmpKeyCache = num;
+	TnmSnmpSetKeyCache();
+	return TCL_OK;
+    case snmpOptAgentCache:
+	if (TnmGetUnsignedFromObj(interp, objPtr, &num) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	tnmSnmpAgentCache = num;
+	TnmSnmpAgentSetCache();
+	return TCL_OK;
+    case snmpOptAgentCacheTTL:
+	if (TnmGetUnsignedFromObj(interp, objPtr, &num) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	tnmSnmpAgentCacheTTL = num;
+	TnmSnmpAgentSetCache();
+	return TCL_OK;
+    }
+
+    return TCL_OK;
+}
 
 /*
  *----------------------------------------------------------------------
@@ -1089,7 +1351,7 @@ Tnm_SnmpObjCmd(clientData, interp, objc, objv)
 #if 0
 	cmdArray,
 #endif
-	cmdDelta, cmdExpand, cmdFind, cmdGenerator, cmdInfo,
+	cmdCget, cmdConfigure, cmdDelta, cmdExpand, cmdFind, cmdGenerator, cmdInfo,
 	cmdListener, cmdNotifier, cmdOid, cmdResponder,
 	cmdType, cmdValue, cmdWait, cmdWatch 
     } cmd;
@@ -1099,20 +1361,20 @@ Tnm_SnmpObjCmd(clientData, interp, objc, objv)
 #if 0
 	"array",
 #endif
-	"delta", "expand", "find", "generator", "info",
+	"cget", "configure", "delta", "expand", "find", "generator", "info",
 	"listener", "notifier", "oid", "responder",
 	"type", "value", "wait", "watch",
 	(char *) NULL
     };
 
     enum infos { 
-	infoDomains, infoErrors, infoExceptions, infoPDUs, infoSecurity,
-	infoTypes, infoVersions 
+	infoDomains, infoErrors, infoExceptions, infoKeys, infoPDUs,
+	infoSecurity, infoSockets, infoTypes, infoVersions 
     } info;
 
     static CONST char *infoTable[] = {
-	"domains", "errors", "exceptions", "pdus", "security",
-	"types", "versions", (char *) NULL
+	"domains", "errors", "exceptions", "keys", "pdus", "security",
+	"sockets", "types", "versions", (char *) NULL
     };
 
     if (! control) {
@@ -1200,6 +1462,16 @@ Tnm_SnmpObjCmd(clientData, interp, objc, objv)
     }
 #endif
 
+    case cmdCget:
+	result = TnmGetConfig(interp, &snmpConfig, (ClientData) NULL,
+			      objc, objv);
+	break;
+
+    case cmdConfigure:
+	result = TnmSetConfig(interp, &snmpConfig, (ClientData) NULL,
+			      objc, objv);
+	break;
+
     case cmdDelta:
 	if (objc != 4) {
 	    Tcl_WrongNumArgs(interp, 2, objv, "varBindList1 varBindList2");
@@ -1312,6 +1584,12 @@ Tnm_SnmpObjCmd(clientData, interp, objc, objv)
 	case infoSecurity:
 	    TnmListFromTable(tnmSnmpSecurityLevelTable, listPtr, pattern);
 	    break;
+	case infoKeys:
+	    Tcl_SetObjResult(interp, TnmSnmpGetKeyCache());
+	    break;
+	case infoSockets:
+	    Tcl_SetObjResult(interp, TnmSnmpGetSockets(pattern));
+	    break;
 	case infoTypes:
 	    TnmListFromTable(tnmSnmpTypeTable, listPtr, pattern);
 	    break;
@@ -1554,7 +1832,7 @@ GeneratorCmd(clientData, interp, objc, objv)
 #ifdef ASN1_SNMP_GETRANGE
 	cmdGetRange, 
 #endif
-	cmdSet, cmdWait, cmdWalk
+	cmdSet, cmdTbl, cmdWait, cmdWalk
     } cmd;
 
     static CONST char *cmdTable[] = {
@@ -1562,7 +1840,7 @@ GeneratorCmd(clientData, interp, objc, objv)
 #ifdef ASN1_SNMP_GETRANGE
  	"getrange", 
 #endif
-	"set", "wait", "walk", (char *) NULL
+	"set", "table", "wait", "walk", (char *) NULL
     };
 
     if (objc < 2) {
@@ -1691,6 +1969,13 @@ GeneratorCmd(clientData, interp, objc, objv)
 	return Request(interp, session, ASN1_SNMP_SET, 0, 0,
 		       objv[2], (objc == 4) ? objv[3] : NULL);
 
+    case cmdTbl:
+	if (objc != 4) {
+	    Tcl_WrongNumArgs(interp, 2, objv, "table arrayName");
+	    return TCL_ERROR;
+	}
+	return Table(interp, session, objv[2], objv[3]);
+
     case cmdWait:
 	if (objc == 2) {
 	    return WaitSession(interp, session, 0);
@@ -1736,13 +2021,6 @@ GeneratorCmd(clientData, interp, objc, objv)
     }
 
     switch (cmd) {
-    case cmdTbl:
-	if (argc != 4) {
-	    TnmWrongNumArgs(interp, 2, argv, "table arrayName");
-	    return TCL_ERROR;
-	}
-	return Table(interp, session, argv[2], argv[3]);
-
     case cmdScalars:
 	if (argc != 4) {
 	    TnmWrongNumArgs(interp, 2, argv, "group arrayName");
@@ -2383,8 +2661,9 @@ WalkCheck(oidListLen, oidListElems, vbListLen, vbListElems)
  *
  *	This procedure is called once we have received the response
  *	during an asynchronous SNMP walk. It evaluates a Tcl script
- *	and starts another SNMP getnext if we did not reach the end
- *	of the MIB view.
+ *	for every row contained in the getbulk response and starts
+ *	another SNMP getbulk if we did not reach the end of the MIB
+ *	view.
  *
  * Results:
  *	None.
@@ -2403,18 +2682,10 @@ AsyncWalkProc(session, pdu, clientData)
 {
     AsyncToken *atPtr = (AsyncToken *) clientData;
     Tcl_Interp *interp = atPtr->interp;
-    Tcl_Obj *vbList, *newList, **vbListElems, **oidListElems;
-    int vbListLen, oidListLen;
-
-#if 0
-    if (pdu->errorStatus == TNM_SNMP_NOSUCHNAME) {
-	pdu->errorStatus = TNM_SNMP_ENDOFWALK;
-	TnmSnmpEvalCallback(interp, session, pdu, 
-			    Tcl_GetStringFromObj(atPtr->tclCmd, NULL),
-			    NULL, NULL, NULL, NULL);
-	goto done;
-    }
-#endif
+    Tcl_Obj *vbList, *newList = NULL, *lastList = NULL;
+    Tcl_Obj **vbListElems, **oidListElems;
+    int j, vbListLen, oidListLen;
+    TnmSnmp *s;
 
     if (pdu->errorStatus != TNM_SNMP_NOERROR) {
 	TnmSnmpEvalCallback(interp, session, pdu, 
@@ -2423,8 +2694,8 @@ AsyncWalkProc(session, pdu, clientData)
 	goto done;
     }
 
-    vbList = Tcl_NewStringObj(Tcl_DStringValue(&pdu->varbind), 
-			      Tcl_DStringLength(&pdu->varbind));
+    vbList = pdu->vbList;
+    Tcl_IncrRefCount(vbList);
     
     if (Tcl_ListObjGetElements(interp, atPtr->oidList,
 			       &oidListLen, &oidListElems) != TCL_OK) {
@@ -2435,25 +2706,65 @@ AsyncWalkProc(session, pdu, clientData)
 			       &vbListLen, &vbListElems) != TCL_OK) {
 	Tcl_Panic("AsyncWalkProc: failed to split varbind list");
     }
-    
-    newList = WalkCheck(oidListLen, oidListElems, vbListLen, vbListElems);
-    Tcl_DecrRefCount(vbList);
+
+    /*
+     * Evaluate the callback for every complete row of the response.
+     * Trailing varbinds of a truncated response are ignored since
+     * the next request starts again with the last complete row.
+     */
+
+    vbListLen -= vbListLen % oidListLen;
+    for (j = 0; j < vbListLen / oidListLen; j++) {
+	newList = WalkCheck(oidListLen, oidListElems, oidListLen,
+			    vbListElems + (j * oidListLen));
+	if (! newList) {
+	    break;
+	}
+	Tcl_IncrRefCount(newList);
+	if (lastList) {
+	    Tcl_DecrRefCount(lastList);
+	}
+	lastList = newList;
+	pdu->vbList = newList;
+	TnmSnmpEvalCallback(interp, session, pdu, 
+			    Tcl_GetStringFromObj(atPtr->tclCmd, NULL),
+			    NULL, NULL, NULL, NULL);
+	pdu->vbList = vbList;
+
+	for (s = tnmSnmpList; s && s != session; s = s->nextPtr) ;
+	if (! s) {
+	    Tcl_DecrRefCount(lastList);
+	    Tcl_DecrRefCount(vbList);
+	    goto done;
+	}
+    }
+
     if (! newList) {
 	pdu->errorStatus = TNM_SNMP_ENDOFWALK;
-	Tcl_DStringFree(&pdu->varbind);
+	pdu->vbList = Tcl_NewListObj(0, NULL);
+	Tcl_IncrRefCount(pdu->vbList);
 	TnmSnmpEvalCallback(interp, session, pdu, 
 			    Tcl_GetStringFromObj(atPtr->tclCmd, NULL),
 			    NULL, NULL, NULL, NULL);
+	Tcl_DecrRefCount(pdu->vbList);
+	pdu->vbList = vbList;
+	if (lastList) {
+	    Tcl_DecrRefCount(lastList);
+	}
+	Tcl_DecrRefCount(vbList);
 	goto done;
     }
-    TnmSnmpEvalCallback(interp, session, pdu, 
-			Tcl_GetStringFromObj(atPtr->tclCmd, NULL),
-			NULL, NULL, NULL, NULL);
-    pdu->type = ASN1_SNMP_GETNEXT;
+
+    pdu->type = ASN1_SNMP_GETBULK;
     pdu->requestId = TnmSnmpGetRequestId();
+    pdu->errorStatus = 0;
+    pdu->errorIndex = TnmSnmpGetRepetitions(session, oidListLen);
+    pdu->vbList = lastList;
     (void) TnmSnmpEncode(interp, session, pdu, AsyncWalkProc, 
 			 (ClientData) atPtr);
-    Tcl_DecrRefCount(newList);
+    pdu->vbList = vbList;
+    Tcl_DecrRefCount(lastList);
+    Tcl_DecrRefCount(vbList);
     return;
 
 done:
@@ -2461,7 +2772,7 @@ done:
     Tcl_DecrRefCount(atPtr->oidList);
     ckfree((char *) atPtr);
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -2530,7 +2841,8 @@ AsyncWalk(interp, session, oidList, tclCmd)
     atPtr->oidList = oidList;
     Tcl_IncrRefCount(atPtr->oidList);
 
-    PduInit(&pdu, session, ASN1_SNMP_GETNEXT);
+    PduInit(&pdu, session, ASN1_SNMP_GETBULK);
+    pdu.errorIndex = TnmSnmpGetRepetitions(session, oidListLen);
     Tcl_DStringAppend(&pdu.varbind, Tcl_GetStringFromObj(oidList, NULL), -1);
     result = TnmSnmpEncode(interp, session, &pdu, 
 			   AsyncWalkProc, (ClientData) atPtr);
@@ -2574,36 +2886,9 @@ SyncWalk(interp, session, varName, oidList, tclCmd)
 {
     int i, j, result;
     TnmSnmpPdu pdu;
-    int numRepeaters = 0;
     int oidListLen, vbListLen;
     Tcl_Obj **oidListElems, **vbListElems, *vbList;
 
-    /* 
-     * Set warpFactor and warpLimit variables defined below control
-     * how we increate the numRepeaters parameter while walking the
-     * MIB tree. We currently use the sequence 4 8 12 16 20 ... 48.
-     *
-     * The warpFactor defines the amount used to increase the value on
-     * numRepeaters in every round. The warpLimit defines an upper
-     * limit for numRepeaters. Note, the code below reduces the upper
-     * limit whenever a response is received with contains an
-     * "incomplete row".
-     *
-     * Some measurements show some real interesting effects. If you
-     * increase the warp factor too much, you will risk timeouts
-     * because the agent might need a lot of time to build the
-     * response. If the agent does not cache response packets, you
-     * will get very bad performance once the agents input queue fills
-     * up with retries. Therefore, we have limited the `warp' factor to
-     * 48 which works well with scotty's default parameters on an
-     * Ethernet. (This number should not be hard coded but perhaps it
-     * is better so because everyone should read this comment before
-     * playing with these parameters.)
-     */
-
-    int warpLimit = 48;
-    int warpFactor = 4;
-    
     /*
      * Make sure our argument is a valid Tcl list where every 
      * element in the list is a valid object identifier.
@@ -2634,13 +2919,14 @@ SyncWalk(interp, session, varName, oidList, tclCmd)
 	pdu.type        = ASN1_SNMP_GETBULK;
 	pdu.requestId   = TnmSnmpGetRequestId();
 
-	if (numRepeaters < warpLimit ) {
-	    numRepeaters += warpFactor;
-	}
+	/*
+	 * The max-repetitions value is derived from the number of
+	 * varbinds per response the session has learned so far.
+	 * See TnmSnmpAdaptRepetitions() for the details.
+	 */
 
 	pdu.errorStatus = 0;
-	pdu.errorIndex  = (numRepeaters / oidListLen > 0) 
-	    ? numRepeaters / oidListLen : 1;
+	pdu.errorIndex  = TnmSnmpGetRepetitions(session, oidListLen);
 
 	result = TnmSnmpEncode(interp, session, &pdu, NULL, NULL);
 	vbList = Tcl_GetObjResult(interp);
@@ -2673,10 +2959,6 @@ SyncWalk(interp, session, varName, oidList, tclCmd)
 	     * sync. 
 	     */
 	    vbListLen -= vbListLen % oidListLen;
-	    if (warpLimit > 0) {
-		numRepeaters -= warpFactor;
-		warpLimit = numRepeaters;
-	    }
 	}
 
 	Tcl_IncrRefCount(vbList);
@@ -2692,14 +2974,13 @@ SyncWalk(interp, session, varName, oidList, tclCmd)
 	    }
 
 	    PduFree(&pdu);
-	    Tcl_DStringAppend(&pdu.varbind, 
-			      Tcl_GetStringFromObj(newList, NULL), -1);
+	    pdu.vbList = newList;
+	    Tcl_IncrRefCount(pdu.vbList);
 
 	    if (Tcl_ObjSetVar2(interp, varName, (Tcl_Obj *) NULL,
 			       newList, TCL_LEAVE_ERR_MSG) == NULL) {
 		result = TCL_ERROR;
 		Tcl_DecrRefCount(vbList);
-		Tcl_DecrRefCount(newList);
 		goto loopDone;
 	    }
 
@@ -2968,18 +3249,22 @@ Extract(interp, what, objPtr, indexObjPtr)
 
     return TCL_OK;
 }
-#if 0
-
+
 /*
  *----------------------------------------------------------------------
  *
  * ExpandTable --
  *
- *	This procedure expands the list of table variables or a single
- *	table name into a list of MIB instances.
+ *	This procedure expands the name of a table or a table entry
+ *	into the list of columns that we retrieve. Columns that are
+ *	part of the index are skipped since their values are contained
+ *	in the instance identifier, unless the table has no other
+ *	columns.
  *
  * Results:
- *	A standard Tcl result.
+ *	A standard Tcl result. A pointer to a NULL terminated vector
+ *	of MIB nodes is left in columnsPtr. The vector must be freed
+ *	by the caller.
  *
  * Side effects:
  *	None.
@@ -2988,185 +3273,627 @@ Extract(interp, what, objPtr, indexObjPtr)
  */
 
 static int
-ExpandTable(interp, tList, dst)
+ExpandTable(interp, tableObj, columnsPtr)
     Tcl_Interp *interp;
-    char *tList;
-    Tcl_DString *dst;
+    Tcl_Obj *tableObj;
+    TnmMibNode ***columnsPtr;
 {
-    int i, argc, code;
-    char **argv = NULL;
-    TnmMibNode *nodePtr, *entryPtr = NULL, *tablePtr = NULL;
-    
-    code = Tcl_SplitList(interp, tList, &argc, &argv);
-    if (code != TCL_OK) {
+    int i, idxc = 0, numColumns = 0;
+    char *name = Tcl_GetStringFromObj(tableObj, NULL);
+    Tcl_Obj *idxObj = NULL, **idxv = NULL;
+    TnmMibNode *nodePtr, *entryPtr = NULL, **columns;
+
+    nodePtr = TnmMibFindNode(name, NULL, 1);
+    if (nodePtr && nodePtr->syntax == ASN1_SEQUENCE_OF) {
+	entryPtr = nodePtr->childPtr;
+    } else if (nodePtr && nodePtr->syntax == ASN1_SEQUENCE) {
+	entryPtr = nodePtr;
+    }
+    if (! entryPtr || ! entryPtr->childPtr) {
+	Tcl_AppendResult(interp, "unknown mib table \"", name, "\"",
+			 (char *) NULL);
 	return TCL_ERROR;
     }
 
-    for (i = 0; i < argc; i++) {
+    if (entryPtr->index && ! entryPtr->augment) {
+	idxObj = Tcl_NewStringObj(entryPtr->index, -1);
+	Tcl_IncrRefCount(idxObj);
+	if (Tcl_ListObjGetElements(NULL, idxObj, &idxc, &idxv) != TCL_OK) {
+	    idxc = 0;
+	}
+    }
 
-	/*
-	 * Lookup the given object.
-	 */
+    for (nodePtr = entryPtr->childPtr; nodePtr; nodePtr = nodePtr->nextPtr) {
+	numColumns++;
+    }
+    columns = (TnmMibNode **) ckalloc((numColumns + 1) * sizeof(TnmMibNode *));
 
-	nodePtr = TnmMibFindNode(argv[i], NULL, 0);
-	if (! nodePtr) {
-	    Tcl_AppendResult(interp, "unknown mib table \"", argv[i], "\"",
-			     (char *) NULL);
-	    ckfree((char *) argv);
-	    return TCL_ERROR;
+    numColumns = 0;
+    for (nodePtr = entryPtr->childPtr; nodePtr; nodePtr = nodePtr->nextPtr) {
+	if (nodePtr->access == TNM_MIB_NOACCESS) {
+	    continue;
+	}
+	for (i = 0; i < idxc; i++) {
+	    if (TnmMibFindNode(Tcl_GetStringFromObj(idxv[i], NULL),
+			       NULL, 1) == nodePtr) {
+		break;
+	    }
 	}
+	if (i == idxc) {
+	    columns[numColumns++] = nodePtr;
+	}
+    }
 
-	/*
-	 * Locate the entry (SEQUENCE) that contains this object.
-	 */
+    if (numColumns == 0) {
+	for (nodePtr = entryPtr->childPtr; nodePtr->nextPtr; 
+	     nodePtr = nodePtr->nextPtr) ;
+	columns[numColumns++] = nodePtr;
+    }
+    columns[numColumns] = NULL;
 
-	switch (nodePtr->syntax) {
-	  case ASN1_SEQUENCE:
-	    entryPtr = nodePtr;
-	    break;
-	  case ASN1_SEQUENCE_OF: 
-	    if (nodePtr->childPtr) {
-		entryPtr = nodePtr->childPtr;
-	    }
+    if (idxObj) {
+	Tcl_DecrRefCount(idxObj);
+    }
+    *columnsPtr = columns;
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TableProbe --
+ *
+ *	This procedure sends a getnext request which locates the first
+ *	row of a table and the first rows at or above the first index
+ *	subidentifiers 2^0 ... 2^31. The responses tell us the range
+ *	of the first index subidentifier which is split into segments.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The number of active requests is incremented if the request
+ *	has been sent.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TableProbe(session, statePtr)
+    TnmSnmp *session;
+    TableState *statePtr;
+{
+    TnmSnmpPdu pdu;
+    TnmOid oid;
+    Tcl_Obj *objPtr;
+    int i;
+
+    PduInit(&pdu, session, ASN1_SNMP_GETNEXT);
+    pdu.vbList = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(pdu.vbList);
+    TnmOidInit(&oid);
+    for (i = 0; i < TABLE_PROBES; i++) {
+	TnmOidCopy(&oid, &statePtr->probeOid);
+	if (i > 0) {
+	    TnmOidAppend(&oid, (u_int) 1 << (i - 1));
+	}
+	objPtr = TnmNewOidObj(&oid);
+	Tcl_ListObjAppendElement(NULL, pdu.vbList,
+				 Tcl_NewListObj(1, &objPtr));
+    }
+    TnmOidFree(&oid);
+
+    if (TnmSnmpEncode(statePtr->interp, session, &pdu,
+		      TableProbeProc, (ClientData) statePtr) == TCL_OK) {
+	statePtr->active++;
+    }
+    Tcl_ResetResult(statePtr->interp);
+    PduFree(&pdu);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TableProbeProc --
+ *
+ *	This procedure is called once we have received the response
+ *	to the probe request. The first varbind returns the first row
+ *	of the table. The first probe which leaves the column bounds
+ *	the first index subidentifier of all rows. Errors leave the
+ *	default range 0 ... 256 in place.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The index range in the table state is updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TableProbeProc(session, pdu, clientData)
+    TnmSnmp *session;
+    TnmSnmpPdu *pdu;
+    ClientData clientData;
+{
+    TableState *statePtr = (TableState *) clientData;
+    int i, vbc, elemc, oidLen;
+    Tcl_Obj **vbv, **elemv;
+    TnmOid *oidPtr;
+    u_int firstIndex = 0, lastIndex = 0xffffffff;
+
+    statePtr->active--;
+    if (pdu->errorStatus != TNM_SNMP_NOERROR
+	|| Tcl_ListObjGetElements(NULL, pdu->vbList, &vbc, &vbv) != TCL_OK
+	|| vbc != TABLE_PROBES) {
+	return;
+    }
+
+    oidLen = TnmOidGetLength(&statePtr->probeOid);
+    for (i = 0; i < vbc; i++) {
+	if (Tcl_ListObjGetElements(NULL, vbv[i], &elemc, &elemv) != TCL_OK
+	    || elemc < 3) {
+	    return;
+	}
+	oidPtr = TnmGetOidFromObj(NULL, elemv[0]);
+	if (! oidPtr) {
+	    return;
+	}
+	if (TnmOidGetLength(oidPtr) <= oidLen
+	    || ! TnmOidInTree(&statePtr->probeOid, oidPtr)
+	    || TnmGetTableKey(tnmSnmpExceptionTable,
+		      Tcl_GetStringFromObj(elemv[1], NULL)) != -1) {
+	    lastIndex = i ? (u_int) 1 << (i - 1) : 0;
 	    break;
-	  default:
-	    if (nodePtr->parentPtr && nodePtr->childPtr == NULL
-		&& nodePtr->parentPtr->syntax == ASN1_SEQUENCE) {
-		entryPtr = nodePtr->parentPtr;
-	    } else {
-	    unknownTable:
-		Tcl_AppendResult(interp, "not a table \"", argv[i], "\"",
-				 (char *) NULL);
-		ckfree((char *) argv);
-		return TCL_ERROR;
-	    }
 	}
+	if (i == 0) {
+	    firstIndex = TnmOidGet(oidPtr, oidLen);
+	}
+    }
 
-	/*
-	 * Check whether all objects belong to the same table.
-	 */
+    statePtr->firstIndex = firstIndex;
+    statePtr->lastIndex = lastIndex;
+}
 
-	if (entryPtr == NULL || entryPtr->parentPtr == NULL) {
-	    goto unknownTable;
-	}
+/*
+ *----------------------------------------------------------------------
+ *
+ * TableWait --
+ *
+ *	This procedure processes events until all requests of a table
+ *	retrieval are done or the session has been destroyed, which
+ *	discards all outstanding requests.
+ *
+ * Results:
+ *	Returns 1 if the session still exists and 0 otherwise.
+ *
+ * Side effects:
+ *	Tcl events are processed.
+ *
+ *----------------------------------------------------------------------
+ */
 
-	if (tablePtr == NULL) {
-	    tablePtr = entryPtr->parentPtr;
+static int
+TableWait(session, statePtr)
+    TnmSnmp *session;
+    TableState *statePtr;
+{
+    TnmSnmp *s;
+
+    while (statePtr->active > 0) {
+	for (s = tnmSnmpList; s && s != session; s = s->nextPtr) ;
+	if (! s) {
+	    return 0;
 	}
-	if (tablePtr != entryPtr->parentPtr) {
-	    Tcl_AppendResult(interp, "instances not in the same table",
-			     (char *) NULL);
-	    ckfree((char *) argv);
-	    return TCL_ERROR;
+	Tcl_DoOneEvent(0);
+    }
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TableRequest --
+ *
+ *	This procedure sends the next request for a segment of a
+ *	table retrieval. The request is queued if the window of the
+ *	session is full.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The number of active requests is incremented or an error
+ *	is recorded in the table state.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TableRequest(session, segPtr)
+    TnmSnmp *session;
+    TableSegment *segPtr;
+{
+    TableState *statePtr = segPtr->statePtr;
+    TnmSnmpPdu pdu;
+    Tcl_Obj *objPtr;
+    int code;
+
+    PduInit(&pdu, session, ASN1_SNMP_GETBULK);
+    segPtr->maxReps = TnmSnmpGetRepetitions(session, 1);
+    pdu.errorIndex = segPtr->maxReps;
+    objPtr = TnmNewOidObj(&segPtr->nextOid);
+    objPtr = Tcl_NewListObj(1, &objPtr);
+    pdu.vbList = Tcl_NewListObj(1, &objPtr);
+    Tcl_IncrRefCount(pdu.vbList);
+
+    code = TnmSnmpEncode(statePtr->interp, session, &pdu,
+			 TableProc, (ClientData) segPtr);
+    if (code == TCL_OK) {
+	statePtr->active++;
+    } else if (statePtr->code == TCL_OK) {
+	statePtr->code = TCL_ERROR;
+	statePtr->errorObj = Tcl_GetObjResult(statePtr->interp);
+	Tcl_IncrRefCount(statePtr->errorObj);
+    }
+    PduFree(&pdu);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TableProc --
+ *
+ *	This procedure is called once we have received the response
+ *	for a segment of a table retrieval. It saves all values that
+ *	belong to the segment and sends the next request unless we
+ *	have reached the end of the segment.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Rows are added to the table state.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TableProc(session, pdu, clientData)
+    TnmSnmp *session;
+    TnmSnmpPdu *pdu;
+    ClientData clientData;
+{
+    TableSegment *segPtr = (TableSegment *) clientData;
+    TableState *statePtr = segPtr->statePtr;
+    int i, j, isNew, vbc, elemc, oidLen;
+    Tcl_Obj **vbv, **elemv;
+    TnmOid *oidPtr, instOid;
+    TableRow *rowPtr;
+    Tcl_HashEntry *entryPtr;
+
+    statePtr->active--;
+    if (statePtr->code != TCL_OK) {
+	return;
+    }
+
+    /*
+     * SNMPv1 agents signal the end of the MIB view with a noSuchName
+     * error. A tooBig error has already reduced the number of
+     * repetitions of the session so we simply retry until we ask
+     * for a single instance.
+     */
+
+    if (pdu->errorStatus == TNM_SNMP_NOSUCHNAME
+	&& session->version == TNM_SNMPv1) {
+	return;
+    }
+    if (pdu->errorStatus == TNM_SNMP_TOOBIG && segPtr->maxReps > 1) {
+	TableRequest(session, segPtr);
+	return;
+    }
+    if (pdu->errorStatus != TNM_SNMP_NOERROR) {
+	char buf[20], *name;
+	name = TnmGetTableValue(tnmSnmpErrorTable,
+				(unsigned) pdu->errorStatus);
+	statePtr->code = TCL_ERROR;
+	statePtr->errorObj = Tcl_NewStringObj(name ? name : "unknown", -1);
+	Tcl_IncrRefCount(statePtr->errorObj);
+	sprintf(buf, " %d ", pdu->errorIndex ? pdu->errorIndex - 1 : 0);
+	Tcl_AppendStringsToObj(statePtr->errorObj, buf,
+			       pdu->vbList ? Tcl_GetString(pdu->vbList) : "{}",
+			       (char *) NULL);
+	return;
+    }
+
+    if (Tcl_ListObjGetElements(NULL, pdu->vbList, &vbc, &vbv) != TCL_OK) {
+	return;
+    }
+
+    oidLen = TnmOidGetLength(&segPtr->colOid);
+    for (i = 0; i < vbc; i++) {
+	if (Tcl_ListObjGetElements(NULL, vbv[i], &elemc, &elemv) != TCL_OK
+	    || elemc < 3) {
+	    return;
+	}
+	oidPtr = TnmGetOidFromObj(NULL, elemv[0]);
+	if (! oidPtr
+	    || TnmOidGetLength(oidPtr) <= oidLen
+	    || ! TnmOidInTree(&segPtr->colOid, oidPtr)
+	    || TnmOidCompare(oidPtr, &segPtr->nextOid) <= 0) {
+	    return;
+	}
+	if (TnmOidGetLength(&segPtr->lastOid)
+	    && TnmOidCompare(oidPtr, &segPtr->lastOid) > 0) {
+	    return;
+	}
+	TnmOidCopy(&segPtr->nextOid, oidPtr);
+
+	switch (TnmGetTableKey(tnmSnmpExceptionTable,
+			       Tcl_GetStringFromObj(elemv[1], NULL))) {
+	case ASN1_END_OF_MIB_VIEW:
+	    return;
+	case ASN1_NO_SUCH_OBJECT:
+	case ASN1_NO_SUCH_INSTANCE:
+	    continue;
 	}
 
 	/*
-	 * Now add the nodes to the list. Expand SEQUENCE nodes to
-	 * include all child nodes. Check the access mode which must
-	 * allow at least read access.
+	 * Locate the row for this instance identifier and save the
+	 * value in the column retrieved by this segment.
 	 */
 
-	if (nodePtr == entryPtr || nodePtr == tablePtr) {
-	    TnmMibNode *nPtr;
-	    for (nPtr = entryPtr->childPtr; nPtr; nPtr=nPtr->nextPtr) {
-		if (nPtr->access != TNM_MIB_NOACCESS) {
-		    Tcl_DStringAppendElement(dst, nPtr->label);
-		}
-	    }
+	TnmOidInit(&instOid);
+	TnmOidSetLength(&instOid, TnmOidGetLength(oidPtr) - oidLen);
+	for (j = oidLen; j < TnmOidGetLength(oidPtr); j++) {
+	    TnmOidSet(&instOid, j - oidLen, TnmOidGet(oidPtr, j));
+	}
+	entryPtr = Tcl_CreateHashEntry(&statePtr->rowTable,
+				       TnmOidToString(&instOid), &isNew);
+	if (isNew) {
+	    rowPtr = (TableRow *) ckalloc(sizeof(TableRow) 
+			  + (statePtr->numColumns - 1) * sizeof(Tcl_Obj *));
+	    memset((char *) rowPtr, 0, sizeof(TableRow)
+		   + (statePtr->numColumns - 1) * sizeof(Tcl_Obj *));
+	    TnmOidInit(&rowPtr->instOid);
+	    TnmOidCopy(&rowPtr->instOid, &instOid);
+	    Tcl_SetHashValue(entryPtr, (ClientData) rowPtr);
 	} else {
-	    if (nodePtr->access != TNM_MIB_NOACCESS) {
-		Tcl_DStringAppendElement(dst, nodePtr->label);
-	    }
+	    rowPtr = (TableRow *) Tcl_GetHashValue(entryPtr);
 	}
+	TnmOidFree(&instOid);
+
+	if (rowPtr->values[segPtr->column]) {
+	    Tcl_DecrRefCount(rowPtr->values[segPtr->column]);
+	}
+	rowPtr->values[segPtr->column] = elemv[2];
+	Tcl_IncrRefCount(elemv[2]);
     }
 
-    ckfree((char *) argv);
-    return TCL_OK;
+    if (vbc > 0) {
+	TableRequest(session, segPtr);
+    }
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TableCompare --
+ *
+ *	This procedure compares two table rows. It is called by
+ *	qsort() to sort the rows by instance identifier.
+ *
+ * Results:
+ *	Returns -1, 0 or 1, depending on whether the first row is
+ *	less than, equal to, or greater than the second row.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+TableCompare(a, b)
+    CONST VOID *a;
+    CONST VOID *b;
+{
+    TableRow *row1 = *(TableRow **) a;
+    TableRow *row2 = *(TableRow **) b;
+
+    return TnmOidCompare(&row1->instOid, &row2->instOid);
+}
+
 /*
  *----------------------------------------------------------------------
  *
  * Table --
  *
  *	This procedure retrieves a conceptual SNMP table and stores
- *	the values in a Tcl array.
+ *	the values in a Tcl array. The elements of the array are
+ *	named column:instance. Every column is split into segments
+ *	which are retrieved in parallel using getbulk requests. The
+ *	segments split the range of the first subidentifier of the
+ *	instance identifier found by a probe request, or 0 ... 256 if
+ *	the probe fails. The number of segments is chosen such that
+ *	all segments fit into the window of the session.
  *
  * Results:
- *	A standard Tcl result.
+ *	A standard Tcl result. The result is the list of instance
+ *	identifiers in lexicographic order.
  *
  * Side effects:
- *	Tcl variables are modified.
+ *	Tcl variables are modified. Tcl events are processed while
+ *	we wait for responses.
  *
  *----------------------------------------------------------------------
  */
 
 static int
-Table(interp, session, table, arrayName)
+Table(interp, session, tableObj, arrayName)
     Tcl_Interp *interp;
     TnmSnmp *session;
-    char *table;
-    char *arrayName;
+    Tcl_Obj *tableObj;
+    Tcl_Obj *arrayName;
 {
-    int i, largc, code;
-    TnmSnmpPdu _pdu, *pdu = &_pdu;
-    Tcl_DString varList;
-    char **largv;
-    
-    /*
-     * A special hack to make sure that the given array name 
-     * is actually known as an array.
-     */
+    int i, j, k, numSegments, numRows, alive = 1;
+    double range;
+    TableState state;
+    TableSegment *segments, *segPtr;
+    TableRow **rows;
+    TnmMibNode **columns;
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+    Tcl_Obj *listObj, *instObj, *nameObj;
 
-    Tcl_SetVar2(interp, arrayName, "foo", "", 0);
-    Tcl_UnsetVar(interp, arrayName, 0);
+    if (ExpandTable(interp, tableObj, &columns) != TCL_OK) {
+	return TCL_ERROR;
+    }
+
+    state.interp = interp;
+    state.active = 0;
+    state.code = TCL_OK;
+    state.errorObj = NULL;
+    for (state.numColumns = 0; columns[state.numColumns]; 
+	 state.numColumns++) ;
+    Tcl_InitHashTable(&state.rowTable, TCL_STRING_KEYS);
+    TnmOidInit(&state.probeOid);
+    TnmMibNodeToOid(columns[0], &state.probeOid);
+    state.firstIndex = 0;
+    state.lastIndex = 256;
+
+    numSegments = session->window 
+	? session->window / state.numColumns : TABLE_SEGMENTS;
+    if (numSegments < 1) {
+	numSegments = 1;
+    }
+    if (numSegments > TABLE_SEGMENTS) {
+	numSegments = TABLE_SEGMENTS;
+    }
 
     /*
-     * Initialize the PDU.
+     * Probe the range of the first index subidentifier unless we
+     * retrieve every column with a single segment. Stop waiting if
+     * the session is destroyed since this discards all outstanding
+     * requests.
      */
 
-    pdu->addr        = session->maddr;
-    pdu->type        = ASN1_SNMP_GETBULK;
-    pdu->requestId   = TnmSnmpGetRequestId();
-    pdu->errorStatus = TNM_SNMP_NOERROR;
-    pdu->errorIndex  = 0;    
-    pdu->trapOID     = NULL;
-    Tcl_DStringInit(&pdu->varbind);
-    Tcl_DStringInit(&varList);
+    Tcl_Preserve((ClientData) session);
+    if (numSegments > 1) {
+	TableProbe(session, &state);
+	alive = TableWait(session, &state);
+    }
+    range = (double) state.lastIndex - state.firstIndex;
+    if (range < numSegments) {
+	numSegments = range < 1 ? 1 : (int) range;
+    }
+
+    segments = (TableSegment *) ckalloc(state.numColumns * numSegments 
+					* sizeof(TableSegment));
+    for (i = 0; i < state.numColumns; i++) {
+	for (k = 0; k < numSegments; k++) {
+	    segPtr = segments + i * numSegments + k;
+	    segPtr->column = i;
+	    segPtr->maxReps = 0;
+	    segPtr->statePtr = &state;
+	    TnmOidInit(&segPtr->colOid);
+	    TnmOidInit(&segPtr->nextOid);
+	    TnmOidInit(&segPtr->lastOid);
+	    TnmMibNodeToOid(columns[i], &segPtr->colOid);
+	    TnmOidCopy(&segPtr->nextOid, &segPtr->colOid);
+	    if (k > 0) {
+		TnmOidAppend(&segPtr->nextOid, (u_int)
+			     (state.firstIndex + range * k / numSegments));
+	    }
+	    if (k < numSegments - 1) {
+		TnmOidCopy(&segPtr->lastOid, &segPtr->colOid);
+		TnmOidAppend(&segPtr->lastOid, (u_int) (state.firstIndex
+			     + range * (k + 1) / numSegments));
+	    }
+	}
+    }
 
     /*
-     * Expand the given table list to create the complete getnext varbind.
+     * Send the first request for every segment and process events
+     * until all segments are done.
      */
 
-    code = ExpandTable(interp, table, &varList);
-    if (code != TCL_OK) {
-        return TCL_ERROR;
+    for (i = 0; alive && i < state.numColumns * numSegments; i++) {
+	if (state.code == TCL_OK) {
+	    TableRequest(session, segments + i);
+	}
     }
-
-    if (Tcl_DStringLength(&varList) == 0) {
-	return TCL_OK;
+    if (alive) {
+	TableWait(session, &state);
     }
+    Tcl_Release((ClientData) session);
 
     /*
-     *
+     * Sort the rows by instance identifier and store the values in
+     * the array in index order.
      */
 
-    code = Tcl_SplitList(interp, Tcl_DStringValue(&varList),
-			 &largc, &largv);
-    if (code != TCL_OK) {
-	Tcl_DStringFree(&varList);
-	return TCL_ERROR;
+    numRows = state.rowTable.numEntries;
+    rows = (TableRow **) ckalloc((numRows + 1) * sizeof(TableRow *));
+    entryPtr = Tcl_FirstHashEntry(&state.rowTable, &search);
+    for (i = 0; entryPtr; entryPtr = Tcl_NextHashEntry(&search)) {
+	rows[i++] = (TableRow *) Tcl_GetHashValue(entryPtr);
+    }
+    qsort((VOID *) rows, (size_t) numRows, sizeof(TableRow *), TableCompare);
+
+    listObj = Tcl_NewListObj(0, NULL);
+    for (i = 0; i < numRows && state.code == TCL_OK; i++) {
+	instObj = Tcl_NewStringObj(TnmOidToString(&rows[i]->instOid), -1);
+	Tcl_ListObjAppendElement(NULL, listObj, instObj);
+	for (j = 0; j < state.numColumns; j++) {
+	    if (! rows[i]->values[j]) continue;
+	    nameObj = Tcl_NewStringObj(columns[j]->label, -1);
+	    Tcl_AppendToObj(nameObj, ":", 1);
+	    Tcl_AppendObjToObj(nameObj, instObj);
+	    Tcl_IncrRefCount(nameObj);
+	    if (Tcl_ObjSetVar2(interp, arrayName, nameObj, 
+			       rows[i]->values[j], TCL_LEAVE_ERR_MSG) == NULL) {
+		state.code = TCL_ERROR;
+		state.errorObj = Tcl_GetObjResult(interp);
+		Tcl_IncrRefCount(state.errorObj);
+		Tcl_DecrRefCount(nameObj);
+		break;
+	    }
+	    Tcl_DecrRefCount(nameObj);
+	}
     }
 
-    for (i = 0; i < largc; i++) {
-	TnmWriteMessage(largv[i]);
-	TnmWriteMessage("\n");
+    if (state.code == TCL_OK) {
+	Tcl_SetObjResult(interp, listObj);
+    } else {
+	Tcl_DecrRefCount(listObj);
+	Tcl_SetObjResult(interp, state.errorObj);
+	Tcl_DecrRefCount(state.errorObj);
     }
 
-    ckfree((char *) largv);
-    Tcl_DStringFree(&varList);
-    return TCL_OK;
+    for (i = 0; i < numRows; i++) {
+	for (j = 0; j < state.numColumns; j++) {
+	    if (rows[i]->values[j]) {
+		Tcl_DecrRefCount(rows[i]->values[j]);
+	    }
+	}
+	TnmOidFree(&rows[i]->instOid);
+	ckfree((char *) rows[i]);
+    }
+    for (i = 0; i < state.numColumns * numSegments; i++) {
+	TnmOidFree(&segments[i].colOid);
+	TnmOidFree(&segments[i].nextOid);
+	TnmOidFree(&segments[i].lastOid);
+    }
+    Tcl_DeleteHashTable(&state.rowTable);
+    TnmOidFree(&state.probeOid);
+    ckfree((char *) rows);
+    ckfree((char *) segments);
+    ckfree((char *) columns);
+    return state.code;
 }
+#if 0
 
 /*
  *----------------------------------------------------------------------
@@ -3306,6 +4033,7 @@ Scalars(interp, session, group, arrayName)
     pdu->errorStatus = TNM_SNMP_NOERROR;
     pdu->errorIndex  = 0;    
     pdu->trapOID     = NULL;
+    pdu->vbList      = NULL;
     Tcl_DStringInit(&pdu->varbind);
     Tcl_DStringInit(&varList);
     Tcl_DStringInit(&result);
@@ -33,38 +33,99 @@ TnmTable tnmSnmpSecurityLevelTable[] =
 };
 
 /*
- * The following structures and procedures are used to keep a list of
- * keys that were computed with the SNMPv3 password to key algorithm.
- * This cache is needed so that identical sessions don't suffer from
- * repeated slow computations of authentication keys.
+ * The following structures and procedures are used to cache keys
+ * that were computed with the SNMPv3 password to key algorithm. The
+ * master cache maps the algorithm and the password to the result of
+ * the expensive password stretching. The localized cache maps the
+ * algorithm, the password and the engineID to the localized key.
+ * Both caches are shared by all interpreters and hold at most
+ * tnmSnmpKeyCache keys each. The least recently used key is removed
+ * when a cache is full.
  */
 
+typedef struct KeyEntry {
+    u_char key[20];		/* The key (large enough for MD5 and SHA). */
+    int keyLength;		/* The length of the key. */
+    Tcl_HashEntry *entryPtr;	/* The hash table entry of this key. */
+    struct KeyEntry *prevPtr;	/* The next more recently used key. */
+    struct KeyEntry *nextPtr;	/* The next less recently used key. */
+} KeyEntry;
+
 typedef struct KeyCache {
-    Tcl_Obj *password;
-    Tcl_Obj *engineID;
-    Tcl_Obj *key;
-    int algorithm;
-    struct KeyCache *nextPtr;
+    Tcl_HashTable table;	/* The keys indexed by their parameters. */
+    KeyEntry *firstPtr;		/* The most recently used key. */
+    KeyEntry *lastPtr;		/* The least recently used key. */
+    Tcl_WideInt hits;		/* The number of successful lookups. */
+    Tcl_WideInt misses;		/* The number of failed lookups. */
 } KeyCache;
 
+int tnmSnmpKeyCache = TNM_SNMP_KEYCACHE;
+
+static KeyCache masterCache, localCache;
+static int initialized = 0;
+
+/*
+ * The localized authentication keys of all sessions which authenticate
+ * their messages are registered in the userTable. The table maps the
+ * engineID and the user name to the list of keys used by sessions for
+ * this user, which may have been computed from different passwords.
+ * The userTable is protected by the keyMutex, just like the caches.
+ */
+
+typedef struct TnmSnmpUsmKey {
+    int algorithm;			/* The authentication algorithm. */
+    u_char key[TNM_SNMP_AUTH_KEYSIZE];	/* The localized key. */
+    int keyLength;			/* The length of the key. */
+    Tcl_HashEntry *entryPtr;		/* The hash table entry of the user. */
+    struct TnmSnmpUsmKey *nextPtr;	/* The next key of the same user. */
+} TnmSnmpUsmKey;
+
+static Tcl_HashTable userTable;
+
+TCL_DECLARE_MUTEX(keyMutex)
+
 /*
  * Forward declarations for procedures defined later in this file:
  */
 
 static void
 MD5PassWord2Key	_ANSI_ARGS_((u_char *pwBytes, int pwLength,
-			     u_char *engineBytes, int engineLength,
 			     u_char *key));
 static void
 SHAPassWord2Key	_ANSI_ARGS_((u_char *pwBytes, int pwLength,
-			     u_char *engineBytes, int engineLength,
 			     u_char *key));
+static int
+LocalizeKey	_ANSI_ARGS_((int algorithm, u_char *keyBytes,
+			     int keyLength, u_char *engineBytes,
+			     int engineLength, u_char *localKey));
+static KeyEntry*
+FindKey		_ANSI_ARGS_((KeyCache *cachePtr, char *name));
+
+static void
+CacheKey	_ANSI_ARGS_((KeyCache *cachePtr, char *name,
+			     u_char *key, int keyLength));
+static void
+TrimKeys	_ANSI_ARGS_((KeyCache *cachePtr, int size));
+
+static void
+KeyName		_ANSI_ARGS_((Tcl_DString *dsPtr, int algorithm,
+			     char *engineBytes, int engineLength,
+			     char *pwBytes, int pwLength));
 static void
 ComputeKey	_ANSI_ARGS_((Tcl_Obj **objPtrPtr, Tcl_Obj *password,
 			     Tcl_Obj *engineID, int algorithm));
 static void
-MD5AuthOutMsg	_ANSI_ARGS_((char *authKey, u_char *msg, int msgLen,
-			     u_char *msgAuthenticationParameters));
+InitKeyTables	_ANSI_ARGS_((void));
+
+static void
+RegisterKey	_ANSI_ARGS_((TnmSnmp *session));
+
+static u_char*
+FindAuthParams	_ANSI_ARGS_((u_char *msg, int msgLen));
+
+static void
+ComputeHmac	_ANSI_ARGS_((int algorithm, u_char *key, int keyLength,
+			     u_char *msg, int msgLen, u_char *digest));
 
 
 /*
@@ -75,10 +136,11 @@ MD5AuthOutMsg	_ANSI_ARGS_((char *authKey, u_char *msg, int msgLen,
  *	This procedure converts a password into a key by using
  *	the `Password to Key Algorithm' as defined in RFC 2274.
  *	The code is a slightly modified version of the source
- *	code in appendix A.2.1 of RFC 2274.
+ *	code in appendix A.2.1 of RFC 2274. The key is not
+ *	localized.
  *
  * Results:
- *	The key is written to the argument key.
+ *	The 16 byte key is written to the argument key.
  *
  * Side effects:
  *	None.
@@ -87,11 +149,9 @@ MD5AuthOutMsg	_ANSI_ARGS_((char *authKey, u_char *msg, int msgLen,
  */
 
 static void
-MD5PassWord2Key(pwBytes, pwLength, engineBytes, engineLength, key)
+MD5PassWord2Key(pwBytes, pwLength, key)
     u_char *pwBytes;
     int pwLength;
-    u_char *engineBytes;
-    int engineLength;
     u_char *key;
 {
     MD5_CTX MD;
@@ -108,16 +168,8 @@ MD5PassWord2Key(pwBytes, pwLength, engineBytes, engineLength, key)
 	count += 64;
     }
     TnmMD5Final(key, &MD);
-
-    memcpy(buffer, key, 16);
-    memcpy(buffer + 16, engineBytes, (size_t) engineLength);
-    memcpy(buffer + 16 + engineLength, key, 16);
-    
-    TnmMD5Init(&MD);
-    TnmMD5Update(&MD, buffer, 16 + engineLength + 16);
-    TnmMD5Final(key, &MD);
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -126,10 +178,11 @@ MD5PassWord2Key(pwBytes, pwLength, engineBytes, engineLength, key)
  *	This procedure converts a password into a key by using
  *	the `Password to Key Algorithm' as defined in RFC 2274.
  *	The code is a slightly modified version of the source
- *	code in appendix A.2.2 of RFC 2274.
+ *	code in appendix A.2.2 of RFC 2274. The key is not
+ *	localized.
  *
  * Results:
- *	The key is written to the argument key.
+ *	The 20 byte key is written to the argument key.
  *
  * Side effects:
  *	None.
@@ -138,15 +191,13 @@ MD5PassWord2Key(pwBytes, pwLength, engineBytes, engineLength, key)
  */
 
 static void
-SHAPassWord2Key(pwBytes, pwLength, engineBytes, engineLength, key)
+SHAPassWord2Key(pwBytes, pwLength, key)
     u_char *pwBytes;
     int pwLength;
-    u_char *engineBytes;
-    int engineLength;
     u_char *key;
 {
     SHA_CTX SH;
-    u_char *cp, buffer[72];
+    u_char *cp, buffer[64];
     int i, index = 0, count = 0;
 
     TnmSHAInit(&SH);
@@ -159,30 +210,296 @@ SHAPassWord2Key(pwBytes, pwLength, engineBytes, engineLength, key)
 	count += 64;
     }
     TnmSHAFinal(key, &SH);
-    
-    memcpy(buffer, key, 20);
-    memcpy(buffer + 20, engineBytes, (size_t) engineLength);
-    memcpy(buffer + 20 + engineLength, key, 20);
-    
-    TnmSHAInit(&SH);
-    TnmSHAUpdate(&SH, buffer, 20 + engineLength + 20);
-    TnmSHAFinal(key, &SH);
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LocalizeKey --
+ *
+ *	This procedure localizes a key for an engineID as described
+ *	in section 2.6 of RFC 2274.
+ *
+ * Results:
+ *	The length of the localized key which is written to the
+ *	argument localKey.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+LocalizeKey(algorithm, keyBytes, keyLength, engineBytes, engineLength,
+	    localKey)
+    int algorithm;
+    u_char *keyBytes;
+    int keyLength;
+    u_char *engineBytes;
+    int engineLength;
+    u_char *localKey;
+{
+    switch (algorithm) {
+    case TNM_SNMP_AUTH_MD5: {
+	MD5_CTX MD;
+	TnmMD5Init(&MD);
+	TnmMD5Update(&MD, keyBytes, keyLength);
+	TnmMD5Update(&MD, engineBytes, engineLength);
+	TnmMD5Update(&MD, keyBytes, keyLength);
+	TnmMD5Final(localKey, &MD);
+	return 16;
+    }
+    case TNM_SNMP_AUTH_SHA: {
+	SHA_CTX SH;
+	TnmSHAInit(&SH);
+	TnmSHAUpdate(&SH, keyBytes, keyLength);
+	TnmSHAUpdate(&SH, engineBytes, engineLength);
+	TnmSHAUpdate(&SH, keyBytes, keyLength);
+	TnmSHAFinal(localKey, &SH);
+	return 20;
+    }
+    default:
+	Tcl_Panic("unknown algorithm for key localization");
+    }
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FindKey --
+ *
+ *	This procedure looks up a key in a key cache and updates
+ *	the statistics of the cache. The caller must hold keyMutex.
+ *
+ * Results:
+ *	A pointer to the key entry or NULL if not found.
+ *
+ * Side effects:
+ *	The key becomes the most recently used key of the cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static KeyEntry*
+FindKey(cachePtr, name)
+    KeyCache *cachePtr;
+    char *name;
+{
+    Tcl_HashEntry *entryPtr;
+    KeyEntry *keyPtr;
+
+    entryPtr = Tcl_FindHashEntry(&cachePtr->table, name);
+    if (! entryPtr) {
+	cachePtr->misses++;
+	return NULL;
+    }
+    cachePtr->hits++;
+
+    keyPtr = (KeyEntry *) Tcl_GetHashValue(entryPtr);
+    if (keyPtr != cachePtr->firstPtr) {
+	keyPtr->prevPtr->nextPtr = keyPtr->nextPtr;
+	if (keyPtr->nextPtr) {
+	    keyPtr->nextPtr->prevPtr = keyPtr->prevPtr;
+	} else {
+	    cachePtr->lastPtr = keyPtr->prevPtr;
+	}
+	keyPtr->prevPtr = NULL;
+	keyPtr->nextPtr = cachePtr->firstPtr;
+	cachePtr->firstPtr->prevPtr = keyPtr;
+	cachePtr->firstPtr = keyPtr;
+    }
+    return keyPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheKey --
+ *
+ *	This procedure adds a key to a key cache. The least recently
+ *	used keys are removed if the cache becomes too large. The
+ *	caller must hold keyMutex.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory is allocated and keys may be removed from the cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CacheKey(cachePtr, name, key, keyLength)
+    KeyCache *cachePtr;
+    char *name;
+    u_char *key;
+    int keyLength;
+{
+    Tcl_HashEntry *entryPtr;
+    KeyEntry *keyPtr;
+    int isNew;
+
+    if (tnmSnmpKeyCache == 0) {
+	return;
+    }
+
+    entryPtr = Tcl_CreateHashEntry(&cachePtr->table, name, &isNew);
+    if (! isNew) {
+	return;
+    }
+
+    keyPtr = (KeyEntry *) ckalloc(sizeof(KeyEntry));
+    memcpy(keyPtr->key, key, (size_t) keyLength);
+    keyPtr->keyLength = keyLength;
+    keyPtr->entryPtr = entryPtr;
+    keyPtr->prevPtr = NULL;
+    keyPtr->nextPtr = cachePtr->firstPtr;
+    if (cachePtr->firstPtr) {
+	cachePtr->firstPtr->prevPtr = keyPtr;
+    } else {
+	cachePtr->lastPtr = keyPtr;
+    }
+    cachePtr->firstPtr = keyPtr;
+    Tcl_SetHashValue(entryPtr, (ClientData) keyPtr);
+
+    TrimKeys(cachePtr, tnmSnmpKeyCache);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TrimKeys --
+ *
+ *	This procedure removes the least recently used keys from a
+ *	key cache until it holds at most size keys. The caller must
+ *	hold keyMutex.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TrimKeys(cachePtr, size)
+    KeyCache *cachePtr;
+    int size;
+{
+    KeyEntry *keyPtr;
+
+    while (cachePtr->lastPtr && cachePtr->table.numEntries > size) {
+	keyPtr = cachePtr->lastPtr;
+	cachePtr->lastPtr = keyPtr->prevPtr;
+	if (cachePtr->lastPtr) {
+	    cachePtr->lastPtr->nextPtr = NULL;
+	} else {
+	    cachePtr->firstPtr = NULL;
+	}
+	Tcl_DeleteHashEntry(keyPtr->entryPtr);
+	memset(keyPtr->key, 0, sizeof(keyPtr->key));
+	ckfree((char *) keyPtr);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * KeyName --
+ *
+ *	This procedure creates the name of a key in a key cache.
+ *	Names of master keys consist of the algorithm and the
+ *	password. Names of localized keys have the engineID in
+ *	hex inserted after the algorithm. Passwords are strings
+ *	and do not contain null bytes. The names used in the
+ *	userTable use the algorithm 0 and the user name instead
+ *	of the password.
+ *
+ * Results:
+ *	None. The name is left in the dynamic string.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+KeyName(dsPtr, algorithm, engineBytes, engineLength, pwBytes, pwLength)
+    Tcl_DString *dsPtr;
+    int algorithm;
+    char *engineBytes;
+    int engineLength;
+    char *pwBytes;
+    int pwLength;
+{
+    char buf[20];
+    int i;
+
+    Tcl_DStringSetLength(dsPtr, 0);
+    sprintf(buf, "%d:", algorithm);
+    Tcl_DStringAppend(dsPtr, buf, -1);
+    if (engineBytes) {
+	for (i = 0; i < engineLength; i++) {
+	    sprintf(buf, "%02x", (u_char) engineBytes[i]);
+	    Tcl_DStringAppend(dsPtr, buf, 2);
+	}
+	Tcl_DStringAppend(dsPtr, ":", 1);
+    }
+    Tcl_DStringAppend(dsPtr, pwBytes, pwLength);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * InitKeyTables --
+ *
+ *	This procedure initializes the key caches and the userTable
+ *	when they are used for the first time. The caller must hold
+ *	the keyMutex.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The hash tables are initialized.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+InitKeyTables()
+{
+    if (! initialized) {
+	Tcl_InitHashTable(&masterCache.table, TCL_STRING_KEYS);
+	Tcl_InitHashTable(&localCache.table, TCL_STRING_KEYS);
+	Tcl_InitHashTable(&userTable, TCL_STRING_KEYS);
+	initialized = 1;
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
  * ComputeKey --
  *
  *	This procedure computes keys by applying the password to
- *	key transformation. A cache of previously computed keys
- *	is maintained in order to save some computations.
+ *	key transformation. The localized key is first searched in
+ *	the localized key cache. The master key is searched in the
+ *	master key cache if the localized key is not known so that
+ *	the password is only stretched once for all engineIDs.
  *
  * Results:
- *	A pointer to the key or NULL if not found.
+ *	None. The new key is left in objPtrPtr or NULL if the key
+ *	can not be computed.
  *
  * Side effects:
- *	None.
+ *	The key caches are updated.
  *
  *----------------------------------------------------------------------
  */
@@ -194,11 +511,11 @@ ComputeKey(objPtrPtr, password, engineID, algorithm)
     Tcl_Obj *engineID;
     int algorithm;
 {
-    char *pwBytes, *engineBytes, *bytes;
-    int pwLength, engineLength, length;
-    KeyCache *elemPtr;
-    static KeyCache *keyList = NULL;
-    char buffer[256];	/* must be large enough to hold keys */
+    char *pwBytes, *engineBytes;
+    int pwLength, engineLength, keyLength, masterLength;
+    KeyEntry *keyPtr;
+    Tcl_DString dst;
+    u_char key[20], master[20];	/* large enough for MD5 and SHA */
 
     if (*objPtrPtr) {
 	Tcl_DecrRefCount(*objPtrPtr);
@@ -211,64 +528,71 @@ ComputeKey(objPtrPtr, password, engineID, algorithm)
     if (! pwBytes || ! engineBytes || engineLength == 0 || pwLength == 0) {
 	return;
     }
-    
-    /*
-     * Check whether the key is already in our cache. We have
-     * to check that the password and the engineID  matches as
-     * well as the algorithm.
-     */
 
-    for (elemPtr = keyList; elemPtr; elemPtr = elemPtr->nextPtr) {
-	if (elemPtr->algorithm != algorithm) continue;
+    Tcl_DStringInit(&dst);
+    Tcl_MutexLock(&keyMutex);
+    InitKeyTables();
 
-	bytes = Tcl_GetStringFromObj(elemPtr->password, &length);
-	if (length != pwLength) continue;
-	if (memcmp(pwBytes, bytes, (size_t) length) != 0) continue;
-	
-	bytes = Tcl_GetStringFromObj(elemPtr->engineID, &length);
-	if (length != engineLength) continue;
-	if (memcmp(engineBytes, bytes, (size_t) length) != 0) continue;
+    KeyName(&dst, algorithm, engineBytes, engineLength, pwBytes, pwLength);
 
-	*objPtrPtr = elemPtr->key;
-	Tcl_IncrRefCount(*objPtrPtr);
+    keyPtr = FindKey(&localCache, Tcl_DStringValue(&dst));
+    if (keyPtr) {
+	keyLength = keyPtr->keyLength;
+	memcpy(key, keyPtr->key, (size_t) keyLength);
+	Tcl_MutexUnlock(&keyMutex);
+	goto done;
     }
 
-    /*
-     * Compute a new key as described in the appendix of RFC 2274.
-     */
+    KeyName(&dst, algorithm, NULL, 0, pwBytes, pwLength);
 
-    switch (algorithm) {
-    case TNM_SNMP_AUTH_MD5:
-	MD5PassWord2Key(pwBytes, pwLength, engineBytes, engineLength, buffer);
-	*objPtrPtr = TnmNewOctetStringObj(buffer, 16);
-	Tcl_IncrRefCount(*objPtrPtr);
-	break;
-    case TNM_SNMP_AUTH_SHA:
-	SHAPassWord2Key(pwBytes, pwLength, engineBytes, engineLength, buffer);
-	*objPtrPtr = TnmNewOctetStringObj(buffer, 20);
-	Tcl_IncrRefCount(*objPtrPtr);
-	break;
-    default:
-	Tcl_Panic("unknown algorithm for password to key conversion");
-    }
-
-    /*
-     * Finally, create a new cache entry to save the result for the
-     * future.
-     */
-
-    elemPtr = (KeyCache *) ckalloc(sizeof(KeyCache));
-    elemPtr->algorithm = algorithm;
-    elemPtr->password = password;
-    Tcl_IncrRefCount(elemPtr->password);
-    elemPtr->engineID = engineID;
-    Tcl_IncrRefCount(elemPtr->engineID);
-    elemPtr->key = *objPtrPtr;
-    Tcl_IncrRefCount(elemPtr->key);
-    elemPtr->nextPtr = keyList;
-    keyList = elemPtr;
+    keyPtr = FindKey(&masterCache, Tcl_DStringValue(&dst));
+    if (keyPtr) {
+	masterLength = keyPtr->keyLength;
+	memcpy(master, keyPtr->key, (size_t) masterLength);
+	Tcl_MutexUnlock(&keyMutex);
+    } else {
+
+	/*
+	 * Stretch the password without holding the mutex. Another
+	 * thread may compute the same key meanwhile, in which case
+	 * the first key added to the cache is kept.
+	 */
+
+	Tcl_MutexUnlock(&keyMutex);
+	switch (algorithm) {
+	case TNM_SNMP_AUTH_MD5:
+	    MD5PassWord2Key((u_char *) pwBytes, pwLength, master);
+	    masterLength = 16;
+	    break;
+	case TNM_SNMP_AUTH_SHA:
+	    SHAPassWord2Key((u_char *) pwBytes, pwLength, master);
+	    masterLength = 20;
+	    break;
+	default:
+	    Tcl_Panic("unknown algorithm for password to key conversion");
+	}
+	Tcl_MutexLock(&keyMutex);
+	CacheKey(&masterCache, Tcl_DStringValue(&dst), master, masterLength);
+	Tcl_MutexUnlock(&keyMutex);
+    }
+
+    keyLength = LocalizeKey(algorithm, master, masterLength,
+			    (u_char *) engineBytes, engineLength, key);
+    memset(master, 0, sizeof(master));
+
+    KeyName(&dst, algorithm, engineBytes, engineLength, pwBytes, pwLength);
+
+    Tcl_MutexLock(&keyMutex);
+    CacheKey(&localCache, Tcl_DStringValue(&dst), key, keyLength);
+    Tcl_MutexUnlock(&keyMutex);
+
+ done:
+    Tcl_DStringFree(&dst);
+    *objPtrPtr = TnmNewOctetStringObj((char *) key, keyLength);
+    Tcl_IncrRefCount(*objPtrPtr);
+    memset(key, 0, sizeof(key));
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -281,7 +605,8 @@ ComputeKey(objPtrPtr, password, engineID, algorithm)
  *	None.
  *
  * Side effects:
- *	The authentication and privacy keys for this session are updated.
+ *	The authentication and privacy keys for this session are updated
+ *	and the authentication key is registered in the userTable.
  *
  *----------------------------------------------------------------------
  */
@@ -303,8 +628,193 @@ TnmSnmpComputeKeys(session)
 		       session->engineID, authProto);
 	}
     }
+    RegisterKey(session);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RegisterKey --
+ *
+ *	This procedure registers the authentication key of a session
+ *	in the userTable under the engineID and the user name of the
+ *	session. A key registered before is removed first.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The userTable is updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RegisterKey(session)
+    TnmSnmp *session;
+{
+    char *user, *engineBytes, *keyBytes;
+    int userLength, engineLength, keyLength, isNew;
+    int algorithm = (session->securityLevel & TNM_SNMP_AUTH_MASK);
+    TnmSnmpUsmKey *keyPtr;
+    Tcl_HashEntry *entryPtr;
+    Tcl_DString dst;
+
+    TnmSnmpDeleteKeys(session);
+
+    if (session->version != TNM_SNMPv3 || ! session->usmAuthKey
+	|| (algorithm != TNM_SNMP_AUTH_MD5
+	    && algorithm != TNM_SNMP_AUTH_SHA)) {
+	return;
+    }
+
+    keyBytes = TnmGetOctetStringFromObj(NULL, session->usmAuthKey,
+					&keyLength);
+    engineBytes = TnmGetOctetStringFromObj(NULL, session->engineID,
+					   &engineLength);
+    if (! keyBytes || ! engineBytes
+	|| keyLength != (algorithm == TNM_SNMP_AUTH_MD5 ? 16 : 20)) {
+	return;
+    }
+    user = Tcl_GetStringFromObj(session->user, &userLength);
+
+    keyPtr = (TnmSnmpUsmKey *) ckalloc(sizeof(TnmSnmpUsmKey));
+    keyPtr->algorithm = algorithm;
+    memcpy(keyPtr->key, keyBytes, (size_t) keyLength);
+    keyPtr->keyLength = keyLength;
+
+    Tcl_DStringInit(&dst);
+    KeyName(&dst, 0, engineBytes, engineLength, user, userLength);
+    Tcl_MutexLock(&keyMutex);
+    InitKeyTables();
+    entryPtr = Tcl_CreateHashEntry(&userTable, Tcl_DStringValue(&dst), &isNew);
+    keyPtr->entryPtr = entryPtr;
+    keyPtr->nextPtr = isNew ? NULL : (TnmSnmpUsmKey *) Tcl_GetHashValue(entryPtr);
+    Tcl_SetHashValue(entryPtr, (ClientData) keyPtr);
+    Tcl_MutexUnlock(&keyMutex);
+    Tcl_DStringFree(&dst);
+
+    session->usmKeyPtr = keyPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpDeleteKeys --
+ *
+ *	This procedure removes the authentication key of a session
+ *	from the userTable. Messages for the user of the session are
+ *	not authentic anymore unless another session uses the key.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The userTable is updated and memory is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmSnmpDeleteKeys(session)
+    TnmSnmp *session;
+{
+    TnmSnmpUsmKey *keyPtr = session->usmKeyPtr, **keyPtrPtr, *firstPtr;
+
+    if (! keyPtr) {
+	return;
+    }
+
+    Tcl_MutexLock(&keyMutex);
+    firstPtr = (TnmSnmpUsmKey *) Tcl_GetHashValue(keyPtr->entryPtr);
+    for (keyPtrPtr = &firstPtr; *keyPtrPtr != keyPtr;
+	 keyPtrPtr = &(*keyPtrPtr)->nextPtr) ;
+    *keyPtrPtr = keyPtr->nextPtr;
+    if (firstPtr) {
+	Tcl_SetHashValue(keyPtr->entryPtr, (ClientData) firstPtr);
+    } else {
+	Tcl_DeleteHashEntry(keyPtr->entryPtr);
+    }
+    Tcl_MutexUnlock(&keyMutex);
+
+    memset((char *) keyPtr, 0, sizeof(TnmSnmpUsmKey));
+    ckfree((char *) keyPtr);
+    session->usmKeyPtr = NULL;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpSetKeyCache --
+ *
+ *	This procedure removes the least recently used keys from the
+ *	key caches until they hold at most tnmSnmpKeyCache keys.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmSnmpSetKeyCache()
+{
+    Tcl_MutexLock(&keyMutex);
+    if (initialized) {
+	TrimKeys(&masterCache, tnmSnmpKeyCache);
+	TrimKeys(&localCache, tnmSnmpKeyCache);
+    }
+    Tcl_MutexUnlock(&keyMutex);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpGetKeyCache --
+ *
+ *	This procedure returns the statistics of the key caches. The
+ *	first element describes the localized key cache and the second
+ *	element the master key cache. Every element contains the number
+ *	of cached keys, the number of hits and the number of misses.
+ *
+ * Results:
+ *	A pointer to a new Tcl list object.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Tcl_Obj*
+TnmSnmpGetKeyCache()
+{
+    Tcl_Obj *listPtr, *elemPtr;
+    KeyCache *caches[2];
+    int i;
+
+    caches[0] = &localCache;
+    caches[1] = &masterCache;
+
+    listPtr = Tcl_NewListObj(0, NULL);
+    Tcl_MutexLock(&keyMutex);
+    for (i = 0; i < 2; i++) {
+	elemPtr = Tcl_NewListObj(0, NULL);
+	Tcl_ListObjAppendElement(NULL, elemPtr, Tcl_NewIntObj(initialized
+				 ? caches[i]->table.numEntries : 0));
+	Tcl_ListObjAppendElement(NULL, elemPtr,
+				 Tcl_NewWideIntObj(caches[i]->hits));
+	Tcl_ListObjAppendElement(NULL, elemPtr,
+				 Tcl_NewWideIntObj(caches[i]->misses));
+	Tcl_ListObjAppendElement(NULL, listPtr, elemPtr);
+    }
+    Tcl_MutexUnlock(&keyMutex);
+    return listPtr;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -330,100 +840,265 @@ TnmSnmpLocalizeKey(algorithm, authKey, engineID, localAuthKey)
     Tcl_Obj *localAuthKey;
 {
     char *engineBytes, *authKeyBytes;
-    int engineLength, authKeyLength, localAuthKeyLength = 20;
-    char localAuthKeyBytes[20]; /* must be big enough for MD5 and SHA */
+    int engineLength, authKeyLength, localAuthKeyLength;
+    u_char localAuthKeyBytes[20]; /* must be big enough for MD5 and SHA */
 
     authKeyBytes = Tcl_GetStringFromObj(authKey, &authKeyLength);
     engineBytes = Tcl_GetStringFromObj(engineID, &engineLength);
 
-    /*
-     * Localize a key as described in section 2.6 of RFC 2274.
-     */
+    localAuthKeyLength = LocalizeKey(algorithm, (u_char *) authKeyBytes,
+				     authKeyLength, (u_char *) engineBytes,
+				     engineLength, localAuthKeyBytes);
+    Tcl_SetStringObj(localAuthKey, (char *) localAuthKeyBytes,
+		     localAuthKeyLength);
+}
 
-    switch (algorithm) {
-    case TNM_SNMP_AUTH_MD5: {
-	MD5_CTX MD;
-	TnmMD5Init(&MD);
-	TnmMD5Update(&MD, authKeyBytes, authKeyLength);
-	TnmMD5Update(&MD, engineBytes, engineLength);
-	TnmMD5Update(&MD, authKeyBytes, authKeyLength);
-	Tcl_SetObjLength(localAuthKey, 16);
-	TnmMD5Final(localAuthKeyBytes, &MD);
-	break;
-    }
-    case TNM_SNMP_AUTH_SHA: {
-	SHA_CTX SH;
-	TnmSHAInit(&SH);
-	TnmSHAUpdate(&SH, authKeyBytes, authKeyLength);
-	TnmSHAUpdate(&SH, engineBytes, engineLength);
-	TnmSHAUpdate(&SH, authKeyBytes, authKeyLength);
-	TnmSHAFinal(localAuthKeyBytes, &SH);
-	break;
+/*
+ *----------------------------------------------------------------------
+ *
+ * FindAuthParams --
+ *
+ *	This procedure locates the msgAuthenticationParameters in a
+ *	serialized SNMPv3 message.
+ *
+ * Results:
+ *	A pointer to the TNM_SNMP_AUTH_PARAMS bytes of the parameters
+ *	or NULL if the message does not carry them.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static u_char*
+FindAuthParams(msg, msgLen)
+    u_char *msg;
+    int msgLen;
+{
+    TnmBer _ber, *ber = &_ber;
+    TnmBer _usmBer, *usmBer = &_usmBer;
+    u_char *seqToken;
+    char *octets;
+    int seqLength, version, length;
+
+    TnmBerInit(ber, msg, msgLen);
+    if (! TnmBerDecSequenceStart(ber, ASN1_SEQUENCE, &seqToken, &seqLength)
+	|| ! TnmBerDecInt(ber, ASN1_INTEGER, &version) || version != 3
+	|| ! TnmBerDecAny(ber, &octets, &length)
+	|| ! TnmBerDecOctetString(ber, ASN1_OCTET_STRING, &octets, &length)) {
+	return NULL;
     }
-    default:
-	Tcl_Panic("unknown algorithm for key localization");
+
+    TnmBerInit(usmBer, (u_char *) octets, length);
+    if (! TnmBerDecSequenceStart(usmBer, ASN1_SEQUENCE,
+				 &seqToken, &seqLength)
+	|| ! TnmBerDecOctetString(usmBer, ASN1_OCTET_STRING, NULL, NULL)
+	|| ! TnmBerDecInt(usmBer, ASN1_INTEGER, &version)
+	|| ! TnmBerDecInt(usmBer, ASN1_INTEGER, &version)
+	|| ! TnmBerDecOctetString(usmBer, ASN1_OCTET_STRING, NULL, NULL)
+	|| ! TnmBerDecOctetString(usmBer, ASN1_OCTET_STRING,
+				  &octets, &length)
+	|| length != TNM_SNMP_AUTH_PARAMS) {
+	return NULL;
     }
 
-    Tcl_SetStringObj(localAuthKey, localAuthKeyBytes, localAuthKeyLength);
+    return (u_char *) octets;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * ComputeHmac --
+ *
+ *	This procedure computes the HMAC-MD5 or HMAC-SHA digest of a
+ *	message as defined in RFC 2104. The keys are at most 20 bytes
+ *	long and therefore never hashed before they are used.
+ *
+ * Results:
+ *	The 16 or 20 byte digest is written to the argument digest.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
 static void
-MD5AuthOutMsg(authKey, msg, msgLen, msgAuthenticationParameters)
-    char *authKey;
+ComputeHmac(algorithm, key, keyLength, msg, msgLen, digest)
+    int algorithm;
+    u_char *key;
+    int keyLength;
     u_char *msg;
     int msgLen;
-    u_char *msgAuthenticationParameters;
+    u_char *digest;
 {
     MD5_CTX MD;
-    char extendedAuthKey[64];
-    char digest[16];
+    SHA_CTX SH;
+    u_char pad[64], inner[20];
     int i;
 
-    memset(msgAuthenticationParameters, 0, 12);
-    memcpy(extendedAuthKey, authKey, 16);
-
-    for (i = 1; i < 64; i++) {
-	extendedAuthKey[i] = extendedAuthKey[i] ^ 0x36;
+    memset(pad, 0, sizeof(pad));
+    memcpy(pad, key, (size_t) keyLength);
+    for (i = 0; i < 64; i++) {
+	pad[i] ^= 0x36;
     }
-    
-    TnmMD5Init(&MD);
-    TnmMD5Update(&MD, extendedAuthKey, 64);
-    TnmMD5Update(&MD, msg, msgLen);
-    TnmMD5Final(digest, &MD);
 
-    for (i = 0; i < 64; i++) {
-	extendedAuthKey[i] = extendedAuthKey[i] ^ 0x5c;
+    switch (algorithm) {
+    case TNM_SNMP_AUTH_MD5:
+	TnmMD5Init(&MD);
+	TnmMD5Update(&MD, pad, 64);
+	TnmMD5Update(&MD, msg, (unsigned) msgLen);
+	TnmMD5Final(inner, &MD);
+	for (i = 0; i < 64; i++) {
+	    pad[i] ^= 0x36 ^ 0x5c;
+	}
+	TnmMD5Init(&MD);
+	TnmMD5Update(&MD, pad, 64);
+	TnmMD5Update(&MD, inner, 16);
+	TnmMD5Final(digest, &MD);
+	break;
+    case TNM_SNMP_AUTH_SHA:
+	TnmSHAInit(&SH);
+	TnmSHAUpdate(&SH, pad, 64);
+	TnmSHAUpdate(&SH, msg, msgLen);
+	TnmSHAFinal(inner, &SH);
+	for (i = 0; i < 64; i++) {
+	    pad[i] ^= 0x36 ^ 0x5c;
+	}
+	TnmSHAInit(&SH);
+	TnmSHAUpdate(&SH, pad, 64);
+	TnmSHAUpdate(&SH, inner, 20);
+	TnmSHAFinal(digest, &SH);
+	break;
+    default:
+        Tcl_Panic("unknown authentication algorithm");
     }
+    memset(pad, 0, sizeof(pad));
+}
 
-    TnmMD5Init(&MD);
-    TnmMD5Update(&MD, extendedAuthKey, 64);
-    TnmMD5Update(&MD, digest, 16);
-    TnmMD5Final(digest, &MD);
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpAuthOutMsg --
+ *
+ *	This procedure signs a serialized SNMPv3 message with the
+ *	HMAC-MD5-96 or HMAC-SHA-96 authentication protocol (RFC 2274
+ *	section 6.3.1 and 7.3.1). The msgAuthenticationParameters of
+ *	the message are overwritten with the digest.
+ *
+ * Results:
+ *	A standard Tcl result. TCL_ERROR is returned if the message
+ *	does not have room for the digest.
+ *
+ * Side effects:
+ *	The message is modified.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSnmpAuthOutMsg(algorithm, key, keyLength, msg, msgLen)
+    int algorithm;
+    u_char *key;
+    int keyLength;
+    u_char *msg;
+    int msgLen;
+{
+    u_char *authParams, digest[20];
+
+    authParams = FindAuthParams(msg, msgLen);
+    if (! authParams) {
+	return TCL_ERROR;
+    }
 
-    memcpy(msgAuthenticationParameters, digest, 12);
+    memset(authParams, 0, TNM_SNMP_AUTH_PARAMS);
+    ComputeHmac(algorithm, key, keyLength, msg, msgLen, digest);
+    memcpy(authParams, digest, TNM_SNMP_AUTH_PARAMS);
+    return TCL_OK;
 }
 
-void
-TnmSnmpAuthOutMsg(algorithm, authKey, msg, msgLen, msgAuthenticationParameters)
-    int algorithm;
-    Tcl_Obj *authKey;
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpAuthInMsg --
+ *
+ *	This procedure verifies the digest of a received SNMPv3
+ *	message (RFC 2274 section 6.3.2 and 7.3.2) with the keys
+ *	registered for the user and the engineID. The keys are
+ *	copied while holding the keyMutex so that the digests are
+ *	computed without blocking other threads.
+ *
+ * Results:
+ *	1 if the digest is valid and 0 otherwise. The algorithm and
+ *	the key which produced the digest are returned in algorithm,
+ *	key and keyLength. The key buffer must hold at least
+ *	TNM_SNMP_AUTH_KEYSIZE bytes.
+ *
+ * Side effects:
+ *	None. The authParams are restored before we return.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSnmpAuthInMsg(user, userLength, engineID, engineIDLength, msg, msgLen,
+		 authParams, algorithm, key, keyLength)
+    char *user;
+    int userLength;
+    char *engineID;
+    int engineIDLength;
     u_char *msg;
     int msgLen;
-    u_char *msgAuthenticationParameters;
+    u_char *authParams;
+    int *algorithm;
+    u_char *key;
+    int *keyLength;
 {
-    char *keyBytes;
-    int keyLen;
-    
-    keyBytes = Tcl_GetStringFromObj(authKey, &keyLen);
+    TnmSnmpUsmKey _keys[4], *keys = _keys, *keyPtr;
+    Tcl_HashEntry *entryPtr;
+    Tcl_DString dst;
+    u_char recvDigest[TNM_SNMP_AUTH_PARAMS], digest[20];
+    int i, n = 0, authentic = 0;
 
-    switch (algorithm) {
-    case TNM_SNMP_AUTH_MD5:
-	if (keyLen != 16) {
-	    Tcl_Panic("illegal length of the MD5 authentication key");
+    Tcl_DStringInit(&dst);
+    KeyName(&dst, 0, engineID, engineIDLength, user, userLength);
+    Tcl_MutexLock(&keyMutex);
+    entryPtr = initialized
+	? Tcl_FindHashEntry(&userTable, Tcl_DStringValue(&dst)) : NULL;
+    if (entryPtr) {
+	for (keyPtr = (TnmSnmpUsmKey *) Tcl_GetHashValue(entryPtr);
+	     keyPtr; keyPtr = keyPtr->nextPtr) {
+	    n++;
 	}
-	MD5AuthOutMsg(keyBytes, msg, msgLen, msgAuthenticationParameters);
-	break;
-    default:
-        Tcl_Panic("unknown authentication algorithm");
+	if (n > 4) {
+	    keys = (TnmSnmpUsmKey *) ckalloc(n * sizeof(TnmSnmpUsmKey));
+	}
+	for (i = 0, keyPtr = (TnmSnmpUsmKey *) Tcl_GetHashValue(entryPtr);
+	     keyPtr; keyPtr = keyPtr->nextPtr) {
+	    keys[i++] = *keyPtr;
+	}
+    }
+    Tcl_MutexUnlock(&keyMutex);
+    Tcl_DStringFree(&dst);
+
+    memcpy(recvDigest, authParams, TNM_SNMP_AUTH_PARAMS);
+    memset(authParams, 0, TNM_SNMP_AUTH_PARAMS);
+    for (i = 0; i < n && ! authentic; i++) {
+	ComputeHmac(keys[i].algorithm, keys[i].key, keys[i].keyLength,
+		    msg, msgLen, digest);
+	if (memcmp(digest, recvDigest, TNM_SNMP_AUTH_PARAMS) == 0) {
+	    *algorithm = keys[i].algorithm;
+	    *keyLength = keys[i].keyLength;
+	    memcpy(key, keys[i].key, (size_t) keys[i].keyLength);
+	    authentic = 1;
+	}
+    }
+    memcpy(authParams, recvDigest, TNM_SNMP_AUTH_PARAMS);
+
+    memset((char *) keys, 0, n * sizeof(TnmSnmpUsmKey));
+    if (keys != _keys) {
+	ckfree((char *) keys);
     }
+    return authentic;
 }
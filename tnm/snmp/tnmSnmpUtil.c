@@ -27,10 +27,39 @@
 extern int hexdump;
 
 /*
- * The queue of active and waiting asynchronous requests.
+ * The global queues of active and waiting asynchronous requests
+ * and the hash table which maps request ids to queued requests.
  */
 
-static TnmSnmpRequest *queueHead = NULL;
+static TnmSnmpQueue activeQueue = { NULL, NULL, 0 };
+static TnmSnmpQueue waitingQueue = { NULL, NULL, 0 };
+
+static Tcl_HashTable *requestTable = NULL;
+
+/*
+ * The timing wheel which schedules retransmissions and timeouts of
+ * asynchronous requests. The wheel has WHEEL_LEVELS levels with
+ * WHEEL_SIZE slots each. A slot of level 0 covers a single tick
+ * while a slot of a higher level covers WHEEL_SIZE slots of the
+ * level below. Requests are cascaded down to the lower levels as
+ * time advances. The wheel is driven by a single Tcl timer handler
+ * which is only installed while the wheel is not empty.
+ */
+
+#define WHEEL_BITS	6
+#define WHEEL_SIZE	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_SPAN	(1UL << (WHEEL_LEVELS * WHEEL_BITS))
+
+static TnmSnmpQueue wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static TnmSnmpQueue expiredQueue = { NULL, NULL, 0 };
+static unsigned long wheelTicks = 0;	/* Next tick to process. */
+static int wheelCount = 0;		/* Requests in the wheel slots. */
+static int wheelResolution = TNM_SNMP_TICK;
+static Tcl_Time wheelStart = { 0, 0 };
+static Tcl_TimerToken wheelTimer = NULL;
+static unsigned long wheelArmed = 0;	/* Tick wheelTimer is set for. */
 
 /*
  * The following tables are used to map SNMP version numbers,
@@ -158,6 +187,30 @@ SessionDestroyProc	_ANSI_ARGS_((char *memPtr));
 static void
 RequestDestroyProc	_ANSI_ARGS_((char *memPtr));
 
+static void
+QueueAppend		_ANSI_ARGS_((TnmSnmpQueue *queue, int which,
+				     TnmSnmpRequest *request));
+static void
+QueueRemove		_ANSI_ARGS_((TnmSnmpQueue *queue, int which,
+				     TnmSnmpRequest *request));
+static void
+UnlinkRequest		_ANSI_ARGS_((TnmSnmpRequest *request));
+
+static unsigned long
+WheelNow		_ANSI_ARGS_((void));
+
+static void
+WheelInsert		_ANSI_ARGS_((TnmSnmpRequest *request));
+
+static void
+WheelCascade		_ANSI_ARGS_((int level));
+
+static void
+WheelSchedule		_ANSI_ARGS_((void));
+
+static void
+WheelProc		_ANSI_ARGS_((ClientData clientData));
+
 #ifdef TNM_SNMPv2U
 static int
 FindAuthKey		_ANSI_ARGS_((TnmSnmp *session));
@@ -265,6 +318,511 @@ RequestDestroyProc(memPtr)
 
     ckfree((char *) request);
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * QueueAppend --
+ *
+ *	This procedure appends a request to the end of a queue. The
+ *	which argument selects the global or the session link of the
+ *	request.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The queue is modified.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+QueueAppend(queue, which, request)
+    TnmSnmpQueue *queue;
+    int which;
+    TnmSnmpRequest *request;
+{
+    TnmSnmpLink *linkPtr = &request->link[which];
+
+    linkPtr->nextPtr = NULL;
+    linkPtr->prevPtr = queue->lastPtr;
+    if (queue->lastPtr) {
+	queue->lastPtr->link[which].nextPtr = request;
+    } else {
+	queue->firstPtr = request;
+    }
+    queue->lastPtr = request;
+    queue->length++;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * QueueRemove --
+ *
+ *	This procedure removes a request from a queue. The which
+ *	argument selects the global or the session link of the
+ *	request.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The queue is modified.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+QueueRemove(queue, which, request)
+    TnmSnmpQueue *queue;
+    int which;
+    TnmSnmpRequest *request;
+{
+    TnmSnmpLink *linkPtr = &request->link[which];
+
+    if (linkPtr->prevPtr) {
+	linkPtr->prevPtr->link[which].nextPtr = linkPtr->nextPtr;
+    } else {
+	queue->firstPtr = linkPtr->nextPtr;
+    }
+    if (linkPtr->nextPtr) {
+	linkPtr->nextPtr->link[which].prevPtr = linkPtr->prevPtr;
+    } else {
+	queue->lastPtr = linkPtr->prevPtr;
+    }
+    linkPtr->nextPtr = linkPtr->prevPtr = NULL;
+    queue->length--;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UnlinkRequest --
+ *
+ *	This procedure removes a request from the global queue, the
+ *	session queue and the request table. The timer handler of
+ *	the request is deleted as well.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The request is not known anymore to the request lookup
+ *	functions.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+UnlinkRequest(request)
+    TnmSnmpRequest *request;
+{
+    TnmSnmp *session = request->session;
+    Tcl_HashEntry *entryPtr;
+
+    if (request->queue == &session->activeQueue) {
+	QueueRemove(&activeQueue, TNM_SNMP_QUEUE_GLOBAL, request);
+    } else {
+	QueueRemove(&waitingQueue, TNM_SNMP_QUEUE_GLOBAL, request);
+    }
+    QueueRemove(request->queue, TNM_SNMP_QUEUE_SESSION, request);
+    request->queue = NULL;
+
+    entryPtr = Tcl_FindHashEntry(requestTable, (char *) (long) request->id);
+    if (entryPtr) {
+	Tcl_DeleteHashEntry(entryPtr);
+    }
+
+    TnmSnmpStopTimer(request);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WheelNow --
+ *
+ *	This procedure returns the number of milliseconds elapsed
+ *	since the timing wheel was used for the first time.
+ *
+ * Results:
+ *	The current time of the timing wheel in milliseconds.
+ *
+ * Side effects:
+ *	The start time of the wheel is initialized on the first call.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static unsigned long
+WheelNow()
+{
+    Tcl_Time now;
+    long ms;
+
+    Tcl_GetTime(&now);
+    if (wheelStart.sec == 0 && wheelStart.usec == 0) {
+	wheelStart = now;
+    }
+
+    ms = (now.sec - wheelStart.sec) * 1000
+	+ (now.usec - wheelStart.usec) / 1000;
+    return (ms < 0) ? 0 : (unsigned long) ms;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WheelInsert --
+ *
+ *	This procedure links a request into the wheel slot which
+ *	covers the expiration tick of the request. Requests which
+ *	expire beyond the span of the wheel are clamped to the last
+ *	tick covered by the wheel.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The request is linked into a slot of the timing wheel.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WheelInsert(request)
+    TnmSnmpRequest *request;
+{
+    unsigned long expire, delta;
+    int level, slot;
+
+    if (request->expire < wheelTicks) {
+	request->expire = wheelTicks;
+    }
+    expire = request->expire;
+    delta = expire - wheelTicks;
+    if (delta >= WHEEL_SPAN) {
+	expire = wheelTicks + WHEEL_SPAN - 1;
+	delta = WHEEL_SPAN - 1;
+    }
+
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+	if (delta < (1UL << ((level + 1) * WHEEL_BITS))) break;
+    }
+    slot = (expire >> (level * WHEEL_BITS)) & WHEEL_MASK;
+
+    request->timer = &wheel[level][slot];
+    QueueAppend(request->timer, TNM_SNMP_QUEUE_TIMER, request);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WheelCascade --
+ *
+ *	This procedure moves all requests of the current slot of the
+ *	given level down to the slots of the lower levels.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Requests are relinked in the timing wheel.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WheelCascade(level)
+    int level;
+{
+    TnmSnmpQueue *slot;
+    TnmSnmpRequest *request;
+
+    slot = &wheel[level][(wheelTicks >> (level * WHEEL_BITS)) & WHEEL_MASK];
+    while ((request = slot->firstPtr)) {
+	QueueRemove(slot, TNM_SNMP_QUEUE_TIMER, request);
+	WheelInsert(request);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WheelSchedule --
+ *
+ *	This procedure makes sure that the Tcl timer handler fires
+ *	when the next non-empty slot of level 0 is due or when the
+ *	next cascade has to take place. The timer handler is removed
+ *	if the wheel is empty.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	A Tcl timer handler may be created or deleted.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WheelSchedule()
+{
+    unsigned long target, now;
+    long delay;
+
+    if (wheelCount == 0) {
+	if (wheelTimer) {
+	    Tcl_DeleteTimerHandler(wheelTimer);
+	    wheelTimer = NULL;
+	}
+	return;
+    }
+
+    /*
+     * Stop at the first non-empty slot or at the next tick which
+     * cascades the higher levels. This may be wheelTicks itself.
+     */
+
+    for (target = wheelTicks; (target & WHEEL_MASK) != 0
+	     && ! wheel[0][target & WHEEL_MASK].firstPtr; target++) {
+	continue;
+    }
+
+    if (wheelTimer) {
+	if (wheelArmed <= target) return;
+	Tcl_DeleteTimerHandler(wheelTimer);
+    }
+
+    now = WheelNow();
+    delay = (long) (target * wheelResolution) - (long) now;
+    wheelTimer = Tcl_CreateTimerHandler(delay > 0 ? (int) delay : 0,
+					WheelProc, (ClientData) NULL);
+    wheelArmed = target;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WheelProc --
+ *
+ *	This procedure is called from the event dispatcher to advance
+ *	the timing wheel. All requests expired since the last call
+ *	are collected first and then processed as a batch.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Requests are retransmitted or timed out.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WheelProc(clientData)
+    ClientData clientData;
+{
+    unsigned long now;
+    TnmSnmpQueue *slot;
+    TnmSnmpRequest *request;
+    int level;
+
+    wheelTimer = NULL;
+    now = WheelNow() / wheelResolution;
+
+    while (wheelCount > 0 && wheelTicks <= now) {
+	if ((wheelTicks & WHEEL_MASK) == 0) {
+	    for (level = 1; level < WHEEL_LEVELS; level++) {
+		WheelCascade(level);
+		if ((wheelTicks >> (level * WHEEL_BITS)) & WHEEL_MASK) break;
+	    }
+	}
+	slot = &wheel[0][wheelTicks & WHEEL_MASK];
+	while ((request = slot->firstPtr)) {
+	    QueueRemove(slot, TNM_SNMP_QUEUE_TIMER, request);
+	    request->timer = &expiredQueue;
+	    QueueAppend(request->timer, TNM_SNMP_QUEUE_TIMER, request);
+	    wheelCount--;
+	}
+	wheelTicks++;
+    }
+
+    WheelSchedule();
+
+    /*
+     * Process the expired requests. Every request is unlinked before
+     * the timeout is processed since the callbacks may re-enter the
+     * event loop or delete other expired requests. Retransmissions
+     * are queued and sent together once all requests are processed.
+     */
+
+    while ((request = expiredQueue.firstPtr)) {
+	QueueRemove(&expiredQueue, TNM_SNMP_QUEUE_TIMER, request);
+	request->timer = NULL;
+	TnmSnmpTimeoutProc((ClientData) request);
+    }
+    TnmSnmpFlush();
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpStartTimer --
+ *
+ *	This procedure schedules a timeout for a request. The timeout
+ *	fires when at least ms milliseconds have passed. A timeout
+ *	already scheduled for the request is cancelled.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The request is linked into the timing wheel.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmSnmpStartTimer(request, ms)
+    TnmSnmpRequest *request;
+    int ms;
+{
+    unsigned long now;
+
+    TnmSnmpStopTimer(request);
+
+    now = WheelNow();
+    if (wheelCount == 0) {
+	wheelTicks = now / wheelResolution;
+    }
+    request->expire = (now + (ms > 0 ? ms : 0) + wheelResolution - 1)
+	/ wheelResolution;
+    WheelInsert(request);
+    wheelCount++;
+    WheelSchedule();
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpStopTimer --
+ *
+ *	This procedure cancels the timeout scheduled for a request.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The request is removed from the timing wheel.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmSnmpStopTimer(request)
+    TnmSnmpRequest *request;
+{
+    if (! request->timer) {
+	return;
+    }
+
+    QueueRemove(request->timer, TNM_SNMP_QUEUE_TIMER, request);
+    if (request->timer != &expiredQueue) {
+	wheelCount--;
+    }
+    request->timer = NULL;
+
+    if (wheelCount == 0) {
+	WheelSchedule();
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpGetTick --
+ *
+ *	This procedure returns the resolution of the timing wheel.
+ *
+ * Results:
+ *	The tick of the timing wheel in milliseconds.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSnmpGetTick()
+{
+    return wheelResolution;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpSetTick --
+ *
+ *	This procedure changes the resolution of the timing wheel.
+ *	Pending timeouts are rescheduled so that they still expire
+ *	at the same time (rounded up to the new resolution).
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	All requests in the timing wheel are relinked.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmSnmpSetTick(ms)
+    int ms;
+{
+    TnmSnmpQueue pending = { NULL, NULL, 0 };
+    TnmSnmpRequest *request;
+    unsigned long now;
+    long remaining;
+    int level, slot;
+
+    if (ms <= 0 || ms == wheelResolution) {
+	return;
+    }
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+	for (slot = 0; slot < WHEEL_SIZE; slot++) {
+	    while ((request = wheel[level][slot].firstPtr)) {
+		QueueRemove(&wheel[level][slot], TNM_SNMP_QUEUE_TIMER, request);
+		QueueAppend(&pending, TNM_SNMP_QUEUE_TIMER, request);
+		request->timer = NULL;
+	    }
+	}
+    }
+    wheelCount = 0;
+
+    now = WheelNow();
+    while ((request = pending.firstPtr)) {
+	QueueRemove(&pending, TNM_SNMP_QUEUE_TIMER, request);
+	remaining = (long) (request->expire * wheelResolution) - (long) now;
+	request->expire = (now + (remaining > 0 ? remaining : 0) + ms - 1) / ms;
+	if (wheelCount == 0) {
+	    wheelTicks = now / ms;
+	}
+	WheelInsert(request);
+	wheelCount++;
+    }
+
+    wheelResolution = ms;
+    if (wheelTimer) {
+	Tcl_DeleteTimerHandler(wheelTimer);
+	wheelTimer = NULL;
+    }
+    WheelSchedule();
+}
 #ifdef TNM_SNMPv2U
 
 /*
@@ -627,7 +1185,11 @@ TnmSnmpEvalCallback(interp, session, pdu, cmd, instance, oid, value, last)
 	    }
 	    break;
 	  case 'V':
-	    Tcl_DStringAppend(&tclCmd, Tcl_DStringValue(&pdu->varbind), -1);
+	    if (pdu->vbList) {
+		Tcl_DStringAppend(&tclCmd, Tcl_GetString(pdu->vbList), -1);
+	    } else {
+		Tcl_DStringAppend(&tclCmd, Tcl_DStringValue(&pdu->varbind), -1);
+	    }
 	    break;
 	  case 'E':
 	    name = TnmGetTableValue(tnmSnmpErrorTable, (unsigned) pdu->errorStatus);
@@ -790,8 +1352,8 @@ TnmSnmpDumpPDU(interp, pdu)
 {
     if (hexdump) {
 
-        int i, code, argc;
-	const char **argv;
+        int i, code, objc;
+	Tcl_Obj *listPtr, **objv;
 	char *name, *status;
 	char buffer[80];
 	Tcl_DString dst;
@@ -824,17 +1386,22 @@ TnmSnmpDumpPDU(interp, pdu)
 
 	Tcl_DStringAppend(&dst, buffer, -1);
 
-	code = Tcl_SplitList(interp, Tcl_DStringValue(&pdu->varbind), 
-			     &argc, &argv);
+	listPtr = pdu->vbList;
+	if (! listPtr) {
+	    listPtr = Tcl_NewStringObj(Tcl_DStringValue(&pdu->varbind),
+				       Tcl_DStringLength(&pdu->varbind));
+	}
+	Tcl_IncrRefCount(listPtr);
+	code = Tcl_ListObjGetElements(interp, listPtr, &objc, &objv);
 	if (code == TCL_OK) {
-	    for (i = 0; i < argc; i++) {
+	    for (i = 0; i < objc; i++) {
 		sprintf(buffer, "%4d.\t", i+1);
 		Tcl_DStringAppend(&dst, buffer, -1);
-		Tcl_DStringAppend(&dst, argv[i], -1);
+		Tcl_DStringAppend(&dst, Tcl_GetString(objv[i]), -1);
 		Tcl_DStringAppend(&dst, "\n", -1);
 	    }
-	    ckfree((char *) argv);
 	}
+	Tcl_DecrRefCount(listPtr);
 	Tcl_ResetResult(interp);
 
 	channel = Tcl_GetStdChannel(TCL_STDOUT);
@@ -964,6 +1531,7 @@ TnmSnmpCreateSession(interp, type)
     session->timeout = TNM_SNMP_TIMEOUT;
     session->window  = TNM_SNMP_WINDOW;
     session->delay   = TNM_SNMP_DELAY;
+    session->maxReps = TNM_SNMP_REPETITIONS;
     session->tagList = Tcl_NewListObj(0, NULL);
     Tcl_IncrRefCount(session->tagList);
 
@@ -994,27 +1562,23 @@ void
 TnmSnmpDeleteSession(session)
     TnmSnmp *session;
 {
-    TnmSnmpRequest **rPtrPtr;
+    TnmSnmpRequest *request;
 
     if (! session) return;
 
-    rPtrPtr = &queueHead;
-    while (*rPtrPtr) {
-	if ((*rPtrPtr)->session == session) {
-	    TnmSnmpRequest *request = *rPtrPtr;
-	    *rPtrPtr = (*rPtrPtr)->nextPtr;
-	    if (request->timer) {
-	        Tcl_DeleteTimerHandler(request->timer);
-	    }
-	    Tcl_EventuallyFree((ClientData) request, RequestDestroyProc);
-	} else {
-	    rPtrPtr = &(*rPtrPtr)->nextPtr;
-	}
+    while ((request = session->activeQueue.firstPtr)
+	   || (request = session->waitingQueue.firstPtr)) {
+	UnlinkRequest(request);
+	Tcl_EventuallyFree((ClientData) request, RequestDestroyProc);
     }
 
+    TnmSnmpAgentClearCache(session);
+#ifdef TNM_SNMPv3
+    TnmSnmpDeleteKeys(session);
+#endif
     Tcl_EventuallyFree((ClientData) session, SessionDestroyProc);
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1068,13 +1632,12 @@ TnmSnmpCreateRequest(id, packet, packetlen, proc, clientData, interp)
  *
  * TnmSnmpFindRequest --
  *
- *	This procedure scans through the request lists of all open
- *	sessions and tries to find the request for a given request
- *	id.
+ *	This procedure looks up the request for a given request id
+ *	in the table of queued requests.
  *
  * Results:
  *	A pointer to the request structure or NULL if the request
- *	id is not in the request list.
+ *	id is not in the request table.
  *
  * Side effects:
  *	None.
@@ -1086,14 +1649,16 @@ TnmSnmpRequest*
 TnmSnmpFindRequest(id)
     int id;
 {
-    TnmSnmpRequest *rPtr;
+    Tcl_HashEntry *entryPtr;
 
-    for (rPtr = queueHead; rPtr; rPtr = rPtr->nextPtr) {
-        if (rPtr->id == id) break;
+    if (! requestTable) {
+	return NULL;
     }
-    return rPtr;
+
+    entryPtr = Tcl_FindHashEntry(requestTable, (char *) (long) id);
+    return entryPtr ? (TnmSnmpRequest *) Tcl_GetHashValue(entryPtr) : NULL;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1113,6 +1678,9 @@ TnmSnmpFindRequest(id)
  *	e.g. creating thousand sessions all with a small window size
  *	sending one request. If the parameter which specifies the
  *	new request is NULL, only queue processing will take place.
+ *	Only the global queue of waiting requests is scanned, which 
+ *	stops as soon as the total number of active requests reaches
+ *	the window size.
  *
  * Results:
  *	The number of requests queued for this SNMP session.
@@ -1128,38 +1696,30 @@ TnmSnmpQueueRequest(session, request)
     TnmSnmp *session;
     TnmSnmpRequest *request;
 {
-    int waiting = 0, active = 0;
-    TnmSnmpRequest *rPtr, *lastPtr = NULL;
+    TnmSnmpRequest *rPtr, *nextPtr;
+    TnmSnmp *s;
 
     /*
-     * Walk through the queue and count active and waiting requests.
-     * Keep a pointer to the last request in the queue.
+     * Append the new request (if we have one) to the waiting
+     * queues and register it in the request table.
      */
 
-    for (rPtr = queueHead; rPtr; rPtr = rPtr->nextPtr) {
-	if (rPtr->sends) {
-	    active++;
-	} else {
-	    waiting++;
-	}
-	if (request) {
-	    lastPtr = rPtr;
-	}
-    }
+    if (request) {
+	Tcl_HashEntry *entryPtr;
+	int isnew;
 
-    /*
-     * Append the new request (if we have one).
-     */
+	if (! requestTable) {
+	    requestTable = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+	    Tcl_InitHashTable(requestTable, TCL_ONE_WORD_KEYS);
+	}
+	entryPtr = Tcl_CreateHashEntry(requestTable,
+				       (char *) (long) request->id, &isnew);
+	Tcl_SetHashValue(entryPtr, (ClientData) request);
 
-    if (request) {
 	request->session = session;
-	session->waiting++;
-	waiting++;
-	if (! queueHead) {
-	    queueHead = request;
-	} else {
-	    lastPtr->nextPtr = request;
-	}
+	request->queue = &session->waitingQueue;
+	QueueAppend(&waitingQueue, TNM_SNMP_QUEUE_GLOBAL, request);
+	QueueAppend(&session->waitingQueue, TNM_SNMP_QUEUE_SESSION, request);
     }
 
     /*
@@ -1168,21 +1728,23 @@ TnmSnmpQueueRequest(session, request)
      * window of the current session.
      */
 
-    for (rPtr = queueHead; rPtr && waiting; rPtr = rPtr->nextPtr) {
-        if (session->window && active >= session->window) break;
-	if (! rPtr->sends && (rPtr->session->active < rPtr->session->window 
-			      || rPtr->session->window == 0)) {
+    for (rPtr = waitingQueue.firstPtr; rPtr; rPtr = nextPtr) {
+	nextPtr = rPtr->link[TNM_SNMP_QUEUE_GLOBAL].nextPtr;
+        if (session->window && activeQueue.length >= session->window) break;
+	s = rPtr->session;
+	if (s->activeQueue.length < s->window || s->window == 0) {
 	    TnmSnmpTimeoutProc((ClientData) rPtr);
-	    active++;
-	    waiting--;
-	    rPtr->session->active++;
-	    rPtr->session->waiting--;
+	    QueueRemove(&waitingQueue, TNM_SNMP_QUEUE_GLOBAL, rPtr);
+	    QueueRemove(&s->waitingQueue, TNM_SNMP_QUEUE_SESSION, rPtr);
+	    QueueAppend(&activeQueue, TNM_SNMP_QUEUE_GLOBAL, rPtr);
+	    QueueAppend(&s->activeQueue, TNM_SNMP_QUEUE_SESSION, rPtr);
+	    rPtr->queue = &s->activeQueue;
 	}
     }
 
-    return (session->active + session->waiting);
+    return (session->activeQueue.length + session->waitingQueue.length);
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1205,66 +1767,37 @@ void
 TnmSnmpDeleteRequest(request)
     TnmSnmpRequest *request;
 {
-    TnmSnmpRequest *rPtr, **rPtrPtr;
     TnmSnmp *session;
 
     /*
      * Check whether the request still exists. It may have been
      * removed because the session for this request has been 
-     * destroyed during callback processing.
+     * destroyed during callback processing. Requests are removed
+     * from the request table when their session is destroyed, so
+     * the session is still alive if we find the request.
      */
 
-    for (rPtr = queueHead; rPtr; rPtr = rPtr->nextPtr) {
-	if (rPtr == request) break;
-    }
-    if (! rPtr) return;
-    
-    /* 
-     * Check whether the session is still in the session list.
-     * We sometimes get called when the session has already been
-     * destroyed as a side effect of evaluating callbacks.
-     */
-    
-    for (session = tnmSnmpList; session; session = session->nextPtr) {
-	if (session == request->session) break;
-    }
-
-    if (session) {
-	if (request->sends) {
-	    session->active--;
-	} else {
-	    session->waiting--;
-	}
+    if (TnmSnmpFindRequest(request->id) != request) {
+	return;
     }
+    session = request->session;
     
     /*
-     * Remove the request from the list of outstanding requests.
+     * Remove the request from the queues of outstanding requests
      * and free the resources allocated for this request.
      */
 
-    rPtrPtr = &queueHead;
-    while (*rPtrPtr && *rPtrPtr != request) {
-	rPtrPtr = &(*rPtrPtr)->nextPtr;
-    }
-    if (*rPtrPtr) {
-	*rPtrPtr = request->nextPtr;
-	if (request->timer) {
-	    Tcl_DeleteTimerHandler(request->timer);
-	    request->timer = NULL;
-	}
-	Tcl_EventuallyFree((ClientData) request, RequestDestroyProc);
-    }
+    UnlinkRequest(request);
+    Tcl_EventuallyFree((ClientData) request, RequestDestroyProc);
 
     /*
      * Update the request queue. This will activate async requests
      * that have been queued because of the window size.
      */
      
-    if (session) {
-	TnmSnmpQueueRequest(session, NULL);
-    }
+    TnmSnmpQueueRequest(session, NULL);
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1285,18 +1818,167 @@ int
 TnmSnmpGetRequestId()
 {
     int id;
-    TnmSnmpRequest *rPtr = queueHead;
 
     do {
 	id = rand();
-	for (rPtr = queueHead; rPtr && rPtr->id != id; rPtr = rPtr->nextPtr) {
-	    /* empty body */
-	}
-    } while (rPtr);
+    } while (TnmSnmpFindRequest(id));
 
     return id;
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpGetRepetitions --
+ *
+ *	This procedure returns the max-repetitions value for a getbulk
+ *	request with the given number of repeating varbinds. The value
+ *	is derived from the number of varbinds per response learned
+ *	for the session.
+ *
+ * Results:
+ *	The max-repetitions value, which is always positive.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSnmpGetRepetitions(session, repeaters)
+    TnmSnmp *session;
+    int repeaters;
+{
+    int reps = (repeaters > 1) ? session->maxReps / repeaters
+	: session->maxReps;
+
+    return (reps > 0) ? reps : 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSnmpAdaptRepetitions --
+ *
+ *	This procedure adapts the number of varbinds per getbulk
+ *	response learned for a session whenever a response to a
+ *	getbulk request is received or the request timed out. The
+ *	number is doubled after complete responses as long as the
+ *	response fits into the maximum message size. It is halved
+ *	after tooBig errors and timeouts, reduced if the agent
+ *	needs more than half of the timeout to respond and limited
+ *	to the size of responses that were silently truncated. The
+ *	limit is doubled after TNM_SNMP_REPSPROBE complete responses
+ *	at the limit so that a single short response or tooBig error
+ *	does not lower the number for the rest of the session.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The maxReps, maxRepsLimit and maxRepsGood members of the
+ *	session are updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TnmSnmpAdaptRepetitions(session, bulk, status, vbList, size, sendTime)
+    TnmSnmp *session;
+    int bulk;
+    int status;
+    Tcl_Obj *vbList;
+    int size;
+    Tcl_Time *sendTime;
+{
+    int vbc, elemc, fit, rtt, reps;
+    Tcl_Obj **vbv, **elemv;
+    Tcl_Time now;
+    if (bulk <= 0) {
+	return;
+    }
+
+    if (status == TNM_SNMP_TOOBIG || status == TNM_SNMP_NORESPONSE) {
+	reps = (bulk < session->maxReps) ? bulk : session->maxReps;
+	session->maxReps = (reps > 1) ? reps / 2 : 1;
+	if (status == TNM_SNMP_TOOBIG) {
+	    session->maxRepsLimit = session->maxReps;
+	    session->maxRepsGood = 0;
+	}
+	return;
+    }
+
+    if (status != TNM_SNMP_NOERROR || ! vbList || size <= 0
+	|| Tcl_ListObjGetElements(NULL, vbList, &vbc, &vbv) != TCL_OK
+	|| vbc == 0) {
+	return;
+    }
+
+    /*
+     * A response with less varbinds than requested has been 
+     * truncated by the agent, unless the last varbind signals the
+     * end of the MIB view. Remember how many varbinds fit.
+     */
+
+    if (vbc < bulk) {
+	if (Tcl_ListObjGetElements(NULL, vbv[vbc-1], &elemc, &elemv) == TCL_OK
+	    && elemc > 1 
+	    && TnmGetTableKey(tnmSnmpExceptionTable, Tcl_GetString(elemv[1]))
+	       == ASN1_END_OF_MIB_VIEW) {
+	    return;
+	}
+	session->maxReps = session->maxRepsLimit = vbc;
+	session->maxRepsGood = 0;
+	return;
+    }
+
+    /*
+     * Back off if the agent needs a long time to build the response
+     * since this would otherwise trigger retransmissions.
+     */
+
+    if (sendTime) {
+	Tcl_GetTime(&now);
+	rtt = (now.sec - sendTime->sec) * 1000
+	    + (now.usec - sendTime->usec) / 1000;
+	if (rtt * 2 > session->timeout * 1000 / (session->retries + 1)) {
+	    reps = session->maxReps * 3 / 4;
+	    session->maxReps = (reps > 0) ? reps : 1;
+	    return;
+	}
+    }
+
+    if (bulk < session->maxReps) {
+	return;
+    }
+
+    /*
+     * Probe beyond the limit once the agent has answered a number
+     * of requests at the limit with complete responses.
+     */
+
+    reps = session->maxReps * 2;
+    if (session->maxRepsLimit && reps > session->maxRepsLimit) {
+	if (session->maxReps >= session->maxRepsLimit
+	    && ++session->maxRepsGood >= TNM_SNMP_REPSPROBE) {
+	    session->maxRepsLimit *= 2;
+	    session->maxRepsGood = 0;
+	}
+	reps = session->maxRepsLimit;
+    }
+    /*
+     * Leave some headroom when estimating how many varbinds fit
+     * into a message since the size of the varbinds varies.
+     */
+
+    fit = (int) ((double) session->maxSize * 7 / 8 * vbc / size);
+    if (reps > fit) {
+	reps = fit;
+    }
+    session->maxReps = (reps > 0) ? reps : 1;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -106,3 +106,18 @@
 
 /* Define if you do have sin_len in struct sockaddr */
 #define HAVE_SA_LEN 1
+
+/* Define if you do have sendmmsg */
+#define HAVE_SENDMMSG 1
+
+/* Define if you do have recvmmsg */
+#define HAVE_RECVMMSG 1
+
+/* Define if you do have mmap */
+#define HAVE_MMAP 1
+
+/* Define if you do have epoll_create1 */
+#define HAVE_EPOLL_CREATE1 1
+
+/* Define if you do have timerfd_create */
+#define HAVE_TIMERFD_CREATE 1
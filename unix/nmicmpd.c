@@ -27,6 +27,7 @@ static char *version =  "nmicmpd  v0.99i  Dec 1996";	/* my version */
 #include <signal.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <fcntl.h>
 
@@ -144,6 +145,19 @@ struct udphdr { u_short uh_sport, uh_dport; short uh_ulen; u_short uh_sum; };
 #include <netdb.h>
 #include <arpa/inet.h>
 
+/*
+ * Use epoll and a timer for the event loop if available. The timer
+ * wakes us up with microsecond resolution while the timeout of the
+ * epoll_wait() and select() calls is limited to milliseconds on
+ * some systems.
+ */
+#if defined(HAVE_EPOLL_CREATE1) && defined(HAVE_TIMERFD_CREATE)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <stdint.h>
+#endif
+
 /* 
  * some simple macros for time handling.
  * time is handled internally in milliseconds.
@@ -153,9 +167,33 @@ struct udphdr { u_short uh_sport, uh_dport; short uh_ulen; u_short uh_sum; };
 #define time_diff(t1,t2)  (timediff2(t1,t2) <= 0 ? (- timediff2(t1,t2)) \
 			   : timediff2(t1,t2))
 
-#define timediff2usec(t1,t2)  (((t2).tv_sec - (t1).tv_sec) * 1000000 \
-	+ ((t2).tv_usec - (t1).tv_usec))
-#define time_diff_usec(t1,t2)  (timediff2usec(t1,t2) <= 0 ? (- timediff2usec(t1,t2)) : timediff2usec(t1,t2))
+#define time_before(t1,t2)  ((t1).tv_sec < (t2).tv_sec \
+	|| ((t1).tv_sec == (t2).tv_sec && (t1).tv_usec < (t2).tv_usec))
+
+#define time_add_usec(t,usec)  { (t).tv_sec += (usec) / 1000000; \
+	(t).tv_usec += (usec) % 1000000; \
+	if ((t).tv_usec >= 1000000) { (t).tv_sec++; (t).tv_usec -= 1000000; } }
+
+/*
+ * round trip times are measured in nanoseconds from timespec values:
+ */
+#define time_diff_nsec(t1,t2)  (((t2).tv_sec - (t1).tv_sec) * 1000000000LL \
+	+ ((t2).tv_nsec - (t1).tv_nsec))
+
+/*
+ * Take the receive time of icmp messages from the kernel if possible.
+ * This excludes the time a message waits in the socket queue while
+ * probes are sent. Messages are read without blocking if possible.
+ */
+#if defined(SO_TIMESTAMPNS) || defined(SO_TIMESTAMP)
+#define USE_TIMESTAMP
+#endif
+
+#ifdef MSG_DONTWAIT
+#define RECV_FLAGS	MSG_DONTWAIT
+#else
+#define RECV_FLAGS	0
+#endif
 
 /* fetch gettimofday: */
 #define gettime(tv,dofail)	\
@@ -175,6 +213,9 @@ struct udphdr { u_short uh_sport, uh_dport; short uh_ulen; u_short uh_sum; };
 #define MAX_POSSIBLE_DATALEN		65536
 static int max_data_len = MAX_POSSIBLE_DATALEN;
 
+/* receive buffer size of the icmp socket: */
+#define ICMP_RCVBUF			(4 * 1024 * 1024)
+
 /* emit debug messages (don't try this at home): */
 static int do_debug = 0;
 
@@ -199,7 +240,10 @@ static int checkComplementPort = 1;
 /*
  * Communication is done via stdin/stdout. The message format is
  * aligned with the the beginning of this structure. Numbers larger 
- * than a char are in network-byteorder.
+ * than a char are in network-byteorder. Version 0 commands end with
+ * the window field, version 1 commands add the count field. Version 1
+ * replies append the statistics encoded by EncodeStats() to the
+ * version 0 reply.
  */
 
 typedef struct _jobElem {
@@ -220,6 +264,8 @@ typedef struct _jobElem {
     } u;
     uint16_t size;				/* packet size requested */
     uint16_t window;				/* comm. window size */
+    uint16_t count;				/* # of echo exchanges */
+    uint16_t reserved;
 
     /*
      * private section of a job:
@@ -227,23 +273,43 @@ typedef struct _jobElem {
     union {
 	struct {
 	    unsigned short port;	/* dest port for traceroute */
-	    struct timeval tv;		/* time ttl probe sent. */
+	    struct timespec ts;		/* time ttl probe sent. */
 	} trace;
     } p;
 
+    int sent;				/* # of exchanges started */
+    int received;			/* # of replies received */
+    struct timespec exch_start;		/* start of the current exchange */
+    uint64_t rtt_min;			/* round trip times in ns */
+    uint64_t rtt_max;
+    uint64_t rtt_sum;
+    uint64_t rtt_last;
+    uint64_t jitter_sum;		/* sum of rtt variations in ns */
+
     int probe_cnt;			/* # of probes still sent */
     struct timeval time_sent;
-    unsigned retry_ival;
+    struct timeval next_probe;		/* time the next probe is due */
+    unsigned retry_ival;		/* retry interval in microseconds */
     int id;
     int done;
     int inServe;			/* are we processing it -- window ok */
-    struct _jobElem *next;
+    int heap_pos;			/* position in the retry heap or -1 */
+    struct _jobElem *id_next;		/* next job with the same id hash */
+    struct _jobElem *port_next;		/* next job with the same port hash */
+    struct _jobElem *next;		/* next job in the wait or done queue */
 } jobElem;
 
 
-#define ICMP_PROTO_VERSION	0		/* protocol version */
-#define ICMP_PROTO_CMD_LEN	20		/* length of a command */
-#define ICMP_PROTO_REPLY_LEN	16		/* length of a reply */
+#define ICMP_PROTO_VERSION	1		/* protocol version */
+#define ICMP_PROTO_CMD_LEN	24		/* length of a command */
+#define ICMP_PROTO_REPLY_LEN	56		/* length of a reply */
+#define ICMP_PROTO_CMD_LEN_V0	20		/* length of a v0 command */
+#define ICMP_PROTO_REPLY_LEN_V0	16		/* length of a v0 reply */
+
+#define ICMP_PROTO_CMD_SIZE(v) \
+	((v) == ICMP_PROTO_VERSION ? ICMP_PROTO_CMD_LEN : ICMP_PROTO_CMD_LEN_V0)
+#define ICMP_PROTO_REPLY_SIZE(v) \
+	((v) == ICMP_PROTO_VERSION ? ICMP_PROTO_REPLY_LEN : ICMP_PROTO_REPLY_LEN_V0)
 
 #define ICMP_TYPE_ECHO		1		/* icmp echo request */
 #define ICMP_TYPE_MASK		2		/* icmp mask request */
@@ -256,11 +322,78 @@ typedef struct _jobElem {
 
 #define ICMP_FLAG_FINALHOP	0x01
 
-/* root of the job queue: */
-static jobElem *job_list = 0;
+/*
+ * Jobs are indexed by ICMP id and by UDP trace port so that received
+ * packets are matched without scanning all jobs. Jobs in service are
+ * kept in a heap ordered by the time of their next probe. Finished
+ * jobs waiting for their reply are kept in a FIFO queue. Jobs waiting
+ * for a free window slot are kept in one FIFO queue per window size.
+ * These queues are sorted by decreasing window size, so that only the
+ * first queue has to be checked when window slots become free.
+ */
+
+typedef struct _waitQueue {
+    unsigned short window;		/* window size of the jobs */
+    jobElem *head, *tail;		/* jobs in order of arrival */
+    struct _waitQueue *next;		/* queue with a smaller window */
+} waitQueue;
+
+#define JOB_HASH_SIZE		4096		/* must be a power of 2 */
+
+static jobElem *id_hash[JOB_HASH_SIZE];
+static jobElem *port_hash[JOB_HASH_SIZE];
+
+static jobElem **heap = 0;
+static int heap_len = 0;
+static int heap_size = 0;
+
+static waitQueue *wait_queues = 0;
+static jobElem *done_head = 0, *done_tail = 0;
+
+static int job_count = 0;
+
+/*
+ * Probes are paced by a token bucket which is filled with pace_rate
+ * tokens per second up to pace_burst tokens. Every probe takes one
+ * token and a rate of 0 turns the bucket off. The delay of a job
+ * keeps further probes from being sent before send_gate. At most
+ * SEND_BATCH probes are sent before pending replies are read. The
+ * event loop waits until the next probe may be sent instead of
+ * sleeping after each probe.
+ */
+
+#define SEND_BATCH		64		/* probes between receives */
+
+static int pace_rate = 0;			/* tokens per second */
+static int pace_burst = 64;			/* size of the bucket */
+static double pace_tokens = 0;			/* tokens in the bucket */
+static struct timeval pace_time;		/* last refill */
+static struct timeval send_gate;		/* earliest next probe */
+
+#ifdef USE_EPOLL
+static int epfd = -1;				/* epoll instance */
+static int tfd = -1;				/* retry timer */
+#endif
+
+/*
+ * Commands are read in blocks since the client writes all commands of
+ * a request at once. A block may end with a partial command which is
+ * completed by the next read. Replies are collected in a buffer and
+ * written with a single write call. Unwritten replies are kept until
+ * stdout becomes writable again.
+ */
+
+#define ICMP_PROTO_BUFFER	256		/* messages per buffer */
+
+static unsigned char cmd_buf[ICMP_PROTO_CMD_LEN * ICMP_PROTO_BUFFER];
+static int cmd_len = 0;
+
+static unsigned char reply_buf[ICMP_PROTO_REPLY_LEN * ICMP_PROTO_BUFFER];
+static int reply_len = 0;
 
 /* forward: */
-static void ReceivePacket();
+static int ReceivePacket();
+static void AddJob();
 
 #include <sys/resource.h>
 
@@ -312,6 +445,40 @@ PosixError(msg)
     syslog(LOG_ERR, "%s: %d", msg, errno);
 #endif
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetTimeNs --
+ *
+ *	This procedure reads the system clock with nanosecond
+ *	resolution if the system supports it. This is the clock
+ *	used for the receive timestamps of the kernel.
+ *
+ * Results:
+ *	The current time is returned in the argument.
+ * 
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GetTimeNs(ts)
+    struct timespec *ts;
+{
+    struct timeval tv;
+
+#ifdef CLOCK_REALTIME
+    if (clock_gettime(CLOCK_REALTIME, ts) == 0) {
+	return;
+    }
+#endif
+    gettime(&tv, tv.tv_sec = tv.tv_usec = 0);
+    ts->tv_sec = tv.tv_sec;
+    ts->tv_nsec = tv.tv_usec * 1000;
+}
 /*
  *----------------------------------------------------------------------
  *
@@ -361,7 +528,7 @@ GetFreeUdpPort()
 #define MAX_BASE_PORT		60000
 
     static int probe_port = 0;		/* base port for ttl probes */
-    int swapped_port;
+    int swapped_port, i;
     jobElem *job;
 
     /* 
@@ -371,28 +538,352 @@ GetFreeUdpPort()
      * should be large enough.)
      */
 
-    probe_port++;
-    if (probe_port < BASE_PORT || probe_port > MAX_BASE_PORT) {
-	probe_port = BASE_PORT;
-    }
-    swapped_port = SwapShort(probe_port);
+    for (i = BASE_PORT; i <= MAX_BASE_PORT; i++) {
+
+	probe_port++;
+	if (probe_port < BASE_PORT || probe_port > MAX_BASE_PORT) {
+	    probe_port = BASE_PORT;
+	}
+	swapped_port = SwapShort(probe_port);
     
-    /* 
-     * Check, if this port is already in use, or a bad candidate
-     * (because it matches a byte-swapped port that is in use).
-     * Recurse if required (this is computer scientists code :-)
+	/* 
+	 * Check, if this port is already in use, or a bad candidate
+	 * (because it matches a byte-swapped port that is in use).
+	 */
+
+	for (job = port_hash[probe_port & (JOB_HASH_SIZE - 1)];
+	     job && job->p.trace.port != probe_port; job = job->port_next) ;
+	if (job) {
+	    continue;
+	}
+	for (job = port_hash[swapped_port & (JOB_HASH_SIZE - 1)];
+	     job && job->p.trace.port != swapped_port; job = job->port_next) ;
+	if (! job) {
+	    break;
+	}
+    }
+
+    return probe_port;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HashJob --
+ *
+ *	This procedure adds a job to the id index and trace jobs to
+ *	the port index.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	The job is added to the hash chains.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HashJob(job)
+    jobElem *job;
+{
+    jobElem **j;
+
+    j = &id_hash[job->id & (JOB_HASH_SIZE - 1)];
+    job->id_next = *j;
+    *j = job;
+
+    if (job->type == ICMP_TYPE_TRACE) {
+	j = &port_hash[job->p.trace.port & (JOB_HASH_SIZE - 1)];
+	job->port_next = *j;
+	*j = job;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UnhashJob --
+ *
+ *	This procedure removes a job from the id and port index.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	The job is removed from the hash chains.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+UnhashJob(job)
+    jobElem *job;
+{
+    jobElem **j;
+
+    for (j = &id_hash[job->id & (JOB_HASH_SIZE - 1)]; *j; 
+	 j = &(*j)->id_next) {
+	if (*j == job) {
+	    *j = job->id_next;
+	    break;
+	}
+    }
+
+    if (job->type == ICMP_TYPE_TRACE) {
+	for (j = &port_hash[job->p.trace.port & (JOB_HASH_SIZE - 1)]; *j;
+	     j = &(*j)->port_next) {
+	    if (*j == job) {
+		*j = job->port_next;
+		break;
+	    }
+	}
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HeapMove --
+ *
+ *	This procedure moves the job at the given heap position up or
+ *	down until the heap is ordered by the time of the next probe.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	The heap is reordered.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HeapMove(pos)
+    int pos;
+{
+    jobElem *job = heap[pos];
+    int child;
+
+    while (pos > 0 
+	   && time_before(job->next_probe, heap[(pos - 1) / 2]->next_probe)) {
+	heap[pos] = heap[(pos - 1) / 2];
+	heap[pos]->heap_pos = pos;
+	pos = (pos - 1) / 2;
+    }
+
+    while ((child = 2 * pos + 1) < heap_len) {
+	if (child + 1 < heap_len 
+	    && time_before(heap[child + 1]->next_probe, 
+			   heap[child]->next_probe)) {
+	    child++;
+	}
+	if (! time_before(heap[child]->next_probe, job->next_probe)) {
+	    break;
+	}
+	heap[pos] = heap[child];
+	heap[pos]->heap_pos = pos;
+	pos = child;
+    }
+
+    heap[pos] = job;
+    job->heap_pos = pos;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HeapRemove --
+ *
+ *	This procedure removes a job from the retry heap.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	The heap is reordered.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HeapRemove(job)
+    jobElem *job;
+{
+    int pos = job->heap_pos;
+
+    job->heap_pos = -1;
+    if (--heap_len > pos) {
+	heap[pos] = heap[heap_len];
+	HeapMove(pos);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FinishJob --
+ *
+ *	This procedure marks a job as done and moves it to the queue
+ *	of jobs waiting for their reply. The reply value of successful
+ *	echo and trace jobs is the average round trip time in
+ *	microseconds.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	The job is removed from the retry heap.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FinishJob(job)
+    jobElem *job;
+{
+    if (job->heap_pos >= 0) {
+	HeapRemove(job);
+    }
+
+    if (job->status == ICMP_STATUS_NOERROR && job->received
+	&& (job->type == ICMP_TYPE_ECHO || job->type == ICMP_TYPE_TRACE)) {
+	job->u.data = htonl((unsigned int) 
+			    (job->rtt_sum / job->received / 1000));
+    }
+
+    job->done = 1;
+    job->next = 0;
+    if (done_tail) {
+	done_tail->next = job;
+    } else {
+	done_head = job;
+    }
+    done_tail = job;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ScheduleJob --
+ *
+ *	This procedure computes the time of the next probe or the
+ *	timeout of a job in service and adds it to the retry heap if
+ *	necessary.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	The heap is reordered. The job is finished with a generic
+ *	error if the heap can not grow.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ScheduleJob(job)
+    jobElem *job;
+{
+    /*
+     * A job without probes left times out right after its last probe.
      */
 
-    for (job = job_list; job; job = job->next) {
-	if (job->type == ICMP_TYPE_TRACE) {
-	    if (job->p.trace.port == probe_port || 
-		job->p.trace.port == swapped_port) {
-		return GetFreeUdpPort();
+    job->next_probe = job->time_sent;
+    if (job->probe_cnt <= job->u.c.retries + 1) {
+	time_add_usec(job->next_probe, job->retry_ival);
+    }
+
+    if (job->heap_pos < 0) {
+	if (heap_len == heap_size) {
+	    int size = heap_size ? 2 * heap_size : 256;
+	    jobElem **h = (jobElem **) realloc((char *) heap, 
+					       size * sizeof(jobElem *));
+	    if (! h) {
+		syslog(LOG_ERR, "out of memory - job %d rejected", job->tid);
+		job->status = ICMP_STATUS_GENERROR;
+		job->u.data = 0;
+		FinishJob(job);
+		return;
 	    }
+	    heap = h;
+	    heap_size = size;
 	}
+	job->heap_pos = heap_len++;
+	heap[job->heap_pos] = job;
     }
 
-    return probe_port;
+    HeapMove(job->heap_pos);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NextExchange --
+ *
+ *	This procedure starts the next exchange of a job in service
+ *	which sends more than one echo request. The first probe of
+ *	the exchange is due immediately.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	The heap is reordered. Replies to probes of earlier exchanges
+ *	are ignored from now on.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+NextExchange(job)
+    jobElem *job;
+{
+    GetTimeNs(&job->exch_start);
+    job->probe_cnt = 0;
+    job->next_probe = job->time_sent;
+    HeapMove(job->heap_pos);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RecordRtt --
+ *
+ *	This procedure adds a round trip time to the statistics of a
+ *	job. The jitter is the mean difference between the round trip
+ *	times of consecutive replies.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	The statistics of the job are updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RecordRtt(job, t1, t2)
+    jobElem *job;
+    struct timespec *t1, *t2;
+{
+    long long diff = time_diff_nsec(*t1, *t2);
+    uint64_t rtt = diff < 0 ? -diff : diff;
+
+    if (! job->received || rtt < job->rtt_min) {
+	job->rtt_min = rtt;
+    }
+    if (rtt > job->rtt_max) {
+	job->rtt_max = rtt;
+    }
+    if (job->received) {
+	job->jitter_sum += rtt > job->rtt_last 
+	    ? rtt - job->rtt_last : job->rtt_last - rtt;
+    }
+    job->rtt_last = rtt;
+    job->rtt_sum += rtt;
+    job->received++;
 }
 
 /*
@@ -424,90 +915,136 @@ GetWindow(val)
 /*
  *----------------------------------------------------------------------
  *
- * ReceivePending --
+ * WaitJob --
  *
- *	This procedure checks about pending icmp messages.
+ *	This procedure appends a job to the wait queue for its window
+ *	size. The queue is created if no job with this window size is
+ *	waiting yet.
  *
  * Results:
  *	None.
  * 
  * Side effects:
- *	Pending messages are received, processed and answered.
- *	At least some time given by the parameter is spent.
+ *	The job is finished with a generic error if the queue can not
+ *	be created.
  *
  *----------------------------------------------------------------------
  */
 
 static void
-ReceivePending(wtim)
-    int wtim;
+WaitJob(job)
+    jobElem *job;
 {
-    fd_set fds;
-    struct timeval tv, time_mark, now;
-    long tdiff;
-    int rc;
+    waitQueue *queue, **queuePtr = &wait_queues;
 
-    /* we should not wait longer than time_mark + wtim: */
-    if (wtim > 0) {
-	gettime(&time_mark, /* ignore */ );
+    while ((queue = *queuePtr) && queue->window > job->window) {
+	queuePtr = &queue->next;
     }
-    
-    do {
-#if 0
-        /* XXX: seems to break delay option: */
-	/* don't spend time, if we are done: */
-	if (wtim > 0 && ! job_list) {
-	    return;
-	}
-#endif
-	
-	/* wait for a ready icmp socket, or timeout: */
-	do {
-	    FD_ZERO (&fds);
-	    FD_SET (icsock, &fds);
-	    
-	    if (wtim > 0) {
-		tv.tv_usec = (wtim * 1000) % 1000000;
-		tv.tv_sec = (wtim * 1000) / 1000000;
-	    } else {
-		tv.tv_sec = tv.tv_usec = 0;
-	    }
 
-	    rc = select(icsock + 1, &fds, (fd_set *) 0, (fd_set *) 0, &tv);
-	    
-	    if (rc < 0 && errno != EINTR && errno != EAGAIN) {
-		PosixError("select failed");
-		exit(1);
-	    }
-	} while (rc < 0);
-	
-	/* if timeout we are done: */
-	if (! rc) {
+    if (! queue || queue->window != job->window) {
+	if (! (queue = (waitQueue *) malloc(sizeof(waitQueue)))) {
+	    syslog(LOG_ERR, "out of memory - job %d rejected", job->tid);
+	    job->status = ICMP_STATUS_GENERROR;
+	    job->u.data = 0;
+	    FinishJob(job);
 	    return;
-	} else {
-	    /* icmp socket is ready: */
-	    ReceivePacket();
 	}
-	
-	/* at least poll, until the queue is empty: */
-	if (wtim <= 0) {
-	    wtim = 0;
-	    continue;
+	queue->window = job->window;
+	queue->head = queue->tail = 0;
+	queue->next = *queuePtr;
+	*queuePtr = queue;
+    }
+
+    if (queue->tail) {
+	queue->tail->next = job;
+    } else {
+	queue->head = job;
+    }
+    queue->tail = job;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AdmitJobs --
+ *
+ *	This procedure moves waiting jobs into service as long as the
+ *	largest window of all waiting jobs allows it. Jobs with the
+ *	same window are admitted in the order they were received.
+ *
+ * Results:
+ *	Returns the number of admitted jobs.
+ * 
+ * Side effects:
+ *	Increments the window-counter for every admitted job.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+AdmitJobs()
+{
+    waitQueue *queue;
+    jobElem *job;
+    int cnt = 0;
+
+    while ((queue = wait_queues) && queue->window > GetWindow(0)) {
+	job = queue->head;
+	queue->head = job->next;
+	if (! queue->head) {
+	    wait_queues = queue->next;
+	    free((char *) queue);
 	}
+	job->next = 0;
+	job->inServe = 1;
+	GetWindow(1);
+	ScheduleJob(job);
+	cnt++;
+    }
 
-	/* recalculate the remaining waittime we have to spend: */
-	gettime(&now, return);
-	tdiff = time_diff(time_mark, now);
-	dsyslog(LOG_DEBUG, "** timediff to spend: %ld", tdiff);
-	/* time to leave ? */
-	if (tdiff > wtim) {
-	    return;
+    return cnt;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReceivePending --
+ *
+ *	This procedure reads all icmp messages which are queued on
+ *	the icmp socket without blocking.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	Pending messages are received, processed and answered.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ReceivePending()
+{
+#ifdef MSG_DONTWAIT
+    while (ReceivePacket() == 0) {
+	continue;
+    }
+#else
+    fd_set fds;
+    struct timeval tv;
+    int rc;
+
+    do {
+	FD_ZERO(&fds);
+	FD_SET(icsock, &fds);
+	tv.tv_sec = tv.tv_usec = 0;
+	rc = select(icsock + 1, &fds, (fd_set *) 0, (fd_set *) 0, &tv);
+	if (rc < 0 && errno != EINTR && errno != EAGAIN) {
+	    PosixError("select failed");
+	    exit(1);
 	}
-	  
-	time_mark = now;
-	wtim -= tdiff;
-	
-    } while (wtim >= 0);
+    } while (rc != 0 && (rc < 0 || ReceivePacket() == 0));
+#endif
 }
 
 /*
@@ -535,11 +1072,19 @@ FindJobByPort(ip, udph)
     unsigned short id = ntohs(udph->uh_sport);
     unsigned short port = ntohs(udph->uh_dport);
     jobElem *job;
+    int i;
     
     dsyslog(LOG_DEBUG, "* looking for src %u (0x%lx)  dest %u (0x%x) ...", 
 	    (unsigned) id, (long) id, (unsigned) port, (int) port);
 
-    for (job = job_list; job; job = job->next) {
+    /*
+     * The job uses either the port or the byte-swapped port. Check
+     * the hash chains of both.
+     */
+
+    for (i = 0; i < 2; i++) {
+      unsigned hash = (i ? SwapShort(port) : port) & (JOB_HASH_SIZE - 1);
+      for (job = port_hash[hash]; job; job = job->port_next) {
 
 	unsigned short src;
 	int got_it = 0;
@@ -577,6 +1122,7 @@ FindJobByPort(ip, udph)
 	    dsyslog(LOG_DEBUG, "job %d: received icmp reply", job->tid);
 	    return job;
 	}
+      }
     }
 
     dsyslog(LOG_DEBUG, "nope");
@@ -589,7 +1135,10 @@ FindJobByPort(ip, udph)
  *
  * FindJobById --
  *
- *	This procedure looks about a job by the given id.
+ *	This procedure looks about a job in service by the given id.
+ *	Waiting jobs are skipped since they have not sent a probe
+ *	yet. Their ids may be in use by jobs in service if a large
+ *	number of jobs made the id counter wrap around.
  *
  * Results:
  *	Returns the job or 0 on error.
@@ -606,8 +1155,8 @@ FindJobById(id)
 {
     jobElem *job;
 
-    for (job = job_list; job; job = job->next) {
-	if (job->id == id) {
+    for (job = id_hash[id & (JOB_HASH_SIZE - 1)]; job; job = job->id_next) {
+	if (job->id == id && job->inServe) {
 	    dsyslog(LOG_DEBUG, "looking for job id %u ... got it",
 		    (unsigned) id);
 	    return job;
@@ -621,60 +1170,88 @@ FindJobById(id)
 /*
  *----------------------------------------------------------------------
  *
- * CleanupJobs --
+ * FlushReplies --
  *
- *	This procedure walks along the job queue and checks about
- *	finished jobs. The jobs are answered to stdout and removed 
- *	from the queue.
+ *	This procedure writes the buffered replies to stdout.
  *
  * Results:
  *	None.
  * 
  * Side effects:
- *	The global job_list may be changed.
- *      May decrement the window-counter.
+ *	Replies which can not be written without blocking are kept
+ *	in the reply buffer.
  *
  *----------------------------------------------------------------------
  */
 
 static void
-CleanupJobs()
+FlushReplies()
 {
-    jobElem **j = &job_list;
-
-    while (*j) {
-
-	jobElem *job = *j;
-	int rc;
+    int rc;
 
-	if (job->done) {
+    if (! reply_len) {
+	return;
+    }
 
-	    rc = write(fileno(stdout), (char *) job, ICMP_PROTO_REPLY_LEN);
-	    if (rc < 0) {
+    rc = write(fileno(stdout), (char *) reply_buf, reply_len);
+    if (rc < 0) {
 #if defined(EWOULDBLOCK)
-		if (errno == EWOULDBLOCK) {
-		    j = &(*j)->next;
-		    continue;
-		}
+	if (errno == EWOULDBLOCK) {
+	    return;
+	}
 #endif
-		PosixError("write failed");
-	    }
-	    if (rc != ICMP_PROTO_REPLY_LEN) {
-		syslog(LOG_ERR, "write returned %d instead of %d bytes",
-			   rc, ICMP_PROTO_REPLY_LEN);
-	    }
+	PosixError("write failed");
+	reply_len = 0;
+	return;
+    }
 
-	    GetWindow(-1);
+    reply_len -= rc;
+    if (reply_len) {
+	memmove(reply_buf, reply_buf + rc, reply_len);
+    }
+}
 
-	    /*
-	     * Remove the job from our queue and free memory:
-	     */
+/*
+ *----------------------------------------------------------------------
+ *
+ * EncodeStats --
+ *
+ *	This procedure encodes the statistics of a job which follow
+ *	the version 0 part of a version 1 reply: the number of
+ *	exchanges and the number of replies (16 bits each), 32 unused
+ *	bits and the minimum, average and maximum round trip time
+ *	and the jitter in nanoseconds (64 bits each).
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	The statistics are written to the buffer.
+ *
+ *----------------------------------------------------------------------
+ */
 
-	    *j = (*j)->next;
-	    free((char *) job);
+static void
+EncodeStats(job, buf)
+    jobElem *job;
+    unsigned char *buf;
+{
+    uint64_t val[4];
+    int i, j;
 
-	} else {
-	    j = &(*j)->next;
+    val[0] = job->received ? job->rtt_min : 0;
+    val[1] = job->received ? job->rtt_sum / job->received : 0;
+    val[2] = job->rtt_max;
+    val[3] = job->received > 1 ? job->jitter_sum / (job->received - 1) : 0;
+
+    buf[0] = (job->sent >> 8) & 0xff;
+    buf[1] = job->sent & 0xff;
+    buf[2] = (job->received >> 8) & 0xff;
+    buf[3] = job->received & 0xff;
+    memset((char *) buf + 4, 0, 4);
+    for (i = 0; i < 4; i++) {
+	for (j = 0; j < 8; j++) {
+	    buf[8 + 8 * i + j] = (val[i] >> (56 - 8 * j)) & 0xff;
 	}
     }
 }
@@ -682,21 +1259,111 @@ CleanupJobs()
 /*
  *----------------------------------------------------------------------
  *
- * ReceivePacket --
+ * QueueReply --
  *
- *	This procedure receives and processes a icmp-message. 
+ *	This procedure appends the reply for a job to the reply buffer.
+ *	The reply format follows the protocol version of the command.
+ *
+ * Results:
+ *	Returns 0 on success and -1 if the reply buffer is full.
+ * 
+ * Side effects:
+ *	The reply buffer is flushed if it is full.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+QueueReply(job)
+    jobElem *job;
+{
+    int len = ICMP_PROTO_REPLY_SIZE(job->version);
+
+    if (reply_len + len > sizeof(reply_buf)) {
+	FlushReplies();
+	if (reply_len + len > sizeof(reply_buf)) {
+	    return -1;
+	}
+    }
+
+    memcpy(reply_buf + reply_len, (char *) job, ICMP_PROTO_REPLY_LEN_V0);
+    if (len > ICMP_PROTO_REPLY_LEN_V0) {
+	EncodeStats(job, reply_buf + reply_len + ICMP_PROTO_REPLY_LEN_V0);
+    }
+    reply_len += len;
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CleanupJobs --
+ *
+ *	This procedure walks along the queue of finished jobs. The
+ *	jobs are answered to stdout and removed from the queue.
  *
  * Results:
  *	None.
  * 
  * Side effects:
- *	If a job is completed, cleanup is called and the global
- *	job_list may be changed.
+ *	Finished jobs are freed.
+ *      May decrement the window-counter.
  *
  *----------------------------------------------------------------------
  */
 
 static void
+CleanupJobs()
+{
+    jobElem *job;
+
+    while ((job = done_head)) {
+
+	if (QueueReply(job) < 0) {
+	    break;
+	}
+
+	if (job->inServe) {
+	    GetWindow(-1);
+	}
+
+	/*
+	 * Remove the job from our queue and free memory:
+	 */
+
+	done_head = job->next;
+	if (! done_head) {
+	    done_tail = 0;
+	}
+	UnhashJob(job);
+	job_count--;
+	free((char *) job);
+    }
+
+    FlushReplies();
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReceivePacket --
+ *
+ *	This procedure receives and processes a icmp-message. The
+ *	receive time is taken from the kernel if the system supports
+ *	receive timestamps.
+ *
+ * Results:
+ *	Returns 0 if a message was received and -1 if no message
+ *	was available or an error occured.
+ * 
+ * Side effects:
+ *	If a job is completed, cleanup is called and the job
+ *	may be freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
 ReceivePacket()
 {
     char packet[MAX_POSSIBLE_DATALEN + 128];
@@ -704,22 +1371,70 @@ ReceivePacket()
     struct ip *ip = (struct ip *) packet;
     struct icmp *icp;			/* for pings */
     struct udphdr *udph;		/* for ttl's */
-    struct timeval tp1, tp2;
+    struct timespec tp1, tp2;
     struct sockaddr_in sfrom;
-    int fromlen = sizeof(sfrom);
     int hlen = 0, cc, ttl_is_done = 0;
     int type = -1;
     jobElem *job = 0;
-    
-    cc = recvfrom(icsock, (char *) packet, len, 0,
+#ifdef USE_TIMESTAMP
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    char control[256];
+
+    iov.iov_base = packet;
+    iov.iov_len = len;
+    memset((char *) &msg, 0, sizeof(msg));
+    msg.msg_name = (char *) &sfrom;
+    msg.msg_namelen = sizeof(sfrom);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cc = recvmsg(icsock, &msg, RECV_FLAGS);
+#else
+    socklen_t fromlen = sizeof(sfrom);
+
+    cc = recvfrom(icsock, (char *) packet, len, RECV_FLAGS,
 		  (struct sockaddr *) &sfrom, &fromlen);
+#endif
 
-    if (cc < 0 && errno != EINTR && errno != EAGAIN) {
-	PosixError("recvfrom failed:");
-	return;
+    if (cc < 0) {
+	if (errno == EINTR) {
+	    return 0;
+	}
+	if (errno != EAGAIN
+#if defined(EWOULDBLOCK)
+	    && errno != EWOULDBLOCK
+#endif
+	    ) {
+	    PosixError("recvfrom failed:");
+	}
+	return -1;
     }
 
-    gettime(&tp2, return);
+    GetTimeNs(&tp2);
+
+#ifdef USE_TIMESTAMP
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	if (cmsg->cmsg_level != SOL_SOCKET) {
+	    continue;
+	}
+#ifdef SO_TIMESTAMPNS
+	if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+	    memcpy((char *) &tp2, CMSG_DATA(cmsg), sizeof(tp2));
+	}
+#else
+	if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+	    struct timeval tv;
+	    memcpy((char *) &tv, CMSG_DATA(cmsg), sizeof(tv));
+	    tp2.tv_sec = tv.tv_sec;
+	    tp2.tv_nsec = tv.tv_usec * 1000;
+	}
+#endif
+    }
+#endif
     
     dsyslog(LOG_DEBUG, "recvfrom got rc = %d", cc);
 
@@ -732,7 +1447,7 @@ ReceivePacket()
     if (cc < hlen + ICMP_MINLEN) {
 	dsyslog(LOG_DEBUG, "short packet (%d < %d) - ignored",
 		cc, hlen + ICMP_MINLEN);
-	return;
+	return 0;
     }
     
     icp = (struct icmp *) (packet + hlen);
@@ -757,7 +1472,7 @@ ReceivePacket()
     case ICMP_UNREACH:
 	if (icp->icmp_code != ICMP_UNREACH_PORT) {
 	    dsyslog(LOG_DEBUG, "bad icmp code - discarded");
-	    return;
+	    return 0;
 	}
 	type = ICMP_TYPE_TRACE;
 	ttl_is_done = 1;
@@ -765,26 +1480,35 @@ ReceivePacket()
     case ICMP_TIMXCEED:
 	if (icp->icmp_code != ICMP_TIMXCEED_INTRANS) {
 	    dsyslog(LOG_DEBUG, "bad icmp code - discarded");
-	    return;
+	    return 0;
 	}
 	type = ICMP_TYPE_TRACE;
 	break;
     default:
 	dsyslog(LOG_DEBUG, "unknown icmp type - discarded");
-	return;
+	return 0;
     }
     
     if ((type != ICMP_TYPE_TRACE && ! (job = FindJobById(icp->icmp_id)))
 	|| (type == ICMP_TYPE_TRACE && ! (job = FindJobByPort(ip, udph))))
       {
 	  dsyslog(LOG_DEBUG, "unknown packet id - discarded");
-	  return;
+	  return 0;
       }
     
     /* this one is still in progress: */
     if (job->done) {
 	dsyslog(LOG_DEBUG, "already done - discarded");
-	return;
+	return 0;
+    }
+
+    /* 
+     * A job waiting for its window has not sent a probe yet. The
+     * packet answers a probe of another process with the same id.
+     */
+    if (! job->inServe) {
+	dsyslog(LOG_DEBUG, "job not in service - discarded");
+	return 0;
     }
 
     if ((type == ICMP_TYPE_ECHO
@@ -793,28 +1517,32 @@ ReceivePacket()
 	&& sfrom.sin_addr.s_addr != job->addr.s_addr) {
 	dsyslog(LOG_DEBUG, "unexpected packet from %s - discarded", 
 		inet_ntoa(sfrom.sin_addr));
-	return;
+	return 0;
     }
 
     switch (type) {
     case ICMP_TYPE_ECHO:
-	tp1 = job->p.trace.tv;		/* time sent */
-	memcpy((char *) &tp1, (char *) icp->icmp_data, 
-	       sizeof(struct timeval)); 
-	{ 
-	    int tdiff = time_diff_usec(tp1, tp2);
-	    memcpy((char *) &job->u.data, (char *) &tdiff, 
-		   sizeof(job->u.data));
-	    job->u.data = htonl(job->u.data);
+	memcpy((char *) &tp1, (char *) icp->icmp_data,	/* time sent */
+	       sizeof(struct timespec)); 
+	if (time_diff_nsec(job->exch_start, tp1) < 0) {
+	    dsyslog(LOG_DEBUG, "reply to an earlier exchange - discarded");
+	    return 0;
 	}
-	job->done = 1;
+	RecordRtt(job, &tp1, &tp2);
 	job->addr = sfrom.sin_addr;
-	dsyslog(LOG_DEBUG, "job %d: echo from %s with rtt %d", job->tid,
-		inet_ntoa(job->addr), ntohl(job->u.data));
+	dsyslog(LOG_DEBUG, "job %d: echo %d from %s with rtt %lld ns", 
+		job->tid, job->sent, inet_ntoa(job->addr),
+		(long long) time_diff_nsec(tp1, tp2));
+	if (job->sent < job->count) {
+	    NextExchange(job);
+	} else {
+	    job->done = 1;
+	}
 	break;
 
     case ICMP_TYPE_MASK:
 	memcpy((char *) &job->u.data, icp->icmp_data, sizeof(job->u.data));
+	job->received++;
 	job->done = 1;
 	job->addr = sfrom.sin_addr;
 	dsyslog(LOG_DEBUG, "job %d: mask 0x%lx\n", job->tid,
@@ -828,6 +1556,7 @@ ReceivePacket()
 	    memcpy((char *) &job->u.data, (char *) &val, sizeof(job->u.data));
 	    job->u.data = htonl(job->u.data);
 	}
+	job->received++;
 	job->done = 1;
 	job->addr = sfrom.sin_addr;
 	dsyslog(LOG_DEBUG, "job %d: timestamp diff %ld", 
@@ -835,13 +1564,7 @@ ReceivePacket()
 	break;
 
     case ICMP_TYPE_TRACE:
-	tp1 = job->p.trace.tv;		/* time sent */
-	{
-	    int tdiff = time_diff_usec(tp1, tp2);
-	    memcpy((char *) &job->u.data, (char *) &tdiff, 
-		   sizeof(job->u.data));
-	    job->u.data = htonl(job->u.data);
-	}
+	RecordRtt(job, &job->p.trace.ts, &tp2);
 	job->addr = sfrom.sin_addr;
 	if (ttl_is_done) {
 	    job->flags |= ICMP_FLAG_FINALHOP;
@@ -853,13 +1576,16 @@ ReceivePacket()
 	
     default:
 	dsyslog(LOG_DEBUG, "unknown type - discarded");
-	return;
+	return 0;
     }
 
     /* fine: */
     if (job->done) {
+	FinishJob(job);
 	CleanupJobs();
     }
+
+    return 0;
 }
 
 /*
@@ -1044,7 +1770,7 @@ SendTrace(job)
 #endif /* USE_DLPI */
 
     /* save time this probe ws sent: */
-    gettime(&job->p.trace.tv, return);
+    GetTimeNs(&job->p.trace.ts);
     
     for (i = sizeof(struct timeval) + 2, j = 'A'; i < job->size; i++, j++) {
 	datap [i] = j;
@@ -1139,8 +1865,10 @@ SendIcmp(job)
 	data_offset = 0;
     } else {
         /* ping: */
-	* (struct timeval *) datap = tv;
-	data_offset = sizeof(struct timeval);
+	struct timespec ts;
+	GetTimeNs(&ts);
+	memcpy(datap, (char *) &ts, sizeof(ts));
+	data_offset = sizeof(struct timespec);
     }
 
     for (i = data_offset; i < job->size; i++) {
@@ -1262,6 +1990,39 @@ InitSockets()
 
     dsyslog(LOG_DEBUG, "using max_data_len of %d", max_data_len);
 
+    /*
+     * Large windows put many replies in flight at once. Enlarge the
+     * receive buffer of the icmp socket so that replies are not lost
+     * while probes are sent. We still have root permissions here, so
+     * SO_RCVBUFFORCE may exceed the system limit.
+     */
+    {
+	int size = ICMP_RCVBUF;
+#ifdef SO_RCVBUFFORCE
+	if (setsockopt(icsock, SOL_SOCKET, SO_RCVBUFFORCE, 
+		       (char *) &size, sizeof(size)) < 0)
+#endif
+	if (setsockopt(icsock, SOL_SOCKET, SO_RCVBUF, 
+		       (char *) &size, sizeof(size)) < 0) {
+	    dsyslog(LOG_DEBUG, "note: cannot set receive buffer size");
+	}
+    }
+
+#ifdef USE_TIMESTAMP
+    {
+	int flag = 1;
+#ifdef SO_TIMESTAMPNS
+	if (setsockopt(icsock, SOL_SOCKET, SO_TIMESTAMPNS, 
+		       (char *) &flag, sizeof(flag)) < 0) {
+#else
+	if (setsockopt(icsock, SOL_SOCKET, SO_TIMESTAMP, 
+		       (char *) &flag, sizeof(flag)) < 0) {
+#endif
+	    dsyslog(LOG_DEBUG, "note: cannot enable receive timestamps");
+	}
+    }
+#endif
+
     /*
      * if the SO_BROADCAST option is avail, try to set this.
      * if it fails, this should cause no extra trouble.
@@ -1387,23 +2148,77 @@ SetUnblock(fd)
  *
  * ReadJob --
  *
- *	This procedure reads a command from stdin.
+ *	This procedure reads commands from stdin. All complete commands
+ *	are added to the job queue and a trailing partial command is
+ *	kept in the command buffer. The length of a command depends
+ *	on the protocol version in its first byte.
  *
  * Results:
  *	Returns 0 on success and -1 on EOF or Error.
  * 
  * Side effects:
- *	May add a job to the global command queue.
- *      May increment the window-counter.
+ *	May add jobs to the global command queue.
  *
  *----------------------------------------------------------------------
  */
 
 static int
 ReadJob()
+{
+    int rc, i, n;
+
+    rc = read(fileno(stdin), (char *) cmd_buf + cmd_len,
+	      sizeof(cmd_buf) - cmd_len);
+    if (rc < 0) {
+	PosixError("read failed");
+	return -1;
+    }
+    if (rc == 0) {
+	if (cmd_len) {
+	    syslog(LOG_ERR, "EOF after %d bytes of a command", cmd_len);
+	}
+	return -1;
+    }
+
+    cmd_len += rc;
+    for (i = 0; i < cmd_len; i += n) {
+	n = ICMP_PROTO_CMD_SIZE(cmd_buf[i]);
+	if (i + n > cmd_len) {
+	    break;
+	}
+	AddJob(cmd_buf + i);
+    }
+    cmd_len -= i;
+    if (cmd_len) {
+	memmove(cmd_buf, cmd_buf + i, cmd_len);
+    }
+
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AddJob --
+ *
+ *	This procedure converts a command into a job and adds it to
+ *	the job index.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	May add a job to the global command queue.
+ *      May increment the window-counter.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AddJob(cmd)
+    unsigned char *cmd;
 {
     jobElem newJob, *job;
-    int rc;
     static unsigned short ident_cnt = 0;
 
     job = &newJob;
@@ -1413,38 +2228,38 @@ ReadJob()
 	ident_cnt = (getpid() & 0xff) << 8;
     }
 
-    rc = read(fileno(stdin), (char *) job, ICMP_PROTO_CMD_LEN);
-    if (rc < 0) {
-	PosixError("read failed");
-	return -1;
-    }
-    if (rc == 0) {
-	return -1;
-    }
-    if (rc != ICMP_PROTO_CMD_LEN) {
-	syslog(LOG_ERR, "read returned %d instead of %d bytes", 
-	       rc, ICMP_PROTO_CMD_LEN);
-	return 0;
-    }
+    memcpy((char *) job, cmd, ICMP_PROTO_CMD_SIZE(cmd[0]));
     
     /* convert network-byteorder parameter fields: */
     job->size = ntohs(job->size);
     job->window = ntohs(job->window);
+
+    /* only version 1 echo commands send more than one request: */
+    job->count = job->version == ICMP_PROTO_VERSION ? ntohs(job->count) : 1;
+    if (job->type != ICMP_TYPE_ECHO || job->count == 0) {
+	job->count = 1;
+    }
     
     /* init reply fields: */
     job->status = ICMP_STATUS_NOERROR;
     job->flags = 0;
 
     /* init internal values: */
-    job->retry_ival = (1000 * job->u.c.timeout) / (job->u.c.retries + 1);
+    /* round up so that the last retry does not time out early: */
+    job->retry_ival = (1000000U * job->u.c.timeout + job->u.c.retries)
+	/ (job->u.c.retries + 1);
 
     job->probe_cnt = 0;
     job->time_sent.tv_sec = job->time_sent.tv_usec = 0;
+    job->sent = job->received = 0;
+    job->exch_start.tv_sec = job->exch_start.tv_nsec = 0;
+    job->rtt_min = job->rtt_max = job->rtt_sum = 0;
+    job->rtt_last = job->jitter_sum = 0;
     job->id = ident_cnt++;
     job->done = 0;
-    if ((job->inServe = (job->window == 0))) {
-        GetWindow(1);
-    }
+    job->inServe = 0;
+    job->heap_pos = -1;
+    job->next = 0;
     if (job->type == ICMP_TYPE_TRACE) {
 	job->p.trace.port = GetFreeUdpPort();
     }
@@ -1456,18 +2271,18 @@ ReadJob()
     if (! (job = (jobElem *) malloc(sizeof(jobElem)))) {
 	syslog(LOG_ERR, "out of memory - job rejected");
 	newJob.status = ICMP_STATUS_GENERROR;
-	if (write(fileno(stdout), (char *) &newJob, ICMP_PROTO_REPLY_LEN) 
-	    != ICMP_PROTO_REPLY_LEN) {
-	    PosixError("write failed");
+	if (QueueReply(&newJob) < 0) {
+	    syslog(LOG_ERR, "reply buffer full - reply for job %d lost",
+		   newJob.tid);
 	}
-	return 0;
+	return;
     } else {
 	*job = newJob;
     }
 
-    /* add to our job list: */
-    job->next = job_list;
-    job_list = job;
+    /* add to our job index: */
+    HashJob(job);
+    job_count++;
 
     dsyslog(LOG_DEBUG,
        "job %d: type=%d id=%u status=%d dest=%s size=%d retries=%d timeout=%d",
@@ -1478,7 +2293,7 @@ ReadJob()
      * sanity checks: 
      */
 
-    if (job->version != ICMP_PROTO_VERSION || job->type > 4) {
+    if (job->version > ICMP_PROTO_VERSION || job->type > 4) {
 	syslog(LOG_ERR, "job %d: bad version %d or type %d",
 	       job->tid, job->version, job->type);
 	job->status = ICMP_STATUS_GENERROR;
@@ -1493,82 +2308,133 @@ ReadJob()
 	job->done = 1;
     }
 
-    return 0;
+    /*
+     * Queue the job for its reply, put it in service or let it wait
+     * until its window allows to send it.
+     */
+
+    if (job->done) {
+	FinishJob(job);
+    } else if (job->window == 0) {
+	job->inServe = 1;
+	GetWindow(1);
+	ScheduleJob(job);
+    } else {
+	WaitJob(job);
+    }
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * LookupNextRetryTimeout --
+ * PaceProbe --
  *
- *	This procedure walks along the job queue and checks the
- *	remaining retry time intervals.
+ *	This procedure checks if a probe may be sent now according to
+ *	the delay of the last probe and the token bucket.
  *
  * Results:
- *	Returns in the argument the smallest retry timeout in ms.
+ *	Returns 1 if the probe may be sent and 0 otherwise.
  * 
  * Side effects:
- *	None.
+ *	Refills the token bucket and takes a token.
  *
  *----------------------------------------------------------------------
  */
 
-static void
-LookupNextRetryTimeout(tv)
-    struct timeval *tv;
+static int
+PaceProbe(now)
+    struct timeval *now;
 {
-    jobElem *job;
-    struct timeval now;
-    int min_diff = -1;
-    int window;
-
-    gettime(&now, return);
-    window = GetWindow(0);
-
-    for (job = job_list; job; job = job->next) {
-        int tdiff;
-
-	if (! job->inServe) {
-	    continue;
-        }
+    if (time_before(*now, send_gate)) {
+	return 0;
+    }
 
-	tdiff = time_diff(job->time_sent, now);
-	if (tdiff > job->retry_ival) {
-	    tdiff = 0;
-	} else {
-	    tdiff = job->retry_ival - tdiff;
+    if (pace_rate > 0) {
+	pace_tokens += ((now->tv_sec - pace_time.tv_sec) * 1e6
+			+ (now->tv_usec - pace_time.tv_usec)) * pace_rate / 1e6;
+	if (pace_tokens > pace_burst) {
+	    pace_tokens = pace_burst;
 	}
-	
-	dsyslog(LOG_DEBUG, "job %d: timeout is %d", job->tid, tdiff);
-	if (min_diff < 0) {
-	    min_diff = tdiff;
-	} else if (tdiff < min_diff) {
-	    min_diff = tdiff;
+	pace_time = *now;
+	if (pace_tokens < 1) {
+	    return 0;
 	}
+	pace_tokens -= 1;
     }
 
-    if (min_diff < 0) {
-	min_diff = 0;
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NextWakeup --
+ *
+ *	This procedure computes the time when the job on top of the
+ *	retry heap needs attention. A probe is further delayed until
+ *	the delay of the last probe has passed and the token bucket
+ *	has a token.
+ *
+ * Results:
+ *	Returns 0 if no job is in service and 1 otherwise. The time
+ *	is returned in the argument.
+ * 
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+NextWakeup(when)
+    struct timeval *when;
+{
+    struct timeval ready;
+    jobElem *job;
+    long usec;
+
+    if (! heap_len) {
+	return 0;
     }
 
-    tv->tv_sec = min_diff / 1000;
-    tv->tv_usec = (min_diff % 1000) * 1000;
+    job = heap[0];
+    *when = job->next_probe;
+
+    if (job->probe_cnt <= job->u.c.retries + 1) {
+	ready = send_gate;
+	if (pace_rate > 0 && pace_tokens < 1) {
+	    struct timeval refill = pace_time;
+	    usec = (long) ((1 - pace_tokens) * 1e6 / pace_rate) + 1;
+	    time_add_usec(refill, usec);
+	    if (time_before(ready, refill)) {
+		ready = refill;
+	    }
+	}
+	if (time_before(*when, ready)) {
+	    *when = ready;
+	}
+    }
 
-    dsyslog(LOG_DEBUG, "next timeout in %d ms", min_diff);
+    dsyslog(LOG_DEBUG, "job %d: next wakeup at %ld.%06ld", job->tid,
+	    (long) when->tv_sec, (long) when->tv_usec);
+    return 1;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
  * SendPending --
  *
- *	This procedure resends all pending icmp and trace packets.
+ *	This procedure sends the probes of all jobs which are due
+ *	according to the retry heap. Sending stops if the pacing
+ *	does not allow further probes or after a batch of probes so
+ *	that replies are read in between.
  *
  * Results:
  *	None.
  * 
  * Side effects:
- *	Collects replies and may remove jobs from the global job_list.
+ *	Collects replies and may free finished jobs.
  *
  *----------------------------------------------------------------------
  */
@@ -1578,83 +2444,290 @@ SendPending()
 {
     jobElem *job;
     struct timeval now;
-    int window;
+    int sent = 0;
 
+    AdmitJobs();
     gettime(&now, return);
 
-retry:
-
-    window = GetWindow(0);
-
-    for (job = job_list; job; job = job->next) {
- 
-	/* 
-	 * Check if we have space in the window to process this job:
-	 */
-
-        if (! job->inServe && job->window > window) {
-	    job->inServe = 1;
-	    window = GetWindow(1);
-	} 
+    /*
+     * Jobs which finish free their window slots when they are
+     * answered. Repeat as long as this admits waiting jobs.
+     */
 
-	/* 
-	 * If this job is not in service, don't try to send:
-	 */
+  again:
+    while (heap_len && ! time_before(now, heap[0]->next_probe)) {
 
-        if (! job->inServe) {
-	    dsyslog(LOG_DEBUG, "job %d: delayed (not in service)", job->tid);
-	    continue;
-	}
+	job = heap[0];
 
 	dsyslog(LOG_DEBUG, 
-		"job %d: done %d, probe_cnt %d, retries %d, tdiff %ld, ival %d",
-		job->tid, job->done, job->probe_cnt, job->u.c.retries,
+		"job %d: probe_cnt %d, retries %d, tdiff %ld, ival %u us",
+		job->tid, job->probe_cnt, job->u.c.retries,
 		time_diff(job->time_sent,now), job->retry_ival);
 
 	/*
-	 * Send a packet if the we have a try left and a timeout reached:
+	 * Send a packet if the we have a try left and pacing allows it:
 	 */
 
-	if (! job->done && job->probe_cnt <= (job->u.c.retries + 1)
-	      && time_diff(job->time_sent,now) > job->retry_ival) {
+	if (job->probe_cnt <= (job->u.c.retries + 1)) {
 
-	      dsyslog(LOG_DEBUG, 
-		      "job %d: sending probe # %d (%ld > %d) with win %d >= %d",
-		      job->tid, job->probe_cnt, time_diff(job->time_sent,now), 
-		      job->retry_ival, job->window, window);
-	      
-	      if (job->type == ICMP_TYPE_TRACE) {
-		  SendTrace(job);
-	      } else {
-		  SendIcmp(job);
-	      }
+	    if (sent == SEND_BATCH || ! PaceProbe(&now)) {
+		break;
+	    }
+
+	    dsyslog(LOG_DEBUG, 
+		    "job %d: sending probe # %d (%ld ms > %u us) with win %d >= %d",
+		    job->tid, job->probe_cnt, time_diff(job->time_sent,now), 
+		    job->retry_ival, job->window, GetWindow(0));
+		      
+	    if (! job->probe_cnt) {
+		job->sent++;
+	    }
+	    if (job->type == ICMP_TYPE_TRACE) {
+		SendTrace(job);
+	    } else {
+		SendIcmp(job);
+	    }
+	    sent++;
+
+	    if (job->u.c.delay) {
+		send_gate = job->time_sent;
+		time_add_usec(send_gate, job->u.c.delay * 1000L);
+	    }
+
+	    if (job->done) {
+		FinishJob(job);
+	    } else {
+		ScheduleJob(job);
+	    }
 
-	      /*
-	       * Process answers and wait delay time:
-	       */
+	} else if (job->sent < job->count) {
 
-	      ReceivePending(job->u.c.delay);
-	      goto retry;
+	    dsyslog(LOG_DEBUG, "job %d: exchange %d failed after %d tries", 
+		    job->tid, job->sent, job->probe_cnt);
+	    NextExchange(job);
 
-	} else if (! job->done && job->probe_cnt > job->u.c.retries + 1) {
+	} else {
 
 	    dsyslog(LOG_DEBUG, "job %d: failed after %d tries", 
 		    job->tid, job->probe_cnt);
-	    job->done = 1;
-	    job->u.data = 0;
-	    job->status |= ICMP_STATUS_TIMEOUT;
-	    goto retry;
+	    if (! job->received) {
+		job->u.data = 0;
+		job->status |= ICMP_STATUS_TIMEOUT;
+	    }
+	    FinishJob(job);
 	}
     }
 
     /*
      * Respond for all jobs (success or timeout) that are done and
-     * remove them from the job list.
+     * free them.
      */
 
     CleanupJobs();
+    if (AdmitJobs()) {
+	goto again;
+    }
 }
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * InitEvents --
+ *
+ *	This procedure creates the epoll instance and the timer used
+ *	by the event loop.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	Falls back to select() if epoll can not watch our file
+ *	descriptors, e.g. if stdin is a regular file.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+InitEvents()
+{
+#ifdef USE_EPOLL
+    struct epoll_event ev;
+    int fds[3], i;
+
+    fds[0] = fileno(stdin);
+    fds[1] = icsock;
+    fds[2] = tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
+    epfd = epoll_create1(0);
+
+    for (i = 0; i < 3 && epfd >= 0 && tfd >= 0; i++) {
+	memset((char *) &ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fds[i];
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+	    break;
+	}
+    }
+
+    if (i < 3) {
+	dsyslog(LOG_DEBUG, "note: cannot use epoll - using select");
+	if (epfd >= 0) {
+	    close(epfd);
+	}
+	if (tfd >= 0) {
+	    close(tfd);
+	}
+	epfd = tfd = -1;
+    }
+#endif
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WaitEvents --
+ *
+ *	This procedure waits for new jobs, icmp messages, a writable
+ *	stdout if replies are left over, or until the given time is
+ *	reached. Epoll and a timer are used if available since the
+ *	timer has microsecond resolution.
+ *
+ * Results:
+ *	Sets in_ready if stdin is readable and icmp_ready if the icmp
+ *	socket is readable.
+ * 
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WaitEvents(when, eof_seen, in_ready, icmp_ready)
+    struct timeval *when;
+    int eof_seen;
+    int *in_ready;
+    int *icmp_ready;
+{
+    struct timeval now, tv;
+    fd_set fds, wfds;
+    int rc, maxfd;
+
+    *in_ready = *icmp_ready = 0;
+
+    if (when) {
+	gettime(&now, now = *when);
+	tv.tv_sec = tv.tv_usec = 0;
+	if (time_before(now, *when)) {
+	    tv.tv_sec = when->tv_sec - now.tv_sec;
+	    tv.tv_usec = when->tv_usec - now.tv_usec;
+	    if (tv.tv_usec < 0) {
+		tv.tv_sec--;
+		tv.tv_usec += 1000000;
+	    }
+	}
+    }
+
+#ifdef USE_EPOLL
+    if (epfd >= 0) {
+	static int in_watched = 1, out_watched = 0;
+	static struct itimerspec armed;
+	struct epoll_event ev, events[8];
+	struct itimerspec its;
+	int i, timeout = -1;
+
+	/*
+	 * Stop watching stdin after EOF and watch stdout as long as
+	 * replies are left over.
+	 */
+
+	memset((char *) &ev, 0, sizeof(ev));
+	if (eof_seen && in_watched) {
+	    epoll_ctl(epfd, EPOLL_CTL_DEL, fileno(stdin), &ev);
+	    in_watched = 0;
+	}
+	if ((reply_len != 0) != out_watched) {
+	    ev.events = EPOLLOUT;
+	    ev.data.fd = fileno(stdout);
+	    if (epoll_ctl(epfd, out_watched ? EPOLL_CTL_DEL : EPOLL_CTL_ADD,
+			  fileno(stdout), &ev) < 0) {
+		timeout = 0;
+	    } else {
+		out_watched = ! out_watched;
+	    }
+	}
+
+	/*
+	 * Arm the timer for the given time or poll if it has passed.
+	 */
+
+	memset((char *) &its, 0, sizeof(its));
+	if (when && (tv.tv_sec || tv.tv_usec)) {
+	    its.it_value.tv_sec = when->tv_sec;
+	    its.it_value.tv_nsec = when->tv_usec * 1000;
+	} else if (when) {
+	    timeout = 0;
+	}
+	if (memcmp((char *) &its, (char *) &armed, sizeof(its))) {
+	    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, 0) < 0) {
+		PosixError("timerfd_settime failed");
+		timeout = 0;
+	    }
+	    armed = its;
+	}
+
+	rc = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]),
+			timeout);
+	if (rc < 0 && errno != EINTR) {
+	    PosixError("epoll_wait failed");
+	}
+
+	for (i = 0; i < rc; i++) {
+	    if (events[i].data.fd == fileno(stdin)) {
+		*in_ready = 1;
+	    } else if (events[i].data.fd == icsock) {
+		*icmp_ready = 1;
+	    } else if (events[i].data.fd == tfd) {
+		uint64_t expirations;
+		if (read(tfd, (char *) &expirations, sizeof(expirations)) < 0) {
+		    dsyslog(LOG_DEBUG, "note: timer read failed");
+		}
+		memset((char *) &armed, 0, sizeof(armed));
+	    }
+	}
+	return;
+    }
+#endif
+
+    FD_ZERO(&fds);
+    if (! eof_seen) {
+	FD_SET(fileno(stdin), &fds);
+    }
+    FD_SET(icsock, &fds);
+    maxfd = icsock > fileno(stdin) ? icsock : fileno(stdin);
+
+    /*
+     * Wait for stdout to become writable if replies are left over.
+     */
+
+    FD_ZERO(&wfds);
+    if (reply_len) {
+	FD_SET(fileno(stdout), &wfds);
+	if (fileno(stdout) > maxfd) {
+	    maxfd = fileno(stdout);
+	}
+    }
+
+    rc = select(maxfd + 1, &fds, &wfds, (fd_set *) 0, when ? &tv : 0);
+    if (rc < 0) {
+	if (errno != EINTR && errno != EAGAIN) {
+	    PosixError("select failed");
+	}
+    } else {
+	*in_ready = FD_ISSET(fileno(stdin), &fds);
+	*icmp_ready = FD_ISSET(icsock, &fds);
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1668,7 +2741,7 @@ retry:
  *	processed.
  * 
  * Side effects:
- *	May change global job_list.
+ *	May add, send and free jobs.
  *
  *----------------------------------------------------------------------
  */
@@ -1676,49 +2749,28 @@ retry:
 static int
 DoOneEvent()
 {
-    fd_set fds;
-    struct timeval tv, *tvp;
-    int rc;
+    struct timeval when;
+    int in_ready, icmp_ready;
     static int eof_seen = 0; 
 
-    FD_ZERO(&fds);
-    FD_SET(fileno(stdin), &fds);
-    FD_SET(icsock, &fds);
-
-    if (eof_seen && ! job_list) {
+    if (eof_seen && ! job_count && ! reply_len) {
 	dsyslog(LOG_DEBUG, "exiting on EOF");
 	return -1;
     }
 
     /*
-     * Calculate the timeout value for the select call.
-     * We may block forever if the job list is empty.
+     * Wait for an event or until the next probe is due. We may
+     * block forever if no job is in service.
      */
-    
-    if (! job_list) {
-	tvp = 0;
-    } else {
-	LookupNextRetryTimeout(tvp = &tv);
-    }
 
-    /*
-     * Wait for an event and process incoming messages.
-     */
+    WaitEvents(NextWakeup(&when) ? &when : (struct timeval *) 0, 
+	       eof_seen, &in_ready, &icmp_ready);
 
-    rc = select(32, &fds, (fd_set *) 0, (fd_set *) 0, tvp);
-    if (rc < 0) {
-	if (errno != EINTR && errno != EAGAIN) {
-	    PosixError("select failed");
-	}
-    } else {
-	if (FD_ISSET(icsock, &fds)) {
-	    ReceivePending(0);
-	} 
-	if (FD_ISSET(fileno(stdin), &fds)) {
-	    if (ReadJob() < 0) {
-		eof_seen = 1;
-	    }
-	}
+    if (icmp_ready) {
+	ReceivePending();
+    }
+    if (in_ready && ReadJob() < 0) {
+	eof_seen = 1;
     }
 
     /*
@@ -1728,7 +2780,7 @@ DoOneEvent()
     SendPending();
     return 0;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1755,13 +2807,20 @@ main(argc, argv)
     while (++argv, --argc > 0) {
 	if (! strcmp (argv[0], "-D")) {
 	    do_debug++;
+	} else if (! strcmp (argv[0], "-r") && argc > 1) {
+	    ++argv, --argc;
+	    pace_rate = atoi(argv[0]);
+	} else if (! strcmp (argv[0], "-b") && argc > 1) {
+	    ++argv, --argc;
+	    pace_burst = atoi(argv[0]);
 	} else {
 	    break;
 	}
     }
 
-    if (argc > 0) {
-	fprintf(stderr, "use: nmicmpd [-D]\nnmicmpd version %s\n", version);
+    if (argc > 0 || pace_rate < 0 || pace_burst < 1) {
+	fprintf(stderr, "use: nmicmpd [-D] [-r rate] [-b burst]\n");
+	fprintf(stderr, "nmicmpd version %s\n", version);
 	fprintf(stderr, "  this demon is started and used by scotty(1)\n");
 	fprintf(stderr, "  and its related icmp(n) command.\n");
 	exit(-1);
@@ -1808,6 +2867,13 @@ main(argc, argv)
 
     SetUnblock(fileno(stdout));
 
+    /*
+     * Read icmp messages without blocking and set up the event loop.
+     */
+
+    SetUnblock(icsock);
+    InitEvents();
+
     /* NB set a resource limit to guard against an undiagnosed infinite
      * loop. */
 
@@ -26,6 +26,15 @@
 
 #include "config.h"
 
+/*
+ * We need _GNU_SOURCE on Linux systems to get the declaration of
+ * recvmmsg() from <sys/socket.h>.
+ */
+
+#if defined(HAVE_RECVMMSG) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -63,6 +72,14 @@
 #define SNMP_TRAP_MCIP		"244.0.0.1"
 #define SNMP_FRWD_PORT		1702
 
+/*
+ * The size of the trap receive buffer and the maximum number of
+ * traps read from a socket whenever it becomes readable.
+ */
+
+#define TRAP_BUFSIZE		8192
+#define TRAP_BATCH		16
+
 
 /*
  *----------------------------------------------------------------------
@@ -188,6 +205,80 @@ ForwardTrap(fd, addr, buf, len)
     return 1;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReceiveTraps --
+ *
+ *	This procedure reads the traps pending on a socket and
+ *	forwards them to all connected clients. We use recvmmsg()
+ *	if available so that a burst of traps is read with a single
+ *	system call. Clients that can not be reached anymore are
+ *	removed from the cl_addr array.
+ *
+ * Results:
+ *	None.
+ * 
+ * Side effects:
+ *	Client sockets may be closed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ReceiveTraps(s, cl_addr)
+    int s;
+    int *cl_addr;
+{
+    static char buf[TRAP_BATCH][TRAP_BUFSIZE];
+    struct sockaddr_in addr[TRAP_BATCH];
+    int len[TRAP_BATCH];
+    int i, j, alen, n = -1;
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr hdr[TRAP_BATCH];
+    struct iovec iov[TRAP_BATCH];
+
+    memset((char *) hdr, 0, sizeof(hdr));
+    for (i = 0; i < TRAP_BATCH; i++) {
+	iov[i].iov_base = buf[i];
+	iov[i].iov_len = TRAP_BUFSIZE;
+	hdr[i].msg_hdr.msg_iov = &iov[i];
+	hdr[i].msg_hdr.msg_iovlen = 1;
+	hdr[i].msg_hdr.msg_name = &addr[i];
+	hdr[i].msg_hdr.msg_namelen = sizeof(addr[i]);
+    }
+    n = recvmmsg(s, hdr, TRAP_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0 && errno != ENOSYS) {
+	PosixError("unable to receive trap");
+	return;
+    }
+    for (i = 0; i < n; i++) {
+	len[i] = hdr[i].msg_len;
+    }
+#endif
+
+    if (n < 0) {
+	alen = sizeof(addr[0]);
+	if ((len[0] = recvfrom(s, buf[0], TRAP_BUFSIZE, 0, 
+			       (struct sockaddr *) &addr[0], &alen)) < 0) {
+	    PosixError("unable to receive trap");
+	    return;
+	}
+	n = 1;
+    }
+
+    for (j = 0; j < n; j++) {
+	for (i = 0; i < FD_SETSIZE; i++) {
+	    if (cl_addr[i] > 0) {
+		if (! ForwardTrap(i, &addr[j], buf[j], len[j])) {
+		    cl_addr[i] = 0;
+		    close(i);
+		}
+	    }
+	}
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -210,12 +301,11 @@ main(argc, argv)
     char *argv[];
 {
     struct servent *se;
-    struct sockaddr_in taddr, laddr;
+    struct sockaddr_in taddr;
     struct sockaddr_in saddr, daddr;
-    int trap_s, serv_s, dlen, llen, rc, i;
+    int trap_s, serv_s, dlen, rc, i;
     fd_set fds;
     static int cl_addr[FD_SETSIZE];
-    char buf[8192];
     int go_on;
     int mcast_s = -1;
     char *name;
@@ -452,21 +542,7 @@ main(argc, argv)
 	    cl_addr[rc] = 1;
 	    
 	} else if (FD_ISSET(trap_s, &fds)) {
-	    llen = sizeof(laddr);
-	    if ((rc = recvfrom(trap_s, buf, sizeof(buf), 0, 
-			       (struct sockaddr *) &laddr, &llen)) < 0) {
-		PosixError("unable to receive trap");
-		continue;
-	    }
-	    
-	    for (i = 0; i < FD_SETSIZE; i++) {
-		if (cl_addr[i] > 0) {
-		    if (! ForwardTrap(i, &laddr, buf, rc)) {
-			cl_addr[i] = 0;
-			close(i);
-		    }
-		}
-	    }
+	    ReceiveTraps(trap_s, cl_addr);
 	    
 	    /* should we go on ? */
 	    for (go_on = 0, i = 0; i < FD_SETSIZE; i++) {
@@ -474,21 +550,7 @@ main(argc, argv)
 	    }
 	    
 	} else if (mcast_s > 0 && FD_ISSET(mcast_s, &fds)) {
-	    llen = sizeof(laddr);
-	    if ((rc = recvfrom(mcast_s, buf, sizeof(buf), 0, 
-			       (struct sockaddr *) &laddr, &llen)) < 0) {
-		PosixError("unable to receive trap");
-		continue;
-	    }
-	    
-	    for (i = 0; i < FD_SETSIZE; i++) {
-		if (cl_addr[i] > 0) {
-		    if (! ForwardTrap(i, &laddr, buf, rc)) {
-			cl_addr[i] = 0;
-			close(i);
-		    }
-		}
-	    }
+	    ReceiveTraps(mcast_s, cl_addr);
 	    
 	    /* should we go on ? */
 	    for (go_on = 0, i = 0; i < FD_SETSIZE; i++) {
@@ -32,14 +32,28 @@
 
 static Tcl_Channel channel = NULL;
 
+/*
+ * The list of requests waiting for responses from the nmicmpd process.
+ * Responses are matched against all requests in this list so that
+ * asynchronous requests and nested synchronous requests can share the
+ * channel. The channel handler is registered as long as there are
+ * asynchronous requests in the list.
+ */
+
+static TnmIcmpRequest *requestList = NULL;
+static int numAsync = 0;
+
 /*
  * The following structure is used to talk to the nmicmpd daemon. See
  * the nmicmpd(8) man page for a description of this message format.
+ * Responses start with the first ICMP_MSG_HEADER_SIZE bytes of this
+ * structure and are followed by the round trip time statistics.
  */
 
-#define ICMP_MSG_VERSION	00
-#define ICMP_MSG_REQUEST_SIZE	20
-#define ICMP_MSG_RESPONSE_SIZE	16
+#define ICMP_MSG_VERSION	01
+#define ICMP_MSG_REQUEST_SIZE	24
+#define ICMP_MSG_RESPONSE_SIZE	56
+#define ICMP_MSG_HEADER_SIZE	16
 
 typedef struct IcmpMsg {
     u_char version;		/* The protocol version. */
@@ -59,6 +73,8 @@ typedef struct IcmpMsg {
     } u;
     unsigned short size;	/* The requested ICMP message size. */
     unsigned short window;	/* The window size for this request. */
+    unsigned short count;	/* The number of echo requests. */
+    unsigned short reserved;	/* Unused, must be zero. */
 } IcmpMsg;
 
 /*
@@ -71,6 +87,27 @@ ForkDaemon	_ANSI_ARGS_((Tcl_Interp *interp));
 static void
 KillDaemon	_ANSI_ARGS_((ClientData clientData));
 
+static int
+SendRequest	_ANSI_ARGS_((Tcl_Interp *interp, TnmIcmpRequest *icmpPtr));
+
+static int
+ReadResponse	_ANSI_ARGS_((Tcl_Interp *interp));
+
+static TnmUnsigned64
+GetUnsigned64	_ANSI_ARGS_((u_char *p));
+
+static void
+Dispatch	_ANSI_ARGS_((IcmpMsg *icmpMsgPtr, u_char *stats));
+
+static void
+Unlink		_ANSI_ARGS_((TnmIcmpRequest *icmpPtr));
+
+static void
+AbortRequests	_ANSI_ARGS_((void));
+
+static void
+ReadProc	_ANSI_ARGS_((ClientData clientData, int mask));
+
 
 /*
  *----------------------------------------------------------------------
@@ -144,41 +181,33 @@ KillDaemon(clientData)
 /*
  *----------------------------------------------------------------------
  *
- * TnmIcmp --
+ * SendRequest --
  *
- *	This procedure is the platform specific entry point for
- *	sending ICMP requests.
+ *	This procedure writes the messages for all targets of a request
+ *	to the nmicmpd process. The messages are collected in a single
+ *	buffer which is written and flushed once.
  *
  * Results:
  *	A standard Tcl result.
  *
  * Side effects:
- *	None.
+ *	The targets are marked pending. The nmicmpd process is killed
+ *	and all outstanding requests are aborted if writing fails.
  *
  *----------------------------------------------------------------------
  */
 
-int
-TnmIcmp(interp, icmpPtr)
+static int
+SendRequest(interp, icmpPtr)
     Tcl_Interp *interp;
     TnmIcmpRequest *icmpPtr;
 {
-    int i, j, rc, code = TCL_OK;
+    int i, rc, err, len;
     IcmpMsg icmpMsg;
+    char *buffer;
 
-    /*
-     * Start nmicmpd if not done yet.
-     */
-
-    if (channel == NULL) {
-	if (ForkDaemon(interp) != TCL_OK) {
-	    return TCL_ERROR;
-	}
-    }
-
-    /*
-     * Start by sending all requests to the nmicmpd daemon.
-     */
+    len = icmpPtr->numTargets * ICMP_MSG_REQUEST_SIZE;
+    buffer = ckalloc(len);
 
     for (i = 0; i < icmpPtr->numTargets; i++) {
 	TnmIcmpTarget *targetPtr = &(icmpPtr->targets[i]);
@@ -197,12 +226,11 @@ TnmIcmp(interp, icmpPtr)
 	icmpMsg.u.c.delay = icmpPtr->delay;
 	icmpMsg.size = htons((unsigned short) icmpPtr->size);
 	icmpMsg.window = htons((unsigned short) icmpPtr->window);
-	rc = Tcl_Write(channel, (char *) &icmpMsg, ICMP_MSG_REQUEST_SIZE);
-	if (rc > 0) {
-	    if (Tcl_Flush(channel) != TCL_OK) {
-		rc = -1;
-	    }
-	}
+	icmpMsg.count = htons((unsigned short) icmpPtr->count);
+	icmpMsg.reserved = 0;
+	targetPtr->flags |= TNM_ICMP_FLAG_PENDING;
+	memcpy(buffer + i * ICMP_MSG_REQUEST_SIZE, (char *) &icmpMsg,
+	       ICMP_MSG_REQUEST_SIZE);
 #if 0
 	{
 	    char s[255];
@@ -211,66 +239,391 @@ TnmIcmp(interp, icmpPtr)
 	    TnmWriteMessage(s);
 	}
 #endif
-	if (rc < 0) {
+    }
+
+    rc = Tcl_Write(channel, buffer, len);
+    if (rc > 0) {
+	if (Tcl_Flush(channel) != TCL_OK) {
+	    rc = -1;
+	}
+    }
+    ckfree(buffer);
+
+    if (rc < 0) {
+	err = Tcl_GetErrno();
+	AbortRequests();
+	Tcl_ResetResult(interp);
+	Tcl_SetErrno(err);
+	Tcl_AppendResult(interp, "nmicmpd: ", Tcl_PosixError(interp),
+			 (char *) NULL);
+	return TCL_ERROR;
+    }
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReadResponse --
+ *
+ *	This procedure reads a single response from the nmicmpd process
+ *	and passes it to the request waiting for it.
+ *
+ * Results:
+ *	A standard Tcl result. An error message is left in interp if
+ *	interp is not NULL.
+ *
+ * Side effects:
+ *	Callbacks of asynchronous requests may be evaluated. The
+ *	nmicmpd process is killed and all outstanding requests are
+ *	aborted if reading fails.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ReadResponse(interp)
+    Tcl_Interp *interp;
+{
+    int rc, err;
+    IcmpMsg icmpMsg;
+    u_char buffer[ICMP_MSG_RESPONSE_SIZE];
+
+    rc = Tcl_Read(channel, (char *) buffer, ICMP_MSG_RESPONSE_SIZE);
+    if (rc != ICMP_MSG_RESPONSE_SIZE) {
+	err = Tcl_GetErrno();
+	AbortRequests();
+	if (interp) {
+	    Tcl_ResetResult(interp);
+	    Tcl_SetErrno(err);
 	    Tcl_AppendResult(interp, "nmicmpd: ", Tcl_PosixError(interp),
 			     (char *) NULL);
-	    KillDaemon((ClientData) NULL);
-	    return TCL_ERROR;
 	}
+	return TCL_ERROR;
+    }
+#if 0
+    {
+	char s[255];
+	TnmHexEnc((char *) buffer, rc, s);
+	strcat(s, "\n");
+	TnmWriteMessage(s);
+    }
+#endif
+    memcpy((char *) &icmpMsg, (char *) buffer, ICMP_MSG_HEADER_SIZE);
+    Dispatch(&icmpMsg, buffer + ICMP_MSG_HEADER_SIZE);
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetUnsigned64 --
+ *
+ *	This procedure decodes a 64 bit number in network byte order.
+ *
+ * Results:
+ *	The decoded number.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TnmUnsigned64
+GetUnsigned64(p)
+    u_char *p;
+{
+    TnmUnsigned64 u = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	u = (u << 8) | p[i];
+    }
+    return u;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Dispatch --
+ *
+ *	This procedure stores a response in the target it belongs to.
+ *	The transaction identifiers of a request are consecutive so
+ *	that the target is found by a subtraction. The statistics
+ *	contain the number of echo requests and replies followed by
+ *	the minimum, average and maximum round trip time and the
+ *	jitter in nanoseconds.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The callback of an asynchronous request is evaluated and the
+ *	request is freed once all targets are completed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Dispatch(icmpMsgPtr, stats)
+    IcmpMsg *icmpMsgPtr;
+    u_char *stats;
+{
+    TnmIcmpRequest *icmpPtr;
+    TnmIcmpTarget *targetPtr;
+    unsigned int k = 0;
+    int last;
+
+    for (icmpPtr = requestList; icmpPtr; icmpPtr = icmpPtr->nextPtr) {
+	k = ntohl(icmpMsgPtr->tid) - icmpPtr->targets[0].tid;
+	if (k < (unsigned int) icmpPtr->numTargets) {
+	    break;
+	}
+    }
+    if (! icmpPtr) {
+	return;
     }
 
+    targetPtr = &(icmpPtr->targets[k]);
+    if (! (targetPtr->flags & TNM_ICMP_FLAG_PENDING)) {
+	return;
+    }
+    targetPtr->res = icmpMsgPtr->addr;
+    switch (icmpMsgPtr->type) {
+    case TNM_ICMP_TYPE_ECHO:
+    case TNM_ICMP_TYPE_TRACE:
+	targetPtr->u.rtt = ntohl(icmpMsgPtr->u.data);
+	break;
+    case TNM_ICMP_TYPE_MASK:
+	targetPtr->u.mask = ntohl(icmpMsgPtr->u.data);
+	break;
+    case TNM_ICMP_TYPE_TIMESTAMP:
+	targetPtr->u.tdiff = ntohl(icmpMsgPtr->u.data);
+	break;
+    }
+    targetPtr->sent = (stats[0] << 8) | stats[1];
+    targetPtr->received = (stats[2] << 8) | stats[3];
+    targetPtr->rttMin = GetUnsigned64(stats + 8);
+    targetPtr->rttAvg = GetUnsigned64(stats + 16);
+    targetPtr->rttMax = GetUnsigned64(stats + 24);
+    targetPtr->jitter = GetUnsigned64(stats + 32);
+    targetPtr->status = icmpMsgPtr->status;
+    targetPtr->flags = (icmpPtr->flags & icmpMsgPtr->flags);
+
     /*
-     * Collect the answers from the nmicmpd daemon.
+     * Remove the request from the list before the callback is
+     * evaluated. Only the completion of the last target frees the
+     * request since the callback may abort all outstanding requests.
      */
 
-    code = TCL_OK;
-    for (j = 0; j < icmpPtr->numTargets; j++) {
-	rc = Tcl_Read(channel, (char *) &icmpMsg, ICMP_MSG_RESPONSE_SIZE);
-	if (rc != ICMP_MSG_RESPONSE_SIZE) {
-	    Tcl_AppendResult(interp, "nmicmpd: ", Tcl_PosixError(interp),
-			     (char *) NULL);
-	    KillDaemon((ClientData) NULL);
+    last = (--icmpPtr->numPending == 0);
+    if (last) {
+	Unlink(icmpPtr);
+    }
+    if (icmpPtr->cmdObj) {
+	TnmIcmpEvalCallback(icmpPtr, targetPtr);
+	if (last) {
+	    TnmIcmpFreeRequest(icmpPtr);
+	}
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Unlink --
+ *
+ *	This procedure removes a request from the list of outstanding
+ *	requests.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The channel handler is deleted if there are no asynchronous
+ *	requests left.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Unlink(icmpPtr)
+    TnmIcmpRequest *icmpPtr;
+{
+    TnmIcmpRequest **icmpPtrPtr;
+
+    for (icmpPtrPtr = &requestList; *icmpPtrPtr;
+	 icmpPtrPtr = &(*icmpPtrPtr)->nextPtr) {
+	if (*icmpPtrPtr == icmpPtr) {
+	    *icmpPtrPtr = icmpPtr->nextPtr;
+	    icmpPtr->nextPtr = NULL;
+	    if (icmpPtr->cmdObj && --numAsync == 0 && channel) {
+		Tcl_DeleteChannelHandler(channel, ReadProc, (ClientData) NULL);
+	    }
+	    break;
+	}
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AbortRequests --
+ *
+ *	This procedure is invoked when the communication with the
+ *	nmicmpd process fails. All pending targets of the outstanding
+ *	requests are completed with a generic error.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The nmicmpd process is killed, callbacks are evaluated and
+ *	asynchronous requests are freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AbortRequests()
+{
+    TnmIcmpRequest *icmpPtr, *nextPtr;
+    int i;
+
+    KillDaemon((ClientData) NULL);
+    icmpPtr = requestList;
+    requestList = NULL;
+    numAsync = 0;
+
+    for (; icmpPtr; icmpPtr = nextPtr) {
+	nextPtr = icmpPtr->nextPtr;
+	icmpPtr->nextPtr = NULL;
+	for (i = 0; i < icmpPtr->numTargets; i++) {
+	    TnmIcmpTarget *targetPtr = &(icmpPtr->targets[i]);
+	    if (targetPtr->flags & TNM_ICMP_FLAG_PENDING) {
+		targetPtr->status = TNM_ICMP_STATUS_GENERROR;
+		targetPtr->flags = 0;
+		icmpPtr->numPending--;
+		if (icmpPtr->cmdObj) {
+		    TnmIcmpEvalCallback(icmpPtr, targetPtr);
+		}
+	    }
+	}
+	if (icmpPtr->cmdObj) {
+	    TnmIcmpFreeRequest(icmpPtr);
+	}
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReadProc --
+ *
+ *	This procedure is the channel handler which reads responses
+ *	while asynchronous requests are outstanding. All responses
+ *	already buffered by the channel are processed at once.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Callbacks of asynchronous requests may be evaluated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ReadProc(clientData, mask)
+    ClientData clientData;
+    int mask;
+{
+    do {
+	if (ReadResponse((Tcl_Interp *) NULL) != TCL_OK) {
+	    break;
+	}
+    } while (channel && numAsync
+	     && Tcl_InputBuffered(channel) >= ICMP_MSG_RESPONSE_SIZE);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmIcmp --
+ *
+ *	This procedure is the platform specific entry point for
+ *	sending ICMP requests. Synchronous requests wait for all
+ *	responses. Asynchronous requests return immediately and are
+ *	completed by the channel handler.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	Asynchronous requests are owned by this module if TCL_OK is
+ *	returned.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmIcmp(interp, icmpPtr)
+    Tcl_Interp *interp;
+    TnmIcmpRequest *icmpPtr;
+{
+    int i;
+
+    /*
+     * Start nmicmpd if not done yet.
+     */
+
+    if (channel == NULL) {
+	if (ForkDaemon(interp) != TCL_OK) {
 	    return TCL_ERROR;
 	}
-#if 0
-	{
-	    char s[255];
-	    TnmHexEnc((char *) &icmpMsg, rc, s);
-	    strcat(s, "\n");
-	    TnmWriteMessage(s);
+    }
+
+    /*
+     * Start by sending all requests to the nmicmpd daemon and queue
+     * the request. Asynchronous requests are completed by the
+     * channel handler.
+     */
+
+    if (SendRequest(interp, icmpPtr) != TCL_OK) {
+	return TCL_ERROR;
+    }
+
+    icmpPtr->nextPtr = requestList;
+    requestList = icmpPtr;
+    if (icmpPtr->cmdObj) {
+	if (numAsync++ == 0) {
+	    Tcl_CreateChannelHandler(channel, TCL_READABLE, ReadProc,
+				     (ClientData) NULL);
 	}
-#endif
-	if (icmpMsg.status == TNM_ICMP_STATUS_GENERROR) {
+	return TCL_OK;
+    }
+
+    /*
+     * Collect the answers from the nmicmpd daemon. Answers for other
+     * requests are dispatched while we wait.
+     */
+
+    while (icmpPtr->numPending > 0) {
+	if (ReadResponse(interp) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+    }
+
+    for (i = 0; i < icmpPtr->numTargets; i++) {
+	if (icmpPtr->targets[i].status == TNM_ICMP_STATUS_GENERROR) {
 	    Tcl_ResetResult(interp);
 	    Tcl_AppendResult(interp, "nmicmpd: failed to send ICMP message",
 			     (char *) NULL);
-	    code = TCL_ERROR;
-	    break;
-	}
-	if (code == TCL_OK) {
-	    for (i = 0; i < icmpPtr->numTargets; i++) {
-		TnmIcmpTarget *targetPtr = &(icmpPtr->targets[i]);
-		if (htonl(targetPtr->tid) == icmpMsg.tid) {
-		    targetPtr->res = icmpMsg.addr;
-		    switch (icmpMsg.type) {
-		    case TNM_ICMP_TYPE_ECHO:
-		    case TNM_ICMP_TYPE_TRACE:
-			targetPtr->u.rtt = ntohl(icmpMsg.u.data);
-			break;
-		    case TNM_ICMP_TYPE_MASK:
-			targetPtr->u.mask = ntohl(icmpMsg.u.data);
-			break;
-		    case TNM_ICMP_TYPE_TIMESTAMP:
-			targetPtr->u.tdiff = ntohl(icmpMsg.u.data);
-			break;
-		    }
-		    targetPtr->status = icmpMsg.status;
-		    targetPtr->flags = (icmpPtr->flags & icmpMsg.flags);
-		    break;
-		}
-	    }
+	    return TCL_ERROR;
 	}
     }
 
-    return code;
+    return TCL_OK;
 }
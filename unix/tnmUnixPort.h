@@ -67,6 +67,10 @@
 #include <sys/select.h>
 #endif
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 #ifdef __osf__
 #include <machine/endian.h>
 #endif
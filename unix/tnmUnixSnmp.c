@@ -264,7 +264,9 @@ TrapRecv(interp, packet, packetlen, from)
  * TrapProc --
  *
  *	This procedure is called from the event dispatcher whenever
- *	a trap message is received.
+ *	a trap message is received. We process all trap messages
+ *	already buffered in the channel before we return to the
+ *	event loop.
  *
  * Results:
  *	None.
@@ -285,18 +287,24 @@ TrapProc(clientData, mask)
     int code, packetlen = TNM_SNMP_MAXSIZE;
     struct sockaddr_in from;
 
-    Tcl_ResetResult(interp);
-    code = TrapRecv(interp, packet, &packetlen, &from);
-    if (code != TCL_OK) return;
+    Tcl_Preserve((ClientData) interp);
+    do {
+	Tcl_ResetResult(interp);
+	packetlen = TNM_SNMP_MAXSIZE;
+	code = TrapRecv(interp, packet, &packetlen, &from);
+	if (code != TCL_OK) break;
 
-    code = TnmSnmpDecode(interp, packet, packetlen, &from, NULL, NULL,
-			 NULL, NULL);
-    if (code == TCL_ERROR) {
-	Tcl_AddErrorInfo(interp, "\n    (snmp trap event)");
-	Tcl_BackgroundError(interp);
-    }
-    if (code == TCL_CONTINUE && hexdump) {
-	TnmWriteMessage(interp->result);
-	TnmWriteMessage("\n");
-    }
+	code = TnmSnmpDecode(interp, packet, packetlen, &from, NULL, NULL,
+			     NULL, NULL);
+	if (code == TCL_ERROR) {
+	    Tcl_AddErrorInfo(interp, "\n    (snmp trap event)");
+	    Tcl_BackgroundError(interp);
+	}
+	if (code == TCL_CONTINUE && hexdump) {
+	    TnmWriteMessage(interp->result);
+	    TnmWriteMessage("\n");
+	}
+    } while (trap_channel && ! Tcl_InterpDeleted(interp)
+	     && Tcl_InputBuffered(trap_channel) > 0);
+    Tcl_Release((ClientData) interp);
 }
@@ -11,11 +11,63 @@
  * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
  */
 
+/*
+ * We need _GNU_SOURCE on Linux systems to get the declarations of
+ * sendmmsg() and recvmmsg() from <sys/socket.h>.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "tnmInt.h"
 #include "tnmPort.h"
 
 #include <fcntl.h>
 
+/*
+ * The maximum number of datagrams sent or received with a single
+ * sendmmsg() or recvmmsg() system call. Larger batches are processed
+ * with multiple calls.
+ */
+
+#define MAX_MMSG 64
+
+/*
+ * The drain loops below must never block. We ask for a non-blocking
+ * read with MSG_DONTWAIT where available. Otherwise, we rely on the
+ * O_NONBLOCK flag set by TnmSocket() and read only a single datagram
+ * (which the caller knows is waiting) if the socket is blocking.
+ */
+
+#ifdef MSG_DONTWAIT
+#define TNM_DONTWAIT MSG_DONTWAIT
+#else
+#define TNM_DONTWAIT 0
+#endif
+
+/*
+ * Flags which are set if the kernel does not implement sendmmsg() or
+ * recvmmsg() although the C library provides them. They are probed
+ * once when the first datagram socket is created. The flags are
+ * never written afterwards. Every socket passed to the procedures
+ * below is created by TnmSocket() after the probe, so the flags may
+ * be read without locking by any thread using such a socket.
+ */
+
+#if defined(HAVE_SENDMMSG) || defined(HAVE_RECVMMSG)
+static int mmsgProbed = 0;
+static int noSendmmsg = 0;
+static int noRecvmmsg = 0;
+TCL_DECLARE_MUTEX(mmsgMutex)
+
+static void
+ProbeMultiMsg		_ANSI_ARGS_((int s));
+#endif
+
+static int
+SocketIsBlocking	_ANSI_ARGS_((int s));
+
 int
 TnmSocket(domain, type, protocol)
     int domain;
@@ -28,10 +80,89 @@ TnmSocket(domain, type, protocol)
     }
 #ifdef O_NONBLOCK
     fcntl(s, F_SETFL, O_NONBLOCK);
+#endif
+#if defined(HAVE_SENDMMSG) || defined(HAVE_RECVMMSG)
+    if (type == SOCK_DGRAM) {
+	ProbeMultiMsg(s);
+    }
 #endif
     return s;
 }
 
+#if defined(HAVE_SENDMMSG) || defined(HAVE_RECVMMSG)
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProbeMultiMsg --
+ *
+ *	This procedure checks once whether the kernel implements
+ *	sendmmsg() and recvmmsg() by calling them with an empty
+ *	vector on a new datagram socket.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The noSendmmsg and noRecvmmsg flags are set.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ProbeMultiMsg(s)
+    int s;
+{
+    Tcl_MutexLock(&mmsgMutex);
+    if (! mmsgProbed) {
+#ifdef HAVE_SENDMMSG
+	if (sendmmsg(s, NULL, 0, 0) < 0 && errno == ENOSYS) {
+	    noSendmmsg = 1;
+	}
+#endif
+#ifdef HAVE_RECVMMSG
+	if (recvmmsg(s, NULL, 0, TNM_DONTWAIT, NULL) < 0 && errno == ENOSYS) {
+	    noRecvmmsg = 1;
+	}
+#endif
+	mmsgProbed = 1;
+    }
+    Tcl_MutexUnlock(&mmsgMutex);
+}
+#endif
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SocketIsBlocking --
+ *
+ *	This procedure checks whether a read on a socket may block
+ *	although it was requested with the TNM_DONTWAIT flag.
+ *
+ * Results:
+ *	1 if a read may block and 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SocketIsBlocking(s)
+    int s;
+{
+#ifdef MSG_DONTWAIT
+    return 0;
+#else
+#ifdef O_NONBLOCK
+    int fl = fcntl(s, F_GETFL, 0);
+    return (fl < 0 || ! (fl & O_NONBLOCK));
+#else
+    return 1;
+#endif
+#endif
+}
+
 int
 TnmSocketBind(s, name, namelen)
     int s;
@@ -68,6 +199,181 @@ TnmSocketRecvFrom(s, buf, len, flags, from, fromlen)
     return (n < 0) ? TNM_SOCKET_ERROR : n;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSocketSendMulti --
+ *
+ *	This procedure sends n datagrams. It uses sendmmsg() if
+ *	available so that all datagrams are passed to the kernel
+ *	with one system call. Otherwise, we call sendto() for each
+ *	datagram.
+ *
+ * Results:
+ *	The number of datagrams sent, starting with the first one,
+ *	or TNM_SOCKET_ERROR if not even the first datagram could be
+ *	sent.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSocketSendMulti(s, msgs, n, flags)
+    int s;
+    TnmSocketMsg *msgs;
+    int n;
+    int flags;
+{
+    int i = 0, r;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr hdr[MAX_MMSG];
+    struct iovec iov[MAX_MMSG];
+    int j, m;
+
+    while (! noSendmmsg && i < n) {
+	m = (n - i < MAX_MMSG) ? n - i : MAX_MMSG;
+	memset((char *) hdr, 0, m * sizeof(struct mmsghdr));
+	for (j = 0; j < m; j++) {
+	    iov[j].iov_base = msgs[i+j].buf;
+	    iov[j].iov_len = msgs[i+j].len;
+	    hdr[j].msg_hdr.msg_iov = &iov[j];
+	    hdr[j].msg_hdr.msg_iovlen = 1;
+	    hdr[j].msg_hdr.msg_name = msgs[i+j].addr;
+	    hdr[j].msg_hdr.msg_namelen = msgs[i+j].addrlen;
+	}
+	r = sendmmsg(s, hdr, m, flags);
+	if (r < 0) {
+	    if (errno == ENOSYS) {
+		break;
+	    }
+	    return i ? i : TNM_SOCKET_ERROR;
+	}
+	i += r;
+	if (r < m) {
+	    return i;
+	}
+    }
+#endif
+
+    for (; i < n; i++) {
+	r = sendto(s, msgs[i].buf, msgs[i].len, flags,
+		   msgs[i].addr, msgs[i].addrlen);
+	if (r < 0) {
+	    break;
+	}
+    }
+    return i ? i : TNM_SOCKET_ERROR;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TnmSocketRecvMulti --
+ *
+ *	This procedure receives up to n datagrams from a socket
+ *	without blocking. It uses recvmmsg() if available so that a
+ *	whole burst of datagrams can be read with one system call.
+ *	Otherwise, we call recvfrom() until the socket is drained.
+ *	Only a single datagram is read if the socket may block.
+ *	The drop counter attached by sockets with the SO_RXQ_OVFL
+ *	option is returned in the drops field of the messages.
+ *
+ * Results:
+ *	The number of datagrams received or TNM_SOCKET_ERROR if not
+ *	even a single datagram could be read.
+ *
+ * Side effects:
+ *	The len, fromlen and drops fields of the received messages
+ *	are updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TnmSocketRecvMulti(s, msgs, n, flags)
+    int s;
+    TnmSocketMsg *msgs;
+    int n;
+    int flags;
+{
+    int i = 0, r;
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr hdr[MAX_MMSG];
+    struct iovec iov[MAX_MMSG];
+#ifdef SO_RXQ_OVFL
+    struct cmsghdr *cmsg;
+    union {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(sizeof(unsigned int))];
+    } control[MAX_MMSG];
+#endif
+    int j, m;
+#endif
+
+    if (n > 1 && SocketIsBlocking(s)) {
+	n = 1;
+    }
+
+#ifdef HAVE_RECVMMSG
+    while (! noRecvmmsg && i < n) {
+	m = (n - i < MAX_MMSG) ? n - i : MAX_MMSG;
+	memset((char *) hdr, 0, m * sizeof(struct mmsghdr));
+	for (j = 0; j < m; j++) {
+	    iov[j].iov_base = msgs[i+j].buf;
+	    iov[j].iov_len = msgs[i+j].len;
+	    hdr[j].msg_hdr.msg_iov = &iov[j];
+	    hdr[j].msg_hdr.msg_iovlen = 1;
+	    hdr[j].msg_hdr.msg_name = msgs[i+j].addr;
+	    hdr[j].msg_hdr.msg_namelen = msgs[i+j].addrlen;
+#ifdef SO_RXQ_OVFL
+	    hdr[j].msg_hdr.msg_control = control[j].buf;
+	    hdr[j].msg_hdr.msg_controllen = sizeof(control[j].buf);
+#endif
+	}
+	r = recvmmsg(s, hdr, m, flags | TNM_DONTWAIT, NULL);
+	if (r < 0) {
+	    if (errno == ENOSYS) {
+		break;
+	    }
+	    return i ? i : TNM_SOCKET_ERROR;
+	}
+	for (j = 0; j < r; j++) {
+	    msgs[i+j].len = hdr[j].msg_len;
+	    msgs[i+j].addrlen = hdr[j].msg_hdr.msg_namelen;
+	    msgs[i+j].drops = 0;
+#ifdef SO_RXQ_OVFL
+	    for (cmsg = CMSG_FIRSTHDR(&hdr[j].msg_hdr); cmsg;
+		 cmsg = CMSG_NXTHDR(&hdr[j].msg_hdr, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET
+		    && cmsg->cmsg_type == SO_RXQ_OVFL) {
+		    memcpy((char *) &msgs[i+j].drops, CMSG_DATA(cmsg),
+			   sizeof(unsigned int));
+		}
+	    }
+#endif
+	}
+	i += r;
+	if (r < m) {
+	    return i;
+	}
+    }
+#endif
+
+    for (; i < n; i++) {
+	r = recvfrom(s, msgs[i].buf, msgs[i].len, flags | TNM_DONTWAIT,
+		     msgs[i].addr, &msgs[i].addrlen);
+	if (r < 0) {
+	    break;
+	}
+	msgs[i].len = r;
+	msgs[i].drops = 0;
+    }
+    return i ? i : TNM_SOCKET_ERROR;
+}
+
 int TnmSocketClose(s)
     int s;
 {
@@ -132,7 +132,8 @@ IcmpThread(lpdwParam)
     PIP_ECHO_REPLY pIpe;
     PIP_OPTION_INFORMATION optInfPtr = NULL;
     char *mem = NULL;
-    int i;
+    int i, n;
+    TnmUnsigned64 rtt, last = 0, sum = 0, jitter = 0;
 
     /*
      * We do not support ICMP mask or ICMP timestamp requests.
@@ -151,69 +152,99 @@ IcmpThread(lpdwParam)
 
     mem = ckalloc(sizeof(IP_ECHO_REPLY) + icmpPtr->size);
 
-    for (i = 0; i <= icmpPtr->retries; i++) {
+    /*
+     * Repeat the exchange for every echo request of the target.
+     * The round trip times are only known in milliseconds.
+     */
+
+    for (n = 0; n < icmpPtr->count; n++) {
+
+	targetPtr->sent++;
+	for (i = 0; i <= icmpPtr->retries; i++) {
 
-	int timeout = (1000 * icmpPtr->timeout) * (i + 1)
-	    / (icmpPtr->retries + 1);
+	    int timeout = (1000 * icmpPtr->timeout) * (i + 1)
+		/ (icmpPtr->retries + 1);
 	
 #if 0
-	{ char buf[80];
-	  sprintf(buf, "try %d timeout %d\n", i, timeout);
-	  TnmWriteMessage(buf);
-	}
+	    { char buf[80];
+	      sprintf(buf, "try %d timeout %d\n", i, timeout);
+	      TnmWriteMessage(buf);
+	    }
 #endif
 	  
-	memset(mem, 0, sizeof(IP_ECHO_REPLY) + icmpPtr->size);
+	    memset(mem, 0, sizeof(IP_ECHO_REPLY) + icmpPtr->size);
 
-	pIpe = (PIP_ECHO_REPLY) mem;
-	pIpe->Data = mem + sizeof(IP_ECHO_REPLY);
-	pIpe->DataSize = icmpPtr->size;
+	    pIpe = (PIP_ECHO_REPLY) mem;
+	    pIpe->Data = mem + sizeof(IP_ECHO_REPLY);
+	    pIpe->DataSize = icmpPtr->size;
 
-	/*
-	 * Set the TTL field if we are doing a traceroute step.
-	 */
+	    /*
+	     * Set the TTL field if we are doing a traceroute step.
+	     */
 	
-	if (icmpPtr->type == TNM_ICMP_TYPE_TRACE) {
-	    optInfPtr = (PIP_OPTION_INFORMATION) ckalloc(sizeof(*optInfPtr));
-	    memset((void *) optInfPtr, 0, sizeof(IP_OPTION_INFORMATION));
-	    optInfPtr->Ttl = icmpPtr->ttl;
-	}
+	    if (icmpPtr->type == TNM_ICMP_TYPE_TRACE) {
+		optInfPtr = (PIP_OPTION_INFORMATION) ckalloc(sizeof(*optInfPtr));
+		memset((void *) optInfPtr, 0, sizeof(IP_OPTION_INFORMATION));
+		optInfPtr->Ttl = icmpPtr->ttl;
+	    }
 
-	targetPtr->status = TNM_ICMP_STATUS_GENERROR;
-	dwStatus = pIcmpSendEcho(hIP, targetPtr->dst.s_addr,
-				 pIpe->Data, pIpe->DataSize, optInfPtr,
-				 pIpe, sizeof(IP_ECHO_REPLY) + icmpPtr->size,
-				 timeout);
-	if (dwStatus) {
+	    targetPtr->status = TNM_ICMP_STATUS_GENERROR;
+	    dwStatus = pIcmpSendEcho(hIP, targetPtr->dst.s_addr,
+				     pIpe->Data, pIpe->DataSize, optInfPtr,
+				     pIpe, sizeof(IP_ECHO_REPLY) + icmpPtr->size,
+				     timeout);
+	    if (dwStatus) {
 #if 0
-	    { char buf[80];
-	      sprintf(buf,
-		      "Addr:%d.%d.%d.%d,\tRTT: %dms,\tTTL: %d,\tStatus: %d\n",
-		      LOBYTE(LOWORD(pIpe->Address)),
-		      HIBYTE(LOWORD(pIpe->Address)),
-		      LOBYTE(HIWORD(pIpe->Address)),
-		      HIBYTE(HIWORD(pIpe->Address)),
-		      pIpe->RoundTripTime,
-		      pIpe->Options.Ttl,
-		      pIpe->Status);
-	      TnmWriteMessage(buf);
-	    }
+		{ char buf[80];
+		  sprintf(buf,
+			  "Addr:%d.%d.%d.%d,\tRTT: %dms,\tTTL: %d,\tStatus: %d\n",
+			  LOBYTE(LOWORD(pIpe->Address)),
+			  HIBYTE(LOWORD(pIpe->Address)),
+			  LOBYTE(HIWORD(pIpe->Address)),
+			  HIBYTE(HIWORD(pIpe->Address)),
+			  pIpe->RoundTripTime,
+			  pIpe->Options.Ttl,
+			  pIpe->Status);
+		  TnmWriteMessage(buf);
+		}
 #endif
-	    if (pIpe->Status == IP_SUCCESS ||
-		pIpe->Status == IP_TTL_EXPIRED_TRANSIT ||
-		pIpe->Status == IP_DEST_PORT_UNREACHABLE) {
-		targetPtr->status = TNM_ICMP_STATUS_NOERROR;
-		targetPtr->res.s_addr = pIpe->Address;
-		targetPtr->u.rtt = pIpe->RoundTripTime * 1000;
-		if (icmpPtr->type == TNM_ICMP_TYPE_TRACE 
-		    && pIpe->Status == IP_DEST_PORT_UNREACHABLE) {
-		    targetPtr->flags |= TNM_ICMP_FLAG_LASTHOP;
+		if (pIpe->Status == IP_SUCCESS ||
+		    pIpe->Status == IP_TTL_EXPIRED_TRANSIT ||
+		    pIpe->Status == IP_DEST_PORT_UNREACHABLE) {
+		    targetPtr->status = TNM_ICMP_STATUS_NOERROR;
+		    targetPtr->res.s_addr = pIpe->Address;
+		    rtt = (TnmUnsigned64) pIpe->RoundTripTime * 1000000;
+		    if (! targetPtr->received || rtt < targetPtr->rttMin) {
+			targetPtr->rttMin = rtt;
+		    }
+		    if (rtt > targetPtr->rttMax) {
+			targetPtr->rttMax = rtt;
+		    }
+		    if (targetPtr->received) {
+			jitter += rtt > last ? rtt - last : last - rtt;
+		    }
+		    last = rtt;
+		    sum += rtt;
+		    targetPtr->received++;
+		    if (icmpPtr->type == TNM_ICMP_TYPE_TRACE 
+			&& pIpe->Status == IP_DEST_PORT_UNREACHABLE) {
+			targetPtr->flags |= TNM_ICMP_FLAG_LASTHOP;
+		    }
+		    break;
 		}
-		break;
 	    }
 	}
     }
 
+    if (targetPtr->received) {
+	targetPtr->status = TNM_ICMP_STATUS_NOERROR;
+	targetPtr->rttAvg = sum / targetPtr->received;
+	targetPtr->u.rtt = (unsigned) (targetPtr->rttAvg / 1000);
+	if (targetPtr->received > 1) {
+	    targetPtr->jitter = jitter / (targetPtr->received - 1);
+	}
+    }
+
  exit:
     if (mem) ckfree((char *) mem);
     if (threadParamPtr) ckfree((char *) threadParamPtr);
@@ -226,7 +257,8 @@ IcmpThread(lpdwParam)
  * TnmIcmp --
  *
  *	This procedure is the platform specific entry point for
- *	sending ICMP requests.
+ *	sending ICMP requests. The callbacks of asynchronous requests
+ *	are evaluated before this procedure returns.
  *
  * Results:
  *	A standard Tcl result.
@@ -329,5 +361,17 @@ TnmIcmp(interp, icmpPtr)
     }
     ckfree((char *) lpHandles);
     pIcmpCloseHandle(hIP);
+
+    /*
+     * ICMP.DLL requests are always completed before we return.
+     * Asynchronous requests are therefore completed here.
+     */
+
+    if (code == TCL_OK && icmpPtr->cmdObj) {
+	for (i = 0; i < icmpPtr->numTargets; i++) {
+	    TnmIcmpEvalCallback(icmpPtr, &(icmpPtr->targets[i]));
+	}
+	TnmIcmpFreeRequest(icmpPtr);
+    }
     return code;
 }
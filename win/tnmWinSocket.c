@@ -118,6 +118,52 @@ TnmSocketRecvFrom(s, buf, len, flags, from, fromlen)
     return (n == SOCKET_ERROR) ? TNM_SOCKET_ERROR : n;
 }
 
+/*
+ * Windows Sockets do not provide calls to send or receive multiple
+ * datagrams at once. We send the datagrams one after the other and
+ * we simply return a single datagram and let the event loop call
+ * us again when receiving.
+ */
+
+int
+TnmSocketSendMulti(s, msgs, n, flags)
+    int s;
+    TnmSocketMsg *msgs;
+    int n;
+    int flags;
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+	if (TnmSocketSendTo(s, msgs[i].buf, msgs[i].len, flags,
+			    msgs[i].addr, msgs[i].addrlen)
+	    == TNM_SOCKET_ERROR) {
+	    break;
+	}
+    }
+    return i ? i : TNM_SOCKET_ERROR;
+}
+
+
+int
+TnmSocketRecvMulti(s, msgs, n, flags)
+    int s;
+    TnmSocketMsg *msgs;
+    int n;
+    int flags;
+{
+    int fromlen = msgs[0].addrlen;
+    int r = TnmSocketRecvFrom(s, msgs[0].buf, msgs[0].len, flags,
+			      msgs[0].addr, &fromlen);
+    if (r == TNM_SOCKET_ERROR) {
+	return TNM_SOCKET_ERROR;
+    }
+    msgs[0].len = r;
+    msgs[0].addrlen = fromlen;
+    msgs[0].drops = 0;
+    return 1;
+}
+
 int TnmSocketClose(s)
     int s;
 {